@@ -125,6 +125,7 @@ public class SerialPort {
 	protected static native boolean n_getConfig(long handle, SerialPortConfiguration config);
 	protected static native boolean n_setTimeouts(long handle, int readTimeout, int readTimeoutInterval, int writeTimeout);
 	protected static native boolean n_getTimeouts(long handle, int[] timeouts);
+	protected static native boolean n_setReadLatencyBudget(long handle, long latencyBudget);
 	protected static native boolean n_openPort(long handle);
 	protected static native void n_closePort(long handle);
 	protected static native boolean n_isOpen(long handle);
@@ -205,6 +206,16 @@ public class SerialPort {
 		return timeouts[2];
 	}
 	
+	/**
+	 * Enables adaptive read sizing, after the first byte arrived, the read methods wait for as many bytes as are expected to arrive within the budget.
+	 * Has to be called after the port was opened, currently only supported on linux.
+	 * @param latencyBudget The maximum additional time in microseconds a received byte is held back, zero disables adaptive reads
+	 * @return true if the budget was set, false if not supported or the port is not open
+	 */
+	public boolean setReadLatencyBudget(long latencyBudget) {
+		return n_setReadLatencyBudget(handle, latencyBudget);
+	}
+	
 	public boolean openPort() {
 		return n_openPort(handle);
 	}
@@ -0,0 +1,178 @@
+/*
+ * soeparser_bench.cpp
+ *
+ * Compares the buffered frame parser of the link handler with the previous parser, which received each frame with
+ * one receive call for the header and one for the payload (and one per byte of the v2 length field).
+ * Pre-built v1 and v2 frame streams are written into an stream socket pair and parsed on the other side.
+ * Not part of the SOE build, linux only:
+ *
+ *   g++ -O2 -std=c++17 -I../src/cpp/header soeparser_bench.cpp ../src/cpp/source/soeframe.cpp -o soeparser_bench -lpthread
+ *   ./soeparser_bench [frames] [payload length ...]
+ */
+
+#include <soeframe.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+#define BENCH_RX_BUFFER_LEN 16384	// same as SOE_TCP_RX_BUFFER_LEN
+
+struct BenchResult {
+	unsigned long frames;			// frames parsed
+	unsigned long calls;			// receive calls made
+	unsigned long long checksum;	// sum of the payload bytes, so that the payload is actually accessed
+	double seconds;
+};
+
+// Builds the stream of frames with the payload length, as the remote would send it
+static std::vector<char> buildStream(bool v2, unsigned long frames, unsigned int payloadLen) {
+	std::vector<char> stream;
+	std::vector<char> payload(payloadLen);
+	for (unsigned int i = 0; i < payloadLen; i++)
+		payload[i] = (char) i;
+	for (unsigned long i = 0; i < frames; i++) {
+		if (v2) {
+			char field[SOE_TCP_VARINT_MAX_LEN];
+			unsigned int fieldLen = SerialOverEthernet::writeVarintBefore(field + sizeof(field), payloadLen);
+			stream.insert(stream.end(), field + sizeof(field) - fieldLen, field + sizeof(field));
+		} else {
+			for (unsigned int b = 0; b < SOE_TCP_PROTO_IDENT_LEN; b++)
+				stream.push_back((char) ((SOE_TCP_PROTO_IDENT >> b * 8) & 0xFF));
+			for (unsigned int b = 0; b < SOE_TCP_FRAME_LEN_BYTES; b++)
+				stream.push_back((char) ((payloadLen >> b * 8) & 0xFF));
+		}
+		stream.insert(stream.end(), payload.begin(), payload.end());
+	}
+	return stream;
+}
+
+static bool receiveBytes(int fd, char* buffer, unsigned int length, BenchResult& result) {
+	unsigned int received = 0;
+	while (received < length) {
+		result.calls++;
+		ssize_t count = ::recv(fd, buffer + received, length - received, 0);
+		if (count <= 0) return false;
+		received += count;
+	}
+	return true;
+}
+
+// The previous parser, receiving the header and the payload of each frame separately
+static void parsePerFrame(int fd, bool v2, BenchResult& result) {
+	std::vector<char> frame(SOE_TCP_FRAME_LIMIT);
+	while (true) {
+		unsigned int payloadLen = 0;
+		if (v2) {
+			char field[SOE_TCP_VARINT_MAX_LEN];
+			unsigned int fieldLen = 0;
+			do {
+				if (fieldLen == SOE_TCP_VARINT_MAX_LEN || !receiveBytes(fd, field + fieldLen, 1, result)) return;
+			} while (SerialOverEthernet::readVarint(field, ++fieldLen, &payloadLen) == 0);
+		} else {
+			char header[SOE_TCP_HEADER_LEN];
+			if (!receiveBytes(fd, header, SOE_TCP_HEADER_LEN, result)) return;
+			for (unsigned int i = 0; i < SOE_TCP_FRAME_LEN_BYTES; i++)
+				payloadLen |= ((unsigned char) header[SOE_TCP_PROTO_IDENT_LEN + i]) << (i * 8);
+		}
+		if (!receiveBytes(fd, frame.data(), payloadLen, result)) return;
+		for (unsigned int i = 0; i < payloadLen; i++)
+			result.checksum += (unsigned char) frame[i];
+		result.frames++;
+	}
+}
+
+// The buffered parser, as used by SOELinkHandler::receiveFrames()
+static void parseBuffered(int fd, bool v2, BenchResult& result) {
+	std::vector<char> buffer(BENCH_RX_BUFFER_LEN > SOE_TCP_FRAME_LIMIT + SOE_TCP_HEADER_LEN ? BENCH_RX_BUFFER_LEN : SOE_TCP_FRAME_LIMIT + SOE_TCP_HEADER_LEN);
+	unsigned int bufferStart = 0;
+	unsigned int bufferEnd = 0;
+	while (true) {
+		unsigned int headerLen = 0;
+		unsigned int payloadLen = 0;
+		int status = v2 ?
+				SerialOverEthernet::parseFrameV2(buffer.data() + bufferStart, bufferEnd - bufferStart, SOE_TCP_FRAME_LIMIT, &headerLen, &payloadLen) :
+				SerialOverEthernet::parseFrameV1(buffer.data() + bufferStart, bufferEnd - bufferStart, &headerLen, &payloadLen);
+		if (status < 0) return;
+		if (status > 0) {
+			const char* payload = buffer.data() + bufferStart + headerLen;
+			bufferStart += headerLen + payloadLen;
+			for (unsigned int i = 0; i < payloadLen; i++)
+				result.checksum += (unsigned char) payload[i];
+			result.frames++;
+			continue;
+		}
+
+		if (bufferStart > 0) {
+			memmove(buffer.data(), buffer.data() + bufferStart, bufferEnd - bufferStart);
+			bufferEnd -= bufferStart;
+			bufferStart = 0;
+		}
+		result.calls++;
+		ssize_t count = ::recv(fd, buffer.data() + bufferEnd, buffer.size() - bufferEnd, 0);
+		if (count <= 0) return;
+		bufferEnd += count;
+	}
+}
+
+static BenchResult run(bool buffered, bool v2, const std::vector<char>& stream) {
+	int fds[2];
+	if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+		printf("[!] failed to create socket pair\n");
+		exit(1);
+	}
+
+	// the stream is written in large chunks, like an busy remote fills the socket
+	std::thread writer([&stream, fds]() {
+		size_t written = 0;
+		while (written < stream.size()) {
+			size_t chunk = stream.size() - written < 65536 ? stream.size() - written : 65536;
+			ssize_t count = ::send(fds[0], stream.data() + written, chunk, 0);
+			if (count <= 0) break;
+			written += count;
+		}
+		::shutdown(fds[0], SHUT_WR);
+	});
+
+	BenchResult result = { 0, 0, 0, 0 };
+	auto start = std::chrono::steady_clock::now();
+	if (buffered)
+		parseBuffered(fds[1], v2, result);
+	else
+		parsePerFrame(fds[1], v2, result);
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	writer.join();
+	::close(fds[0]);
+	::close(fds[1]);
+	return result;
+}
+
+int main(int argc, const char** argv) {
+	unsigned long frames = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+	std::vector<unsigned int> payloadLens;
+	for (int i = 2; i < argc; i++)
+		payloadLens.push_back(strtoul(argv[i], nullptr, 10));
+	if (payloadLens.empty())
+		payloadLens = { 8, 64, 400 };
+
+	for (unsigned int payloadLen : payloadLens) {
+		if (payloadLen > SOE_TCP_FRAME_MAX_LEN - SOE_TCP_HEADER_LEN) {
+			printf("[!] payload length exceeds the v1 frame limit: %u\n", payloadLen);
+			continue;
+		}
+		for (int v2 = 0; v2 < 2; v2++) {
+			std::vector<char> stream = buildStream(v2 != 0, frames, payloadLen);
+			for (int buffered = 0; buffered < 2; buffered++) {
+				BenchResult result = run(buffered != 0, v2 != 0, stream);
+				printf("v%d %3u byte payload %-9s %lu frames, %lu recv calls, %.0f frames/s, %.1f MB/s\n", v2 + 1, payloadLen, buffered ? "buffered" : "per frame",
+						result.frames, result.calls, result.frames / result.seconds, stream.size() / result.seconds / 1000000.0);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * soecompression.hpp
+ *
+ * Defines the stream compression used for serial data packages of links with compression enabled.
+ * An byte oriented LZ77 codec (sequence layout similar to LZ4) with an history window shared by all packages of the link.
+ */
+
+#ifndef SOECOMPRESSION_HPP_
+#define SOECOMPRESSION_HPP_
+
+#include <vector>
+
+namespace SerialOverEthernet {
+
+#define SOE_COMPRESS_WINDOW 65536			// size of the history window, the max distance of an match
+#define SOE_COMPRESS_MIN_LEN 16				// min length of serial data to attempt compression, shorter packages are always send raw
+#define SOE_COMPRESS_MAX_LEN 65536			// max length of serial data compressed or decompressed as one package
+#define SOE_COMPRESS_HASH_BITS 12			// number of bits of the match finder hash table index
+#define SOE_COMPRESS_MISS_LIMIT 8			// number of subsequent packages not benefiting from compression until attempts are paused
+#define SOE_COMPRESS_BACKOFF 64				// number of packages send raw without attempt after the miss limit was reached
+
+/**
+ * Compresses the serial data packages of one link direction.
+ * Only packages which are smaller after compression become part of the history, packages send raw are not seen by the decompressor.
+ */
+class SOECompressor {
+
+public:
+	SOECompressor();
+
+	/**
+	 * Returns true if compression should be attempted for the next package.
+	 * Short packages are not compressed to not delay single characters, and after multiple packages did not benefit from
+	 * compression (such as already compressed or encrypted data) attempts are paused for an number of packages.
+	 * @param length The length of the package data
+	 * @return true if compress() should be called, false if the package should be send raw
+	 */
+	bool shouldAttempt(unsigned int length);
+
+	/**
+	 * Compresses the data, matches can reference all previously compressed packages within the history window.
+	 * @param data The serial data, at most SOE_COMPRESS_MAX_LEN bytes
+	 * @param length The length of the serial data
+	 * @param output The buffer to write the compressed data to
+	 * @param outputCapacity The capacity of the output buffer, compression fails if the data does not fit
+	 * @return The length of the compressed data, or zero if it did not fit and the package has to be send raw
+	 */
+	unsigned int compress(const char* data, unsigned int length, char* output, unsigned int outputCapacity);
+
+private:
+	std::vector<char> history;				// the data of the previous packages, followed by the current package
+	unsigned int historyLen;				// number of valid bytes in the history
+	std::vector<int> hashTable;				// last history position of each hashed four byte sequence, -1 if unused
+	unsigned int misses;					// subsequent packages which did not benefit from compression
+	unsigned int backoff;					// remaining packages to send raw without attempt
+
+};
+
+/**
+ * Decompresses the serial data packages of one link direction.
+ */
+class SOEDecompressor {
+
+public:
+	SOEDecompressor();
+
+	/**
+	 * Decompresses the data of an compressed package and appends it to the history.
+	 * @param data The compressed data
+	 * @param length The length of the compressed data
+	 * @param output Set to the decompressed data, which stays valid until the next call
+	 * @return The length of the decompressed data, or -1 if the data is malformed
+	 */
+	int decompress(const char* data, unsigned int length, const char** output);
+
+private:
+	std::vector<char> history;				// the data of the previous packages, followed by the current package
+	unsigned int historyLen;				// number of valid bytes in the history
+
+};
+
+}
+
+#endif /* SOECOMPRESSION_HPP_ */
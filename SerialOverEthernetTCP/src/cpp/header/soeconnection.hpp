@@ -12,67 +12,249 @@
 
 #include <netsocket.hpp>
 #include <serial_port.hpp>
+#include <serial_thread.hpp>
 #include <thread>
+#include <atomic>
 #include <map>
+#include <vector>
 #include <shared_mutex>
 #include <string>
 #include <condition_variable>
 #include <functional>
+#include "soecompression.hpp"
+#include "soeframe.hpp"
+#include "soetransport.hpp"
+#include "soeeventloop.hpp"
 
 namespace SerialOverEthernet {
 
 #define SOE_TCP_DEFAULT_SOE_PORT 26												// default server port
-#define SOE_TCP_FRAME_MAX_LEN 512												// max package length
-#define SOE_TCP_FRAME_LEN_BYTES 3												// length of package length field
-#define SOE_TCP_PROTO_IDENT_LEN 4												// length of package identifier
-#define SOE_TCP_PROTO_IDENT 0x534F4950U											// package identifier
 #define SOE_TCP_HANDSHAKE_TIMEOUT 4000											// timeout for handshake operations and initial connection
-#define SOE_TCP_HEADER_LEN (SOE_TCP_PROTO_IDENT_LEN + SOE_TCP_FRAME_LEN_BYTES)	// length of the package header
 #define SOE_SERIAL_BUFFER_LEN (SOE_TCP_FRAME_MAX_LEN - SOE_TCP_HEADER_LEN) - 1	// max length of received serial data for one package
+#define SOE_TCP_PROTOCOL_VERSION 2												// highest supported protocol version
+#define SOE_TCP_PACKAGE_HEADROOM SOE_TCP_HEADER_LEN								// bytes reserved in front of each transmitted package for the v1 header or the v2 frame and record length
+#define SOE_TCP_CHANNEL_PREFIX_LEN 2											// length of the channel prefix in front of packages of channels other than zero
+#define SOE_TCP_CHANNEL_HEADROOM (SOE_TCP_PACKAGE_HEADROOM + SOE_TCP_CHANNEL_PREFIX_LEN)	// bytes reserved in front of each transmitted channel package
+#define SOE_TCP_REQUEST_PREFIX_LEN 3											// length of the request prefix in front of requests to remotes supporting request ids
+#define SOE_TCP_REQUEST_HEADROOM (SOE_TCP_CHANNEL_HEADROOM + SOE_TCP_REQUEST_PREFIX_LEN)	// bytes reserved in front of each transmitted request package
+#define SOE_SERIAL_DATA_HEADROOM (SOE_TCP_CHANNEL_HEADROOM + 1)					// bytes reserved in front of serial data for the package opcode and header
+#define SOE_TCP_RX_BUFFER_LEN 16384												// min length of the network reception buffer, which can hold multiple frames
+#define SOE_TCP_FEATURE_COMPRESSION 0x1											// hello feature flag and open option for serial data compression
+#define SOE_TCP_FEATURE_CHANNELS 0x2											// hello feature flag for multiple port pairs on one connection
+#define SOE_TCP_FEATURE_REQUEST_IDS 0x4											// hello feature flag for request ids echoed by the confirm packages
+#define SOE_TCP_FEATURE_CREDITS 0x8												// hello feature flag for credit based flow control of the serial data
+#define SOE_TCP_FEATURE_PING 0x10												// hello feature flag for round trip time probes
+#define SOE_TCP_PING_INTERVAL 1000												// default interval in ms between round trip time probes
+#define SOE_TCP_RTT_SAMPLES 256													// number of round trip time samples the statistics are calculated from
+#define SOE_TCP_FEATURE_SESSION 0x20											// hello feature flag for sessions which can be resumed after the connection was lost
+#define SOE_TCP_SESSION_TIMEOUT 30000											// default time in ms within an lost connection can be resumed
+#define SOE_TCP_SESSION_RETRY 1000												// time in ms between attempts to reconnect to the remote of an lost session
+#define SOE_TCP_SESSION_CLOSE_TIMEOUT 1000										// max time in ms an shutdown waits for the current transmission to end the session
+#define SOE_TCP_SESSION_POLL 100												// max time in ms the TX thread waits for serial data before checking for retransmissions
+#define SOE_TCP_MAX_CHANNELS 256												// number of channels of an connection, channel numbers are one byte
+#define SOE_SERIAL_BUFFER_TIME 20												// time in ms of serial data at the current baud one v2 package should hold
+#define SOE_SERIAL_CREDIT_TIME 50												// time in ms of serial data at the current baud the remote can send ahead of the local port
+#define SOE_SERIAL_READ_LATENCY 2												// time in ms a received byte can be held back to read the local port in larger chunks, if not using an event loop
+#define SOE_SERIAL_CREDIT_MIN 2048												// min number of bytes the remote can send ahead of the local port
+#define SOE_SERIAL_TX_QUEUE_LEN 16384											// max number of bytes waiting for the local port if the remote does not support credits
+#define SOE_SERIAL_RETRANSMIT_LEN 65536											// max number of transmitted bytes kept until the remote acknowledged them, if sessions are supported
+#define SOE_SERIAL_ACK_LEN (SOE_SERIAL_RETRANSMIT_LEN / 4)						// number of received bytes after which the reception is acknowledged to the remote
+
+/**
+ * The state of one port pair of an connection.
+ * Channels are created on first use and stay allocated until the connection is deleted, so references to them stay valid.
+ */
+struct SOEChannel {
+	unsigned char number;									// the channel number used on the connection
+	bool allocated;											// if the channel was handed out by allocateChannel()
+	std::thread thread_tx;									// serial reception and network transmission thread, if not handled by an event loop
+	std::mutex m_localPort;									// protect local serial port against async modification
+	std::condition_variable cv_openLocalPort;				// waiting point for TX thread when port closed
+	std::shared_ptr<SerialAccess::SerialPort> localPort;	// local serial port, the threads keep their own reference while reading or writing
+	std::string localPortName;								// local serial port name currently open
+	std::string remotePortName;								// remote serial prot currently open
+	std::atomic<unsigned long> localBaud;					// baud of the local serial port, used to size the serial buffer
+	std::atomic<unsigned int> serialBufferLen;				// length of serial data read for one package
+	std::unique_ptr<SOECompressor> txCompressor;			// compressor for transmitted serial data, set before the local port is opened
+	std::vector<char> txCompressed;							// compressed serial data with headroom, only accessed by the TX thread
+	std::unique_ptr<SOEDecompressor> rxDecompressor;		// decompressor for received serial data, only accessed by the RX thread
+	std::mutex m_txCredits;									// protect the credits against async writes
+	std::condition_variable cv_txCredits;					// waiting point for TX thread when no credits are left
+	unsigned long txCredits;								// number of bytes which can be send to the remote port, if the remote supports credits
+	std::thread thread_serialTX;							// serial transmission thread, writes the queued data to the local port, if not handled by an event loop
+	std::mutex m_serialTX;									// protect the serial transmission queue against async writes
+	std::condition_variable cv_serialTX;					// waiting point for data to write or space in the queue
+	std::vector<char> serialTXQueue;						// received serial data waiting for the local port
+	unsigned long long rxCreditsGranted;					// total number of bytes the remote was allowed to send
+	unsigned long long rxBytesWritten;						// total number of received bytes written to the local port or discarded
+	unsigned int rxCreditWindow;							// max number of bytes the remote can send ahead of the local port
+	std::vector<char> retransmitBuffer;						// transmitted serial data not yet acknowledged by the remote, protected by m_txCredits
+	unsigned long long txSequence;							// total number of serial bytes transmitted, protected by m_txCredits
+	unsigned long long txAcknowledged;						// total number of serial bytes the remote acknowledged, the position of the retransmission buffer
+	bool resyncPending;										// if the connection was lost and the remote did not report its reception position yet
+	bool retransmitPending;									// if the data of the retransmission buffer has to be transmitted again before new data
+	unsigned long long rxSequence;							// total number of serial bytes received, only accessed by the RX thread
+	unsigned long long rxAcknowledged;						// total number of serial bytes acknowledged to the remote, only accessed by the RX thread
+	std::atomic<unsigned long> serialSource;				// event source of the local port, zero if not open or handled by the threads
+	std::vector<char> serialData;							// serial data read from the local port with headroom, only accessed by the event loop
+	bool localPortFailed;									// if the local port reported an error, it is not waited on anymore until reopened
+	std::atomic<unsigned long long> serialBytesRead;		// total number of bytes read from the local port
+	std::atomic<unsigned long long> serialErrors;			// total number of failed reads and writes on the local port
+};
+
+/**
+ * The round trip time statistics of an connection, all times in microseconds.
+ */
+struct SOELatencyStats {
+	unsigned long samples;									// number of samples the statistics were calculated from, zero if none are available
+	unsigned long long probes;								// total number of probes send
+	unsigned long long responses;							// total number of probe responses received
+	unsigned long last;										// the last round trip time
+	unsigned long min;										// the min round trip time of the samples
+	unsigned long avg;										// the average round trip time of the samples
+	unsigned long p99;										// the 99th percentile round trip time of the samples
+	unsigned long jitter;									// the smoothed variation between subsequent round trip times
+};
+
+/**
+ * The transfer counters and queue depths of one port pair of an connection.
+ */
+struct SOEChannelStats {
+	unsigned char number;									// the channel number used on the connection
+	std::string localPortName;								// local serial port name, empty if not open
+	std::string remotePortName;								// remote serial port name, empty if not open
+	unsigned long long serialBytesRead;						// total number of bytes read from the local port
+	unsigned long long serialBytesWritten;					// total number of received bytes written to the local port or discarded
+	unsigned long long serialErrors;						// total number of failed reads and writes on the local port
+	unsigned long serialQueue;								// number of received bytes waiting for the local port
+	unsigned long retransmitQueue;							// number of transmitted bytes not yet acknowledged by the remote
+	unsigned long txCredits;								// number of bytes which can be send to the remote port
+};
+
+/**
+ * The transfer counters, queue depths and thread CPU times of an connection.
+ */
+struct SOELinkStats {
+	unsigned long long bytesSent;							// total number of bytes send over the transport, including frame headers
+	unsigned long long bytesReceived;						// total number of bytes received from the transport
+	unsigned long long framesSent;							// total number of frames send
+	unsigned long long framesReceived;						// total number of frames received
+	unsigned long long resumes;								// number of times the session was resumed after the connection was lost
+	unsigned long transmitQueue;							// number of bytes waiting in the v2 transmission queue
+	unsigned long long rxThreadCpuTime;						// CPU time in microseconds of the RX thread, zero if handled by the event loop
+	unsigned long long txThreadCpuTime;						// CPU time in microseconds of the TX and serial TX threads, zero if handled by the event loop
+	std::vector<SOEChannelStats> channels;					// the port pairs of this connection
+};
+
+/**
+ * An control request send to the remote, waiting for its confirm package.
+ */
+struct SOERequest {
+	unsigned long sequence;									// order in which the requests were send, remotes without request ids confirm in this order
+	const char* operation;									// description of the requested operation for log entries
+	std::string portName;									// the port name the request is related to for log entries
+	bool completed;											// if the confirm was received or the connection was closed
+	bool success;											// the result of the request
+	bool abandoned;											// if the request timed out, it is removed when the confirm arrives anyway
+};
+
+/**
+ * Formats the round trip time statistics for log entries.
+ * @param stats The statistics
+ * @return The statistics in milliseconds as human readable string
+ */
+std::string formatLatencyStats(const SOELatencyStats& stats);
 
 class SOELinkHandler {
 
 public:
 	/**
 	 * Creates a new client network connection handler
-	 * @param socket The socket of the client-server connection
+	 * @param transport The transport of the client-server connection, the handler takes ownership of it
 	 * @param onDeath A callback invoked when the connection was closed
+	 * @param eventLoop The event loop handling the connection, nullptr to use the loop with the fewest connections
 	 */
-	SOELinkHandler(NetSocket::Socket* socket, std::string& hostName, std::string& hostPort, std::function<void(SOELinkHandler*)> onDeath);
+	SOELinkHandler(SOETransport* transport, std::string& hostName, std::string& hostPort, std::function<void(SOELinkHandler*)> onDeath, SOEEventLoop* eventLoop = nullptr);
 
 	/**
 	 * Closes all ports and the socket and cleans all allocated buffer memory
 	 */
 	~SOELinkHandler();
 
+	/**
+	 * Allocates an unused channel for an additional port pair on this connection, has to be called after negotiateProtocol().
+	 * Channel zero is always available first, further channels are only available if the remote supports them.
+	 * @return The channel number, or -1 if no channel is available
+	 */
+	int allocateChannel();
+
 	/**
 	 * Attempts to open the local serial port.
+	 * @param channel The channel of the port pair
 	 * @param localSerial The serial port file name
 	 * @return true if the port as opened successfully, false otherwise
 	 */
-	bool openLocalPort(const std::string& localSerial);
+	bool openLocalPort(unsigned char channel, const std::string& localSerial);
 	/**
 	 * Attempts to open the remote serial port.
+	 * @param channel The channel of the port pair
 	 * @param localSerial The serial port file name
 	 * @return true if the port as opened successfully, false otherwise
 	 */
-	bool openRemotePort(const std::string& remoteSerial);
+	bool openRemotePort(unsigned char channel, const std::string& remoteSerial);
+
+	/**
+	 * Sends the request to open the remote serial port, without waiting for the response.
+	 * Multiple requests can be pending at the same time, they are processed by the remote in the order they were send.
+	 * @param channel The channel of the port pair
+	 * @param remoteSerial The serial port file name
+	 * @return The request id to wait for with awaitRequest(), or -1 if the request could not be send
+	 */
+	int requestRemoteOpen(unsigned char channel, const std::string& remoteSerial);
+	/**
+	 * Sends the request to apply the serial port configuration to the remote port, without waiting for the response.
+	 * @param channel The channel of the port pair
+	 * @param remoteConfig The serial port configuration
+	 * @return The request id to wait for with awaitRequest(), or -1 if the request could not be send
+	 */
+	int requestRemoteConfig(unsigned char channel, const SerialAccess::SerialPortConfiguration& remoteConfig);
+	/**
+	 * Sends the request to release the remote port, without waiting for the response.
+	 * @param channel The channel of the port pair
+	 * @return The request id to wait for with awaitRequest(), or -1 if the request could not be send
+	 */
+	int requestRemoteClose(unsigned char channel);
+	/**
+	 * Waits for the response of an request send before.
+	 * @param requestId The request id returned when sending the request
+	 * @return true if the remote confirmed the request successfully, false if it failed, timed out or the request id was invalid
+	 */
+	bool awaitRequest(int requestId);
+
+	/**
+	 * Requests compression of the serial data in both directions, has to be called before openRemotePort().
+	 * Compression is only enabled if the remote supports it, otherwise the link continues uncompressed.
+	 * @param enable true to request compression
+	 */
+	void requestCompression(bool enable);
 
 	/**
 	 * Attempts to apply the serial port configuration to the remote port
+	 * @param channel The channel of the port pair
 	 * @param remoteConfig The serial port configuration
 	 * @return true if the configuration was applied successfully, false otherwise
 	 */
-	bool setLocalConfig(const SerialAccess::SerialPortConfiguration& localConfig);
+	bool setLocalConfig(unsigned char channel, const SerialAccess::SerialPortConfiguration& localConfig);
 	/**
 	 * Attempts to apply the serial port configuration to the remote port
+	 * @param channel The channel of the port pair
 	 * @param remoteConfig The serial port configuration
 	 * @return true if the configuration was applied successfully, false otherwise
 	 */
-	bool setRemoteConfig(const SerialAccess::SerialPortConfiguration& remoteConfig);
+	bool setRemoteConfig(unsigned char channel, const SerialAccess::SerialPortConfiguration& remoteConfig);
 
 	/**
-	 * Closes this connection, releasing both the local and the remote serial port.
+	 * Closes this connection, releasing the local and the remote serial ports of all channels.
 	 * This function blocks until everything is closed.
 	 * If an shutdown was already issued and the function is called a second time, it returns immediately.
 	 * @return false if the method was already called before and this call did not have any effect, true if this was the first call and the shutdown was performed
@@ -81,15 +263,31 @@ public:
 
 	/**
 	 * Attempts to release the remote port.
+	 * @param channel The channel of the port pair
 	 * @return true if the remote port could be released successfully, false otherwise
 	 */
-	bool closeRemotePort();
+	bool closeRemotePort(unsigned char channel);
 
 	/**
 	 * Attempts to release the local port.
+	 * @param channel The channel of the port pair
 	 * @return true if the local port could be released successfully, false otherwise
 	 */
-	bool closeLocalPort();
+	bool closeLocalPort(unsigned char channel);
+
+	/**
+	 * Closes the local and the remote port of an channel allocated by allocateChannel() and makes it available again.
+	 * The other channels of the connection are not affected.
+	 * @param channel The channel of the port pair
+	 * @return true if both ports could be released successfully, false otherwise
+	 */
+	bool releaseChannel(unsigned char channel);
+
+	/**
+	 * Returns true if any channel of this connection is allocated, used to close connections which carry no link anymore.
+	 * @return true if at least one channel is allocated
+	 */
+	bool hasAllocatedChannels();
 
 	/**
 	 * Returns true if the network connection is still operational
@@ -97,19 +295,226 @@ public:
 	 */
 	bool isAlive();
 
+	/**
+	 * Negotiates the protocol version with the remote, has to be called before any other request is sent.
+	 * Protocol v2 packs multiple packages into one frame and omits the identifier, it is only used if both sides support it.
+	 * If the remote does not know the negotiation (it answers with an error), the link continues to use v1.
+	 * @return true if the negotiation completed (with either version), false if the remote did not answer
+	 */
+	bool negotiateProtocol();
+
+	/**
+	 * Enables resuming the session after the connection was lost, has to be called before negotiateProtocol().
+	 * The session is only resumable if the remote supports it, the ports stay open and the serial data in flight is retransmitted.
+	 * @param reconnect A callback establishing an new connection to the remote, returning nullptr if it failed
+	 */
+	void enableResume(std::function<SOETransport*()> reconnect);
+
+	/**
+	 * Sends an round trip time probe to the remote, the result is included in the latency statistics when the response arrives.
+	 * Does nothing if the remote does not support probes.
+	 * @return false if the probe could not be send, true otherwise
+	 */
+	bool probeLatency();
+
+	/**
+	 * Returns the round trip time statistics of the probes send over this connection.
+	 * @param stats The statistics to fill in
+	 */
+	void getLatencyStats(SOELatencyStats& stats);
+
+	/**
+	 * Returns the transfer counters, queue depths and thread CPU times of this connection and its channels.
+	 * @param stats The statistics to fill in
+	 */
+	void getLinkStats(SOELinkStats& stats);
+
+	/**
+	 * Returns the remote host name and port this connection was established with, for log entries.
+	 * @return The remote address as host/port
+	 */
+	std::string getRemoteAddress();
+
+	/**
+	 * Sets the scheduling configuration applied to the RX and TX threads of all links created afterwards.
+	 * @param config The thread configuration
+	 */
+	static void setThreadConfig(const SerialAccess::SerialThreadConfig& config);
+
+	/**
+	 * Sets the max v2 frame payload length offered during the protocol negotiation of all links created afterwards.
+	 * The link uses the smaller of the lengths offered by both sides, the value is clamped between SOE_TCP_FRAME_MAX_LEN and SOE_TCP_FRAME_LIMIT.
+	 * @param frameLimit The max frame payload length in bytes
+	 */
+	static void setFrameLimit(unsigned int frameLimit);
+
+	/**
+	 * Sets the time within the sessions of all links created afterwards can be resumed after their connection was lost.
+	 * @param timeout The time in ms, zero disables sessions
+	 */
+	static void setSessionTimeout(unsigned int timeout);
+
 private:
 
+	/**
+	 * Returns the channel with the number, creating it and starting its TX thread if it does not exist yet.
+	 * @param number The channel number
+	 * @return The channel
+	 */
+	SOEChannel& getChannel(unsigned char number);
+
+	/**
+	 * Recalculates the length of the serial data read for one package of all channels,
+	 * from the negotiated frame length, the number of channels and the baud of their local ports.
+	 */
+	void updateSerialBuffer();
+
+	/**
+	 * Applies the configured scheduling to the calling RX or TX thread.
+	 * @param threadName The name of the thread for log entries
+	 */
+	void applyThreadConfig(const char* threadName);
+
 	/**
 	 * Handles network package reception
 	 */
 	void handleClientRX();
 	/**
-	 * Handles network package transmission
+	 * Handles the events of the transport, if the link is handled by an event loop.
+	 * @param events The events which occurred
+	 */
+	void handleClientEvent(unsigned int events);
+	/**
+	 * Handles the events of the local port of an channel, if the link is handled by an event loop.
+	 * @param channel The channel of the local port
+	 * @param events The events which occurred
 	 */
-	void handleClientTX();
+	void handleSerialEvent(SOEChannel& channel, unsigned int events);
 
-	bool processPackage(const char* package, unsigned int packageLen);
-	bool transmitPackage(const char* package, unsigned int packageLen);
+	/**
+	 * Processes the complete frames in the reception buffer and receives from the transport once, if more data is required.
+	 * @return 1 if the reception can continue, 0 if the link has to shut down and -1 if the connection was lost and the session can be resumed
+	 */
+	int receiveFrames();
+
+	/**
+	 * Reads the serial data available from the local port without blocking and transmits it, as much as the credits allow.
+	 * @param channel The channel of the local port
+	 * @return false if the data could not be transmitted and the link has to shut down
+	 */
+	bool readSerialData(SOEChannel& channel);
+	/**
+	 * Writes as much of the queued serial data to the local port as possible without blocking.
+	 * @param channel The channel of the local port
+	 */
+	void writeSerialData(SOEChannel& channel);
+
+	/**
+	 * Registers the transport with the event loop of this link, if it supports event loops.
+	 */
+	void watchTransport();
+	/**
+	 * Removes the transport from the event loop, so that it can be replaced.
+	 */
+	void unwatchTransport();
+	/**
+	 * Updates the events waited for on the transport, the reception is paused while the local ports of an remote without credits are behind.
+	 */
+	void updateClientEvents();
+	/**
+	 * Applies the events waited for on the transport, the transmission is continued when the transport has space for the deferred bytes.
+	 * Has to be called with m_socketTX locked.
+	 */
+	void applyClientEvents();
+	/**
+	 * Updates the events waited for on the local port of an channel, from its credits, retransmission buffer and queued serial data.
+	 * @param channel The channel of the local port
+	 */
+	void updateSerialEvents(SOEChannel& channel);
+	/**
+	 * Handles network package transmission of an channel
+	 * @param channel The channel to transmit the serial data of
+	 */
+	void handleClientTX(SOEChannel& channel);
+	/**
+	 * Handles writing the received serial data of an channel to the local port
+	 * @param channel The channel to write the serial data of
+	 */
+	void handleSerialTX(SOEChannel& channel);
+
+	/**
+	 * Grants the remote credits for the space available in the serial transmission queue of the channel,
+	 * if the space is large enough to be worth an package, or if forced.
+	 * @param channel The channel of the local port
+	 * @param force If the credits should be granted even if only little space is available
+	 * @return false if the credits could not be transmitted
+	 */
+	bool grantCredits(SOEChannel& channel, bool force);
+
+	/**
+	 * Suspends the session after its connection was lost and waits for an new connection, reconnecting to the remote if this side established the session.
+	 * Has to be called by the RX thread, or the resume thread if handled by an event loop, the reception continues on the new connection if this succeeds.
+	 * @return true if an new connection was established, false if the session expired or the link was shut down
+	 */
+	bool resumeSession();
+
+	/**
+	 * Passes the connection resuming this session from the handler which accepted it, the current connection is closed.
+	 * @param resumed The transport of the new connection, this handler takes ownership of it
+	 */
+	void handOverTransport(SOETransport* resumed);
+
+	/**
+	 * Stores the serial data in the retransmission buffer of the channel, after the data lost with an connection was retransmitted.
+	 * Waits until the session was resumed and the buffer has space for the data.
+	 * @param channel The channel to transmit the serial data of
+	 * @param data The serial data
+	 * @param len The length of the serial data
+	 * @param sessionLock Set to hold the session until the data was transmitted
+	 * @return false if the link was shut down, true otherwise
+	 */
+	bool bufferSerialData(SOEChannel& channel, const char* data, unsigned int len, std::shared_lock<std::shared_mutex>& sessionLock);
+
+	/**
+	 * Transmits the serial data after the reception position of the remote again, if the session was resumed since the last call.
+	 * @param channel The channel to retransmit the serial data of
+	 * @return false if the link was shut down, true otherwise
+	 */
+	bool retransmitSerialData(SOEChannel& channel);
+
+	/**
+	 * Fails all requests waiting for their response, which is lost with the connection.
+	 */
+	void failPendingRequests();
+
+	bool processFrameV2(const char* frame, unsigned int frameLen);
+
+	bool processPackage(const char* package, unsigned int packageLen, unsigned char channel);
+	// the package buffers have to provide SOE_TCP_PACKAGE_HEADROOM writable bytes in front of the package
+	bool transmitPackage(char* package, unsigned int packageLen);
+	// the package buffers have to provide SOE_TCP_CHANNEL_HEADROOM writable bytes in front of the package
+	bool transmitChannelPackage(unsigned char channel, char* package, unsigned int packageLen);
+	bool processChannel(const char* package, unsigned int packageLen, unsigned char channel);
+	// the package buffers have to provide SOE_TCP_REQUEST_HEADROOM writable bytes in front of the package
+	int transmitRequestPackage(unsigned char channel, char* package, unsigned int packageLen, const char* operation, const std::string& portName);
+	bool processRequest(const char* package, unsigned int packageLen, unsigned char channel);
+	bool transmitPackageV1(char* package, unsigned int packageLen);
+	bool transmitPackageV2(char* package, unsigned int packageLen);
+	// transmits the package as its own v2 frame bypassing the queue, has to be called with m_socketTX locked
+	bool transmitPackageDirect(char* package, unsigned int packageLen);
+	// transmits the queued v2 records while txSending is set, until the queue is empty or the transport does not accept more without blocking
+	bool transmitQueue(std::unique_lock<std::mutex>& lock);
+	// transmits an frame with m_socketTX locked, behind the bytes still deferred to the event loop
+	bool transmitFrameLocked(const char* frame, unsigned int frameLen);
+	// sends the frame over the transport, an non-blocking transport might only accept the first part, closes the transport if this fails
+	bool transmitFrame(const char* frame, unsigned int frameLen, unsigned int* sent);
+	// keeps the bytes the transport did not accept for the event loop, which transmits them when the transport has space, has to be called with m_socketTX locked
+	void deferTransmission(const char* data, unsigned int dataLen);
+	// transmits the deferred bytes and the records queued meanwhile, called from the event loop when the transport has space
+	void flushTransmission();
+
+	bool sendHello(unsigned char version, unsigned int frameLimit, unsigned long long session);
+	bool processHello(const char* package, unsigned int packageLen);
 
 	bool sendError(const std::string& errorMessage);
 	bool processError(const char* package, unsigned int packageLen);
@@ -117,38 +522,116 @@ private:
 	bool sendConfirm(bool success);
 	bool processConfirm(const char* package, unsigned int packageLen);
 
-	bool sendRemoteOpen(const std::string& remoteSerial);
-	bool processRemoteOpen(const char* package, unsigned int packageLen);
+	bool sendPing(unsigned long long timestamp);
+	bool processPing(const char* package, unsigned int packageLen);
+	bool processPong(const char* package, unsigned int packageLen);
+
+	int sendRemoteOpen(unsigned char channel, const std::string& remoteSerial, unsigned char options);
+	bool processRemoteOpen(const char* package, unsigned int packageLen, unsigned char channel);
+
+	int sendRemoteClose(unsigned char channel);
+	bool processRemoteClose(const char* package, unsigned int packageLen, unsigned char channel);
 
-	bool sendRemoteClose();
-	bool processRemoteClose(const char* package, unsigned int packageLen);
+	int sendRemoteConfig(unsigned char channel, const SerialAccess::SerialPortConfiguration& remoteConfig);
+	bool processRemoteConfig(const char* package, unsigned int packageLen, unsigned char channel);
 
-	bool sendRemoteConfig(const SerialAccess::SerialPortConfiguration& remoteConfig);
-	bool processRemoteConfig(const char* package, unsigned int packageLen);
+	// the data buffer has to provide SOE_SERIAL_DATA_HEADROOM writable bytes in front of the data
+	bool sendSerialData(SOEChannel& channel, char* data, unsigned int len);
+	bool processSerialData(const char* package, unsigned int packageLen, unsigned char channel);
+	bool processCompressedData(const char* package, unsigned int packageLen, unsigned char channel);
 
-	bool sendSerialData(const char* data, unsigned int len);
-	bool processSerialData(const char* package, unsigned int packageLen);
+	bool sendCredits(unsigned char channel, unsigned long credits);
+	bool processCredits(const char* package, unsigned int packageLen, unsigned char channel);
 
-	void transmitSerialData(const char* data, unsigned int len);
+	bool sendAck(unsigned char channel, unsigned long long received);
+	bool processAck(const char* package, unsigned int packageLen, unsigned char channel);
+	bool acknowledgeSerialData(SOEChannel& channel, unsigned int len);
+
+	// the resume and resync packages have to be send with m_socketTX locked
+	bool sendResume();
+	bool processResume(const char* package, unsigned int packageLen);
+	bool sendResync();
+	bool processResync(const char* package, unsigned int packageLen, unsigned char channel);
+	bool processResynced(const char* package, unsigned int packageLen);
+	bool sendCloseSession();
+	bool processCloseSession(const char* package, unsigned int packageLen);
+
+	/**
+	 * Tells the remote that the session ends, so that it closes its side immediately instead of waiting for it to be resumed.
+	 * Called by shutdown(), nothing is send if the connection was lost or the remote ended the session.
+	 */
+	void closeSession();
+
+	void queueSerialData(SOEChannel& channel, const char* data, unsigned int len);
 
 	std::mutex m_socketTX;									// protect against async writes to network
-	std::unique_ptr<NetSocket::Socket> socket;				// network TCP socket
+	std::condition_variable cv_socketTX;					// waiting point for space in the v2 transmission queue
+	unsigned char txProtocolVersion;						// protocol version used for transmission, protected by m_socketTX
+	unsigned char rxProtocolVersion;						// protocol version used for reception, only accessed by the RX thread
+	bool txSending;											// if an thread is currently transmitting the v2 queue, or the event loop the deferred bytes
+	std::vector<char> txDeferred;							// bytes of frames the transport did not accept without blocking, transmitted by the event loop, protected by m_socketTX
+	std::atomic<bool> txBlocked;							// if bytes are deferred, the local ports are not read meanwhile
+	std::atomic<bool> rxPaused;								// if the reception is paused because the local ports are behind
+	std::vector<char> txQueue;								// v2 records waiting for transmission, with headroom for the frame length
+	std::vector<char> txFrame;								// v2 frame currently transmitted
+	unsigned int txFrameMaxLen;								// negotiated max v2 frame payload length for transmission, protected by m_socketTX
+	unsigned int rxFrameMaxLen;								// negotiated max v2 frame payload length for reception, only accessed by the RX thread
+	bool helloPending;										// if an protocol negotiation is waiting for the response
+	unsigned char remoteFeatures;							// feature flags received with the hello of the remote
+	bool compressionRequested;								// if compression should be requested when opening the remote port
+	static unsigned int frameLimit;							// max frame payload length offered during negotiation
+	std::mutex m_transport;									// protect the transport against replacement while an session is resumed
+	std::unique_ptr<SOETransport> transport;				// network TCP or UDP transport, only replaced by the RX thread with m_socketTX locked
+	std::atomic<bool> alive;								// if the link was not shut down yet
 	std::string remoteHostName;									// the host name this connection was established with
 	std::string remoteHostPort;									// the host port this connection was established with
 	std::function<void(SOELinkHandler*)> onDeath;			// callback when connection is shut down
 
-	std::thread thread_rx;									// TCP reception thread
-	std::thread thread_tx;									// TCP transmission thread
+	std::thread thread_rx;									// TCP reception thread, if the transport is not handled by the event loop
+	std::thread thread_resume;								// waits for the new connection of an lost session, if the transport is handled by the event loop
+	SOEEventLoop* eventLoop;								// the loop handling the transport and local ports, nullptr if handled by threads
+	unsigned long clientSource;								// event source of the transport, zero if not handled by the event loop, protected by m_transport
+	std::vector<char> rxBuffer;								// received data, the data waiting for processing is located between rxBufferStart and rxBufferEnd
+	unsigned int rxBufferStart;								// start of the unprocessed data in the reception buffer, only accessed by the RX thread
+	unsigned int rxBufferEnd;								// end of the received data in the reception buffer, only accessed by the RX thread
+	static SerialAccess::SerialThreadConfig threadConfig;	// scheduling configuration of the RX/TX threads
 
-	std::mutex m_remoteReturn;								// protect return value against async writes
-	std::condition_variable cv_remoteReturn;				// waiting point for return value
-	bool remoteReturn;										// remote return value set by confirm package
+	std::mutex m_remoteRequest;								// keeps the transmission of requests in the order of their sequence
+	std::mutex m_remoteReturn;								// protect the pending requests against async writes
+	std::condition_variable cv_remoteReturn;				// waiting point for request responses
+	std::map<unsigned short, SOERequest> remoteRequests;	// requests waiting for their response, by request id
+	unsigned short nextRequestId;							// the id of the next request, zero is never used
+	unsigned long nextRequestSequence;						// the sequence of the next request
+	unsigned short rxRequestId;								// the id of the remote request currently processed, zero if none, only accessed by the RX thread
 
-	std::mutex m_localPort;									// protect local serial port against async modification
-	std::condition_variable cv_openLocalPort;				// waiting point for TX thread when port closed
-	std::unique_ptr<SerialAccess::SerialPort> localPort;	// local serial port
-	std::string localPortName;								// local serial port name currently open
-	std::string remotePortName;								// remote serial prot currently open
+	std::mutex m_latency;									// protect the round trip time statistics against async writes
+	std::vector<unsigned long> rttSamples;					// the last round trip times, used as ring buffer
+	unsigned int rttSampleIndex;							// the position of the next sample in the ring buffer
+	unsigned long long rttProbes;							// total number of probes send
+	unsigned long long rttResponses;						// total number of probe responses received
+	unsigned long rttLast;									// the last round trip time
+	unsigned long rttJitter;								// the smoothed variation between subsequent round trip times
+
+	std::atomic<unsigned long long> bytesSent;				// total number of bytes send over the transport
+	std::atomic<unsigned long long> bytesReceived;			// total number of bytes received from the transport
+	std::atomic<unsigned long long> framesSent;				// total number of frames send
+	std::atomic<unsigned long long> framesReceived;			// total number of frames received
+	std::atomic<unsigned long long> resumes;				// number of times the session was resumed
+
+	std::shared_mutex m_session;							// keeps transmissions of serial data and credits out of the resume handshake
+	std::condition_variable cv_session;						// waiting point for the new connection of an lost session
+	std::atomic<unsigned long long> sessionId;				// the id of the session, zero if the remote does not support sessions
+	std::function<SOETransport*()> reconnect;				// callback establishing an new connection, if this side established the session
+	std::unique_ptr<SOETransport> resumeTransport;			// connection handed over to resume the session, protected by m_transport
+	bool suspended;											// if the connection of the session was lost, only the resume handshake is transmitted, protected by m_socketTX
+	bool resumePending;										// if the resume request was send and the response is pending, only accessed by the RX thread
+	std::atomic<bool> sessionClosed;						// if the remote ended the session, the connection is not resumed when it is closed
+	static unsigned int sessionTimeout;						// time within an lost connection can be resumed
+	static std::mutex m_sessions;							// protect the session registry against async modification
+	static std::map<unsigned long long, SOELinkHandler*> sessions;	// the handlers with resumable sessions established by remotes, by session id
+
+	std::shared_mutex m_channels;							// protect the channel map against async creation of channels
+	std::map<unsigned char, std::unique_ptr<SOEChannel>> channels;	// the port pairs of this connection
 
 };
 
@@ -0,0 +1,118 @@
+/*
+ * soeeventloop.hpp
+ *
+ * Defines the event loops which handle the sockets and serial ports of many links with few threads.
+ * Each loop runs one thread waiting for the file descriptors registered with it, all descriptors of an link are registered
+ * with the same loop, so that its handlers never run concurrently. The event loops are currently only supported on linux.
+ */
+
+#ifndef SOEEVENTLOOP_HPP_
+#define SOEEVENTLOOP_HPP_
+
+#include <serial_thread.hpp>
+#include <functional>
+
+namespace SerialOverEthernet {
+
+#define SOE_EVENT_LOOPS 1					// default number of event loop threads
+#define SOE_EVENT_READ 0x1					// the descriptor has data to read
+#define SOE_EVENT_WRITE 0x2					// the descriptor has space to write
+#define SOE_EVENT_ERROR 0x4					// the descriptor was closed or failed, reported while the descriptor is registered
+#define SOE_EVENT_TRIGGER 0x8				// the handler was requested to run by trigger()
+#define SOE_EVENT_BATCH 64					// max number of events handled per wakeup of an loop
+
+/**
+ * An thread dispatching the readiness of file descriptors to their handlers.
+ */
+class SOEEventLoop {
+
+public:
+	virtual ~SOEEventLoop() {};
+
+	/**
+	 * Registers an file descriptor, its handler is called from the loop thread when one of the events occurs.
+	 * @param fd The file descriptor, it has to stay open until it was unwatched
+	 * @param events The SOE_EVENT_READ and SOE_EVENT_WRITE flags to wait for, zero to only register the handler
+	 * @param handler The handler, called with the flags of the events which occurred
+	 * @return The id of the event source, or zero if the descriptor could not be registered
+	 */
+	virtual unsigned long watch(int fd, unsigned int events, std::function<void(unsigned int)> handler) = 0;
+
+	/**
+	 * Changes the events waited for, the descriptor is not waited on at all while no events are requested.
+	 * Has no effect if the source was unwatched already.
+	 * @param source The id of the event source
+	 * @param events The SOE_EVENT_READ and SOE_EVENT_WRITE flags to wait for
+	 * @return false if the source does not exist or the descriptor could not be registered
+	 */
+	virtual bool modify(unsigned long source, unsigned int events) = 0;
+
+	/**
+	 * Removes the event source, its handler is not called anymore after an currently running call returned.
+	 * @param source The id of the event source
+	 */
+	virtual void unwatch(unsigned long source) = 0;
+
+	/**
+	 * Requests an call of the handler with SOE_EVENT_TRIGGER from the loop thread, independent of the descriptor.
+	 * @param source The id of the event source
+	 */
+	virtual void trigger(unsigned long source) = 0;
+
+	/**
+	 * Waits until the handler currently running on the loop thread returned, returns immediately if called from the loop thread.
+	 * After sources were unwatched, this guarantees that none of their handlers is still running.
+	 */
+	virtual void sync() = 0;
+
+	/**
+	 * Returns the number of event sources registered, used to distribute the links.
+	 * @return The number of event sources
+	 */
+	virtual unsigned int getSourceCount() = 0;
+
+	/**
+	 * Reads the CPU time the loop thread consumed so far, for monitoring.
+	 * @param cpuTime Where to store the CPU time in microseconds
+	 * @return true if the time was read, false otherwise
+	 */
+	virtual bool getCpuTime(unsigned long long* cpuTime) = 0;
+
+};
+
+/**
+ * Starts the event loop threads, which handle the links created afterwards.
+ * If more than one loop is started with an CPU mask, each loop is pinned to one CPU of the mask in turn.
+ * @param count The number of loop threads
+ * @param config The scheduling configuration applied to the loop threads
+ * @return true if the loops were started, false if they are not supported on this platform or could not be created
+ */
+bool startEventLoops(unsigned int count, const SerialAccess::SerialThreadConfig& config);
+
+/**
+ * Stops the event loop threads, the handlers still registered are not called anymore.
+ */
+void stopEventLoops();
+
+/**
+ * Returns the event loop with the fewest event sources, for an new link.
+ * @return The event loop, or nullptr if no loops were started
+ */
+SOEEventLoop* nextEventLoop();
+
+/**
+ * Returns the number of event loops started.
+ * @return The number of event loops
+ */
+unsigned int getEventLoopCount();
+
+/**
+ * Returns the event loop with the supplied index, used to pin an link to an specific loop.
+ * @param index The index of the loop, less than getEventLoopCount()
+ * @return The event loop, or nullptr if the index is out of range
+ */
+SOEEventLoop* getEventLoop(unsigned int index);
+
+}
+
+#endif /* SOEEVENTLOOP_HPP_ */
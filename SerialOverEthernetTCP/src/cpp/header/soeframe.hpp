@@ -0,0 +1,62 @@
+/*
+ * soeframe.hpp
+ *
+ * Defines the framing of the packages on the network connection.
+ * Protocol v1 prefixes each package with the identifier and an three byte length, protocol v2 packs multiple
+ * length prefixed records into one varint length prefixed frame.
+ */
+
+#ifndef SOEFRAME_HPP_
+#define SOEFRAME_HPP_
+
+namespace SerialOverEthernet {
+
+#define SOE_TCP_FRAME_MAX_LEN 512												// max package length
+#define SOE_TCP_FRAME_LEN_BYTES 3												// length of package length field
+#define SOE_TCP_PROTO_IDENT_LEN 4												// length of package identifier
+#define SOE_TCP_PROTO_IDENT 0x534F4950U											// package identifier
+#define SOE_TCP_HEADER_LEN (SOE_TCP_PROTO_IDENT_LEN + SOE_TCP_FRAME_LEN_BYTES)	// length of the package header
+#define SOE_TCP_VARINT_MAX_LEN 3												// max length of an v2 frame or record length field
+#define SOE_TCP_FRAME_LIMIT 65536												// max v2 frame payload length which can be negotiated
+
+/**
+ * Parses the v1 frame at the beginning of the buffer, only the bytes already received are inspected.
+ * @param buffer The received bytes
+ * @param bufferLen The number of received bytes
+ * @param headerLen Where to store the length of the frame header
+ * @param payloadLen Where to store the length of the package following the header
+ * @return 1 if the frame is complete, 0 if more data is required and -1 if the frame is malformed
+ */
+int parseFrameV1(const char* buffer, unsigned int bufferLen, unsigned int* headerLen, unsigned int* payloadLen);
+
+/**
+ * Parses the v2 frame at the beginning of the buffer, only the bytes already received are inspected.
+ * @param buffer The received bytes
+ * @param bufferLen The number of received bytes
+ * @param maxPayloadLen The negotiated max frame payload length, longer frames are malformed
+ * @param headerLen Where to store the length of the frame length field
+ * @param payloadLen Where to store the length of the records following the length field
+ * @return 1 if the frame is complete, 0 if more data is required and -1 if the frame is malformed
+ */
+int parseFrameV2(const char* buffer, unsigned int bufferLen, unsigned int maxPayloadLen, unsigned int* headerLen, unsigned int* payloadLen);
+
+/**
+ * Reads an little endian base 128 varint from the buffer.
+ * @param buffer The buffer to read from
+ * @param bufferLen The number of bytes available
+ * @param value Where to store the value
+ * @return The number of bytes used, or zero if incomplete or longer than SOE_TCP_VARINT_MAX_LEN
+ */
+unsigned int readVarint(const char* buffer, unsigned int bufferLen, unsigned int* value);
+
+/**
+ * Writes the value as little endian base 128 varint right aligned before end.
+ * @param end The position after the last byte to write
+ * @param value The value to write
+ * @return The number of bytes used
+ */
+unsigned int writeVarintBefore(char* end, unsigned int value);
+
+}
+
+#endif /* SOEFRAME_HPP_ */
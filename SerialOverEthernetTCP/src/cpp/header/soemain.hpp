@@ -15,6 +15,26 @@
 #include <serial_port.hpp>
 #include <netsocket.hpp>
 #include <soeconnection.hpp>
+#include <functional>
+
+#define SOE_LINK_PARALLELISM 8				// default max number of links established at the same time
+#define SOE_LINK_RELOAD_INTERVAL 2000		// time in ms between checks of the link configuration file for changes
+#define SOE_LINK_RETRY_INTERVAL 30000		// time in ms after which an link of the configuration file which failed or was closed is established again
+#define SOE_REAPER_RETRY_INTERVAL 100		// time in ms after which the reaper retries to delete an connection which could still be used by an link setup
+
+/**
+ * The options of an link between an local and an remote serial port.
+ */
+struct SOELinkConfig {
+	std::string remoteHost;
+	std::string remotePort;
+	std::string remoteSerial;
+	std::string localSerial;
+	SerialAccess::SerialPortConfiguration remoteConfig;
+	SerialAccess::SerialPortConfiguration localConfig;
+	bool compression;
+	bool udp;
+};
 
 /**
  * Starts the main process, initializes server and client connections.
@@ -25,6 +45,36 @@
  */
 int runMain(std::string& serverHostName, std::string& serverHostPort, std::vector<std::string>& linkArgs);
 
+/**
+ * Configures the periodic round trip time probes of all connections, has to be called before runMain().
+ * @param pingInterval The interval in ms between probes, zero disables probing
+ * @param statsInterval The interval in seconds between log entries of the latency statistics, zero disables the log entries
+ */
+void configureLatencyMonitor(unsigned int pingInterval, unsigned int statsInterval);
+
+/**
+ * Configures the event loops handling the links, has to be called before runMain().
+ * On platforms without event loop support the links always use their own threads.
+ * @param count The number of event loop threads, zero to handle each link with its own RX and TX threads
+ * @param config The scheduling configuration applied to the event loop threads
+ */
+void configureEventLoops(unsigned int count, const SerialAccess::SerialThreadConfig& config);
+
+/**
+ * Configures the metrics endpoint, has to be called before runMain().
+ * @param address An TCP address as host:port, or the path of an unix socket starting with /, empty to disable the endpoint
+ */
+void configureMetrics(const std::string& address);
+
+/**
+ * Configures the link configuration file and how many links are established at the same time, has to be called before runMain().
+ * The file contains one link per line, with the same link options as on the command line, lines starting with # are ignored.
+ * It is checked for changes while the process runs, only the links which were added or removed are established or closed.
+ * @param path The path of the link configuration file, empty to only establish the links of the command line
+ * @param parallelism The max number of links established at the same time
+ */
+void configureLinks(const std::string& path, unsigned int parallelism);
+
 /**
  * Interprets start argument flags for connections to create.
  * @param args The command line arguments
@@ -32,29 +82,34 @@ int runMain(std::string& serverHostName, std::string& serverHostPort, std::vecto
 void interpretFlags(const std::vector<std::string>& args);
 
 /**
- * Creates a new connection handler for the supplied client socket.
- * The newly created manager handles deletion of the dynamically allocated socket.
- * @param unmanagedSocket The dynamically created client socket, must be connected already
- * @param socketHostName The remote host name, used for log entries related to this connection
- * @param socketHostPort The remote host port, used for log entries related to this connection
- * @return An pointer to the newly created connection handler, or an nullptr if the creation failed
+ * Parses the link options of the command line or of an line of the link configuration file, each link starts with -link.
+ * Options not repeated for an link keep the value they had for the previous link.
+ * @param args The link options
+ * @param links The list to append the parsed links to
+ * @return false if an link had not enough or invalid options and was skipped, true otherwise
  */
-SerialOverEthernet::SOELinkHandler* createConnectionHandler(NetSocket::Socket* unmanagedSocket, std::string socketHostName, std::string socketHostPort);
+bool parseLinkFlags(const std::vector<std::string>& args, std::vector<SOELinkConfig>& links);
+
 /**
- * Check all currently available connection handler for closed connections, and properly shutdown and delte them.
+ * Establishes the links, with at most the configured number of links at the same time.
+ * Links to the same remote are established one after another, so that they can share one connection.
+ * @param links The links to establish
+ * @param established Called for each link with the connection and channel carrying it, or nullptr and -1 if it failed.
+ * The connection is not deleted before the callback returned, even if it is closed meanwhile.
+ * @return The number of links established successfully
  */
-void cleanupDeadConnectionHandlers();
+unsigned int establishLinks(std::vector<SOELinkConfig>& links, std::function<void(size_t index, SerialOverEthernet::SOELinkHandler* handler, int channel)> established = nullptr);
+
 /**
- * Attempts to establish an connection to the specified host and configures the remote ports with the supplied configurations.
- * @param remoteHost The remote server host address to connect to
- * @param remotePort The remote server host port to connect to
- * @param remoteSerial The remote server serial port path
- * @param localSerial The local serial port path
- * @param remoteConfig The remote server serial configuration
- * @param localConfig The local serial configuration
- * @return true if the connection was established successfully, false otherwise
+ * Creates a new connection handler for the supplied client transport.
+ * The newly created manager handles deletion of the dynamically allocated transport.
+ * The handler is deleted by the reaper thread as soon as its connection was closed.
+ * @param unmanagedTransport The dynamically created client transport, must be connected already
+ * @param socketHostName The remote host name, used for log entries related to this connection
+ * @param socketHostPort The remote host port, used for log entries related to this connection
+ * @return An pointer to the newly created connection handler, or an nullptr if the creation failed
  */
-bool linkRemotePort(std::string& remoteHost, std::string& remotePort, std::string& remoteSerial, std::string& localSerial, SerialAccess::SerialPortConfiguration& remoteConfig, SerialAccess::SerialPortConfiguration& localConfig);
+SerialOverEthernet::SOELinkHandler* createConnectionHandler(SerialOverEthernet::SOETransport* unmanagedTransport, std::string socketHostName, std::string socketHostPort);
 
 /**
  * Main entry point of the process, with C++ compatible data types.
@@ -0,0 +1,101 @@
+/*
+ * soemetrics.hpp
+ *
+ * Defines the metrics endpoint, which serves the counters of the process and its links in the Prometheus text format.
+ * The endpoint answers HTTP requests on an TCP port or an unix socket, it is currently only supported on linux.
+ */
+
+#ifndef SOEMETRICS_HPP_
+#define SOEMETRICS_HPP_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+
+namespace SerialOverEthernet {
+
+#define SOE_METRICS_REQUEST_LEN 8192		// max length of an HTTP request header accepted by the metrics endpoint
+#define SOE_METRICS_TIMEOUT 1000			// time in ms an client of the metrics endpoint has to send its request and receive the response
+
+/**
+ * Collects metric samples and formats them in the Prometheus text format.
+ * The samples of each metric are grouped under its help and type lines, in the order the metrics were first added.
+ */
+class SOEMetricsWriter {
+
+public:
+	/**
+	 * Adds an sample of an metric.
+	 * @param name The name of the metric
+	 * @param type The type of the metric, counter or gauge
+	 * @param help The description of the metric, only used when the metric is added first
+	 * @param labels The labels of the sample, formatted by label() and separated by commas, or empty
+	 * @param value The value of the sample
+	 */
+	void add(const char* name, const char* type, const char* help, const std::string& labels, unsigned long long value);
+
+	/**
+	 * Adds an sample of an metric with an fractional value, such as seconds.
+	 * @param name The name of the metric
+	 * @param type The type of the metric, counter or gauge
+	 * @param help The description of the metric, only used when the metric is added first
+	 * @param labels The labels of the sample, formatted by label() and separated by commas, or empty
+	 * @param value The value of the sample
+	 */
+	void add(const char* name, const char* type, const char* help, const std::string& labels, double value);
+
+	/**
+	 * Formats all samples added so far.
+	 * @return The metrics in the Prometheus text format
+	 */
+	std::string format();
+
+	/**
+	 * Formats an label of an sample, escaping the value.
+	 * @param name The name of the label
+	 * @param value The value of the label
+	 * @return The label as name="value"
+	 */
+	static std::string label(const char* name, const std::string& value);
+
+private:
+	struct Metric {
+		const char* type;
+		const char* help;
+		std::string samples;									// the formatted sample lines
+	};
+
+	void addSample(const char* name, const char* type, const char* help, const std::string& labels, const char* value);
+
+	std::vector<std::string> order;								// the metric names in the order they were added first
+	std::map<std::string, Metric> metrics;						// the metrics by name
+
+};
+
+/**
+ * An HTTP endpoint serving metrics from its own thread.
+ */
+class SOEMetricsServer {
+
+public:
+	virtual ~SOEMetricsServer() {};
+
+	/**
+	 * Stops serving the metrics and waits for the thread to terminate, an unix socket is removed.
+	 */
+	virtual void close() = 0;
+
+};
+
+/**
+ * Starts serving metrics on the address, requests to / and /metrics are answered with the collected metrics.
+ * @param address An TCP address as host:port, or the path of an unix socket starting with /
+ * @param collect Called from the server thread for each request, returns the metrics in the Prometheus text format
+ * @return The server, or nullptr if the address could not be bound or this is not supported on this platform
+ */
+SOEMetricsServer* newMetricsServer(const std::string& address, std::function<std::string()> collect);
+
+}
+
+#endif /* SOEMETRICS_HPP_ */
@@ -0,0 +1,201 @@
+/*
+ * soetransport.hpp
+ *
+ * Defines the byte stream transports an link can run on.
+ * The TCP transport wraps an connected network socket, on linux the sockets accepted by an TCP listener are used directly,
+ * so that their reception can be handled by an event loop, the UDP transport implements an reliable ordered stream ontop of datagrams
+ * with selective acknowledgment, fast retransmission and paced transmission, so that an lost datagram only delays the stream
+ * for about one round trip instead of an TCP retransmission timeout.
+ */
+
+#ifndef SOETRANSPORT_HPP_
+#define SOETRANSPORT_HPP_
+
+#include <netsocket.hpp>
+#include <memory>
+#include <string>
+
+namespace SerialOverEthernet {
+
+#define SOE_UDP_SEGMENT_LEN 1200			// max payload of an UDP datagram, small enough to not get fragmented
+#define SOE_UDP_WINDOW 256					// max number of segments in flight and buffered out of order
+#define SOE_UDP_SACK_BITS 32				// number of segments after the cumulative acknowledgment covered by the selective acknowledgment
+#define SOE_UDP_DUP_THRESHOLD 3				// number of later segments acknowledged before an missing segment is retransmitted
+#define SOE_UDP_MIN_RTO 20					// min retransmission timeout in ms
+#define SOE_UDP_MAX_RTO 1000				// max retransmission timeout in ms
+#define SOE_UDP_MAX_RETRIES 30				// number of retransmissions of an single segment until the connection is considered lost
+#define SOE_UDP_KEEPALIVE 1000				// interval in ms of acknowledgments send while idle
+#define SOE_UDP_IDLE_TIMEOUT 10000			// time in ms without any datagram from the remote until the connection is considered lost
+#define SOE_UDP_DEFAULT_RATE 12500000		// default pacing rate in bytes per second
+#define SOE_UDP_PACING_BURST 8				// number of segments which can be send back to back
+
+/**
+ * An reliable, ordered byte stream connection to the remote.
+ */
+class SOETransport {
+
+public:
+	virtual ~SOETransport() {};
+
+	/**
+	 * Transmits all bytes of the buffer, blocks until they were accepted.
+	 * @param buffer The data to transmit
+	 * @param length The number of bytes to transmit
+	 * @return true if the data was accepted, false if the connection failed
+	 */
+	virtual bool send(const char* buffer, unsigned int length) = 0;
+
+	/**
+	 * Transmits as many bytes of the buffer as the transport accepts without blocking.
+	 * Transports which can not transmit without blocking accept all bytes, like send().
+	 * @param buffer The data to transmit
+	 * @param length The number of bytes to transmit
+	 * @param sent The number of bytes accepted, less than the length if the transport would block
+	 * @return true if the connection is still open, false if it failed
+	 */
+	virtual bool trySend(const char* buffer, unsigned int length, unsigned int* sent) {
+		*sent = send(buffer, length) ? length : 0;
+		return *sent == length;
+	}
+
+	/**
+	 * Receives the bytes available, blocks until at least one byte is available.
+	 * @param buffer The buffer to write the data to
+	 * @param length The capacity of the buffer
+	 * @param received The number of bytes received
+	 * @return true if data was received, false if the connection was closed or failed
+	 */
+	virtual bool receive(char* buffer, unsigned int length, unsigned int* received) = 0;
+
+	/**
+	 * Closes the connection, unblocking all pending send and receive calls.
+	 */
+	virtual void close() = 0;
+
+	/**
+	 * Returns true if the connection is still open.
+	 * @return true if open, false otherwise
+	 */
+	virtual bool isOpen() = 0;
+
+	/**
+	 * Returns the error code of the last failed operation.
+	 * @return The error code, zero if the connection was closed by the remote
+	 */
+	virtual int lastError() = 0;
+
+	/**
+	 * Returns the name of the transport for log entries.
+	 * @return The name of the transport
+	 */
+	virtual const char* getName() = 0;
+
+	/**
+	 * Returns the file descriptor an event loop can wait on for received data.
+	 * After it reported data, the next receive call does not block.
+	 * @return The file descriptor, or -1 if the transport can only be used with blocking receive calls
+	 */
+	virtual int getHandle() = 0;
+
+};
+
+/**
+ * Accepts UDP transport connections on an local address.
+ */
+class SOEUdpListener {
+
+public:
+	virtual ~SOEUdpListener() {};
+
+	/**
+	 * Waits for the next incoming connection.
+	 * @param hostName Set to the numeric address of the remote
+	 * @param hostPort Set to the port of the remote
+	 * @return The new transport, or nullptr if the listener was closed
+	 */
+	virtual SOETransport* accept(std::string& hostName, std::string& hostPort) = 0;
+
+	/**
+	 * Closes the listener, unblocking pending accept calls, established connections remain open.
+	 */
+	virtual void close() = 0;
+
+};
+
+/**
+ * Accepts TCP transport connections on an local address, without blocking so that it can be driven by an event loop.
+ */
+class SOETcpListener {
+
+public:
+	virtual ~SOETcpListener() {};
+
+	/**
+	 * Accepts the next pending connection, returns immediately if none is pending.
+	 * @param hostName Set to the numeric address of the remote
+	 * @param hostPort Set to the port of the remote
+	 * @return The new transport, or nullptr if no connection was pending or the listener failed
+	 */
+	virtual SOETransport* accept(std::string& hostName, std::string& hostPort) = 0;
+
+	/**
+	 * Returns the file descriptor an event loop can wait on for pending connections.
+	 * @return The file descriptor of the listen socket
+	 */
+	virtual int getHandle() = 0;
+
+	/**
+	 * Returns true if the listener still accepts connections.
+	 * @return true if open, false if it was closed or failed
+	 */
+	virtual bool isOpen() = 0;
+
+	/**
+	 * Closes the listener, established connections remain open.
+	 */
+	virtual void close() = 0;
+
+};
+
+/**
+ * Creates an transport for an connected TCP socket, the transport takes ownership of the socket.
+ * @param socket The connected socket
+ * @return The transport
+ */
+SOETransport* newTcpTransport(NetSocket::Socket* socket);
+
+/**
+ * Creates an listener for TCP transport connections, which can be waited on with an event loop.
+ * Shared listeners bind with SO_REUSEPORT, the kernel then distributes the incoming connections between all listeners on the address.
+ * @param hostName The local address to bind to
+ * @param hostPort The local port to bind to
+ * @param shared If further listeners may bind to the same address
+ * @return The listener, or nullptr if the address could not be bound or this is not supported on this platform
+ */
+SOETcpListener* newTcpListener(const std::string& hostName, const std::string& hostPort, bool shared);
+
+/**
+ * Establishes an UDP transport connection to the remote.
+ * @param hostName The remote host name or address
+ * @param hostPort The remote port
+ * @return The transport, or nullptr if the connection failed or UDP is not supported on this platform
+ */
+SOETransport* newUdpTransport(const std::string& hostName, const std::string& hostPort);
+
+/**
+ * Creates an listener for UDP transport connections.
+ * @param hostName The local address to bind to
+ * @param hostPort The local port to bind to
+ * @return The listener, or nullptr if the address could not be bound or UDP is not supported on this platform
+ */
+SOEUdpListener* newUdpListener(const std::string& hostName, const std::string& hostPort);
+
+/**
+ * Sets the pacing rate of all UDP transports created afterwards.
+ * @param bytesPerSecond The max transmission rate in bytes per second
+ */
+void setUdpPacingRate(unsigned long bytesPerSecond);
+
+}
+
+#endif /* SOETRANSPORT_HPP_ */
@@ -15,77 +15,111 @@
 #define STRINGIZE(x) #x
 #define ASSTRING(x) STRINGIZE(x)
 
+#include <algorithm>
+#include <errno.h>
+#include <stdlib.h>
 #include "soemain.hpp"
 #include "dbgprintf.h"
 
 void interpretFlags(const std::vector<std::string>& args) {
+	std::vector<SOELinkConfig> links;
+	parseLinkFlags(args, links);
+	if (!links.empty())
+		establishLinks(links);
+}
+
+// Parses an unsigned decimal option value without throwing, an invalid value is reported instead of terminating the process
+static bool parseNumber(const std::string& value, unsigned long max, unsigned long* number) {
+	if (value.empty() || value[0] < '0' || value[0] > '9') return false;
+	char* end;
+	errno = 0;
+	*number = strtoul(value.c_str(), &end, 10);
+	return errno == 0 && *end == '\0' && *number <= max;
+}
+
+bool parseLinkFlags(const std::vector<std::string>& args, std::vector<SOELinkConfig>& links) {
 
 	// parse arguments for connections
-	std::string remoteHost;
-	std::string remotePort = std::to_string(SOE_TCP_DEFAULT_SOE_PORT);
-	std::string remoteSerial;
-	std::string localSerial;
-	SerialAccess::SerialPortConfiguration remoteConfig = SerialAccess::DEFAULT_PORT_CONFIGURATION;
-	SerialAccess::SerialPortConfiguration localConfig = SerialAccess::DEFAULT_PORT_CONFIGURATION;
+	SOELinkConfig config;
+	config.remotePort = std::to_string(SOE_TCP_DEFAULT_SOE_PORT);
+	config.remoteConfig = SerialAccess::DEFAULT_PORT_CONFIGURATION;
+	config.localConfig = SerialAccess::DEFAULT_PORT_CONFIGURATION;
+	config.compression = false;
+	config.udp = false;
 	bool link = false;
+	bool valid = true;
+	bool complete = true;
 
 	for (auto flag = args.begin(); flag != args.end(); flag++) {
 
 		// complete last link call before processing other options
 		if (*flag == "-link" || *flag == "-unlink") {
 			if (link) {
-				if (remoteHost.empty() || remotePort.empty() || remoteSerial.empty() || localSerial.empty()) {
+				link = false;
+				if (config.remoteHost.empty() || config.remotePort.empty() || config.remoteSerial.empty() || config.localSerial.empty()) {
 					printf("[!] not enough arguments for connection\n");
-					continue;
+					complete = false;
+				} else if (valid) {
+					links.push_back(config);
 				}
-				link = false;
-
-				linkRemotePort(remoteHost, remotePort, remoteSerial, localSerial, localConfig, remoteConfig);
 			}
+			valid = true;
 		}
 
 		if (flag + 1 != args.end()) {
 			// flags with argument
 			if (*flag == "-addr") {
-				remoteHost = *++flag;
+				config.remoteHost = *++flag;
 			} else if (*flag == "-port") {
-				remotePort = *++flag;
+				config.remotePort = *++flag;
 			} else if (*flag == "-rser") {
-				remoteSerial = *++flag;
+				config.remoteSerial = *++flag;
 			} else if (*flag == "-lser") {
-				localSerial = *++flag;
+				config.localSerial = *++flag;
 			} else {
 				bool applyLocal = flag->rfind("-r", 0) != 0;
 				bool applyRemote = flag->rfind("-l", 0) != 0;
-				SerialAccess::SerialPortConfiguration* config = applyRemote ? &remoteConfig : &localConfig;
+				SerialAccess::SerialPortConfiguration* portConfig = applyRemote ? &config.remoteConfig : &config.localConfig;
 
 				if (*flag == "-lbaud" || *flag == "-rbaud" || *flag == "-baud") {
-					config->baudRate = stoul(*++flag);
-					if (applyRemote && applyLocal) localConfig.baudRate = remoteConfig.baudRate;
+					unsigned long baud;
+					if (parseNumber(*++flag, 0xFFFFFFFFUL, &baud)) {
+						portConfig->baudRate = baud;
+					} else {
+						printf("[!] invalid baud: %s\n", flag->c_str());
+						valid = complete = false;
+					}
+					if (applyRemote && applyLocal) config.localConfig.baudRate = config.remoteConfig.baudRate;
 				} else if (*flag == "-lbits" || *flag == "-rbits" || *flag == "-bits") {
-					config->dataBits = stoul(*++flag);
-					if (applyRemote && applyLocal) localConfig.dataBits = remoteConfig.dataBits;
+					unsigned long bits;
+					if (parseNumber(*++flag, 0xFF, &bits)) {
+						portConfig->dataBits = (unsigned char) bits;
+					} else {
+						printf("[!] invalid data bits: %s\n", flag->c_str());
+						valid = complete = false;
+					}
+					if (applyRemote && applyLocal) config.localConfig.dataBits = config.remoteConfig.dataBits;
 				} else if (*flag == "-lstops" || *flag == "-rstops" || *flag == "-stops") {
 					flag++;
-					if (*flag == "one") config->stopBits = SerialAccess::SPC_STOPB_ONE;
-					if (*flag == "one-half") config->stopBits = SerialAccess::SPC_STOPB_ONE_HALF;
-					if (*flag == "two") config->stopBits = SerialAccess::SPC_STOPB_TWO;
-					if (applyRemote && applyLocal) localConfig.stopBits = remoteConfig.stopBits;
+					if (*flag == "one") portConfig->stopBits = SerialAccess::SPC_STOPB_ONE;
+					if (*flag == "one-half") portConfig->stopBits = SerialAccess::SPC_STOPB_ONE_HALF;
+					if (*flag == "two") portConfig->stopBits = SerialAccess::SPC_STOPB_TWO;
+					if (applyRemote && applyLocal) config.localConfig.stopBits = config.remoteConfig.stopBits;
 				} else if (*flag == "-lparity" || *flag == "-rparity" || *flag == "-parity") {
 					flag++;
-					if (*flag == "none") config->parity = SerialAccess::SPC_PARITY_NONE;
-					if (*flag == "even") config->parity = SerialAccess::SPC_PARITY_EVEN;
-					if (*flag == "odd") config->parity = SerialAccess::SPC_PARITY_ODD;
-					if (*flag == "mark") config->parity = SerialAccess::SPC_PARITY_MARK;
-					if (*flag == "space") config->parity = SerialAccess::SPC_PARITY_SPACE;
-					if (applyRemote && applyLocal) localConfig.parity = remoteConfig.parity;
+					if (*flag == "none") portConfig->parity = SerialAccess::SPC_PARITY_NONE;
+					if (*flag == "even") portConfig->parity = SerialAccess::SPC_PARITY_EVEN;
+					if (*flag == "odd") portConfig->parity = SerialAccess::SPC_PARITY_ODD;
+					if (*flag == "mark") portConfig->parity = SerialAccess::SPC_PARITY_MARK;
+					if (*flag == "space") portConfig->parity = SerialAccess::SPC_PARITY_SPACE;
+					if (applyRemote && applyLocal) config.localConfig.parity = config.remoteConfig.parity;
 				} else if (*flag == "-lflowctrl" || *flag == "-rflowctrl" || *flag == "-flowctrl") {
 					flag++;
-					if (*flag == "none") config->flowControl = SerialAccess::SPC_FLOW_NONE;
-					if (*flag == "xonxoff") config->flowControl = SerialAccess::SPC_FLOW_XON_XOFF;
-					if (*flag == "rtscts") config->flowControl = SerialAccess::SPC_FLOW_RTS_CTS;
-					if (*flag == "dsrdtr") config->flowControl = SerialAccess::SPC_FLOW_DSR_DTR;
-					if (applyRemote && applyLocal) localConfig.flowControl = remoteConfig.flowControl;
+					if (*flag == "none") portConfig->flowControl = SerialAccess::SPC_FLOW_NONE;
+					if (*flag == "xonxoff") portConfig->flowControl = SerialAccess::SPC_FLOW_XON_XOFF;
+					if (*flag == "rtscts") portConfig->flowControl = SerialAccess::SPC_FLOW_RTS_CTS;
+					if (*flag == "dsrdtr") portConfig->flowControl = SerialAccess::SPC_FLOW_DSR_DTR;
+					if (applyRemote && applyLocal) config.localConfig.flowControl = config.remoteConfig.flowControl;
 				}
 
 			}
@@ -95,16 +129,23 @@ void interpretFlags(const std::vector<std::string>& args) {
 		if (*flag == "-link") {
 			link = true;
 		}
+		if (*flag == "-compress") {
+			config.compression = true;
+		}
+		if (*flag == "-udp") {
+			config.udp = true;
+		}
 	}
 
 	if (link) {
-		if (remoteHost.empty() || remotePort.empty() || remoteSerial.empty() || localSerial.empty()) {
+		if (config.remoteHost.empty() || config.remotePort.empty() || config.remoteSerial.empty() || config.localSerial.empty()) {
 			printf("[!] not enough arguments for connection\n");
-			return;
+			return false;
 		}
-
-		linkRemotePort(remoteHost, remotePort, remoteSerial, localSerial, remoteConfig, localConfig);
+		if (valid)
+			links.push_back(config);
 	}
+	return complete;
 }
 
 int mainCPP(std::string& exec, std::vector<std::string>& args) {
@@ -120,6 +161,19 @@ int mainCPP(std::string& exec, std::vector<std::string>& args) {
 		printf("options:\n");
 		printf(" -addr [local IP]\n");
 		printf(" -port [local network port]\n");
+		printf(" -sched [thread scheduling] : normal|fifo|rr\n");
+		printf(" -prio [real time thread priority]\n");
+		printf(" -cpus [cpu list for RX/TX threads] : e.g. 0,2-3\n");
+		printf(" -mlock (lock process memory)\n");
+		printf(" -framelen [max frame length offered to links] : %u-%u bytes\n", SOE_TCP_FRAME_MAX_LEN, SOE_TCP_FRAME_LIMIT);
+		printf(" -udprate [UDP pacing rate] : kbyte/s\n");
+		printf(" -ping [round trip time probe interval] : ms, 0 to disable\n");
+		printf(" -stats [latency statistics log interval] : s, 0 to disable\n");
+		printf(" -resume [time to resume lost connections] : s, 0 to disable\n");
+		printf(" -metrics [metrics endpoint address] : host:port or /path of an unix socket, prometheus text format\n");
+		printf(" -eventloops [number of event loop threads, each accepting and handling its own share of the links] : 0 for RX/TX threads per link, linux only\n");
+		printf(" -links [link configuration file] : one line of link options per link, reloaded when changed\n");
+		printf(" -linkjobs [max number of links established at the same time] : default %u\n", SOE_LINK_PARALLELISM);
 		printf("link options:\n");
 		printf(" -addr [remote IP]\n");
 		printf(" -port [remote network port]\n");
@@ -129,6 +183,8 @@ int mainCPP(std::string& exec, std::vector<std::string>& args) {
 		printf(" -(l|r|)bits [data bits]\n");
 		printf(" -(l|r|)stops [stop bits] : one|one-half|two\n");
 		printf(" -(l|r|)parity [parity] : none|even|odd|mark|space\n");
+		printf(" -compress (compress serial data if supported by the remote)\n");
+		printf(" -udp (use the UDP transport, linux only)\n");
 		printf(" (l - local only | r - remote only | both)\n");
 		printf("serial over ethernet version: " ASSTRING(BUILD_VERSION) "\n");
 		return 1;
@@ -137,6 +193,15 @@ int mainCPP(std::string& exec, std::vector<std::string>& args) {
 	// default configuration
 	std::string serverHostPort = std::to_string(SOE_TCP_DEFAULT_SOE_PORT);
 	std::string serverHostName = ""; // empty means create no server
+	SerialAccess::SerialThreadConfig threadConfig = SerialAccess::DEFAULT_THREAD_CONFIGURATION;
+	bool lockMemory = false;
+	unsigned int frameLimit = SOE_TCP_FRAME_LIMIT;
+	unsigned int pingInterval = SOE_TCP_PING_INTERVAL;
+	unsigned int statsInterval = 0;
+	unsigned int eventLoops = SOE_EVENT_LOOPS;
+	std::string metricsAddress = ""; // empty means no metrics endpoint
+	std::string linkFile = ""; // empty means only the links of the command line
+	unsigned int linkParallelism = SOE_LINK_PARALLELISM;
 
 	// parse arguments for network connection
 	auto flag = args.begin();
@@ -147,9 +212,72 @@ int mainCPP(std::string& exec, std::vector<std::string>& args) {
 				serverHostName = *++flag;
 			} else if (*flag == "-port") {
 				serverHostPort = *++flag;
+			} else if (*flag == "-sched") {
+				flag++;
+				if (*flag == "normal") threadConfig.scheduling = SerialAccess::SPC_SCHED_NORMAL;
+				if (*flag == "fifo") threadConfig.scheduling = SerialAccess::SPC_SCHED_FIFO;
+				if (*flag == "rr") threadConfig.scheduling = SerialAccess::SPC_SCHED_RR;
+			} else if (*flag == "-prio") {
+				unsigned long priority;
+				if (parseNumber(*++flag, 99, &priority))
+					threadConfig.priority = (int) priority;
+				else
+					printf("[!] invalid thread priority: %s\n", flag->c_str());
+			} else if (*flag == "-cpus") {
+				if (!SerialAccess::parseCpuList(*++flag, &threadConfig.cpuMask))
+					printf("[!] invalid cpu list: %s\n", flag->c_str());
+			} else if (*flag == "-framelen") {
+				unsigned long length;
+				if (parseNumber(*++flag, SOE_TCP_FRAME_LIMIT, &length))
+					frameLimit = (unsigned int) length;
+				else
+					printf("[!] invalid frame length: %s\n", flag->c_str());
+			} else if (*flag == "-ping") {
+				unsigned long interval;
+				if (parseNumber(*++flag, 0xFFFFFFFFUL, &interval))
+					pingInterval = (unsigned int) interval;
+				else
+					printf("[!] invalid ping interval: %s\n", flag->c_str());
+			} else if (*flag == "-stats") {
+				unsigned long interval;
+				if (parseNumber(*++flag, 0xFFFFFFFFUL, &interval))
+					statsInterval = (unsigned int) interval;
+				else
+					printf("[!] invalid statistics interval: %s\n", flag->c_str());
+			} else if (*flag == "-resume") {
+				unsigned long timeout;
+				if (parseNumber(*++flag, 0xFFFFFFFFUL / 1000, &timeout))
+					SerialOverEthernet::SOELinkHandler::setSessionTimeout((unsigned int) timeout * 1000);
+				else
+					printf("[!] invalid resume time: %s\n", flag->c_str());
+			} else if (*flag == "-metrics") {
+				metricsAddress = *++flag;
+			} else if (*flag == "-eventloops") {
+				unsigned long count;
+				if (parseNumber(*++flag, 0xFFFFFFFFUL, &count))
+					eventLoops = (unsigned int) count;
+				else
+					printf("[!] invalid number of event loops: %s\n", flag->c_str());
+			} else if (*flag == "-links") {
+				linkFile = *++flag;
+			} else if (*flag == "-linkjobs") {
+				unsigned long count;
+				if (parseNumber(*++flag, 0xFFFFFFFFUL, &count))
+					linkParallelism = (unsigned int) std::max(1ul, count);
+				else
+					printf("[!] invalid number of link jobs: %s\n", flag->c_str());
+			} else if (*flag == "-udprate") {
+				unsigned long rate;
+				if (parseNumber(*++flag, 0xFFFFFFFFUL / 1000, &rate))
+					SerialOverEthernet::setUdpPacingRate(rate * 1000);
+				else
+					printf("[!] invalid UDP pacing rate: %s\n", flag->c_str());
 			}
 		}
 		// flags without arguments
+		if (*flag == "-mlock") {
+			lockMemory = true;
+		}
 		if (*flag == "-link") {
 			break; // end of server arguments
 		}
@@ -157,6 +285,17 @@ int mainCPP(std::string& exec, std::vector<std::string>& args) {
 	if (flag != args.begin())
 		args.erase(args.begin(), flag - 1);
 
+	// configure real time options
+	if (lockMemory && !(lockMemory = SerialAccess::lockProcessMemory()))
+		printf("[!] failed to lock process memory\n");
+	SerialOverEthernet::SOELinkHandler::setThreadConfig(threadConfig);
+	printf("[i] RX/TX thread configuration: %s%s\n", SerialAccess::formatThreadConfig(threadConfig).c_str(), lockMemory ? ", memory locked" : "");
+	SerialOverEthernet::SOELinkHandler::setFrameLimit(frameLimit);
+	configureLatencyMonitor(pingInterval, statsInterval);
+	configureEventLoops(eventLoops, threadConfig);
+	configureMetrics(metricsAddress);
+	configureLinks(linkFile, linkParallelism);
+
 	return runMain(serverHostName, serverHostPort, args);
 }
 
@@ -0,0 +1,187 @@
+/*
+ * soecompression.cpp
+ *
+ * Implements the stream compression of serial data packages.
+ * Each package is encoded as an sequence of tokens: the high nibble holds the literal length, the low nibble the match length - 4,
+ * followed by the literals and the two byte little endian match distance. Lengths of 15 or more continue in the following bytes,
+ * summed until an byte less than 255. The last token of an package only holds literals and has no match distance.
+ */
+
+#include <string.h>
+#include "soecompression.hpp"
+
+#define SOE_COMPRESS_MIN_MATCH 4
+#define SOE_COMPRESS_MAX_DISTANCE 65535
+
+static inline unsigned int hashSequence(const char* data) {
+	unsigned int sequence;
+	memcpy(&sequence, data, 4);
+	return (sequence * 2654435761U) >> (32 - SOE_COMPRESS_HASH_BITS);
+}
+
+static inline bool writeLength(char*& output, const char* outputEnd, unsigned int length) {
+	while (length >= 255) {
+		if (output == outputEnd) return false;
+		*output++ = (char) 255;
+		length -= 255;
+	}
+	if (output == outputEnd) return false;
+	*output++ = (char) length;
+	return true;
+}
+
+static inline bool readLength(const char*& data, const char* dataEnd, unsigned int* length) {
+	unsigned char value;
+	do {
+		if (data == dataEnd) return false;
+		value = (unsigned char) *data++;
+		*length += value;
+	} while (value == 255 && *length <= SOE_COMPRESS_MAX_LEN);
+	return true;
+}
+
+// Writes one token with its literals, and the match if the match length is not zero
+static bool writeSequence(char*& output, const char* outputEnd, const char* literals, unsigned int literalLen, unsigned int distance, unsigned int matchLen) {
+	if (output == outputEnd) return false;
+	unsigned int matchCode = matchLen ? matchLen - SOE_COMPRESS_MIN_MATCH : 0;
+	*output++ = (char) ((literalLen < 15 ? literalLen : 15) << 4 | (matchCode < 15 ? matchCode : 15));
+	if (literalLen >= 15 && !writeLength(output, outputEnd, literalLen - 15)) return false;
+	if ((unsigned int) (outputEnd - output) < literalLen) return false;
+	memcpy(output, literals, literalLen);
+	output += literalLen;
+	if (!matchLen) return true;
+	if (outputEnd - output < 2) return false;
+	*output++ = (char) (distance & 0xFF);
+	*output++ = (char) (distance >> 8);
+	if (matchCode >= 15 && !writeLength(output, outputEnd, matchCode - 15)) return false;
+	return true;
+}
+
+// Drops the oldest history, keeping the window, so that the next package fits
+static void slideHistory(std::vector<char>& history, unsigned int* historyLen, std::vector<int>* hashTable) {
+	unsigned int keep = *historyLen < SOE_COMPRESS_WINDOW ? *historyLen : SOE_COMPRESS_WINDOW;
+	unsigned int shift = *historyLen - keep;
+	memmove(history.data(), history.data() + shift, keep);
+	*historyLen = keep;
+	if (hashTable)
+		for (int& position : *hashTable)
+			position = position >= (int) shift ? position - (int) shift : -1;
+}
+
+SerialOverEthernet::SOECompressor::SOECompressor() {
+	this->history.resize(SOE_COMPRESS_WINDOW + SOE_COMPRESS_MAX_LEN);
+	this->historyLen = 0;
+	this->hashTable.resize(1 << SOE_COMPRESS_HASH_BITS, -1);
+	this->misses = 0;
+	this->backoff = 0;
+}
+
+bool SerialOverEthernet::SOECompressor::shouldAttempt(unsigned int length) {
+	if (length < SOE_COMPRESS_MIN_LEN || length > SOE_COMPRESS_MAX_LEN) return false;
+	if (this->backoff > 0) {
+		this->backoff--;
+		return false;
+	}
+	return true;
+}
+
+unsigned int SerialOverEthernet::SOECompressor::compress(const char* data, unsigned int length, char* output, unsigned int outputCapacity) {
+
+	if (length > SOE_COMPRESS_MAX_LEN) return 0;
+	if (this->historyLen + length > this->history.size())
+		slideHistory(this->history, &this->historyLen, &this->hashTable);
+
+	// the package is appended to the history, so that matches within the package and across packages are found the same way
+	char* window = this->history.data();
+	unsigned int start = this->historyLen;
+	unsigned int end = start + length;
+	memcpy(window + start, data, length);
+
+	char* outputPos = output;
+	const char* outputEnd = output + outputCapacity;
+	unsigned int anchor = start;
+	unsigned int position = start;
+	bool fits = true;
+	while (position + SOE_COMPRESS_MIN_MATCH <= end && fits) {
+		unsigned int hash = hashSequence(window + position);
+		int candidate = this->hashTable[hash];
+		this->hashTable[hash] = (int) position;
+
+		// entries can point beyond the current position after an package was discarded, the content is always verified
+		if (candidate < 0 || (unsigned int) candidate >= position || position - candidate > SOE_COMPRESS_MAX_DISTANCE ||
+				memcmp(window + candidate, window + position, SOE_COMPRESS_MIN_MATCH) != 0) {
+			position++;
+			continue;
+		}
+
+		unsigned int matchLen = SOE_COMPRESS_MIN_MATCH;
+		while (position + matchLen < end && window[candidate + matchLen] == window[position + matchLen])
+			matchLen++;
+
+		fits = writeSequence(outputPos, outputEnd, window + anchor, position - anchor, position - candidate, matchLen);
+		position += matchLen;
+		anchor = position;
+	}
+	fits = fits && writeSequence(outputPos, outputEnd, window + anchor, end - anchor, 0, 0);
+
+	// only packages benefiting from compression are send compressed and become part of the history
+	unsigned int outputLen = (unsigned int) (outputPos - output);
+	if (!fits || outputLen >= length) {
+		if (++this->misses >= SOE_COMPRESS_MISS_LIMIT) {
+			this->misses = 0;
+			this->backoff = SOE_COMPRESS_BACKOFF;
+		}
+		return 0;
+	}
+	this->misses = 0;
+	this->historyLen = end;
+	return outputLen;
+}
+
+SerialOverEthernet::SOEDecompressor::SOEDecompressor() {
+	this->history.resize(SOE_COMPRESS_WINDOW + SOE_COMPRESS_MAX_LEN);
+	this->historyLen = 0;
+}
+
+int SerialOverEthernet::SOEDecompressor::decompress(const char* data, unsigned int length, const char** output) {
+
+	if (this->historyLen + SOE_COMPRESS_MAX_LEN > this->history.size())
+		slideHistory(this->history, &this->historyLen, nullptr);
+
+	char* window = this->history.data();
+	unsigned int start = this->historyLen;
+	unsigned int limit = start + SOE_COMPRESS_MAX_LEN;
+	unsigned int position = start;
+	const char* dataEnd = data + length;
+	while (data < dataEnd) {
+		unsigned char token = (unsigned char) *data++;
+
+		unsigned int literalLen = token >> 4;
+		if (literalLen == 15 && !readLength(data, dataEnd, &literalLen)) return -1;
+		if (literalLen > (unsigned int) (dataEnd - data) || literalLen > limit - position) return -1;
+		memcpy(window + position, data, literalLen);
+		data += literalLen;
+		position += literalLen;
+
+		// the last token has no match
+		if (data == dataEnd) break;
+
+		if (dataEnd - data < 2) return -1;
+		unsigned int distance = (unsigned char) data[0] | (unsigned char) data[1] << 8;
+		data += 2;
+		unsigned int matchLen = token & 0xF;
+		if (matchLen == 15 && !readLength(data, dataEnd, &matchLen)) return -1;
+		matchLen += SOE_COMPRESS_MIN_MATCH;
+		if (distance == 0 || distance > position || matchLen > limit - position) return -1;
+
+		// the match can overlap with its own output, so it has to be copied byte by byte
+		const char* match = window + position - distance;
+		for (unsigned int i = 0; i < matchLen; i++)
+			window[position + i] = match[i];
+		position += matchLen;
+	}
+
+	*output = window + start;
+	this->historyLen = position;
+	return (int) (position - start);
+}
@@ -0,0 +1,326 @@
+/*
+ * soeeventloop.cpp
+ *
+ * Implements the event loops using epoll.
+ * The event loops are currently only supported on linux, on other platforms the links use their own threads.
+ */
+
+#include <stdio.h>
+#include "soeeventloop.hpp"
+#include "dbgprintf.h"
+
+#ifdef PLATFORM_LIN
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <map>
+#include <vector>
+
+#define SOE_EVENT_WAKEUP 0					// source id of the eventfd waking the loop for triggers and termination
+
+namespace SerialOverEthernet {
+
+static inline unsigned int toEpollEvents(unsigned int events) {
+	return (events & SOE_EVENT_READ ? (unsigned int) EPOLLIN : 0) | (events & SOE_EVENT_WRITE ? (unsigned int) EPOLLOUT : 0);
+}
+
+static inline unsigned int fromEpollEvents(unsigned int events) {
+	return (events & EPOLLIN ? SOE_EVENT_READ : 0) | (events & EPOLLOUT ? SOE_EVENT_WRITE : 0) | (events & (EPOLLERR | EPOLLHUP) ? SOE_EVENT_ERROR : 0);
+}
+
+class SOEEventLoopLin : public SOEEventLoop {
+
+public:
+	SOEEventLoopLin(int epoll, int wakeup) {
+		this->epoll = epoll;
+		this->wakeup = wakeup;
+		this->nextSource = SOE_EVENT_WAKEUP + 1;
+		this->dispatching = false;
+		this->iteration = 0;
+		this->stopping = false;
+	}
+
+	~SOEEventLoopLin() {
+		stop();
+		::close(this->wakeup);
+		::close(this->epoll);
+	}
+
+	bool start(const SerialAccess::SerialThreadConfig& config) {
+		epoll_event event = {};
+		event.events = EPOLLIN;
+		event.data.u64 = SOE_EVENT_WAKEUP;
+		if (::epoll_ctl(this->epoll, EPOLL_CTL_ADD, this->wakeup, &event) != 0)
+			return false;
+		this->thread = std::thread([this, config]() { run(config); });
+		return true;
+	}
+
+	void stop() {
+		std::unique_lock<std::mutex> lock(this->m_sources);
+		this->stopping = true;
+		lock.unlock();
+		wake();
+		if (this->thread.joinable())
+			this->thread.join();
+		this->cv_dispatch.notify_all();
+	}
+
+	unsigned long watch(int fd, unsigned int events, std::function<void(unsigned int)> handler) override {
+		std::shared_ptr<EventSource> source = std::make_shared<EventSource>();
+		source->fd = fd;
+		source->events = 0;
+		source->registered = false;
+		source->handler = handler;
+		std::lock_guard<std::mutex> lock(this->m_sources);
+		unsigned long id = this->nextSource++;
+		if (!update(id, *source, events))
+			return 0;
+		this->sources[id] = source;
+		return id;
+	}
+
+	bool modify(unsigned long source, unsigned int events) override {
+		std::lock_guard<std::mutex> lock(this->m_sources);
+		auto entry = this->sources.find(source);
+		if (entry == this->sources.end()) return false;
+		return update(source, *entry->second, events);
+	}
+
+	void unwatch(unsigned long source) override {
+		std::lock_guard<std::mutex> lock(this->m_sources);
+		auto entry = this->sources.find(source);
+		if (entry == this->sources.end()) return;
+		update(source, *entry->second, 0);
+		this->sources.erase(entry);
+	}
+
+	void trigger(unsigned long source) override {
+		std::unique_lock<std::mutex> lock(this->m_sources);
+		this->triggered.push_back(source);
+		lock.unlock();
+		wake();
+	}
+
+	void sync() override {
+		if (std::this_thread::get_id() == this->thread.get_id()) return;
+		std::unique_lock<std::mutex> lock(this->m_sources);
+		unsigned long long current = this->iteration;
+		this->cv_dispatch.wait(lock, [this, current]() { return !this->dispatching || this->iteration != current || this->stopping; });
+	}
+
+	unsigned int getSourceCount() override {
+		std::lock_guard<std::mutex> lock(this->m_sources);
+		return this->sources.size();
+	}
+
+	bool getCpuTime(unsigned long long* cpuTime) override {
+		return SerialAccess::getThreadCpuTime(this->thread, cpuTime);
+	}
+
+private:
+	struct EventSource {
+		int fd;
+		unsigned int events;								// the events currently waited for
+		bool registered;									// if the descriptor is currently registered with epoll
+		std::function<void(unsigned int)> handler;
+	};
+
+	// applies the events to the epoll registration, has to be called with m_sources locked
+	bool update(unsigned long id, EventSource& source, unsigned int events) {
+		// an descriptor without events is removed, since epoll would report hang ups anyway
+		if (events == 0) {
+			if (source.registered)
+				::epoll_ctl(this->epoll, EPOLL_CTL_DEL, source.fd, nullptr);
+			source.registered = false;
+			source.events = 0;
+			return true;
+		}
+		if (source.registered && source.events == events)
+			return true;
+
+		epoll_event event = {};
+		event.events = toEpollEvents(events);
+		event.data.u64 = id;
+		if (::epoll_ctl(this->epoll, source.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, source.fd, &event) != 0) {
+			printf("[!] failed to register descriptor %d with event loop: %d\n", source.fd, errno);
+			return false;
+		}
+		source.registered = true;
+		source.events = events;
+		return true;
+	}
+
+	void wake() {
+		uint64_t count = 1;
+		if (::write(this->wakeup, &count, sizeof(count)) < 0) {
+			dbgprintf("[DBG] failed to wake event loop: %d\n", errno);
+		}
+	}
+
+	void run(SerialAccess::SerialThreadConfig config) {
+		if (config.scheduling != SerialAccess::SPC_SCHED_NORMAL || config.cpuMask != 0) {
+			if (!SerialAccess::applyThreadConfig(config))
+				printf("[!] failed to apply thread configuration to event loop thread\n");
+			SerialAccess::SerialThreadConfig effectiveConfig;
+			if (SerialAccess::getThreadConfig(effectiveConfig))
+				printf("[i] event loop thread running with: %s\n", SerialAccess::formatThreadConfig(effectiveConfig).c_str());
+		}
+
+		epoll_event events[SOE_EVENT_BATCH];
+		std::vector<unsigned long> triggers;
+		while (true) {
+			int count = ::epoll_wait(this->epoll, events, SOE_EVENT_BATCH, -1);
+			if (count < 0 && errno != EINTR) {
+				printf("[!] event loop failed: %d\n", errno);
+				break;
+			}
+
+			// the wakeup is reset before the triggers are taken, so that an trigger requested meanwhile wakes the next wait
+			for (int i = 0; i < count; i++) {
+				if (events[i].data.u64 != SOE_EVENT_WAKEUP) continue;
+				uint64_t value;
+				if (::read(this->wakeup, &value, sizeof(value)) < 0) {
+					dbgprintf("[DBG] failed to reset event loop wakeup: %d\n", errno);
+				}
+			}
+
+			std::unique_lock<std::mutex> lock(this->m_sources);
+			if (this->stopping) break;
+			this->dispatching = true;
+			triggers.swap(this->triggered);
+			lock.unlock();
+
+			for (int i = 0; i < count; i++) {
+				if (events[i].data.u64 != SOE_EVENT_WAKEUP)
+					dispatch(events[i].data.u64, fromEpollEvents(events[i].events));
+			}
+			for (unsigned long source : triggers)
+				dispatch(source, SOE_EVENT_TRIGGER);
+			triggers.clear();
+
+			lock.lock();
+			this->dispatching = false;
+			this->iteration++;
+			lock.unlock();
+			this->cv_dispatch.notify_all();
+		}
+		dbgprintf("[DBG] event loop terminated\n");
+	}
+
+	// calls the handler of the source, if it was not unwatched meanwhile
+	void dispatch(unsigned long id, unsigned int events) {
+		std::unique_lock<std::mutex> lock(this->m_sources);
+		auto entry = this->sources.find(id);
+		if (entry == this->sources.end()) return;
+		std::shared_ptr<EventSource> source = entry->second;
+		lock.unlock();
+		source->handler(events);
+	}
+
+	int epoll;
+	int wakeup;												// eventfd waking the loop for triggers and termination
+	std::thread thread;
+	std::mutex m_sources;									// protect the sources against async modification
+	std::condition_variable cv_dispatch;					// waiting point for the end of the current dispatch
+	std::map<unsigned long, std::shared_ptr<EventSource>> sources;	// the registered sources by id
+	std::vector<unsigned long> triggered;					// the sources requested to run by trigger()
+	unsigned long nextSource;								// the id of the next source, zero is the wakeup
+	bool dispatching;										// if the loop thread currently calls handlers
+	unsigned long long iteration;							// the number of completed dispatches
+	bool stopping;											// if the loop has to terminate
+
+};
+
+static std::vector<std::unique_ptr<SOEEventLoopLin>> eventLoops;
+
+}
+
+bool SerialOverEthernet::startEventLoops(unsigned int count, const SerialAccess::SerialThreadConfig& config) {
+	// the loops are pinned to one CPU each, so that the connections of an loop stay on the same core
+	std::vector<unsigned int> cpus;
+	for (unsigned int cpu = 0; cpu < sizeof(config.cpuMask) * 8; cpu++)
+		if (config.cpuMask & (1ULL << cpu)) cpus.push_back(cpu);
+
+	for (unsigned int i = 0; i < count; i++) {
+		int epoll = ::epoll_create1(EPOLL_CLOEXEC);
+		int wakeup = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (epoll < 0 || wakeup < 0) {
+			printf("[!] failed to create event loop: %d\n", errno);
+			if (epoll >= 0) ::close(epoll);
+			if (wakeup >= 0) ::close(wakeup);
+			stopEventLoops();
+			eventLoops.clear();
+			return false;
+		}
+		std::unique_ptr<SOEEventLoopLin> loop(new SOEEventLoopLin(epoll, wakeup));
+		SerialAccess::SerialThreadConfig loopConfig = config;
+		if (count > 1 && !cpus.empty())
+			loopConfig.cpuMask = 1ULL << cpus[i % cpus.size()];
+		if (!loop->start(loopConfig)) {
+			printf("[!] failed to start event loop: %d\n", errno);
+			stopEventLoops();
+			eventLoops.clear();
+			return false;
+		}
+		eventLoops.push_back(std::move(loop));
+	}
+	return count > 0;
+}
+
+void SerialOverEthernet::stopEventLoops() {
+	// the loops are not deleted, links still referencing them are not handled anymore
+	for (auto& loop : eventLoops)
+		loop->stop();
+}
+
+SerialOverEthernet::SOEEventLoop* SerialOverEthernet::nextEventLoop() {
+	SOEEventLoop* next = nullptr;
+	unsigned int nextCount = 0;
+	for (auto& loop : eventLoops) {
+		unsigned int count = loop->getSourceCount();
+		if (next == nullptr || count < nextCount) {
+			next = loop.get();
+			nextCount = count;
+		}
+	}
+	return next;
+}
+
+unsigned int SerialOverEthernet::getEventLoopCount() {
+	return eventLoops.size();
+}
+
+SerialOverEthernet::SOEEventLoop* SerialOverEthernet::getEventLoop(unsigned int index) {
+	return index < eventLoops.size() ? eventLoops[index].get() : nullptr;
+}
+
+#else
+
+bool SerialOverEthernet::startEventLoops(unsigned int count, const SerialAccess::SerialThreadConfig& config) {
+	return false;
+}
+
+void SerialOverEthernet::stopEventLoops() {}
+
+SerialOverEthernet::SOEEventLoop* SerialOverEthernet::nextEventLoop() {
+	return nullptr;
+}
+
+unsigned int SerialOverEthernet::getEventLoopCount() {
+	return 0;
+}
+
+SerialOverEthernet::SOEEventLoop* SerialOverEthernet::getEventLoop(unsigned int index) {
+	return nullptr;
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * soeframe.cpp
+ *
+ * Implements the parsing of the frames from the received byte stream and the varint length fields.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "soeframe.hpp"
+
+unsigned int SerialOverEthernet::writeVarintBefore(char* end, unsigned int value) {
+	unsigned char bytes[SOE_TCP_VARINT_MAX_LEN];
+	unsigned int length = 0;
+	do {
+		bytes[length] = value & 0x7F;
+		value >>= 7;
+		if (value) bytes[length] |= 0x80;
+		length++;
+	} while (value && length < SOE_TCP_VARINT_MAX_LEN);
+	memcpy(end - length, bytes, length);
+	return length;
+}
+
+unsigned int SerialOverEthernet::readVarint(const char* buffer, unsigned int bufferLen, unsigned int* value) {
+	*value = 0;
+	for (unsigned int i = 0; i < bufferLen && i < SOE_TCP_VARINT_MAX_LEN; i++) {
+		*value |= (((unsigned char) buffer[i]) & 0x7F) << (i * 7);
+		if (!(buffer[i] & 0x80)) return i + 1;
+	}
+	return 0;
+}
+
+int SerialOverEthernet::parseFrameV1(const char* buffer, unsigned int bufferLen, unsigned int* headerLen, unsigned int* payloadLen) {
+
+	if (bufferLen < SOE_TCP_HEADER_LEN)
+		return 0;
+
+	// check protocol identifier
+	for (unsigned char i = 0; i < SOE_TCP_PROTO_IDENT_LEN; i++) {
+		if ((unsigned char) buffer[i] != ((SOE_TCP_PROTO_IDENT >> i * 8) & 0xFF)) {
+			printf("[!] frame error, received package with unknown identifier: %.*s\n", SOE_TCP_PROTO_IDENT_LEN, buffer);
+			return -1;
+		}
+	}
+
+	// read package len
+	*headerLen = SOE_TCP_HEADER_LEN;
+	*payloadLen = 0;
+	for (unsigned char i = 0; i < SOE_TCP_FRAME_LEN_BYTES; i++)
+		*payloadLen |= (((unsigned char) buffer[SOE_TCP_PROTO_IDENT_LEN + i]) << (i * 8));
+	if (*payloadLen > SOE_TCP_FRAME_MAX_LEN - SOE_TCP_HEADER_LEN) {
+		printf("[!] frame error, received package with oversize payload: %u\n", *payloadLen);
+		return -1;
+	}
+
+	return bufferLen - SOE_TCP_HEADER_LEN >= *payloadLen ? 1 : 0;
+}
+
+int SerialOverEthernet::parseFrameV2(const char* buffer, unsigned int bufferLen, unsigned int maxPayloadLen, unsigned int* headerLen, unsigned int* payloadLen) {
+
+	// read the frame length varint, an incomplete one is only malformed if it exceeds the max length
+	*headerLen = readVarint(buffer, bufferLen, payloadLen);
+	if (*headerLen == 0) {
+		if (bufferLen < SOE_TCP_VARINT_MAX_LEN)
+			return 0;
+		printf("[!] frame error, received malformed frame length\n");
+		return -1;
+	}
+
+	if (*payloadLen > maxPayloadLen) {
+		printf("[!] frame error, received frame with oversize payload: %u\n", *payloadLen);
+		return -1;
+	}
+
+	return bufferLen - *headerLen >= *payloadLen ? 1 : 0;
+}
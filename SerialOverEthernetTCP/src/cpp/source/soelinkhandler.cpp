@@ -2,49 +2,135 @@
  * soelinkhandler.cpp
  *
  * Handles an single Serial over Ethernet/IP connection/link.
- * This file implements the generic code required, such as opening sockets and ports and the RX/TX threads.
+ * This file implements the generic code required, such as opening sockets and ports and the RX/TX threads or the event loop handlers.
  *
  *  Created on: 04.02.2025
  *      Author: Marvin Koehler (M_Marvin)
  */
 
 #include <string>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
 #include "soeconnection.hpp"
 #include "dbgprintf.h"
 
-SerialOverEthernet::SOELinkHandler::SOELinkHandler(NetSocket::Socket* socket, std::string& hostName, std::string& hostPort, std::function<void(SOELinkHandler*)> onDeath) {
+SerialAccess::SerialThreadConfig SerialOverEthernet::SOELinkHandler::threadConfig = SerialAccess::DEFAULT_THREAD_CONFIGURATION;
+unsigned int SerialOverEthernet::SOELinkHandler::frameLimit = SOE_TCP_FRAME_LIMIT;
+unsigned int SerialOverEthernet::SOELinkHandler::sessionTimeout = SOE_TCP_SESSION_TIMEOUT;
+std::mutex SerialOverEthernet::SOELinkHandler::m_sessions;
+std::map<unsigned long long, SerialOverEthernet::SOELinkHandler*> SerialOverEthernet::SOELinkHandler::sessions;
+
+SerialOverEthernet::SOELinkHandler::SOELinkHandler(SOETransport* transport, std::string& hostName, std::string& hostPort, std::function<void(SOELinkHandler*)> onDeath, SOEEventLoop* eventLoop) {
 	this->onDeath = onDeath;
 	this->remoteHostName = hostName;
 	this->remoteHostPort = hostPort;
-	this->socket.reset(socket);
-	this->socket->setTimeouts(0, 0);
-	this->socket->setNagle(false);
-	this->thread_rx = std::thread([this]() -> void {
-		this->handleClientRX();
-	});
-	this->thread_tx = std::thread([this]() -> void {
-		this->handleClientTX();
-	});
+	this->transport.reset(transport);
+	this->alive = true;
+	this->txProtocolVersion = 1;
+	this->rxProtocolVersion = 1;
+	this->txSending = false;
+	this->txBlocked = false;
+	this->rxPaused = false;
+	this->txQueue.resize(SOE_TCP_VARINT_MAX_LEN);
+	this->txFrameMaxLen = SOE_TCP_FRAME_MAX_LEN;
+	this->rxFrameMaxLen = SOE_TCP_FRAME_MAX_LEN;
+	this->helloPending = false;
+	this->remoteFeatures = 0;
+	this->compressionRequested = false;
+	this->nextRequestId = 1;
+	this->nextRequestSequence = 0;
+	this->rxRequestId = 0;
+	this->rttSampleIndex = 0;
+	this->rttProbes = 0;
+	this->rttResponses = 0;
+	this->rttLast = 0;
+	this->rttJitter = 0;
+	this->bytesSent = 0;
+	this->bytesReceived = 0;
+	this->framesSent = 0;
+	this->framesReceived = 0;
+	this->resumes = 0;
+	this->sessionId = 0;
+	this->suspended = false;
+	this->resumePending = false;
+	this->sessionClosed = false;
+	this->eventLoop = eventLoop != nullptr ? eventLoop : nextEventLoop();
+	this->clientSource = 0;
+	this->rxBuffer.resize(SOE_TCP_RX_BUFFER_LEN);
+	this->rxBufferStart = 0;
+	this->rxBufferEnd = 0;
+
+	// the transport is received by the event loop if it can be waited on, otherwise by its own thread
+	if (this->eventLoop == nullptr || this->transport->getHandle() < 0) {
+		this->thread_rx = std::thread([this]() -> void {
+			this->applyThreadConfig("RX");
+			this->handleClientRX();
+		});
+	}
+	getChannel(0); // the default channel used by remotes without channel support
+	watchTransport();
 }
 
 SerialOverEthernet::SOELinkHandler::~SOELinkHandler() {
 	shutdown();
 	printf("[DBG] joining RX thread ...\n");
-	this->thread_rx.join();
+	if (this->thread_rx.joinable()) this->thread_rx.join();
+	if (this->thread_resume.joinable()) this->thread_resume.join();
 	printf("[DBG] joined\n");
-	printf("[DBG] joining TX thread ...\n");
-	this->thread_tx.join();
+
+	// the sources were unwatched by the shutdown, but one of their handlers might still be running
+	if (this->eventLoop) this->eventLoop->sync();
+	printf("[DBG] joining TX threads ...\n");
+	std::unique_lock<std::shared_mutex> lock(this->m_channels);
+	for (auto& channel : this->channels) {
+		if (channel.second->thread_tx.joinable()) channel.second->thread_tx.join();
+		if (channel.second->thread_serialTX.joinable()) channel.second->thread_serialTX.join();
+	}
 	printf("[DBG] joined\n");
 }
 
 bool SerialOverEthernet::SOELinkHandler::shutdown() {
-	if (isAlive()) {
-		printf("[i] link shutting down: %s <-> %s @ %s/%s\n", this->localPortName.c_str(), this->remotePortName.c_str(), this->remoteHostName.c_str(), this->remoteHostPort.c_str());
-		closeLocalPort();
-		this->socket->close();
-		this->remoteReturn = false;
-		this->cv_remoteReturn.notify_all();
-		this->cv_openLocalPort.notify_all();
+	if (this->alive.exchange(false)) {
+		// the session can not be resumed anymore, the remote is told so before the connection is closed
+		if (this->sessionId != 0) {
+			std::unique_lock<std::mutex> sessionLock(m_sessions);
+			auto session = sessions.find(this->sessionId);
+			if (session != sessions.end() && session->second == this)
+				sessions.erase(session);
+			sessionLock.unlock();
+			closeSession();
+		}
+
+		// channels are never removed, the references stay valid after releasing the lock
+		std::shared_lock<std::shared_mutex> lock(this->m_channels);
+		std::vector<SOEChannel*> channels;
+		for (auto& channel : this->channels)
+			channels.push_back(channel.second.get());
+		lock.unlock();
+
+		for (SOEChannel* channel : channels) {
+			if (channel->allocated || !channel->localPortName.empty())
+				printf("[i] link shutting down: %s <-> %s @ %s/%s\n", channel->localPortName.c_str(), channel->remotePortName.c_str(), this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+			closeLocalPort(channel->number);
+		}
+		unwatchTransport();
+		std::unique_lock<std::mutex> transportLock(this->m_transport);
+		if (this->transport) this->transport->close();
+		transportLock.unlock();
+		this->cv_session.notify_all();
+		SOELatencyStats stats;
+		getLatencyStats(stats);
+		if (stats.samples > 0)
+			printf("[i] link latency: %s/%s %s\n", this->remoteHostName.c_str(), this->remoteHostPort.c_str(), formatLatencyStats(stats).c_str());
+		failPendingRequests();
+		for (SOEChannel* channel : channels) {
+			channel->cv_openLocalPort.notify_all();
+			channel->cv_txCredits.notify_all();
+			channel->cv_serialTX.notify_all();
+		}
+		this->cv_socketTX.notify_all();
 		this->onDeath(this);
 		dbgprintf("[DBG] client handler terminated\n");
 		return true;
@@ -52,108 +138,696 @@ bool SerialOverEthernet::SOELinkHandler::shutdown() {
 	return false;
 }
 
+void SerialOverEthernet::SOELinkHandler::closeSession() {
+	std::unique_lock<std::mutex> lock(this->m_socketTX);
+	if (!this->cv_socketTX.wait_for(lock, std::chrono::milliseconds(SOE_TCP_SESSION_CLOSE_TIMEOUT), [this]() { return !this->txSending || !this->txDeferred.empty(); })) {
+		dbgprintf("[DBG] transmission pending, session not closed: %s/%s\n", this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+		return;
+	}
+	if (this->suspended || this->sessionClosed) return;
+	std::unique_lock<std::mutex> transportLock(this->m_transport);
+	if (!this->transport || !this->transport->isOpen()) return;
+	transportLock.unlock();
+	dbgprintf("[DBG] close session: %s/%s\n", this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+	sendCloseSession();
+}
+
 bool SerialOverEthernet::SOELinkHandler::isAlive() {
-	return this->socket->isOpen();
+	return this->alive;
+}
+
+void SerialOverEthernet::SOELinkHandler::failPendingRequests() {
+	std::unique_lock<std::mutex> lock(this->m_remoteReturn);
+	for (auto& request : this->remoteRequests) {
+		request.second.completed = true;
+		request.second.success = false;
+	}
+	lock.unlock();
+	this->cv_remoteReturn.notify_all();
+}
+
+void SerialOverEthernet::SOELinkHandler::getLinkStats(SOELinkStats& stats) {
+	stats.bytesSent = this->bytesSent;
+	stats.bytesReceived = this->bytesReceived;
+	stats.framesSent = this->framesSent;
+	stats.framesReceived = this->framesReceived;
+	stats.resumes = this->resumes;
+	std::unique_lock<std::mutex> txLock(this->m_socketTX);
+	stats.transmitQueue = this->txQueue.size() - SOE_TCP_VARINT_MAX_LEN + this->txDeferred.size();
+	txLock.unlock();
+
+	// the threads are only joined when the handler is deleted, so their clocks stay valid
+	stats.rxThreadCpuTime = stats.txThreadCpuTime = 0;
+	unsigned long long cpuTime;
+	if (SerialAccess::getThreadCpuTime(this->thread_rx, &cpuTime))
+		stats.rxThreadCpuTime = cpuTime;
+
+	std::shared_lock<std::shared_mutex> lock(this->m_channels);
+	stats.channels.clear();
+	for (auto& entry : this->channels) {
+		SOEChannel& channel = *entry.second;
+		if (SerialAccess::getThreadCpuTime(channel.thread_tx, &cpuTime))
+			stats.txThreadCpuTime += cpuTime;
+		if (SerialAccess::getThreadCpuTime(channel.thread_serialTX, &cpuTime))
+			stats.txThreadCpuTime += cpuTime;
+
+		SOEChannelStats channelStats;
+		channelStats.number = channel.number;
+		std::unique_lock<std::mutex> portLock(channel.m_localPort);
+		channelStats.localPortName = channel.localPortName;
+		channelStats.remotePortName = channel.remotePortName;
+		portLock.unlock();
+		channelStats.serialBytesRead = channel.serialBytesRead;
+		channelStats.serialErrors = channel.serialErrors;
+		std::unique_lock<std::mutex> serialLock(channel.m_serialTX);
+		channelStats.serialBytesWritten = channel.rxBytesWritten;
+		channelStats.serialQueue = channel.serialTXQueue.size();
+		serialLock.unlock();
+		std::unique_lock<std::mutex> creditLock(channel.m_txCredits);
+		channelStats.retransmitQueue = channel.retransmitBuffer.size();
+		channelStats.txCredits = channel.txCredits;
+		creditLock.unlock();
+		stats.channels.push_back(channelStats);
+	}
+}
+
+std::string SerialOverEthernet::SOELinkHandler::getRemoteAddress() {
+	return this->remoteHostName + "/" + this->remoteHostPort;
+}
+
+bool SerialOverEthernet::SOELinkHandler::probeLatency() {
+	if (!(this->remoteFeatures & SOE_TCP_FEATURE_PING) || !isAlive()) return true;
+	std::unique_lock<std::mutex> txLock(this->m_socketTX);
+	if (this->suspended) return true;
+	txLock.unlock();
+	unsigned long long timestamp = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	std::unique_lock<std::mutex> lock(this->m_latency);
+	this->rttProbes++;
+	lock.unlock();
+	return sendPing(timestamp);
+}
+
+void SerialOverEthernet::SOELinkHandler::getLatencyStats(SOELatencyStats& stats) {
+	std::unique_lock<std::mutex> lock(this->m_latency);
+	std::vector<unsigned long> samples(this->rttSamples);
+	stats.probes = this->rttProbes;
+	stats.responses = this->rttResponses;
+	stats.last = this->rttLast;
+	stats.jitter = this->rttJitter;
+	lock.unlock();
+
+	stats.samples = samples.size();
+	stats.min = stats.avg = stats.p99 = 0;
+	if (samples.empty()) return;
+	unsigned long long sum = 0;
+	for (unsigned long sample : samples)
+		sum += sample;
+	stats.avg = (unsigned long) (sum / samples.size());
+	stats.min = *std::min_element(samples.begin(), samples.end());
+	auto p99 = samples.begin() + (samples.size() * 99) / 100;
+	std::nth_element(samples.begin(), p99, samples.end());
+	stats.p99 = *p99;
+}
+
+std::string SerialOverEthernet::formatLatencyStats(const SOELatencyStats& stats) {
+	char buffer[160];
+	snprintf(buffer, sizeof(buffer), "rtt min %.2f avg %.2f p99 %.2f jitter %.2f ms (%lu samples, %llu/%llu probes answered)",
+			stats.min / 1000.0, stats.avg / 1000.0, stats.p99 / 1000.0, stats.jitter / 1000.0, stats.samples, stats.responses, stats.probes);
+	return std::string(buffer);
+}
+
+void SerialOverEthernet::SOELinkHandler::setThreadConfig(const SerialAccess::SerialThreadConfig& config) {
+	threadConfig = config;
+}
+
+void SerialOverEthernet::SOELinkHandler::setFrameLimit(unsigned int limit) {
+	frameLimit = limit < SOE_TCP_FRAME_MAX_LEN ? SOE_TCP_FRAME_MAX_LEN : limit > SOE_TCP_FRAME_LIMIT ? SOE_TCP_FRAME_LIMIT : limit;
+}
+
+void SerialOverEthernet::SOELinkHandler::setSessionTimeout(unsigned int timeout) {
+	sessionTimeout = timeout;
+}
+
+void SerialOverEthernet::SOELinkHandler::enableResume(std::function<SOETransport*()> reconnect) {
+	this->reconnect = reconnect;
+}
+
+SerialOverEthernet::SOEChannel& SerialOverEthernet::SOELinkHandler::getChannel(unsigned char number) {
+	std::shared_lock<std::shared_mutex> lock(this->m_channels);
+	auto entry = this->channels.find(number);
+	if (entry != this->channels.end())
+		return *entry->second;
+	lock.unlock();
+
+	std::unique_lock<std::shared_mutex> createLock(this->m_channels);
+	std::unique_ptr<SOEChannel>& channel = this->channels[number];
+	if (channel) return *channel; // created by an other thread meanwhile
+	channel.reset(new SOEChannel());
+	channel->number = number;
+	channel->allocated = false;
+	channel->localBaud = SerialAccess::DEFAULT_PORT_CONFIGURATION.baudRate;
+	channel->serialBufferLen = SOE_SERIAL_BUFFER_LEN;
+	channel->txCredits = 0;
+	channel->rxCreditsGranted = 0;
+	channel->rxBytesWritten = 0;
+	channel->rxCreditWindow = SOE_SERIAL_CREDIT_MIN;
+	channel->txSequence = 0;
+	channel->txAcknowledged = 0;
+	channel->resyncPending = false;
+	channel->retransmitPending = false;
+	channel->rxSequence = 0;
+	channel->rxAcknowledged = 0;
+	channel->serialSource = 0;
+	channel->localPortFailed = false;
+	channel->serialBytesRead = 0;
+	channel->serialErrors = 0;
+	SOEChannel* created = channel.get();
+
+	// with an event loop the local port is registered with it when opened
+	if (this->eventLoop == nullptr) {
+		created->thread_tx = std::thread([this, created]() -> void {
+			this->applyThreadConfig("TX");
+			this->handleClientTX(*created);
+		});
+		created->thread_serialTX = std::thread([this, created]() -> void {
+			this->applyThreadConfig("serial TX");
+			this->handleSerialTX(*created);
+		});
+	}
+	dbgprintf("[DBG] channel created: %u\n", (unsigned int) number);
+	createLock.unlock();
+
+	// the frame is shared with one more channel now
+	updateSerialBuffer();
+	return *created;
+}
+
+int SerialOverEthernet::SOELinkHandler::allocateChannel() {
+	std::unique_lock<std::shared_mutex> lock(this->m_channels);
+	for (unsigned int number = 0; number < SOE_TCP_MAX_CHANNELS; number++) {
+		auto entry = this->channels.find((unsigned char) number);
+		if (entry == this->channels.end()) {
+			// channels other than zero require support by the remote
+			if (!(this->remoteFeatures & SOE_TCP_FEATURE_CHANNELS)) return -1;
+			lock.unlock();
+			getChannel((unsigned char) number).allocated = true;
+			return (int) number;
+		}
+		if (!entry->second->allocated && entry->second->localPortName.empty() && entry->second->remotePortName.empty()) {
+			entry->second->allocated = true;
+			return (int) number;
+		}
+	}
+	return -1;
+}
+
+void SerialOverEthernet::SOELinkHandler::updateSerialBuffer() {
+	std::unique_lock<std::mutex> lock(this->m_socketTX);
+	unsigned char protocolVersion = this->txProtocolVersion;
+	unsigned int frameMaxLen = this->txFrameMaxLen;
+	lock.unlock();
+
+	std::shared_lock<std::shared_mutex> channelLock(this->m_channels);
+	for (auto& entry : this->channels) {
+		SOEChannel& channel = *entry.second;
+		if (protocolVersion < 2) {
+			channel.serialBufferLen = SOE_SERIAL_BUFFER_LEN;
+			continue;
+		}
+
+		// hold the data arriving within the buffer time (10 bits per character), but at least an v1 package and at most an full frame,
+		// shared by all channels so that the data of every channel fits in the next frame
+		unsigned int maxLen = (frameMaxLen - SOE_TCP_VARINT_MAX_LEN) / this->channels.size() - (SOE_SERIAL_DATA_HEADROOM - SOE_TCP_PACKAGE_HEADROOM);
+		unsigned long long timeLen = (unsigned long long) channel.localBaud * SOE_SERIAL_BUFFER_TIME / 10000;
+		unsigned int bufferLen = timeLen > maxLen ? maxLen : (unsigned int) timeLen;
+		if (bufferLen < SOE_SERIAL_BUFFER_LEN) bufferLen = SOE_SERIAL_BUFFER_LEN;
+		if (bufferLen != channel.serialBufferLen)
+			dbgprintf("[DBG] serial buffer of channel %u resized to %u bytes (baud %lu)\n", (unsigned int) channel.number, bufferLen, (unsigned long) channel.localBaud);
+		channel.serialBufferLen = bufferLen;
+	}
+}
+
+// Returns the number of bytes the remote can send ahead of an local port with the baud
+static unsigned int creditWindow(unsigned long baud) {
+	unsigned long long timeLen = (unsigned long long) baud * SOE_SERIAL_CREDIT_TIME / 10000;
+	return timeLen < SOE_SERIAL_CREDIT_MIN ? SOE_SERIAL_CREDIT_MIN : timeLen > 0x7FFFFFFF ? 0x7FFFFFFF : (unsigned int) timeLen;
+}
+
+bool SerialOverEthernet::SOELinkHandler::grantCredits(SOEChannel& channel, bool force) {
+	if (!(this->remoteFeatures & SOE_TCP_FEATURE_CREDITS)) return true;
+
+	// the credits granted meanwhile are included in the resync of an resumed session, so they must not be transmitted after it
+	std::shared_lock<std::shared_mutex> sessionLock(this->m_session);
+
+	// the data the remote can still send and the data waiting for the local port must not exceed the window
+	std::unique_lock<std::mutex> lock(channel.m_serialTX);
+	unsigned long long outstanding = channel.rxCreditsGranted - channel.rxBytesWritten;
+	if (outstanding >= channel.rxCreditWindow) return true;
+	unsigned long credits = (unsigned long) (channel.rxCreditWindow - outstanding);
+	if (!force && credits < channel.rxCreditWindow / 4) return true;
+	channel.rxCreditsGranted += credits;
+	lock.unlock();
+
+	return sendCredits(channel.number, credits);
+}
+
+bool SerialOverEthernet::SOELinkHandler::resumeSession() {
+	printf("[i] connection lost, attempt to resume session: %s/%s\n", this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+
+	// stop all transmissions on the lost connection, the queued records are covered by the resync
+	std::unique_lock<std::mutex> txLock(this->m_socketTX);
+	this->suspended = true;
+	std::unique_lock<std::mutex> transportLock(this->m_transport);
+	this->transport->close();
+	transportLock.unlock();
+	this->cv_socketTX.wait(txLock, [this]() { return !this->txSending || !this->txDeferred.empty(); });
+	this->txQueue.resize(SOE_TCP_VARINT_MAX_LEN);
+	this->txDeferred.clear();
+	this->txSending = false;
+	this->txBlocked = false;
+	txLock.unlock();
+	this->cv_socketTX.notify_all();
+
+	// the responses to the pending requests are lost, the serial data waits for the resync of its channel
+	failPendingRequests();
+	std::shared_lock<std::shared_mutex> channelLock(this->m_channels);
+	std::vector<SOEChannel*> channels;
+	for (auto& channel : this->channels)
+		channels.push_back(channel.second.get());
+	channelLock.unlock();
+	for (SOEChannel* channel : channels) {
+		std::unique_lock<std::mutex> lock(channel->m_txCredits);
+		channel->resyncPending = true;
+		channel->retransmitPending = false;
+		lock.unlock();
+		channel->rxDecompressor.reset(); // the compressor of the remote restarts with the resync
+	}
+
+	// this side reconnects if it established the session, otherwise the remote has to reconnect
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(sessionTimeout);
+	std::unique_ptr<SOETransport> resumed;
+	while (!resumed && isAlive() && std::chrono::steady_clock::now() < deadline) {
+		if (this->reconnect) {
+			resumed.reset(this->reconnect());
+			if (resumed) break;
+			transportLock.lock();
+			this->cv_session.wait_for(transportLock, std::chrono::milliseconds(SOE_TCP_SESSION_RETRY), [this]() { return !isAlive(); });
+			transportLock.unlock();
+		} else {
+			transportLock.lock();
+			this->cv_session.wait_until(transportLock, deadline, [this]() { return this->resumeTransport || !isAlive(); });
+			resumed = std::move(this->resumeTransport);
+			transportLock.unlock();
+		}
+	}
+	if (!resumed || !isAlive()) {
+		if (isAlive())
+			printf("[!] unable to resume session within %u ms: %s/%s\n", sessionTimeout, this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+		return false;
+	}
+
+	// the transmissions of serial data and credits are held back until the resync was send
+	std::unique_lock<std::shared_mutex> sessionLock(this->m_session);
+	txLock.lock();
+	transportLock.lock();
+	this->transport.swap(resumed);
+	if (!isAlive()) this->transport->close(); // shut down while reconnecting
+	transportLock.unlock();
+	this->rxBufferStart = this->rxBufferEnd = 0;
+
+	if (!sendResume()) {
+		printf("[!] failed to send resume request: %s/%s\n", this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+		return true; // the RX thread notices the lost connection
+	}
+	if (this->reconnect) {
+		// the response is framed as v1 package, followed by the resync of the remote
+		this->resumePending = true;
+		this->rxProtocolVersion = 1;
+		return true;
+	}
+
+	// the remote sends its resync after receiving the response
+	sendResync();
+	this->suspended = false;
+	txLock.unlock();
+	this->cv_socketTX.notify_all();
+	this->resumes++;
+	printf("[i] session resumed: %s/%s\n", this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+	return true;
+}
+
+void SerialOverEthernet::SOELinkHandler::handOverTransport(SOETransport* resumed) {
+	std::unique_lock<std::mutex> lock(this->m_transport);
+	this->resumeTransport.reset(resumed);
+
+	// the remote might have noticed the lost connection first
+	this->transport->close();
+	lock.unlock();
+	this->cv_session.notify_all();
+}
+
+bool SerialOverEthernet::SOELinkHandler::bufferSerialData(SOEChannel& channel, const char* data, unsigned int len, std::shared_lock<std::shared_mutex>& sessionLock) {
+	bool credits = this->remoteFeatures & SOE_TCP_FEATURE_CREDITS;
+	while (isAlive()) {
+		if (!retransmitSerialData(channel)) return false;
+
+		std::unique_lock<std::mutex> lock(channel.m_txCredits);
+		channel.cv_txCredits.wait(lock, [this, &channel, len]() {
+			return (!channel.resyncPending && (channel.retransmitPending || channel.retransmitBuffer.size() + len <= SOE_SERIAL_RETRANSMIT_LEN)) || !isAlive();
+		});
+		if (!isAlive()) return false;
+		if (channel.retransmitPending) continue;
+		lock.unlock();
+
+		// the data has to be transmitted before the resume handshake of an lost connection, or retransmitted after it
+		sessionLock = std::shared_lock<std::shared_mutex>(this->m_session);
+		lock.lock();
+		if (channel.resyncPending || channel.retransmitPending) {
+			lock.unlock();
+			sessionLock.unlock();
+			continue;
+		}
+		channel.retransmitBuffer.insert(channel.retransmitBuffer.end(), data, data + len);
+		channel.txSequence += len;
+		if (credits)
+			channel.txCredits = channel.txCredits > len ? channel.txCredits - len : 0;
+		return true;
+	}
+	return false;
+}
+
+bool SerialOverEthernet::SOELinkHandler::retransmitSerialData(SOEChannel& channel) {
+	std::unique_lock<std::mutex> lock(channel.m_txCredits);
+	if (!channel.retransmitPending) return isAlive();
+	channel.retransmitPending = false;
+	std::vector<char> serialData(SOE_SERIAL_DATA_HEADROOM + channel.retransmitBuffer.size());
+	memcpy(serialData.data() + SOE_SERIAL_DATA_HEADROOM, channel.retransmitBuffer.data(), channel.retransmitBuffer.size());
+	lock.unlock();
+
+	// the decompressor of the remote restarts after an lost connection
+	if (channel.txCompressor)
+		channel.txCompressor.reset(new SerialOverEthernet::SOECompressor());
+
+	// if the connection was lost again meanwhile, the data is retransmitted after the next resume
+	std::shared_lock<std::shared_mutex> sessionLock(this->m_session);
+	lock.lock();
+	bool resync = channel.resyncPending;
+	lock.unlock();
+	if (resync) return isAlive();
+
+	dbgprintf("[DBG] retransmit serial data: %u bytes (channel %u)\n", (unsigned int) (serialData.size() - SOE_SERIAL_DATA_HEADROOM), (unsigned int) channel.number);
+	for (unsigned int offset = SOE_SERIAL_DATA_HEADROOM; offset < serialData.size();) {
+		unsigned int len = serialData.size() - offset;
+		if (len > channel.serialBufferLen) len = channel.serialBufferLen;
+
+		// the package header overwrites the end of the previous part, which was already transmitted
+		if (!sendSerialData(channel, serialData.data() + offset, len)) break;
+		offset += len;
+	}
+	return isAlive();
 }
 
-bool SerialOverEthernet::SOELinkHandler::openLocalPort(const std::string& localSerial) {
-	closeLocalPort();
-	std::unique_lock<std::mutex> lock(this->m_localPort);
-	this->localPort.reset(SerialAccess::newSerialPortS(localSerial));
-	this->localPortName = localSerial;
-	dbgprintf("[DBG] opening local port: %s\n", this->localPortName.c_str());
-	bool opened = this->localPort->openPort();
+void SerialOverEthernet::SOELinkHandler::applyThreadConfig(const char* threadName) {
+	if (threadConfig.scheduling == SerialAccess::SPC_SCHED_NORMAL && threadConfig.cpuMask == 0) return;
+	if (!SerialAccess::applyThreadConfig(threadConfig))
+		printf("[!] failed to apply thread configuration to %s thread: %s/%s\n", threadName, this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+	SerialAccess::SerialThreadConfig effectiveConfig;
+	if (SerialAccess::getThreadConfig(effectiveConfig))
+		printf("[i] %s thread running with: %s\n", threadName, SerialAccess::formatThreadConfig(effectiveConfig).c_str());
+}
+
+bool SerialOverEthernet::SOELinkHandler::openLocalPort(unsigned char number, const std::string& localSerial) {
+	closeLocalPort(number);
+	SOEChannel& channel = getChannel(number);
+	std::unique_lock<std::mutex> lock(channel.m_localPort);
+	channel.localPort.reset(SerialAccess::newSerialPortS(localSerial));
+	channel.localPortName = localSerial;
+	dbgprintf("[DBG] opening local port: %s (channel %u)\n", channel.localPortName.c_str(), (unsigned int) number);
+	bool opened = this->eventLoop ? channel.localPort->openPortNonBlocking() : channel.localPort->openPort();
 	if (opened) {
-		if (!this->localPort->setTimeouts(-1, 0, -1)) {
+		if (!channel.localPort->setTimeouts(-1, 0, -1)) {
 			dbgprintf("[DBG] failed to configure timeouts when opening port\n");
-			this->localPort->closePort();
+			channel.localPort->closePort();
 			return false;
 		}
-		this->cv_openLocalPort.notify_all();
+		channel.localBaud = channel.localPort->getBaud();
+
+		// the RX thread reads saturated ports in larger chunks, the event loop already batches reads by its wakeups
+		if (!this->eventLoop && !channel.localPort->setReadLatencyBudget(SOE_SERIAL_READ_LATENCY * 1000))
+			dbgprintf("[DBG] adaptive reads not supported on local port: %s\n", channel.localPortName.c_str());
+		lock.unlock();
+		updateSerialBuffer();
+		channel.cv_openLocalPort.notify_all();
+
+		// allow the remote to send data to the port
+		std::unique_lock<std::mutex> serialLock(channel.m_serialTX);
+		channel.rxCreditWindow = creditWindow(channel.localBaud);
+		serialLock.unlock();
+		grantCredits(channel, true);
+
+		// the port is read and written by the event loop from now on
+		if (this->eventLoop) {
+			channel.localPortFailed = false;
+			channel.serialSource = this->eventLoop->watch(channel.localPort->getNativeHandle(), 0, [this, &channel](unsigned int events) {
+				this->handleSerialEvent(channel, events);
+			});
+			updateSerialEvents(channel);
+		}
 	}
 	return opened;
 }
 
-bool SerialOverEthernet::SOELinkHandler::closeLocalPort() {
-	if (this->localPort == 0 || !this->localPort->isOpen()) return true;
-	std::unique_lock<std::mutex> lock(this->m_localPort);
-	this->localPort->closePort();
-	this->localPort.release();
-	dbgprintf("[DBG] local port closed: %s\n", this->localPortName.c_str());
+bool SerialOverEthernet::SOELinkHandler::closeLocalPort(unsigned char number) {
+	SOEChannel& channel = getChannel(number);
+
+	// the event loop must not wait on the port anymore when it is closed, and no handler may still use it
+	unsigned long source = channel.serialSource.exchange(0);
+	if (source != 0) {
+		this->eventLoop->unwatch(source);
+		this->eventLoop->sync();
+	}
+
+	// closing interrupts pending reads and writes of the threads, which release their reference afterwards
+	std::unique_lock<std::mutex> lock(channel.m_localPort);
+	if (channel.localPort == 0) return true;
+	channel.localPort->closePort();
+	channel.localPort.reset();
+	dbgprintf("[DBG] local port closed: %s\n", channel.localPortName.c_str());
 	return true;
 }
 
-bool SerialOverEthernet::SOELinkHandler::setLocalConfig(const SerialAccess::SerialPortConfiguration& localConfig) {
-	if (this->localPort == 0 || !this->localPort->isOpen()) return false;
-	std::lock_guard<std::mutex> lock(this->m_localPort);
-	dbgprintf("[DBG] changing local port configuration: %s (baud %lu)\n", this->localPortName.c_str(), localConfig.baudRate);
-	return this->localPort->setConfig(localConfig);
+bool SerialOverEthernet::SOELinkHandler::setLocalConfig(unsigned char number, const SerialAccess::SerialPortConfiguration& localConfig) {
+	SOEChannel& channel = getChannel(number);
+	std::unique_lock<std::mutex> lock(channel.m_localPort);
+	if (channel.localPort == 0 || !channel.localPort->isOpen()) return false;
+	dbgprintf("[DBG] changing local port configuration: %s (baud %lu)\n", channel.localPortName.c_str(), localConfig.baudRate);
+	if (!channel.localPort->setConfig(localConfig)) return false;
+	channel.localBaud = localConfig.baudRate;
+	lock.unlock();
+	updateSerialBuffer();
+
+	// the window follows the baud, an smaller window takes effect after the already granted credits were used
+	std::unique_lock<std::mutex> serialLock(channel.m_serialTX);
+	channel.rxCreditWindow = creditWindow(channel.localBaud);
+	serialLock.unlock();
+	grantCredits(channel, false);
+	return true;
 }
 
-bool SerialOverEthernet::SOELinkHandler::openRemotePort(const std::string& remoteSerial) {
-	std::unique_lock<std::mutex> lock(this->m_remoteReturn);
-	this->remotePortName = remoteSerial;
-	dbgprintf("[DBG] opening remote port: %s\n", this->remotePortName.c_str());
-	if (!sendRemoteOpen(remoteSerial)) {
-		printf("[!] failed to send open request for remote port: %s\n", this->remotePortName.c_str());
-		return false;
+void SerialOverEthernet::SOELinkHandler::requestCompression(bool enable) {
+	this->compressionRequested = enable;
+}
+
+int SerialOverEthernet::SOELinkHandler::requestRemoteOpen(unsigned char number, const std::string& remoteSerial) {
+	SOEChannel& channel = getChannel(number);
+	std::unique_lock<std::mutex> portLock(channel.m_localPort);
+	channel.remotePortName = remoteSerial; // read by the metrics
+	portLock.unlock();
+	dbgprintf("[DBG] opening remote port: %s (channel %u)\n", channel.remotePortName.c_str(), (unsigned int) number);
+	unsigned char options = 0;
+	if (this->compressionRequested) {
+		if (this->remoteFeatures & SOE_TCP_FEATURE_COMPRESSION)
+			options |= SOE_TCP_FEATURE_COMPRESSION;
+		else
+			printf("[!] remote does not support compression, link continues uncompressed: %s\n", channel.remotePortName.c_str());
 	}
-	if (this->cv_remoteReturn.wait_for(lock, std::chrono::milliseconds(SOE_TCP_HANDSHAKE_TIMEOUT)) == std::cv_status::timeout) {
-		printf("[!] handshake timed out, failed to open port: %s\n", this->remotePortName.c_str());
-		return false;
+
+	// the remote accepts compressed data as soon as it supports compression, no need to wait for the response
+	if ((options & SOE_TCP_FEATURE_COMPRESSION) && !channel.txCompressor) {
+		printf("[i] compression enabled: %s\n", channel.remotePortName.c_str());
+		channel.txCompressor.reset(new SerialOverEthernet::SOECompressor());
 	}
-	return this->remoteReturn;
+
+	int requestId = sendRemoteOpen(number, remoteSerial, options);
+	if (requestId < 0)
+		printf("[!] failed to send open request for remote port: %s\n", channel.remotePortName.c_str());
+	return requestId;
+}
+
+int SerialOverEthernet::SOELinkHandler::requestRemoteConfig(unsigned char number, const SerialAccess::SerialPortConfiguration& remoteConfig) {
+	SOEChannel& channel = getChannel(number);
+	dbgprintf("[DBG] changing remote port configuration: %s\n", channel.remotePortName.c_str());
+	int requestId = sendRemoteConfig(number, remoteConfig);
+	if (requestId < 0)
+		printf("[!] failed to send configuration request for remote port: %s\n", channel.remotePortName.c_str());
+	return requestId;
+}
+
+int SerialOverEthernet::SOELinkHandler::requestRemoteClose(unsigned char number) {
+	SOEChannel& channel = getChannel(number);
+	dbgprintf("[DBG] close remote port: %s\n", channel.remotePortName.c_str());
+	int requestId = sendRemoteClose(number);
+	if (requestId < 0)
+		printf("[!] failed to send close request for remote port: %s\n", channel.remotePortName.c_str());
+	return requestId;
 }
 
-bool SerialOverEthernet::SOELinkHandler::closeRemotePort() {
-	if (this->remotePortName.empty()) return true;
+bool SerialOverEthernet::SOELinkHandler::awaitRequest(int requestId) {
+	if (requestId < 0) return false;
 	std::unique_lock<std::mutex> lock(this->m_remoteReturn);
-	dbgprintf("[DBG] close remote port: %s\n", this->remotePortName.c_str());
-	if (!sendRemoteClose()) {
-		printf("[!] failed to send close request for remote port: %s\n", this->remotePortName.c_str());
-		return false;
-	}
-	if (this->cv_remoteReturn.wait_for(lock, std::chrono::milliseconds(SOE_TCP_HANDSHAKE_TIMEOUT)) == std::cv_status::timeout) {
-		printf("[!] handshake timed out, failed to close port: %s\n", this->remotePortName.c_str());
+	auto request = this->remoteRequests.find((unsigned short) requestId);
+	if (request == this->remoteRequests.end() || request->second.abandoned) return false;
+
+	if (!this->cv_remoteReturn.wait_for(lock, std::chrono::milliseconds(SOE_TCP_HANDSHAKE_TIMEOUT), [&request]() { return request->second.completed; })) {
+		// keep the request, so that an late confirm is not assigned to the next request
+		printf("[!] handshake timed out, failed to %s: %s\n", request->second.operation, request->second.portName.c_str());
+		request->second.abandoned = true;
 		return false;
 	}
-	return this->remoteReturn;
+	bool success = request->second.success;
+	this->remoteRequests.erase(request);
+	return success;
+}
+
+bool SerialOverEthernet::SOELinkHandler::openRemotePort(unsigned char number, const std::string& remoteSerial) {
+	return awaitRequest(requestRemoteOpen(number, remoteSerial));
+}
+
+bool SerialOverEthernet::SOELinkHandler::closeRemotePort(unsigned char number) {
+	if (getChannel(number).remotePortName.empty()) return true;
+	return awaitRequest(requestRemoteClose(number));
 }
 
-bool SerialOverEthernet::SOELinkHandler::setRemoteConfig(const SerialAccess::SerialPortConfiguration& remoteConfig) {
+bool SerialOverEthernet::SOELinkHandler::releaseChannel(unsigned char number) {
+	SOEChannel& channel = getChannel(number);
+	bool localClosed = closeLocalPort(number);
+	bool remoteClosed = closeRemotePort(number);
+
+	// an handler of the closed port still running on the event loop could read the names
+	if (this->eventLoop) this->eventLoop->sync();
+	std::unique_lock<std::mutex> portLock(channel.m_localPort);
+	dbgprintf("[DBG] channel released: %u\n", (unsigned int) number);
+	channel.localPortName.clear();
+	channel.remotePortName.clear();
+	portLock.unlock();
+
+	std::unique_lock<std::shared_mutex> lock(this->m_channels);
+	channel.allocated = false;
+	return localClosed && remoteClosed;
+}
+
+bool SerialOverEthernet::SOELinkHandler::hasAllocatedChannels() {
+	std::shared_lock<std::shared_mutex> lock(this->m_channels);
+	for (auto& entry : this->channels)
+		if (entry.second->allocated) return true;
+	return false;
+}
+
+bool SerialOverEthernet::SOELinkHandler::negotiateProtocol() {
 	std::unique_lock<std::mutex> lock(this->m_remoteReturn);
-	dbgprintf("[DBG] changing remote port configuration: %s\n", this->remotePortName.c_str());
-	if (!sendRemoteConfig(remoteConfig)) {
-		printf("[!] failed to send configuration request for remote port: %s\n", this->remotePortName.c_str());
+	dbgprintf("[DBG] negotiate protocol version: %s/%s\n", this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+	this->helloPending = true;
+
+	// an session is only offered if this side can reconnect to the remote
+	unsigned long long session = 0;
+	if (this->reconnect && sessionTimeout > 0) {
+		std::random_device seed;
+		std::mt19937_64 random(((unsigned long long) seed() << 32) | seed());
+		while (session == 0)
+			session = random();
+	}
+	if (!sendHello(SOE_TCP_PROTOCOL_VERSION, frameLimit, session)) {
+		printf("[!] failed to send protocol negotiation: %s/%s\n", this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+		this->helloPending = false;
 		return false;
 	}
-	if (this->cv_remoteReturn.wait_for(lock, std::chrono::milliseconds(SOE_TCP_HANDSHAKE_TIMEOUT)) == std::cv_status::timeout) {
-		printf("[!] handshake timed out, failed to change configuration: %s\n", this->remotePortName.c_str());
+	if (!this->cv_remoteReturn.wait_for(lock, std::chrono::milliseconds(SOE_TCP_HANDSHAKE_TIMEOUT), [this]() { return !this->helloPending; })) {
+		printf("[!] handshake timed out, failed to negotiate protocol: %s/%s\n", this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+		this->helloPending = false;
 		return false;
 	}
-	return this->remoteReturn;
+	lock.unlock();
+	updateSerialBuffer();
+	printf("[i] using protocol v%u, max frame length %u: %s/%s\n", this->rxProtocolVersion, this->rxFrameMaxLen, this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+
+	// the resume handshake relies on the v2 framing
+	if (session != 0 && (this->remoteFeatures & SOE_TCP_FEATURE_SESSION) && this->rxProtocolVersion >= 2) {
+		dbgprintf("[DBG] session established: %016llx\n", session);
+		this->sessionId = session;
+	}
+	return true;
 }
 
-void SerialOverEthernet::SOELinkHandler::handleClientTX() {
+bool SerialOverEthernet::SOELinkHandler::setRemoteConfig(unsigned char number, const SerialAccess::SerialPortConfiguration& remoteConfig) {
+	return awaitRequest(requestRemoteConfig(number, remoteConfig));
+}
 
-	char serialData[SOE_SERIAL_BUFFER_LEN] {0};
+void SerialOverEthernet::SOELinkHandler::handleClientTX(SOEChannel& channel) {
+
+	std::vector<char> serialData;	// headroom for the package header, followed by the serial data
 
 	while (isAlive()) {
 
-		if (this->localPort == 0 || !this->localPort->isOpen()) {
-			std::unique_lock<std::mutex> lock(this->m_localPort);
-			this->cv_openLocalPort.wait(lock, [this]() {
-				return (this->localPort != 0 && this->localPort->isOpen()) || !isAlive();
+		std::unique_lock<std::mutex> portLock(channel.m_localPort);
+		channel.cv_openLocalPort.wait(portLock, [this, &channel]() {
+			return (channel.localPort != 0 && channel.localPort->isOpen()) || !isAlive();
+		});
+		if (!isAlive()) break;
+		std::shared_ptr<SerialAccess::SerialPort> localPort = channel.localPort;
+		portLock.unlock();
+
+		// the length changes with the negotiated frame length, the number of channels and the baud of the port
+		unsigned int bufferLen = channel.serialBufferLen;
+		if (serialData.size() < SOE_SERIAL_DATA_HEADROOM + bufferLen)
+			serialData.resize(SOE_SERIAL_DATA_HEADROOM + bufferLen);
+		char* data = serialData.data() + SOE_SERIAL_DATA_HEADROOM;
+
+		// the data lost with the connection of an resumed session is transmitted first
+		bool session = this->sessionId != 0;
+		if (session && !retransmitSerialData(channel)) break;
+
+		// the data stays in the local port until the remote has space for it
+		bool credits = this->remoteFeatures & SOE_TCP_FEATURE_CREDITS;
+		if (credits) {
+			std::unique_lock<std::mutex> lock(channel.m_txCredits);
+			channel.cv_txCredits.wait(lock, [this, &channel]() {
+				return channel.txCredits > 0 || channel.retransmitPending || !isAlive();
 			});
 			if (!isAlive()) break;
+			if (channel.retransmitPending) continue;
+			if (bufferLen > channel.txCredits) bufferLen = (unsigned int) channel.txCredits;
 		}
 
-		unsigned long read = this->localPort->readBytes(serialData, SOE_SERIAL_BUFFER_LEN);
+		// in sessions the port is polled, so that retransmissions are not delayed until new data arrives
+		if (session && !localPort->waitForData(SOE_TCP_SESSION_POLL * 1000)) continue;
+
+		unsigned long read = localPort->readBytes(data, bufferLen);
 		if (read == 0) continue; // when port closed / timed out
+		channel.serialBytesRead += read;
+
+		// in sessions the data is kept until the remote acknowledged it, the credits are accounted together with it
+		std::shared_lock<std::shared_mutex> sessionLock;
+		if (session) {
+			if (!bufferSerialData(channel, data, read, sessionLock)) break;
+		} else if (credits) {
+			std::lock_guard<std::mutex> lock(channel.m_txCredits);
+			channel.txCredits -= read;
+		}
 
-		dbgprintf("[DBG] stream data: |serial| -> [network] : >%.*s<\n", (int) read, serialData);
+		dbgprintf("[DBG] stream data: |serial| -> [network] : >%.*s< (channel %u)\n", (int) read, data, (unsigned int) channel.number);
 
-		if (!sendSerialData(serialData, read)) {
+		// if the connection of an session was lost, the data is retransmitted after it was resumed
+		if (!sendSerialData(channel, data, read) && !session) {
 			printf("[!] frame error, unable to transmit serial data\n");
 			break;
 		}
@@ -165,94 +839,586 @@ void SerialOverEthernet::SOELinkHandler::handleClientTX() {
 
 }
 
-void SerialOverEthernet::SOELinkHandler::transmitSerialData(const char* data, unsigned int len) {
+void SerialOverEthernet::SOELinkHandler::handleSerialTX(SOEChannel& channel) {
 
-	if (this->localPort == 0 || !this->localPort->isOpen()) return;
+	std::vector<char> serialData;	// the data taken from the queue, written to the port
 
-	dbgprintf("[DBG] stream data: [serial] <- |network| : >%.*s<\n", len, data);
+	while (isAlive()) {
+
+		std::unique_lock<std::mutex> lock(channel.m_serialTX);
+		channel.cv_serialTX.wait(lock, [this, &channel]() {
+			return !channel.serialTXQueue.empty() || !isAlive();
+		});
+		if (!isAlive()) break;
+		serialData.swap(channel.serialTXQueue);
+		channel.serialTXQueue.clear();
+		lock.unlock();
+
+		// the port blocks until everything is written, data received while the port is closed is discarded
+		std::unique_lock<std::mutex> portLock(channel.m_localPort);
+		std::shared_ptr<SerialAccess::SerialPort> localPort = channel.localPort;
+		portLock.unlock();
+		if (localPort != 0 && localPort->isOpen()) {
+			dbgprintf("[DBG] stream data: [serial] <- |network| : >%.*s< (channel %u)\n", (int) serialData.size(), serialData.data(), (unsigned int) channel.number);
+			if (localPort->writeBytes(serialData.data(), serialData.size()) < serialData.size())
+				channel.serialErrors++;
+		}
 
-	this->localPort->writeBytes(data, len);
+		lock.lock();
+		channel.rxBytesWritten += serialData.size();
+		lock.unlock();
+		channel.cv_serialTX.notify_all();
+
+		// the credits of an lost connection are included in the resync of the session
+		if (!grantCredits(channel, false) && this->sessionId == 0) {
+			printf("[!] frame error, unable to transmit credits\n");
+			break;
+		}
+
+	}
+
+	dbgprintf("[DBG] serial TX terminated\n");
+
+}
+
+void SerialOverEthernet::SOELinkHandler::queueSerialData(SOEChannel& channel, const char* data, unsigned int len) {
+
+	// with an event loop the data is written as far as the port accepts it, the rest when the port reports space
+	if (this->eventLoop) {
+		std::unique_lock<std::mutex> lock(channel.m_serialTX);
+		if (!(this->remoteFeatures & SOE_TCP_FEATURE_CREDITS) && this->thread_rx.joinable()) {
+			// only an RX thread can wait for space, the reception of the event loop is paused by updateClientEvents() instead
+			channel.cv_serialTX.wait(lock, [this, &channel, len]() {
+				return channel.serialTXQueue.empty() || channel.serialTXQueue.size() + len <= SOE_SERIAL_TX_QUEUE_LEN || !isAlive();
+			});
+		}
+		channel.serialTXQueue.insert(channel.serialTXQueue.end(), data, data + len);
+		lock.unlock();
+		writeSerialData(channel);
+		updateSerialEvents(channel);
+		return;
+	}
+
+	// remotes with credits never send more than the window, for other remotes the reception is held back until space is available
+	std::unique_lock<std::mutex> lock(channel.m_serialTX);
+	if (!(this->remoteFeatures & SOE_TCP_FEATURE_CREDITS)) {
+		channel.cv_serialTX.wait(lock, [this, &channel, len]() {
+			return channel.serialTXQueue.empty() || channel.serialTXQueue.size() + len <= SOE_SERIAL_TX_QUEUE_LEN || !isAlive();
+		});
+	}
+	channel.serialTXQueue.insert(channel.serialTXQueue.end(), data, data + len);
+	lock.unlock();
+	channel.cv_serialTX.notify_all();
 
 }
 
 void SerialOverEthernet::SOELinkHandler::handleClientRX() {
 
-	char packageFrame[SOE_TCP_FRAME_MAX_LEN] {0};
-	unsigned int headerLen = 0;
+	int status;
+	while ((status = receiveFrames()) != 0) {
+		// an session is resumed if the connection was lost
+		if (status < 0 && !resumeSession())
+			break;
+	}
+
+	dbgprintf("[DBG] client socket RX terminated, shutting down ...\n");
+	shutdown();
+
+}
+
+int SerialOverEthernet::SOELinkHandler::receiveFrames() {
 
+	bool received = false;
 	while (isAlive()) {
 
-		if (!this->socket->receive(packageFrame, SOE_TCP_HEADER_LEN, &headerLen)) {
-			if (socket->lastError() == 0)
+		// process all complete frames in the buffer
+		// the version can change while processing an frame, but only after the frame which requested it
+		bool frameV2 = this->rxProtocolVersion >= 2;
+		unsigned int headerLen = 0;
+		unsigned int payloadLen = 0;
+		int status = frameV2 ?
+				parseFrameV2(this->rxBuffer.data() + this->rxBufferStart, this->rxBufferEnd - this->rxBufferStart, this->rxFrameMaxLen, &headerLen, &payloadLen) :
+				parseFrameV1(this->rxBuffer.data() + this->rxBufferStart, this->rxBufferEnd - this->rxBufferStart, &headerLen, &payloadLen);
+		if (status < 0)
+			return 0;
+		if (status > 0) {
+			const char* payload = this->rxBuffer.data() + this->rxBufferStart + headerLen;
+			this->rxBufferStart += headerLen + payloadLen;
+			this->framesReceived++;
+
+			// attempt to process the package, an session is resumed if the response failed because the connection was lost
+			if (!(frameV2 ? processFrameV2(payload, payloadLen) : processPackage(payload, payloadLen, 0))) {
+				if (this->sessionId != 0 && isAlive() && !this->sessionClosed && !this->transport->isOpen())
+					return -1;
+				printf("[!] frame error, package response failed\n");
+				return 0;
+			}
+
+			// the remote shut down deliberately, there is nothing to resume
+			if (this->sessionClosed)
+				return 0;
+			continue;
+		}
+
+		// move the incomplete frame to the beginning, and grow the buffer after the frame length was negotiated
+		if (this->rxBufferStart > 0) {
+			memmove(this->rxBuffer.data(), this->rxBuffer.data() + this->rxBufferStart, this->rxBufferEnd - this->rxBufferStart);
+			this->rxBufferEnd -= this->rxBufferStart;
+			this->rxBufferStart = 0;
+		}
+		if (this->rxBuffer.size() < this->rxFrameMaxLen + SOE_TCP_HEADER_LEN)
+			this->rxBuffer.resize(this->rxFrameMaxLen + SOE_TCP_HEADER_LEN);
+
+		// the event loop only reported data for one receive call, the reception continues with its next event
+		if (received)
+			return 1;
+
+		// receive as much as available, which might contain multiple frames
+		unsigned int count = 0;
+		if (!this->transport->receive(this->rxBuffer.data() + this->rxBufferEnd, this->rxBuffer.size() - this->rxBufferEnd, &count)) {
+			if (this->sessionId != 0 && isAlive() && !this->sessionClosed)
+				return -1;
+			if (this->transport->lastError() == 0)
 				printf("[DBG] client socket returned EOF\n");
 			else
-				printf("[DBG] client socket header RX returned with error code: %d\n", this->socket->lastError());
-			break;
+				printf("[DBG] client socket RX returned with error code: %d\n", this->transport->lastError());
+			return 0;
 		}
+		this->rxBufferEnd += count;
+		this->bytesReceived += count;
+		received = true;
 
-		// check for header
-		if (headerLen < SOE_TCP_HEADER_LEN) {
-			printf("[!] frame error, receivied incomplete frame header\n");
-			break;
-		}
+	}
+	return 0;
 
-		// check protocol identifier
-		for (unsigned char i = 0; i < SOE_TCP_PROTO_IDENT_LEN; i++)
-			if (packageFrame[i] != ((SOE_TCP_PROTO_IDENT >> i * 8) & 0xFF)) {
-				printf("[!] frame error, received package with unknown identifier: %*.s\n", SOE_TCP_PROTO_IDENT_LEN, packageFrame);
-				break;
-			}
+}
 
-		// read package len
-		unsigned int payloadLen = 0;
-		for (unsigned char i = 0; i < SOE_TCP_FRAME_LEN_BYTES; i++)
-			payloadLen |= (((unsigned char) packageFrame[SOE_TCP_PROTO_IDENT_LEN + i]) << (i * 8));
-		if (payloadLen > SOE_TCP_FRAME_MAX_LEN - SOE_TCP_HEADER_LEN) {
-			printf("[!] frame error, received package with oversize payload: %u\n", payloadLen);
-			break;
+void SerialOverEthernet::SOELinkHandler::handleClientEvent(unsigned int events) {
+
+	// the transport has space for the deferred bytes again
+	if (events & SOE_EVENT_WRITE)
+		flushTransmission();
+	if (!(events & (SOE_EVENT_READ | SOE_EVENT_ERROR)))
+		return;
+
+	int status = receiveFrames();
+	if (status > 0) {
+		updateClientEvents();
+		return;
+	}
+
+	unwatchTransport();
+	if (status == 0) {
+		dbgprintf("[DBG] client socket RX terminated, shutting down ...\n");
+		shutdown();
+		return;
+	}
+
+	// resuming the session can take until it expires, so it can not block the event loop
+	if (this->thread_resume.joinable())
+		this->thread_resume.join();
+	this->thread_resume = std::thread([this]() -> void {
+		this->applyThreadConfig("resume");
+		if (resumeSession()) {
+			watchTransport();
+			return;
 		}
+		dbgprintf("[DBG] client socket RX terminated, shutting down ...\n");
+		shutdown();
+	});
 
-		// read remaining payload
-		unsigned int received = 0;
-		while (received < payloadLen && isAlive()) {
-			if (!this->socket->receive(packageFrame + headerLen, payloadLen, &received)) {
-				printf("[DBG] client socket payload RX returned with error code: %d\n", this->socket->lastError());
-			}
+}
+
+void SerialOverEthernet::SOELinkHandler::handleSerialEvent(SOEChannel& channel, unsigned int events) {
+
+	// the data lost with the connection of an resumed session is transmitted first
+	if (this->sessionId != 0 && !retransmitSerialData(channel))
+		return;
+
+	if ((events & (SOE_EVENT_READ | SOE_EVENT_ERROR)) && !readSerialData(channel)) {
+		printf("[!] frame error, unable to transmit serial data\n");
+		shutdown();
+		return;
+	}
+	if (events & (SOE_EVENT_WRITE | SOE_EVENT_ERROR)) {
+		writeSerialData(channel);
+		updateClientEvents();
+	}
+	updateSerialEvents(channel);
+
+}
+
+bool SerialOverEthernet::SOELinkHandler::readSerialData(SOEChannel& channel) {
+
+	// the length changes with the negotiated frame length, the number of channels and the baud of the port
+	unsigned int bufferLen = channel.serialBufferLen;
+	if (channel.serialData.size() < SOE_SERIAL_DATA_HEADROOM + bufferLen)
+		channel.serialData.resize(SOE_SERIAL_DATA_HEADROOM + bufferLen);
+	char* data = channel.serialData.data() + SOE_SERIAL_DATA_HEADROOM;
+
+	// the data stays in the local port until the remote has space for it, and in sessions until it fits in the retransmission buffer
+	bool session = this->sessionId != 0;
+	bool credits = this->remoteFeatures & SOE_TCP_FEATURE_CREDITS;
+	std::unique_lock<std::mutex> lock(channel.m_txCredits);
+	if (credits && bufferLen > channel.txCredits)
+		bufferLen = (unsigned int) channel.txCredits;
+	if (session && bufferLen > SOE_SERIAL_RETRANSMIT_LEN - channel.retransmitBuffer.size())
+		bufferLen = SOE_SERIAL_RETRANSMIT_LEN - channel.retransmitBuffer.size();
+	lock.unlock();
+	if (bufferLen == 0) return true;
+
+	long read = channel.localPort->tryReadBytes(data, bufferLen);
+	if (read == SerialAccess::SERIAL_IO_ERROR) {
+		printf("[!] local port failed: %s\n", channel.localPortName.c_str());
+		channel.localPortFailed = true;
+		channel.serialErrors++;
+		return true;
+	}
+	if (read <= 0) return true;
+	channel.serialBytesRead += read;
+
+	// in sessions the data is kept until the remote acknowledged it, while an lost connection is resumed it is only retransmitted afterwards
+	std::shared_lock<std::shared_mutex> sessionLock;
+	bool transmit = true;
+	if (session) {
+		sessionLock = std::shared_lock<std::shared_mutex>(this->m_session);
+		lock.lock();
+		channel.retransmitBuffer.insert(channel.retransmitBuffer.end(), data, data + read);
+		channel.txSequence += read;
+		transmit = !channel.resyncPending && !channel.retransmitPending;
+	} else {
+		lock.lock();
+	}
+	if (credits)
+		channel.txCredits = channel.txCredits > (unsigned long) read ? channel.txCredits - read : 0;
+	lock.unlock();
+
+	dbgprintf("[DBG] stream data: |serial| -> [network] : >%.*s< (channel %u)\n", (int) read, data, (unsigned int) channel.number);
+
+	// if the connection of an session was lost, the data is retransmitted after it was resumed
+	if (transmit && !sendSerialData(channel, data, (unsigned int) read) && !session)
+		return false;
+	return true;
+
+}
+
+void SerialOverEthernet::SOELinkHandler::writeSerialData(SOEChannel& channel) {
+
+	std::unique_lock<std::mutex> lock(channel.m_serialTX);
+	if (channel.serialTXQueue.empty()) return;
+
+	// data received while the port is closed or failed is discarded, an RX thread can write while the port is closed
+	std::unique_lock<std::mutex> portLock(channel.m_localPort);
+	std::shared_ptr<SerialAccess::SerialPort> localPort = channel.localPort;
+	portLock.unlock();
+	long written = channel.serialTXQueue.size();
+	if (channel.serialSource != 0 && !channel.localPortFailed && localPort != 0 && localPort->isOpen()) {
+		written = localPort->tryWriteBytes(channel.serialTXQueue.data(), channel.serialTXQueue.size());
+		if (written == SerialAccess::SERIAL_IO_WOULD_BLOCK) {
+			written = 0;
+		} else if (written == SerialAccess::SERIAL_IO_ERROR) {
+			printf("[!] local port failed: %s\n", channel.localPortName.c_str());
+			channel.localPortFailed = true;
+			channel.serialErrors++;
+			written = channel.serialTXQueue.size();
+		} else {
+			dbgprintf("[DBG] stream data: [serial] <- |network| : >%.*s< (channel %u)\n", (int) written, channel.serialTXQueue.data(), (unsigned int) channel.number);
 		}
+	}
+	if (written == 0) return;
+	channel.serialTXQueue.erase(channel.serialTXQueue.begin(), channel.serialTXQueue.begin() + written);
+	channel.rxBytesWritten += written;
+	lock.unlock();
+	channel.cv_serialTX.notify_all();
 
-		// attempt to process the package
-		if (!processPackage(packageFrame + headerLen, payloadLen)) {
-			printf("[!] frame error, package response failed\n");
-			break;
+	// the credits of an lost connection are included in the resync of the session
+	if (!grantCredits(channel, false) && this->sessionId == 0)
+		printf("[!] frame error, unable to transmit credits\n");
+
+}
+
+void SerialOverEthernet::SOELinkHandler::watchTransport() {
+	// the resume and resync packages send before might be deferred already
+	std::unique_lock<std::mutex> txLock(this->m_socketTX);
+	std::unique_lock<std::mutex> lock(this->m_transport);
+	if (this->eventLoop == nullptr || this->thread_rx.joinable() || !isAlive()) return;
+	this->clientSource = this->eventLoop->watch(this->transport->getHandle(), SOE_EVENT_READ | (this->txDeferred.empty() ? 0 : SOE_EVENT_WRITE), [this](unsigned int events) {
+		this->handleClientEvent(events);
+	});
+	if (this->clientSource != 0) return;
+	lock.unlock();
+	txLock.unlock();
+	printf("[!] unable to handle connection with event loop: %s/%s\n", this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+	shutdown();
+}
+
+void SerialOverEthernet::SOELinkHandler::unwatchTransport() {
+	std::lock_guard<std::mutex> lock(this->m_transport);
+	if (this->clientSource == 0) return;
+	this->eventLoop->unwatch(this->clientSource);
+	this->clientSource = 0;
+}
+
+void SerialOverEthernet::SOELinkHandler::updateClientEvents() {
+	// remotes with credits never send more than the local ports can take
+	if (!(this->remoteFeatures & SOE_TCP_FEATURE_CREDITS)) {
+		bool backlog = false;
+		std::shared_lock<std::shared_mutex> channelLock(this->m_channels);
+		for (auto& channel : this->channels) {
+			std::lock_guard<std::mutex> lock(channel.second->m_serialTX);
+			if (channel.second->serialTXQueue.size() > SOE_SERIAL_TX_QUEUE_LEN)
+				backlog = true;
 		}
+		channelLock.unlock();
+		this->rxPaused = backlog;
+	}
+
+	std::lock_guard<std::mutex> txLock(this->m_socketTX);
+	applyClientEvents();
+}
+
+void SerialOverEthernet::SOELinkHandler::applyClientEvents() {
+	std::lock_guard<std::mutex> lock(this->m_transport);
+	if (this->clientSource != 0)
+		this->eventLoop->modify(this->clientSource, (this->rxPaused ? 0 : SOE_EVENT_READ) | (this->txDeferred.empty() ? 0 : SOE_EVENT_WRITE));
+}
 
+void SerialOverEthernet::SOELinkHandler::updateSerialEvents(SOEChannel& channel) {
+	unsigned long source = channel.serialSource;
+	if (source == 0) return;
+	bool session = this->sessionId != 0;
+	bool credits = this->remoteFeatures & SOE_TCP_FEATURE_CREDITS;
+
+	// the state stays locked until the events were applied, so that updates from different threads are not applied in the wrong order
+	std::lock_guard<std::mutex> lock(channel.m_txCredits);
+	std::lock_guard<std::mutex> serialLock(channel.m_serialTX);
+	unsigned int events = 0;
+	if (!channel.localPortFailed && !this->txBlocked && (!credits || channel.txCredits > 0) && (!session || channel.retransmitBuffer.size() < SOE_SERIAL_RETRANSMIT_LEN))
+		events |= SOE_EVENT_READ;
+	if (!channel.serialTXQueue.empty())
+		events |= SOE_EVENT_WRITE;
+	this->eventLoop->modify(source, events);
+
+	// the data lost with the connection of an resumed session is retransmitted by the event loop, like new serial data
+	if (channel.retransmitPending && !channel.resyncPending)
+		this->eventLoop->trigger(source);
+}
+
+bool SerialOverEthernet::SOELinkHandler::processFrameV2(const char* frame, unsigned int frameLen) {
+	unsigned int offset = 0;
+	while (offset < frameLen) {
+		unsigned int recordLen;
+		unsigned int fieldLen = readVarint(frame + offset, frameLen - offset, &recordLen);
+		if (fieldLen == 0 || recordLen > frameLen - offset - fieldLen) {
+			printf("[!] frame error, received malformed record\n");
+			return false;
+		}
+		offset += fieldLen;
+		if (!processPackage(frame + offset, recordLen, 0))
+			return false;
+		offset += recordLen;
 	}
+	return true;
+}
 
-	dbgprintf("[DBG] client socket RX terminated, shutting down ...\n");
-	shutdown();
+bool SerialOverEthernet::SOELinkHandler::transmitPackage(char* package, unsigned int packageLen) {
+
+	// acquire mutex for transmission
+	std::unique_lock<std::mutex> lock(this->m_socketTX);
+
+	// nothing is transmitted while the connection of an session is lost, the serial data and credits are resynced after it was resumed
+	if (this->suspended) return false;
 
+	if (this->txProtocolVersion >= 2) {
+		lock.unlock();
+		return transmitPackageV2(package, packageLen);
+	}
+	return transmitPackageV1(package, packageLen);
 }
 
-bool SerialOverEthernet::SOELinkHandler::transmitPackage(const char* package, unsigned int packageLen) {
+bool SerialOverEthernet::SOELinkHandler::transmitPackageV1(char* package, unsigned int packageLen) {
 
-	// assemble frame header
-	char frameHeader[SOE_TCP_HEADER_LEN] {0};
+	// assemble frame header in the headroom in front of the package
+	char* frameHeader = package - SOE_TCP_HEADER_LEN;
 	for (unsigned char i = 0; i < SOE_TCP_PROTO_IDENT_LEN; i++)
 		frameHeader[i] = (SOE_TCP_PROTO_IDENT >> i * 8) & 0xFF;
 	for (unsigned char i = 0; i < SOE_TCP_FRAME_LEN_BYTES; i++)
 		frameHeader[SOE_TCP_PROTO_IDENT_LEN + i] = (packageLen >> i * 8) & 0xFF;
 
-	// acquire mutex for transmission
-	std::unique_lock<std::mutex> lock(this->m_socketTX);
+	return transmitFrameLocked(frameHeader, SOE_TCP_HEADER_LEN + packageLen);
+}
+
+bool SerialOverEthernet::SOELinkHandler::transmitPackageV2(char* package, unsigned int packageLen) {
 
-	if (!this->socket->send(frameHeader, SOE_TCP_HEADER_LEN)) {
-		printf("[!] transmission error, unable to transmit frame header\n");
+	// the record length goes directly in front of the package
+	unsigned int fieldLen = writeVarintBefore(package, packageLen);
+	char* record = package - fieldLen;
+	unsigned int recordLen = fieldLen + packageLen;
+	std::unique_lock<std::mutex> lock(this->m_socketTX);
+	if (recordLen > this->txFrameMaxLen) {
+		printf("[!] transmission error, package too large: %u\n", packageLen);
 		return false;
 	}
-	if (!this->socket->send(package, packageLen)) {
-		printf("[!] transmission error, unable to transmit package payload\n");
+
+	// wait until the record fits in the queue, while an other thread transmits the previous records
+	// the event loop can not wait for itself, while it has deferred bytes the records are queued beyond one frame
+	this->cv_socketTX.wait(lock, [this, recordLen]() {
+		return this->txQueue.size() - SOE_TCP_VARINT_MAX_LEN + recordLen <= this->txFrameMaxLen || !this->txDeferred.empty() || this->suspended || !isAlive();
+	});
+	if (this->suspended || !isAlive()) return false;
+
+	if (!this->txSending && this->txQueue.size() == SOE_TCP_VARINT_MAX_LEN) {
+
+		// nothing waiting, transmit the record as its own frame directly from the callers buffer
+		this->txSending = true;
+		lock.unlock();
+
+		unsigned int headerLen = writeVarintBefore(record, recordLen);
+		unsigned int sent = 0;
+		bool success = transmitFrame(record - headerLen, recordLen + headerLen, &sent);
+
+		lock.lock();
+		if (!success) {
+			this->txSending = false;
+			this->cv_socketTX.notify_all();
+			return false;
+		}
+		if (sent < recordLen + headerLen)
+			deferTransmission(record - headerLen + sent, recordLen + headerLen - sent);
+
+	} else {
+
+		this->txQueue.insert(this->txQueue.end(), record, record + recordLen);
+
+		// if an other thread is currently transmitting, it will pick up the record with the next frame
+		if (this->txSending) return true;
+		this->txSending = true;
+
+	}
+
+	return transmitQueue(lock);
+}
+
+bool SerialOverEthernet::SOELinkHandler::transmitQueue(std::unique_lock<std::mutex>& lock) {
+
+	// transmit frames until no more records are waiting, records queued meanwhile share the next frame
+	bool success = true;
+	while (success && this->txDeferred.empty() && this->txQueue.size() > SOE_TCP_VARINT_MAX_LEN) {
+		if (this->txQueue.size() - SOE_TCP_VARINT_MAX_LEN <= this->txFrameMaxLen) {
+			this->txFrame.swap(this->txQueue);
+			this->txQueue.resize(SOE_TCP_VARINT_MAX_LEN);
+		} else {
+			// the records queued while bytes were deferred can exceed one frame, the records not fitting stay queued
+			unsigned int frameEnd = SOE_TCP_VARINT_MAX_LEN;
+			while (frameEnd < this->txQueue.size()) {
+				unsigned int packageLen = 0;
+				unsigned int fieldLen = readVarint(this->txQueue.data() + frameEnd, this->txQueue.size() - frameEnd, &packageLen);
+				if (frameEnd + fieldLen + packageLen - SOE_TCP_VARINT_MAX_LEN > this->txFrameMaxLen) break;
+				frameEnd += fieldLen + packageLen;
+			}
+			this->txFrame.assign(this->txQueue.begin(), this->txQueue.begin() + frameEnd);
+			this->txQueue.erase(this->txQueue.begin() + SOE_TCP_VARINT_MAX_LEN, this->txQueue.begin() + frameEnd);
+		}
+		this->cv_socketTX.notify_all();
+		lock.unlock();
+
+		unsigned int payloadLen = this->txFrame.size() - SOE_TCP_VARINT_MAX_LEN;
+		unsigned int headerLen = writeVarintBefore(this->txFrame.data() + SOE_TCP_VARINT_MAX_LEN, payloadLen);
+		const char* frame = this->txFrame.data() + SOE_TCP_VARINT_MAX_LEN - headerLen;
+		unsigned int frameLen = payloadLen + headerLen;
+		unsigned int sent = 0;
+		success = transmitFrame(frame, frameLen, &sent);
+
+		lock.lock();
+		if (success && sent < frameLen)
+			deferTransmission(frame + sent, frameLen - sent);
+	}
+
+	// the event loop continues the transmission when the transport has space again
+	if (success && !this->txDeferred.empty())
+		return true;
+	this->txDeferred.clear();
+	this->txSending = false;
+	this->cv_socketTX.notify_all();
+	return success;
+}
+
+bool SerialOverEthernet::SOELinkHandler::transmitPackageDirect(char* package, unsigned int packageLen) {
+
+	// the package is prefixed by its record length and the frame length
+	unsigned int fieldLen = writeVarintBefore(package, packageLen);
+	char* record = package - fieldLen;
+	unsigned int recordLen = fieldLen + packageLen;
+	unsigned int headerLen = writeVarintBefore(record, recordLen);
+
+	return transmitFrameLocked(record - headerLen, recordLen + headerLen);
+}
+
+bool SerialOverEthernet::SOELinkHandler::transmitFrameLocked(const char* frame, unsigned int frameLen) {
+
+	// the frame must not overtake the bytes deferred to the event loop
+	if (!this->txDeferred.empty()) {
+		this->txDeferred.insert(this->txDeferred.end(), frame, frame + frameLen);
+		this->framesSent++;
+		return true;
+	}
+
+	unsigned int sent = 0;
+	if (!transmitFrame(frame, frameLen, &sent))
 		return false;
+	if (sent < frameLen) {
+		this->txSending = true;
+		deferTransmission(frame + sent, frameLen - sent);
 	}
+	return true;
+}
 
+bool SerialOverEthernet::SOELinkHandler::transmitFrame(const char* frame, unsigned int frameLen, unsigned int* sent) {
+	if (!this->transport->trySend(frame, frameLen, sent)) {
+		printf("[!] transmission error, unable to transmit frame\n");
+		this->transport->close();
+		return false;
+	}
+	this->bytesSent += *sent;
+	this->framesSent++;
 	return true;
 }
+
+void SerialOverEthernet::SOELinkHandler::deferTransmission(const char* data, unsigned int dataLen) {
+	dbgprintf("[DBG] transport would block, %u bytes deferred to the event loop\n", dataLen);
+	this->txDeferred.insert(this->txDeferred.end(), data, data + dataLen);
+	this->txBlocked = true;
+	applyClientEvents();
+}
+
+void SerialOverEthernet::SOELinkHandler::flushTransmission() {
+	std::unique_lock<std::mutex> lock(this->m_socketTX);
+	if (this->txDeferred.empty()) return;
+
+	// the transport does not block, so the lock can be held while transmitting
+	unsigned int sent = 0;
+	if (!this->transport->trySend(this->txDeferred.data(), this->txDeferred.size(), &sent)) {
+		printf("[!] transmission error, unable to transmit frame\n");
+		this->transport->close();
+		sent = this->txDeferred.size();
+	}
+	this->bytesSent += sent;
+	this->txDeferred.erase(this->txDeferred.begin(), this->txDeferred.begin() + sent);
+	if (!this->txDeferred.empty()) return;
+
+	// continue with the records queued meanwhile, they might be deferred again
+	transmitQueue(lock);
+	if (!this->txDeferred.empty()) return;
+	this->txBlocked = false;
+	applyClientEvents();
+	lock.unlock();
+
+	// the local ports were not read while the bytes were deferred
+	std::shared_lock<std::shared_mutex> channelLock(this->m_channels);
+	std::vector<SOEChannel*> channels;
+	for (auto& channel : this->channels)
+		channels.push_back(channel.second.get());
+	channelLock.unlock();
+	for (SOEChannel* channel : channels)
+		updateSerialEvents(*channel);
+}
@@ -10,41 +10,425 @@
 
 #include <iostream>
 #include <algorithm>
+#include <map>
+#include <memory>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <shared_mutex>
+#include <iterator>
 #include "soemain.hpp"
+#include "soemetrics.hpp"
 #include "dbgprintf.h"
 
 static std::mutex m_clientConnections;
 static std::condition_variable cv_clientConnections;
 static std::vector<SerialOverEthernet::SOELinkHandler*> clientConnections;
+static std::map<std::string, SerialOverEthernet::SOELinkHandler*> linkConnections; // outgoing connections by remote address, shared by the links to the same remote
+
+// An shard of the server, accepting connections with its own listener and handling them on its own event loop.
+// Each shard has its own registry, so that accepting and reaping connections does not contend on a single lock.
+struct SOEServerShard {
+	SerialOverEthernet::SOEEventLoop* eventLoop;
+	std::unique_ptr<SerialOverEthernet::SOETcpListener> listener;
+	unsigned long listenerSource;
+	std::mutex m_connections;										// protect the connections against async modification
+	std::vector<SerialOverEthernet::SOELinkHandler*> connections;	// the connections accepted by this shard
+};
+static std::vector<std::unique_ptr<SOEServerShard>> serverShards; // only modified before the latency monitor and the metrics endpoint are started
+
+static std::mutex m_reaper;
+static std::condition_variable cv_reaper;
+static std::vector<std::pair<SerialOverEthernet::SOELinkHandler*, SOEServerShard*>> reaperQueue; // the closed handlers to delete, with the shard which accepted them
+static bool reaperStop = false;
+static std::shared_mutex m_linkSetup; // held shared while establishing or closing links, which use the handlers of the global registry without holding its lock
+static std::shared_mutex m_registryUse; // held shared while the latency monitor and the metrics endpoint use copies of the registries, the reaper does not delete handlers meanwhile
+static std::atomic<unsigned long long> connectionCount(0); // total number of connection handlers created
+static std::string metricsAddress;
+
+static unsigned int latencyPingInterval = SOE_TCP_PING_INTERVAL;
+static unsigned int latencyStatsInterval = 0;
+static std::mutex m_latencyMonitor;
+static std::condition_variable cv_latencyMonitor;
+static bool latencyMonitorStop = false;
+
+static unsigned int eventLoopCount = SOE_EVENT_LOOPS;
+static SerialAccess::SerialThreadConfig eventLoopConfig = SerialAccess::DEFAULT_THREAD_CONFIGURATION;
+
+// An link of the link configuration file
+struct SOEFileLink {
+	SOELinkConfig config;
+	SerialOverEthernet::SOELinkHandler* handler;		// the connection carrying the link, nullptr while the link is not established
+	int channel;										// the channel of the link on the connection
+	std::chrono::steady_clock::time_point retry;		// when to establish the link again while it is not established
+};
+static std::string linkFilePath;
+static unsigned int linkParallelism = SOE_LINK_PARALLELISM;
+static std::mutex m_fileLinks;
+static std::map<std::string, SOEFileLink> fileLinks; // the links of the configuration file by their options, only added and removed by the link file thread
+static std::mutex m_linkFile;
+static std::condition_variable cv_linkFile;
+static bool linkFileStop = false;
+
+void configureLatencyMonitor(unsigned int pingInterval, unsigned int statsInterval) {
+	latencyPingInterval = pingInterval;
+	latencyStatsInterval = statsInterval;
+}
 
-void cleanupDeadConnectionHandlers() {
-	std::lock_guard<std::mutex> lock(m_clientConnections);
-	clientConnections.erase(std::remove_if(clientConnections.begin(), clientConnections.end(), [](SerialOverEthernet::SOELinkHandler* managedHandler){
-		if (!managedHandler->isAlive()) {
+void configureEventLoops(unsigned int count, const SerialAccess::SerialThreadConfig& config) {
+	eventLoopCount = count;
+	eventLoopConfig = config;
+}
+
+void configureMetrics(const std::string& address) {
+	metricsAddress = address;
+}
+
+void configureLinks(const std::string& path, unsigned int parallelism) {
+	linkFilePath = path;
+	linkParallelism = parallelism;
+}
+
+// Copies the handlers of all registries, so that they can be used without blocking the registries.
+// Has to be called with m_registryUse held shared, so that the handlers are not deleted while they are used.
+static std::vector<SerialOverEthernet::SOELinkHandler*> listConnections() {
+	std::unique_lock<std::mutex> lock(m_clientConnections);
+	std::vector<SerialOverEthernet::SOELinkHandler*> connections(clientConnections);
+	lock.unlock();
+	for (auto& shard : serverShards) {
+		std::lock_guard<std::mutex> shardLock(shard->m_connections);
+		connections.insert(connections.end(), shard->connections.begin(), shard->connections.end());
+	}
+	return connections;
+}
+
+// Adds the metrics of the connections, has to be called with m_registryUse held shared
+static void collectLinkMetrics(SerialOverEthernet::SOEMetricsWriter& metrics, const std::vector<SerialOverEthernet::SOELinkHandler*>& connections, unsigned long long* alive) {
+	SerialOverEthernet::SOELinkStats stats;
+	SerialOverEthernet::SOELatencyStats latency;
+	for (SerialOverEthernet::SOELinkHandler* handler : connections) {
+		if (!handler->isAlive()) continue;
+		(*alive)++;
+		handler->getLinkStats(stats);
+		handler->getLatencyStats(latency);
+		std::string remote = SerialOverEthernet::SOEMetricsWriter::label("remote", handler->getRemoteAddress());
+
+		metrics.add("soe_link_bytes_total", "counter", "Bytes transferred over the connection, including the frame headers.", remote + ",direction=\"sent\"", stats.bytesSent);
+		metrics.add("soe_link_bytes_total", "counter", "Bytes transferred over the connection, including the frame headers.", remote + ",direction=\"received\"", stats.bytesReceived);
+		metrics.add("soe_link_frames_total", "counter", "Frames transferred over the connection.", remote + ",direction=\"sent\"", stats.framesSent);
+		metrics.add("soe_link_frames_total", "counter", "Frames transferred over the connection.", remote + ",direction=\"received\"", stats.framesReceived);
+		metrics.add("soe_link_resumes_total", "counter", "Sessions resumed after the connection was lost.", remote, stats.resumes);
+		metrics.add("soe_link_transmit_queue_bytes", "gauge", "Bytes waiting in the transmission queue of the connection.", remote, (unsigned long long) stats.transmitQueue);
+		metrics.add("soe_link_rtt_probes_total", "counter", "Round trip time probes send.", remote, latency.probes);
+		metrics.add("soe_link_rtt_responses_total", "counter", "Round trip time probe responses received.", remote, latency.responses);
+		if (latency.samples > 0) {
+			metrics.add("soe_link_rtt_last_seconds", "gauge", "Round trip time of the last probe.", remote, latency.last / 1000000.0);
+			metrics.add("soe_link_rtt_min_seconds", "gauge", "Min round trip time of the recent probes.", remote, latency.min / 1000000.0);
+			metrics.add("soe_link_rtt_avg_seconds", "gauge", "Average round trip time of the recent probes.", remote, latency.avg / 1000000.0);
+			metrics.add("soe_link_rtt_p99_seconds", "gauge", "99th percentile round trip time of the recent probes.", remote, latency.p99 / 1000000.0);
+			metrics.add("soe_link_rtt_jitter_seconds", "gauge", "Smoothed variation between subsequent round trip times.", remote, latency.jitter / 1000000.0);
+		}
+		// links handled by an event loop have no threads of their own
+		if (stats.rxThreadCpuTime > 0)
+			metrics.add("soe_link_thread_cpu_seconds_total", "counter", "CPU time of the threads of the connection.", remote + ",thread=\"rx\"", stats.rxThreadCpuTime / 1000000.0);
+		if (stats.txThreadCpuTime > 0)
+			metrics.add("soe_link_thread_cpu_seconds_total", "counter", "CPU time of the threads of the connection.", remote + ",thread=\"tx\"", stats.txThreadCpuTime / 1000000.0);
+
+		for (SerialOverEthernet::SOEChannelStats& channel : stats.channels) {
+			std::string labels = remote + "," + SerialOverEthernet::SOEMetricsWriter::label("channel", std::to_string(channel.number)) + "," +
+					SerialOverEthernet::SOEMetricsWriter::label("local_port", channel.localPortName) + "," +
+					SerialOverEthernet::SOEMetricsWriter::label("remote_port", channel.remotePortName);
+			metrics.add("soe_channel_serial_bytes_total", "counter", "Bytes read from and written to the local serial port.", labels + ",direction=\"read\"", channel.serialBytesRead);
+			metrics.add("soe_channel_serial_bytes_total", "counter", "Bytes read from and written to the local serial port.", labels + ",direction=\"written\"", channel.serialBytesWritten);
+			metrics.add("soe_channel_serial_errors_total", "counter", "Failed reads and writes on the local serial port.", labels, channel.serialErrors);
+			metrics.add("soe_channel_serial_queue_bytes", "gauge", "Received bytes waiting for the local serial port.", labels, (unsigned long long) channel.serialQueue);
+			metrics.add("soe_channel_retransmit_queue_bytes", "gauge", "Transmitted bytes not yet acknowledged by the remote.", labels, (unsigned long long) channel.retransmitQueue);
+			metrics.add("soe_channel_transmit_credits_bytes", "gauge", "Bytes the remote currently allows to be send.", labels, (unsigned long long) channel.txCredits);
+		}
+	}
+}
+
+// Collects the metrics of the process and all connections, called from the metrics server thread
+static std::string collectMetrics() {
+	SerialOverEthernet::SOEMetricsWriter metrics;
+	metrics.add("soe_process_cpu_seconds_total", "counter", "CPU time of the process.", "", (double) std::clock() / CLOCKS_PER_SEC);
+	metrics.add("soe_connections_created_total", "counter", "Connection handlers created for established and accepted connections.", "", (unsigned long long) connectionCount);
+	for (unsigned int i = 0; i < SerialOverEthernet::getEventLoopCount(); i++) {
+		SerialOverEthernet::SOEEventLoop* loop = SerialOverEthernet::getEventLoop(i);
+		std::string labels = SerialOverEthernet::SOEMetricsWriter::label("loop", std::to_string(i));
+		unsigned long long cpuTime;
+		if (loop->getCpuTime(&cpuTime))
+			metrics.add("soe_event_loop_cpu_seconds_total", "counter", "CPU time of the event loop threads.", labels, cpuTime / 1000000.0);
+		metrics.add("soe_event_loop_sources", "gauge", "Descriptors registered with the event loops.", labels, (unsigned long long) loop->getSourceCount());
+	}
+
+	// the statistics wait for the transmissions of the handlers, which must not block accepting and reaping connections
+	unsigned long long alive = 0;
+	std::shared_lock<std::shared_mutex> useLock(m_registryUse);
+	collectLinkMetrics(metrics, listConnections(), &alive);
+	useLock.unlock();
+	metrics.add("soe_connections", "gauge", "Open connections.", "", alive);
+	return metrics.format();
+}
+
+// Probes the round trip time of the connections and logs their statistics, has to be called with m_registryUse held shared
+static void probeLatency(const std::vector<SerialOverEthernet::SOELinkHandler*>& connections, bool logStats) {
+	for (SerialOverEthernet::SOELinkHandler* handler : connections) {
+		if (!handler->isAlive()) continue;
+		handler->probeLatency();
+		if (!logStats) continue;
+		SerialOverEthernet::SOELatencyStats stats;
+		handler->getLatencyStats(stats);
+		if (stats.samples > 0)
+			printf("[i] link latency: %s %s\n", handler->getRemoteAddress().c_str(), SerialOverEthernet::formatLatencyStats(stats).c_str());
+	}
+}
+
+// Probes the round trip time of all connections periodically and logs their statistics
+static void runLatencyMonitor() {
+	auto nextStats = std::chrono::steady_clock::now() + std::chrono::seconds(latencyStatsInterval);
+	std::unique_lock<std::mutex> lock(m_latencyMonitor);
+	while (!cv_latencyMonitor.wait_for(lock, std::chrono::milliseconds(latencyPingInterval), []() { return latencyMonitorStop; })) {
+		bool logStats = latencyStatsInterval > 0 && std::chrono::steady_clock::now() >= nextStats;
+		if (logStats) nextStats += std::chrono::seconds(latencyStatsInterval);
+
+		// an probe can block while the transmission queue of its connection is full, so the registries are not held meanwhile
+		std::shared_lock<std::shared_mutex> useLock(m_registryUse);
+		probeLatency(listConnections(), logStats);
+	}
+}
+
+// Queues an closed handler for deletion by the reaper thread, called from the handler when its connection was closed
+static void reapConnectionHandler(SerialOverEthernet::SOELinkHandler* managedHandler, SOEServerShard* shard) {
+	std::lock_guard<std::mutex> lock(m_reaper);
+	reaperQueue.emplace_back(managedHandler, shard);
+	cv_reaper.notify_one();
+}
+
+// Removes the closed handlers from their registry and deletes them as soon as they are queued.
+// The registries are only locked for the removal, so that an slow teardown never blocks accepting new connections.
+static void runReaper() {
+	std::vector<std::pair<SerialOverEthernet::SOELinkHandler*, SOEServerShard*>> handlers;
+	std::vector<std::pair<SerialOverEthernet::SOELinkHandler*, SOEServerShard*>> deferred; // the handlers which could still be used by an link setup
+	std::unique_lock<std::mutex> lock(m_reaper);
+	while (true) {
+		if (deferred.empty())
+			cv_reaper.wait(lock, []() { return reaperStop || !reaperQueue.empty(); });
+		else
+			cv_reaper.wait_for(lock, std::chrono::milliseconds(SOE_REAPER_RETRY_INTERVAL), []() { return !reaperQueue.empty(); });
+		if (reaperQueue.empty() && deferred.empty()) break;
+		handlers.swap(reaperQueue);
+		handlers.insert(handlers.end(), deferred.begin(), deferred.end());
+		deferred.clear();
+		lock.unlock();
+
+		for (auto& entry : handlers) {
+			SerialOverEthernet::SOELinkHandler* managedHandler = entry.first;
+
+			// the latency monitor and the metrics endpoint can still use the handler, it is deleted after they are done
+			std::unique_lock<std::shared_mutex> useLock(m_registryUse, std::try_to_lock);
+			if (!useLock.owns_lock()) {
+				deferred.push_back(entry);
+				continue;
+			}
+			if (entry.second != nullptr) {
+				// the shards only hold accepted connections, which are never shared by outgoing links
+				std::lock_guard<std::mutex> shardLock(entry.second->m_connections);
+				entry.second->connections.erase(std::remove(entry.second->connections.begin(), entry.second->connections.end(), managedHandler), entry.second->connections.end());
+			} else {
+				// the links being set up can take seconds to connect, the other handlers are deleted meanwhile
+				std::unique_lock<std::shared_mutex> setupLock(m_linkSetup, std::try_to_lock);
+				if (!setupLock.owns_lock()) {
+					deferred.push_back(entry);
+					continue;
+				}
+				std::unique_lock<std::mutex> connectionLock(m_clientConnections);
+				clientConnections.erase(std::remove(clientConnections.begin(), clientConnections.end(), managedHandler), clientConnections.end());
+				for (auto link = linkConnections.begin(); link != linkConnections.end();)
+					link = link->second == managedHandler ? linkConnections.erase(link) : std::next(link);
+				connectionLock.unlock();
+
+				// the links of the configuration file carried by the connection are established again
+				std::lock_guard<std::mutex> fileLock(m_fileLinks);
+				for (auto& link : fileLinks) {
+					if (link.second.handler != managedHandler) continue;
+					link.second.handler = nullptr;
+					link.second.channel = -1;
+					link.second.retry = std::chrono::steady_clock::now();
+				}
+			}
+			useLock.unlock(); // not in the registry anymore, so no new copy contains it
+			dbgprintf("[DBG] delete handler for: %s\n", managedHandler->getRemoteAddress().c_str());
 			delete managedHandler;
-			return true;
+			if (entry.second == nullptr)
+				cv_clientConnections.notify_all(); // the process terminates when all links are closed if not in server mode
 		}
-		return false;
-	}), clientConnections.end());
+		handlers.clear();
+
+		lock.lock();
+	}
 }
 
-SerialOverEthernet::SOELinkHandler* createConnectionHandler(NetSocket::Socket* unmanagedSocket, std::string socketHostName, std::string socketHostPort) {
+SerialOverEthernet::SOELinkHandler* createConnectionHandler(SerialOverEthernet::SOETransport* unmanagedTransport, std::string socketHostName, std::string socketHostPort) {
 	std::lock_guard<std::mutex> lock(m_clientConnections);
-	dbgprintf("[DBG] create handler for: %s/%s\n", socketHostName.c_str(), socketHostPort.c_str());
-	SerialOverEthernet::SOELinkHandler* managedHandler = new SerialOverEthernet::SOELinkHandler(unmanagedSocket, socketHostName, socketHostPort, [](SerialOverEthernet::SOELinkHandler* managedHandler) {
-		cv_clientConnections.notify_one(); // try to run the cleanup of closed handlers if not in server mode
+	dbgprintf("[DBG] create handler for: %s/%s (%s)\n", socketHostName.c_str(), socketHostPort.c_str(), unmanagedTransport->getName());
+	SerialOverEthernet::SOELinkHandler* managedHandler = new SerialOverEthernet::SOELinkHandler(unmanagedTransport, socketHostName, socketHostPort, [](SerialOverEthernet::SOELinkHandler* managedHandler) {
+		reapConnectionHandler(managedHandler, nullptr);
 	});
 	clientConnections.push_back(managedHandler);
+	connectionCount++;
 	return managedHandler;
 }
 
-bool linkRemotePort(std::string& remoteHost, std::string& remotePort, std::string& remoteSerial, std::string& localSerial, SerialAccess::SerialPortConfiguration& remoteConfig, SerialAccess::SerialPortConfiguration& localConfig) {
+// Creates the handler for an connection accepted by an shard, it is pinned to the event loop of the shard
+static SerialOverEthernet::SOELinkHandler* createShardConnectionHandler(SOEServerShard* shard, SerialOverEthernet::SOETransport* unmanagedTransport, std::string socketHostName, std::string socketHostPort) {
+	std::lock_guard<std::mutex> lock(shard->m_connections);
+	dbgprintf("[DBG] create handler for: %s/%s (%s)\n", socketHostName.c_str(), socketHostPort.c_str(), unmanagedTransport->getName());
+	SerialOverEthernet::SOELinkHandler* managedHandler = new SerialOverEthernet::SOELinkHandler(unmanagedTransport, socketHostName, socketHostPort, [shard](SerialOverEthernet::SOELinkHandler* managedHandler) {
+		reapConnectionHandler(managedHandler, shard);
+	}, shard->eventLoop);
+	shard->connections.push_back(managedHandler);
+	connectionCount++;
+	return managedHandler;
+}
+
+// Binds an listener for each event loop, the kernel distributes the incoming connections between them
+static bool openServerShards(const std::string& serverHostName, const std::string& serverHostPort) {
+	unsigned int count = SerialOverEthernet::getEventLoopCount();
+	for (unsigned int i = 0; i < count; i++) {
+		std::unique_ptr<SerialOverEthernet::SOETcpListener> listener(SerialOverEthernet::newTcpListener(serverHostName, serverHostPort, count > 1));
+		if (!listener) {
+			// an single listener can still handle all connections, the first one failing means the address is not available
+			if (i > 0) {
+				printf("[!] unable to open server shard %u, continue with %u shard(s)\n", i, i);
+				break;
+			}
+			return false;
+		}
+		std::unique_ptr<SOEServerShard> shard(new SOEServerShard());
+		shard->eventLoop = SerialOverEthernet::getEventLoop(i);
+		shard->listener = std::move(listener);
+		shard->listenerSource = 0;
+		serverShards.push_back(std::move(shard));
+	}
+	return true;
+}
+
+// Applies the link configuration to an channel of an connected handler, shuts the handler down if this fails on an new connection
+static bool configureLink(SerialOverEthernet::SOELinkHandler* handler, bool newConnection, std::string& remoteSerial, std::string& localSerial, SerialAccess::SerialPortConfiguration& remoteConfig, SerialAccess::SerialPortConfiguration& localConfig, bool compression, const std::string& serverHostName, const std::string& serverHostPort, int* linkChannel) {
+	if (newConnection && !handler->negotiateProtocol()) {
+		printf("[!] failed to negotiate protocol: %s/%s\n", serverHostName.c_str(), serverHostPort.c_str());
+		handler->shutdown();
+		return false;
+	}
+	int channel = handler->allocateChannel();
+	if (channel < 0) {
+		printf("[!] no channel available on connection: %s/%s\n", serverHostName.c_str(), serverHostPort.c_str());
+		if (newConnection) handler->shutdown();
+		return false;
+	}
+	if (channel > 0)
+		printf("[i] using channel %d of existing connection: %s/%s\n", channel, serverHostName.c_str(), serverHostPort.c_str());
+	handler->requestCompression(compression);
+
+	// send the remote requests together and open the local port while waiting for their responses
+	int openRequest = handler->requestRemoteOpen(channel, remoteSerial);
+	int configRequest = openRequest < 0 ? -1 : handler->requestRemoteConfig(channel, remoteConfig);
+	bool localOpened = handler->openLocalPort(channel, localSerial);
+	bool localConfigured = localOpened && handler->setLocalConfig(channel, localConfig);
+	bool remoteOpened = handler->awaitRequest(openRequest);
+	bool remoteConfigured = handler->awaitRequest(configRequest);
+
+	if (!remoteOpened)
+		printf("[!] failed to open remote port: %s\n", remoteSerial.c_str());
+	else if (!remoteConfigured)
+		printf("[!] failed to configure remote port: %s\n", remoteSerial.c_str());
+	if (!localOpened)
+		printf("[!] failed to open local port: %s\n", localSerial.c_str());
+	else if (!localConfigured)
+		printf("[!] failed to configure local port: %s\n", localSerial.c_str());
+	if (remoteOpened && remoteConfigured && localConfigured) {
+		*linkChannel = channel;
+		return true;
+	}
+
+	// the channel can be used by an other link again
+	if (newConnection)
+		handler->shutdown();
+	else
+		handler->releaseChannel(channel);
+	return false;
+}
+
+// Returns the existing connection to the remote if it is still alive and can carry an additional channel
+static SerialOverEthernet::SOELinkHandler* findLinkConnection(const std::string& linkKey) {
+	std::lock_guard<std::mutex> lock(m_clientConnections);
+	auto link = linkConnections.find(linkKey);
+	if (link == linkConnections.end() || !link->second->isAlive()) return nullptr;
+	return link->second;
+}
+
+// Returns the key of the connection carrying the link, links to the same remote share one connection
+static std::string getLinkKey(const SOELinkConfig& link) {
+	return link.remoteHost + "/" + link.remotePort + (link.udp ? "/udp" : "/tcp");
+}
+
+// Attempts to establish an connection to the remote of the link and opens and configures the ports on an channel of it.
+// If an connection to the same remote already exists and the remote supports channels, the link is added to it as an additional channel.
+// Has to be called with the link setup lock held shared, so that the reaper can not delete the handler while it is used here.
+static bool linkRemotePort(SOELinkConfig& link, SerialOverEthernet::SOELinkHandler** linkHandler, int* linkChannel) {
+	std::string& remoteHost = link.remoteHost;
+	std::string& remotePort = link.remotePort;
+	std::string& remoteSerial = link.remoteSerial;
+	std::string& localSerial = link.localSerial;
+	SerialAccess::SerialPortConfiguration& remoteConfig = link.remoteConfig;
+	SerialAccess::SerialPortConfiguration& localConfig = link.localConfig;
+	bool compression = link.compression;
+
+	printf("[i] establishing link: %s <-> %s @ %s/%s\n", localSerial.c_str(), remoteSerial.c_str(), remoteHost.c_str(), remotePort.c_str());
+
+	// links to the same remote share one connection, each using its own channel
+	std::string linkKey = getLinkKey(link);
+	SerialOverEthernet::SOELinkHandler* existing = findLinkConnection(linkKey);
+	if (existing != nullptr) {
+		if (configureLink(existing, false, remoteSerial, localSerial, remoteConfig, localConfig, compression, remoteHost, remotePort, linkChannel)) {
+			*linkHandler = existing;
+			printf("[i] link established: %s <-> %s @ %s/%s (shared connection)\n", localSerial.c_str(), remoteSerial.c_str(), remoteHost.c_str(), remotePort.c_str());
+			return true;
+		}
+		printf("[i] unable to share connection, attempt new connection: %s/%s\n", remoteHost.c_str(), remotePort.c_str());
+	}
+
+	if (link.udp) {
+
+		printf("[i] serial over ethernet/IP, attempt UDP connection on: %s/%s\n", remoteHost.c_str(), remotePort.c_str());
+
+		// the UDP transport resolves the address itself and tries all results
+		SerialOverEthernet::SOETransport* transport = SerialOverEthernet::newUdpTransport(remoteHost, remotePort);
+		if (transport != nullptr) {
+			SerialOverEthernet::SOELinkHandler* handler = createConnectionHandler(transport, remoteHost, remotePort);
+			handler->enableResume([remoteHost, remotePort]() {
+				return SerialOverEthernet::newUdpTransport(remoteHost, remotePort);
+			});
+			if (!configureLink(handler, true, remoteSerial, localSerial, remoteConfig, localConfig, compression, remoteHost, remotePort, linkChannel))
+				return false;
+			*linkHandler = handler;
+
+			std::unique_lock<std::mutex> lock(m_clientConnections);
+			linkConnections[linkKey] = handler;
+			lock.unlock();
+			printf("[i] link established: %s <-> %s @ %s/%s (UDP)\n", localSerial.c_str(), remoteSerial.c_str(), remoteHost.c_str(), remotePort.c_str());
+			return true;
+		}
+
+		printf("[i] unable to established link: %s <-> %s @ %s/%s\n", localSerial.c_str(), remoteSerial.c_str(), remoteHost.c_str(), remotePort.c_str());
+		return false;
+	}
+
 	std::vector<NetSocket::INetAddress> addresses;
 	NetSocket::resolveInet(remoteHost, remotePort, true, addresses);
 	NetSocket::Socket* clientSocket = NetSocket::newSocket();
 
-	printf("[i] establishing link: %s <-> %s @ %s/%s\n", localSerial.c_str(), remoteSerial.c_str(), remoteHost.c_str(), remotePort.c_str());
-
 	for (auto address : addresses) {
 
 		std::string serverHostName;
@@ -61,28 +445,24 @@ bool linkRemotePort(std::string& remoteHost, std::string& remotePort, std::strin
 		dbgprintf("[DBG] connect succeded at: %s/%s\n", serverHostName.c_str(), serverHostPortStr.c_str());
 
 		// create connection handler, try to apply configurations
-		SerialOverEthernet::SOELinkHandler* handler = createConnectionHandler(clientSocket, serverHostName, serverHostPortStr);
-		if (!handler->openRemotePort(remoteSerial)) {
-			printf("[!] failed to open remote port: %s\n", remoteSerial.c_str());
-			handler->shutdown();
-			return false;
-		}
-		if (!handler->setRemoteConfig(remoteConfig)) {
-			printf("[!] failed to configure remote port: %s\n", remoteSerial.c_str());
-			handler->shutdown();
-			return false;
-		}
-		if (!handler->openLocalPort(localSerial)) {
-			printf("[!] failed to open local port: %s\n", localSerial.c_str());
-			handler->shutdown();
-			return false;
-		}
-		if (!handler->setLocalConfig(localConfig)) {
-			printf("[!] failed to configure local port: %s\n", remoteSerial.c_str());
-			handler->shutdown();
+		SerialOverEthernet::SOELinkHandler* handler = createConnectionHandler(SerialOverEthernet::newTcpTransport(clientSocket), serverHostName, serverHostPortStr);
+
+		// an lost connection is resumed by reconnecting to the same address
+		handler->enableResume([address]() -> SerialOverEthernet::SOETransport* {
+			NetSocket::Socket* socket = NetSocket::newSocket();
+			if (!socket->connect(address, SOE_TCP_HANDSHAKE_TIMEOUT)) {
+				delete socket;
+				return nullptr;
+			}
+			return SerialOverEthernet::newTcpTransport(socket);
+		});
+		if (!configureLink(handler, true, remoteSerial, localSerial, remoteConfig, localConfig, compression, serverHostName, serverHostPortStr, linkChannel))
 			return false;
-		}
+		*linkHandler = handler;
 
+		std::unique_lock<std::mutex> lock(m_clientConnections);
+		linkConnections[linkKey] = handler;
+		lock.unlock();
 		printf("[i] link established: %s <-> %s @ %s/%s (%s/%s)\n", localSerial.c_str(), remoteSerial.c_str(), remoteHost.c_str(), remotePort.c_str(), serverHostName.c_str(), serverHostPortStr.c_str());
 		return true;
 
@@ -92,6 +472,166 @@ bool linkRemotePort(std::string& remoteHost, std::string& remotePort, std::strin
 	return false;
 }
 
+unsigned int establishLinks(std::vector<SOELinkConfig>& links, std::function<void(size_t index, SerialOverEthernet::SOELinkHandler* handler, int channel)> established) {
+
+	// the links to the same remote are established by the same worker, so that the later ones can use the connection of the first one
+	std::vector<std::vector<size_t>> remotes;
+	std::map<std::string, size_t> remoteIndex;
+	for (size_t index = 0; index < links.size(); index++) {
+		auto entry = remoteIndex.emplace(getLinkKey(links[index]), remotes.size());
+		if (entry.second) remotes.emplace_back();
+		remotes[entry.first->second].push_back(index);
+	}
+
+	std::atomic<size_t> nextRemote(0);
+	std::atomic<unsigned int> linked(0);
+	auto worker = [&]() {
+		size_t remote;
+		while ((remote = nextRemote++) < remotes.size()) {
+			for (size_t index : remotes[remote]) {
+				std::shared_lock<std::shared_mutex> setupLock(m_linkSetup);
+				SerialOverEthernet::SOELinkHandler* handler = nullptr;
+				int channel = -1;
+				if (linkRemotePort(links[index], &handler, &channel))
+					linked++;
+				if (established) established(index, handler, channel);
+			}
+		}
+	};
+
+	// an unreachable remote only delays its own links, the others are established by the remaining workers meanwhile
+	size_t workerCount = std::min((size_t) linkParallelism, remotes.size());
+	if (workerCount <= 1) {
+		worker();
+	} else {
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < workerCount; i++)
+			workers.emplace_back(worker);
+		for (std::thread& thread : workers)
+			thread.join();
+	}
+	return linked;
+}
+
+// Parses the link configuration file, each line is one link identified by its options
+static void parseLinkFile(const std::string& content, std::map<std::string, SOELinkConfig>& links) {
+	std::istringstream lines(content);
+	std::string line;
+	while (std::getline(lines, line)) {
+		std::istringstream tokens(line);
+		std::vector<std::string> args = { "-link" };
+		std::string options;
+		std::string token;
+		while (tokens >> token) {
+			if (token[0] == '#') break;
+			if (args.size() == 1 && token == "-link") continue;
+			args.push_back(token);
+			options.append(options.empty() ? "" : " ").append(token);
+		}
+		if (options.empty()) continue;
+
+		std::vector<SOELinkConfig> parsed;
+		if (!parseLinkFlags(args, parsed) || parsed.size() != 1) {
+			printf("[!] invalid link in configuration file: %s\n", options.c_str());
+			continue;
+		}
+		links[options] = parsed[0];
+	}
+}
+
+// Closes an link of the configuration file, the connection is closed too if it carries no other link.
+// Has to be called with the link setup lock held shared.
+static void closeFileLink(SOEFileLink& link) {
+	if (link.handler == nullptr) return;
+	printf("[i] closing link: %s <-> %s @ %s/%s\n", link.config.localSerial.c_str(), link.config.remoteSerial.c_str(), link.config.remoteHost.c_str(), link.config.remotePort.c_str());
+	if (!link.handler->releaseChannel((unsigned char) link.channel))
+		printf("[!] failed to release remote port: %s\n", link.config.remoteSerial.c_str());
+	if (!link.handler->hasAllocatedChannels())
+		link.handler->shutdown();
+}
+
+// Applies the changed link configuration file, if supplied, and establishes the links which are due
+static void updateFileLinks(const std::map<std::string, SOELinkConfig>* configured) {
+	std::vector<std::string> keys;
+	std::vector<SOELinkConfig> links;
+	auto now = std::chrono::steady_clock::now();
+
+	std::shared_lock<std::shared_mutex> setupLock(m_linkSetup);
+	std::unique_lock<std::mutex> lock(m_fileLinks);
+	if (configured != nullptr) {
+		// only the links not in the file anymore are closed, the unchanged links keep running
+		unsigned int removed = 0;
+		unsigned int added = 0;
+		for (auto link = fileLinks.begin(); link != fileLinks.end();) {
+			if (configured->count(link->first) > 0) {
+				link++;
+				continue;
+			}
+			closeFileLink(link->second);
+			link = fileLinks.erase(link);
+			removed++;
+		}
+		for (auto& link : *configured) {
+			if (fileLinks.count(link.first) > 0) continue;
+			fileLinks[link.first] = SOEFileLink { link.second, nullptr, -1, now };
+			added++;
+		}
+		printf("[i] link configuration loaded: %s (%u link(s), %u added, %u removed)\n", linkFilePath.c_str(), (unsigned int) configured->size(), added, removed);
+	}
+
+	for (auto& link : fileLinks) {
+		if (link.second.handler != nullptr || link.second.retry > now) continue;
+		link.second.retry = now + std::chrono::milliseconds(SOE_LINK_RETRY_INTERVAL);
+		keys.push_back(link.first);
+		links.push_back(link.second.config);
+	}
+	lock.unlock();
+	setupLock.unlock();
+	if (links.empty()) return;
+
+	// only this thread adds and removes file links, the entries are still present when the links were established
+	unsigned int linked = establishLinks(links, [&keys](size_t index, SerialOverEthernet::SOELinkHandler* handler, int channel) {
+		std::lock_guard<std::mutex> lock(m_fileLinks);
+		SOEFileLink& link = fileLinks[keys[index]];
+		link.handler = handler;
+		link.channel = channel;
+	});
+	if (linked < links.size())
+		printf("[!] %u of %u link(s) of the configuration file failed, retry in %u s\n", (unsigned int) links.size() - linked, (unsigned int) links.size(), SOE_LINK_RETRY_INTERVAL / 1000);
+}
+
+// Loads the link configuration file and checks it for changes periodically.
+// An file which can not be read keeps the links running, since editors often replace the file when saving it.
+static void runLinkFile() {
+	std::string loaded;
+	bool readable = false;
+	bool first = true;
+	std::unique_lock<std::mutex> lock(m_linkFile);
+	do {
+		lock.unlock();
+		std::ifstream file(linkFilePath);
+		if (file) {
+			std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+			if (first || content != loaded) {
+				std::map<std::string, SOELinkConfig> configured;
+				parseLinkFile(content, configured);
+				loaded = content;
+				first = false;
+				updateFileLinks(&configured);
+			} else {
+				updateFileLinks(nullptr);
+			}
+			readable = true;
+		} else {
+			if (readable || first)
+				printf("[!] unable to read link configuration file: %s\n", linkFilePath.c_str());
+			readable = first = false;
+			updateFileLinks(nullptr);
+		}
+		lock.lock();
+	} while (!cv_linkFile.wait_for(lock, std::chrono::milliseconds(SOE_LINK_RELOAD_INTERVAL), []() { return linkFileStop; }));
+}
+
 int runMain(std::string& serverHostName, std::string& serverHostPort, std::vector<std::string>& linkArgs) {
 	
 	// initialize networking
@@ -100,77 +640,184 @@ int runMain(std::string& serverHostName, std::string& serverHostPort, std::vecto
 		return -1;
 	}
 
+	// the links created from now on are handled by the event loops, if supported on this platform
+	bool eventLoops = eventLoopCount > 0 && SerialOverEthernet::startEventLoops(eventLoopCount, eventLoopConfig);
+	if (eventLoops)
+		printf("[i] links handled by %u event loop thread(s)\n", eventLoopCount);
+
+	// with event loops each loop accepts connections on its own listener, they are bound before the latency monitor and the metrics read the shards
+	if (eventLoops && !serverHostName.empty() && !openServerShards(serverHostName, serverHostPort))
+		printf("[!] unable to open server shards, fall back to single listener: %s/%s\n", serverHostName.c_str(), serverHostPort.c_str());
+
+	// closed connections are deleted by the reaper from now on
+	std::thread reaper(runReaper);
+
+	// the metrics are served after the shards were opened, since they read the shards
+	std::unique_ptr<SerialOverEthernet::SOEMetricsServer> metricsServer;
+	if (!metricsAddress.empty()) {
+		metricsServer.reset(SerialOverEthernet::newMetricsServer(metricsAddress, collectMetrics));
+		if (metricsServer)
+			printf("[i] metrics served on: %s\n", metricsAddress.c_str());
+		else
+			printf("[!] unable to open metrics endpoint: %s\n", metricsAddress.c_str());
+	}
+
+	// start probing the round trip times before the links are established, so that the first probes are send right after
+	std::thread latencyMonitor;
+	if (latencyPingInterval > 0)
+		latencyMonitor = std::thread(runLatencyMonitor);
+
 	// parse additional link flags, triggering client connection handshakes and setup
 	interpretFlags(linkArgs);
 
-	// If no host address supplied, only wait for client connections to terminate
+	// the links of the configuration file are established in the background, after the links of the command line
+	std::thread linkFile;
+	if (!linkFilePath.empty())
+		linkFile = std::thread(runLinkFile);
+
+	// If no host address supplied, only wait for client connections to terminate, with an link configuration file the links can be added again at any time
 	if (serverHostName.empty()) {
 		std::unique_lock<std::mutex> lock(m_clientConnections);
-		cv_clientConnections.wait(lock, [&lock](){
-			// this has to run every now and then to get rid of closed connection handlers
-			lock.unlock();
-			cleanupDeadConnectionHandlers();
-			lock.lock();
-
-			return clientConnections.size() == 0;
+		cv_clientConnections.wait(lock, [](){
+			return clientConnections.size() == 0 && linkFilePath.empty();
 		});
 	} else {
 
-		// resolve supplied host string
-		std::vector<NetSocket::INetAddress> localAddresses;
-		NetSocket::resolveInet(serverHostName, serverHostPort, true, localAddresses);
-
-		// attempt to bind to first available local host address
-		NetSocket::Socket* serverSocket = NetSocket::newSocket();
-		for (NetSocket::INetAddress& address : localAddresses) {
-
-			std::string localAddress;
-			unsigned int localPort;
-			address.tostr(localAddress, &localPort);
-			printf("[i] serial over ethernet/IP, attempt claim address: %s/%d\n", localAddress.c_str(), localPort);
+		// accept UDP transport connections on the same address, if supported on this platform
+		std::unique_ptr<SerialOverEthernet::SOEUdpListener> udpListener(SerialOverEthernet::newUdpListener(serverHostName, serverHostPort));
+		std::thread udpAcceptor;
+		if (udpListener) {
+			printf("[i] serial over ethernet/IP, open UDP server port on: %s/%s\n", serverHostName.c_str(), serverHostPort.c_str());
+			udpAcceptor = std::thread([&udpListener]() {
+				std::string clientHostName;
+				std::string clientHostPort;
+				SerialOverEthernet::SOETransport* transport;
+				while ((transport = udpListener->accept(clientHostName, clientHostPort)) != nullptr) {
+					printf("[i] incomming UDP connection request: %s/%s\n", clientHostName.c_str(), clientHostPort.c_str());
+					createConnectionHandler(transport, clientHostName, clientHostPort);
+				}
+			});
+		}
 
-			if (serverSocket->listen(address)) {
+		// with event loops the connections are accepted by the shards, this thread only waits for the listeners to close
+		if (!serverShards.empty()) {
+			printf("[i] serial over ethernet/IP, open server port on: %s/%s (%u shard(s))\n", serverHostName.c_str(), serverHostPort.c_str(), (unsigned int) serverShards.size());
+			for (auto& entry : serverShards) {
+				SOEServerShard* shard = entry.get();
+				shard->listenerSource = shard->eventLoop->watch(shard->listener->getHandle(), SOE_EVENT_READ, [shard](unsigned int events) {
+					std::string clientHostName;
+					std::string clientHostPort;
+					SerialOverEthernet::SOETransport* transport;
+					while ((transport = shard->listener->accept(clientHostName, clientHostPort)) != nullptr) {
+						printf("[i] incomming connection request: %s/%s\n", clientHostName.c_str(), clientHostPort.c_str());
+						createShardConnectionHandler(shard, transport, clientHostName, clientHostPort);
+					}
+					if (!shard->listener->isOpen()) {
+						std::lock_guard<std::mutex> lock(m_clientConnections);
+						cv_clientConnections.notify_all();
+					}
+				});
+				if (shard->listenerSource == 0)
+					shard->listener->close();
+			}
 
-				printf("[i] serial over ethernet/IP, open server port on: %s/%d\n", localAddress.c_str(), localPort);
+			std::unique_lock<std::mutex> lock(m_clientConnections);
+			cv_clientConnections.wait(lock, [](){
+				return std::none_of(serverShards.begin(), serverShards.end(), [](const std::unique_ptr<SOEServerShard>& shard) { return shard->listener->isOpen(); });
+			});
+			lock.unlock();
+			for (auto& shard : serverShards) {
+				shard->eventLoop->unwatch(shard->listenerSource);
+				shard->eventLoop->sync();
+			}
+			printf("[i] server socket closed, no more connections accepted\n");
+		} else {
+
+			// resolve supplied host string
+			std::vector<NetSocket::INetAddress> localAddresses;
+			NetSocket::resolveInet(serverHostName, serverHostPort, true, localAddresses);
+
+			// attempt to bind to first available local host address
+			NetSocket::Socket* serverSocket = NetSocket::newSocket();
+			for (NetSocket::INetAddress& address : localAddresses) {
+
+				std::string localAddress;
+				unsigned int localPort;
+				address.tostr(localAddress, &localPort);
+				printf("[i] serial over ethernet/IP, attempt claim address: %s/%d\n", localAddress.c_str(), localPort);
+
+				if (serverSocket->listen(address)) {
+
+					printf("[i] serial over ethernet/IP, open server port on: %s/%d\n", localAddress.c_str(), localPort);
+
+					while (serverSocket->isOpen()) {
+						NetSocket::Socket* clientSocket = NetSocket::newSocket();
+						if (serverSocket->accept(*clientSocket)) {
+
+							std::string clientHostName = "N/A";
+							std::string clientHostPort = "N/A";
+							NetSocket::INetAddress address;
+							if (clientSocket->getINet(address)) {
+								unsigned int clientHostPortNr = 0;
+								if (address.tostr(clientHostName, &clientHostPortNr)) {
+									clientHostPort = std::to_string(clientHostPortNr);
+								}
+							}
 
-				while (serverSocket->isOpen()) {
-					// this has to run every now and then to get rid of closed connection handlers
-					cleanupDeadConnectionHandlers();
+							printf("[i] incomming connection request: %s/%s\n", clientHostName.c_str(), clientHostPort.c_str());
 
-					NetSocket::Socket* clientSocket = NetSocket::newSocket();
-					if (serverSocket->accept(*clientSocket)) {
+							// create handler for connection and make new socket for next request
+							createConnectionHandler(SerialOverEthernet::newTcpTransport(clientSocket), clientHostName, clientHostPort);
+							continue;
 
-						std::string clientHostName = "N/A";
-						std::string clientHostPort = "N/A";
-						NetSocket::INetAddress address;
-						if (clientSocket->getINet(address)) {
-							unsigned int clientHostPortNr = 0;
-							if (address.tostr(clientHostName, &clientHostPortNr)) {
-								clientHostPort = std::to_string(clientHostPortNr);
-							}
 						}
+						delete clientSocket;
+					}
 
-						printf("[i] incomming connection request: %s/%s\n", clientHostName.c_str(), clientHostPort.c_str());
-
-						// create handler for connection and make new socket for next request
-						createConnectionHandler(clientSocket, clientHostName, clientHostPort);
-						continue;
+					goto end_listen;
 
-					}
-					delete clientSocket;
 				}
 
-				goto end_listen;
-
 			}
+			printf("[!] unable to bind to address: %s/%s\n", serverHostName.c_str(), serverHostPort.c_str());
+		end_listen:
+			printf("[i] server socket closed, no more connections accepted\n");
+			delete serverSocket;
 
 		}
-		printf("[!] unable to bind to address: %s/%s\n", serverHostName.c_str(), serverHostPort.c_str());
-	end_listen:
-		printf("[i] server socket closed, no more connections accepted\n");
-		delete serverSocket;
 
+		if (udpListener) {
+			udpListener->close();
+			udpAcceptor.join();
+		}
+
+	}
+
+	if (linkFile.joinable()) {
+		std::unique_lock<std::mutex> lock(m_linkFile);
+		linkFileStop = true;
+		lock.unlock();
+		cv_linkFile.notify_all();
+		linkFile.join();
+	}
+	if (latencyMonitor.joinable()) {
+		std::unique_lock<std::mutex> lock(m_latencyMonitor);
+		latencyMonitorStop = true;
+		lock.unlock();
+		cv_latencyMonitor.notify_all();
+		latencyMonitor.join();
 	}
+	if (metricsServer)
+		metricsServer->close();
+
+	// the handlers still queued are deleted before the event loops stop, since they wait for their loop
+	std::unique_lock<std::mutex> reaperLock(m_reaper);
+	reaperStop = true;
+	reaperLock.unlock();
+	cv_reaper.notify_all();
+	reaper.join();
+	if (eventLoops)
+		SerialOverEthernet::stopEventLoops();
 
 	// cleanup network and exit
 	NetSocket::InetCleanup();
@@ -0,0 +1,261 @@
+/*
+ * soemetrics.cpp
+ *
+ * Implements the formatting of the metrics and the HTTP endpoint serving them.
+ * The endpoint is currently only supported on linux.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "soemetrics.hpp"
+#include "dbgprintf.h"
+
+void SerialOverEthernet::SOEMetricsWriter::add(const char* name, const char* type, const char* help, const std::string& labels, unsigned long long value) {
+	char formatted[24];
+	snprintf(formatted, sizeof(formatted), "%llu", value);
+	addSample(name, type, help, labels, formatted);
+}
+
+void SerialOverEthernet::SOEMetricsWriter::add(const char* name, const char* type, const char* help, const std::string& labels, double value) {
+	char formatted[32];
+	snprintf(formatted, sizeof(formatted), "%.6f", value);
+	addSample(name, type, help, labels, formatted);
+}
+
+void SerialOverEthernet::SOEMetricsWriter::addSample(const char* name, const char* type, const char* help, const std::string& labels, const char* value) {
+	auto entry = this->metrics.find(name);
+	if (entry == this->metrics.end()) {
+		entry = this->metrics.emplace(name, Metric { type, help, "" }).first;
+		this->order.push_back(name);
+	}
+	std::string& samples = entry->second.samples;
+	samples.append(name);
+	if (!labels.empty())
+		samples.append("{").append(labels).append("}");
+	samples.append(" ").append(value).append("\n");
+}
+
+std::string SerialOverEthernet::SOEMetricsWriter::format() {
+	std::string text;
+	for (const std::string& name : this->order) {
+		Metric& metric = this->metrics[name];
+		text.append("# HELP ").append(name).append(" ").append(metric.help).append("\n");
+		text.append("# TYPE ").append(name).append(" ").append(metric.type).append("\n");
+		text.append(metric.samples);
+	}
+	return text;
+}
+
+std::string SerialOverEthernet::SOEMetricsWriter::label(const char* name, const std::string& value) {
+	std::string formatted(name);
+	formatted.append("=\"");
+	for (char c : value) {
+		if (c == '\\') formatted.append("\\\\");
+		else if (c == '"') formatted.append("\\\"");
+		else if (c == '\n') formatted.append("\\n");
+		else formatted.push_back(c);
+	}
+	formatted.append("\"");
+	return formatted;
+}
+
+#ifdef PLATFORM_LIN
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <thread>
+
+namespace SerialOverEthernet {
+
+class SOEMetricsServerLin : public SOEMetricsServer {
+
+public:
+	SOEMetricsServerLin(int fd, int wakeup, const std::string& socketPath, std::function<std::string()> collect) {
+		this->fd = fd;
+		this->wakeup = wakeup;
+		this->socketPath = socketPath;
+		this->collect = collect;
+		this->thread = std::thread([this]() { run(); });
+	}
+
+	~SOEMetricsServerLin() {
+		close();
+		::close(this->wakeup);
+	}
+
+	void close() override {
+		if (!this->thread.joinable()) return;
+		uint64_t count = 1;
+		if (::write(this->wakeup, &count, sizeof(count)) < 0)
+			dbgprintf("[DBG] failed to wake metrics server: %d\n", errno);
+		this->thread.join();
+		::close(this->fd);
+		if (!this->socketPath.empty())
+			::unlink(this->socketPath.c_str());
+	}
+
+private:
+	void run() {
+		pollfd fds[2];
+		fds[0].fd = this->fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = this->wakeup;
+		fds[1].events = POLLIN;
+		while (true) {
+			if (::poll(fds, 2, -1) < 0) {
+				if (errno == EINTR) continue;
+				printf("[!] metrics server failed: %d\n", errno);
+				break;
+			}
+			if (fds[1].revents) break;
+			if (!fds[0].revents) continue;
+
+			int client = ::accept4(this->fd, nullptr, nullptr, SOCK_CLOEXEC);
+			if (client < 0) continue;
+			// an client not completing its request can only delay the next scrape
+			timeval timeout = { SOE_METRICS_TIMEOUT / 1000, (SOE_METRICS_TIMEOUT % 1000) * 1000 };
+			::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			::setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+			serve(client);
+			::close(client);
+		}
+		dbgprintf("[DBG] metrics server terminated\n");
+	}
+
+	void serve(int client) {
+		// only the request line is evaluated, the headers are read to not reset the connection by closing it with unread data
+		std::string request;
+		char buffer[1024];
+		while (request.find("\r\n\r\n") == std::string::npos && request.size() < SOE_METRICS_REQUEST_LEN) {
+			ssize_t received = ::recv(client, buffer, sizeof(buffer), 0);
+			if (received <= 0) return;
+			request.append(buffer, received);
+		}
+
+		std::string line = request.substr(0, request.find("\r\n"));
+		std::string status;
+		std::string body;
+		if (line.rfind("GET / ", 0) == 0 || line.rfind("GET /metrics ", 0) == 0 || line.rfind("GET /metrics?", 0) == 0) {
+			status = "200 OK";
+			body = this->collect();
+		} else if (line.rfind("GET ", 0) == 0) {
+			status = "404 Not Found";
+			body = "not found\n";
+		} else {
+			status = "405 Method Not Allowed";
+			body = "method not allowed\n";
+		}
+
+		std::string response = "HTTP/1.1 " + status + "\r\n"
+				"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+				"Content-Length: " + std::to_string(body.size()) + "\r\n"
+				"Connection: close\r\n\r\n" + body;
+		const char* data = response.data();
+		size_t remaining = response.size();
+		while (remaining > 0) {
+			ssize_t sent = ::send(client, data, remaining, MSG_NOSIGNAL);
+			if (sent <= 0) return;
+			data += sent;
+			remaining -= sent;
+		}
+	}
+
+	int fd;
+	int wakeup;												// eventfd terminating the server thread
+	std::string socketPath;									// the path of the unix socket, empty for TCP
+	std::function<std::string()> collect;
+	std::thread thread;
+
+};
+
+// binds an listen socket to the TCP address host:port, returns -1 if not possible
+static int bindTcpAddress(const std::string& address) {
+	size_t separator = address.find_last_of(':');
+	if (separator == std::string::npos) {
+		printf("[!] invalid metrics address, expected host:port: %s\n", address.c_str());
+		return -1;
+	}
+	std::string hostName = address.substr(0, separator);
+	std::string hostPort = address.substr(separator + 1);
+	if (hostName.size() >= 2 && hostName.front() == '[' && hostName.back() == ']')
+		hostName = hostName.substr(1, hostName.size() - 2);
+
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo* addresses;
+	if (::getaddrinfo(hostName.empty() ? nullptr : hostName.c_str(), hostPort.c_str(), &hints, &addresses) != 0)
+		return -1;
+
+	for (addrinfo* entry = addresses; entry != nullptr; entry = entry->ai_next) {
+		int fd = ::socket(entry->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0) continue;
+		int reuse = 1;
+		::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		if (::bind(fd, entry->ai_addr, entry->ai_addrlen) != 0 || ::listen(fd, 16) != 0) {
+			::close(fd);
+			continue;
+		}
+		freeaddrinfo(addresses);
+		return fd;
+	}
+	freeaddrinfo(addresses);
+	return -1;
+}
+
+// binds an listen socket to the unix socket path, an stale socket of an previous process is replaced
+static int bindUnixAddress(const std::string& path) {
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		printf("[!] metrics socket path too long: %s\n", path.c_str());
+		return -1;
+	}
+	strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+	struct stat status;
+	if (::stat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode))
+		::unlink(path.c_str());
+	if (::bind(fd, (const sockaddr*) &address, sizeof(address)) != 0 || ::listen(fd, 16) != 0) {
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+}
+
+SerialOverEthernet::SOEMetricsServer* SerialOverEthernet::newMetricsServer(const std::string& address, std::function<std::string()> collect) {
+	bool unixSocket = !address.empty() && address.front() == '/';
+	int fd = unixSocket ? bindUnixAddress(address) : bindTcpAddress(address);
+	if (fd < 0) return nullptr;
+	int wakeup = ::eventfd(0, EFD_CLOEXEC);
+	if (wakeup < 0) {
+		::close(fd);
+		if (unixSocket) ::unlink(address.c_str());
+		return nullptr;
+	}
+	return new SOEMetricsServerLin(fd, wakeup, unixSocket ? address : "", collect);
+}
+
+#else
+
+SerialOverEthernet::SOEMetricsServer* SerialOverEthernet::newMetricsServer(const std::string& address, std::function<std::string()> collect) {
+	printf("[!] metrics endpoint not supported on this platform\n");
+	return nullptr;
+}
+
+#endif
@@ -9,35 +9,157 @@
  */
 
 #include <string.h>
+#include <chrono>
 #include "soeconnection.hpp"
 #include "dbgprintf.h"
 
 #define SOE_TCP_OPC_ERROR 0x0
 #define SOE_TCP_OPC_CONFIRM 0x1
+#define SOE_TCP_OPC_HELLO 0x2
+#define SOE_TCP_OPC_PING 0x3
+#define SOE_TCP_OPC_PONG 0x4
+#define SOE_TCP_OPC_RESUME 0x5
+#define SOE_TCP_OPC_RESYNCED 0x6
+#define SOE_TCP_OPC_CLOSE_SESSION 0x7
 #define SOE_TCP_OPC_OPEN_PORT 0x10
 #define SOE_TCP_OPC_CLOSE_PORT 0x20
 #define SOE_TCP_OPC_CONFIGURE_PORT 0x30
 #define SOE_TCP_OPC_STREAM_SERIAL 0x40
+#define SOE_TCP_OPC_STREAM_COMPRESSED 0x41
+#define SOE_TCP_OPC_STREAM_CREDITS 0x42
+#define SOE_TCP_OPC_STREAM_ACK 0x43
+#define SOE_TCP_OPC_STREAM_RESYNC 0x44
+#define SOE_TCP_OPC_CHANNEL 0x50
+#define SOE_TCP_OPC_REQUEST 0x51
 
-bool SerialOverEthernet::SOELinkHandler::processPackage(const char* package, unsigned int packageLen) {
+#define SOE_TCP_FEATURES (SOE_TCP_FEATURE_COMPRESSION | SOE_TCP_FEATURE_CHANNELS | SOE_TCP_FEATURE_REQUEST_IDS | SOE_TCP_FEATURE_CREDITS | SOE_TCP_FEATURE_PING)
+
+bool SerialOverEthernet::SOELinkHandler::processPackage(const char* package, unsigned int packageLen, unsigned char channel) {
 
 	if (packageLen == 0)
 		return sendError("no package payload");
 
 	switch (package[0]) {
-	case SOE_TCP_OPC_STREAM_SERIAL:		return processSerialData(package, packageLen);
+	case SOE_TCP_OPC_STREAM_SERIAL:		return processSerialData(package, packageLen, channel);
+	case SOE_TCP_OPC_STREAM_COMPRESSED:	return processCompressedData(package, packageLen, channel);
+	case SOE_TCP_OPC_STREAM_CREDITS:	return processCredits(package, packageLen, channel);
+	case SOE_TCP_OPC_STREAM_ACK:		return processAck(package, packageLen, channel);
+	case SOE_TCP_OPC_STREAM_RESYNC:		return processResync(package, packageLen, channel);
+	case SOE_TCP_OPC_CHANNEL:			return processChannel(package, packageLen, channel);
+	case SOE_TCP_OPC_REQUEST:			return processRequest(package, packageLen, channel);
 	case SOE_TCP_OPC_ERROR: 			return processError(package, packageLen);
 	case SOE_TCP_OPC_CONFIRM:			return processConfirm(package, packageLen);
-	case SOE_TCP_OPC_OPEN_PORT: 		return processRemoteOpen(package, packageLen);
-	case SOE_TCP_OPC_CLOSE_PORT: 		return processRemoteClose(package, packageLen);
-	case SOE_TCP_OPC_CONFIGURE_PORT: 	return processRemoteConfig(package, packageLen);
+	case SOE_TCP_OPC_HELLO:				return processHello(package, packageLen);
+	case SOE_TCP_OPC_PING:				return processPing(package, packageLen);
+	case SOE_TCP_OPC_PONG:				return processPong(package, packageLen);
+	case SOE_TCP_OPC_RESUME:			return processResume(package, packageLen);
+	case SOE_TCP_OPC_RESYNCED:			return processResynced(package, packageLen);
+	case SOE_TCP_OPC_CLOSE_SESSION:		return processCloseSession(package, packageLen);
+	case SOE_TCP_OPC_OPEN_PORT: 		return processRemoteOpen(package, packageLen, channel);
+	case SOE_TCP_OPC_CLOSE_PORT: 		return processRemoteClose(package, packageLen, channel);
+	case SOE_TCP_OPC_CONFIGURE_PORT: 	return processRemoteConfig(package, packageLen, channel);
 	default: 							return sendError("undefined package code: " + std::to_string(package[0]));
 	}
 
 }
 
+bool SerialOverEthernet::SOELinkHandler::transmitChannelPackage(unsigned char channel, char* package, unsigned int packageLen) {
+
+	// packages of the default channel are send without prefix, so that remotes without channel support understand them
+	if (channel == 0)
+		return transmitPackage(package, packageLen);
+
+	char* prefix = package - SOE_TCP_CHANNEL_PREFIX_LEN;
+	prefix[0] = SOE_TCP_OPC_CHANNEL;
+	prefix[1] = (char) channel;
+	return transmitPackage(prefix, packageLen + SOE_TCP_CHANNEL_PREFIX_LEN);
+}
+
+bool SerialOverEthernet::SOELinkHandler::processChannel(const char* package, unsigned int packageLen, unsigned char channel) {
+	// the prefix addresses the package following it to an channel, it can not be nested
+	if (packageLen < SOE_TCP_CHANNEL_PREFIX_LEN + 1 || channel != 0)
+		return sendError("malformed channel package");
+
+	return processPackage(package + SOE_TCP_CHANNEL_PREFIX_LEN, packageLen - SOE_TCP_CHANNEL_PREFIX_LEN, (unsigned char) package[1]);
+}
+
+int SerialOverEthernet::SOELinkHandler::transmitRequestPackage(unsigned char channel, char* package, unsigned int packageLen, const char* operation, const std::string& portName) {
+
+	// the requests have to be transmitted in the order of their sequence, remotes without request ids confirm in this order
+	std::lock_guard<std::mutex> requestLock(this->m_remoteRequest);
+	std::unique_lock<std::mutex> lock(this->m_remoteReturn);
+	unsigned short requestId = this->nextRequestId;
+	while (requestId == 0 || this->remoteRequests.count(requestId))
+		requestId++;
+	this->nextRequestId = requestId + 1;
+	SOERequest& request = this->remoteRequests[requestId];
+	request.sequence = this->nextRequestSequence++;
+	request.operation = operation;
+	request.portName = portName;
+	request.completed = false;
+	request.success = false;
+	request.abandoned = false;
+	bool requestIds = this->remoteFeatures & SOE_TCP_FEATURE_REQUEST_IDS;
+	lock.unlock();
+
+	if (channel != 0) {
+		package -= SOE_TCP_CHANNEL_PREFIX_LEN;
+		packageLen += SOE_TCP_CHANNEL_PREFIX_LEN;
+		package[0] = SOE_TCP_OPC_CHANNEL;
+		package[1] = (char) channel;
+	}
+	if (requestIds) {
+		package -= SOE_TCP_REQUEST_PREFIX_LEN;
+		packageLen += SOE_TCP_REQUEST_PREFIX_LEN;
+		package[0] = SOE_TCP_OPC_REQUEST;
+		package[1] = (requestId >> 0) & 0xFF;
+		package[2] = (requestId >> 8) & 0xFF;
+	}
+
+	if (!transmitPackage(package, packageLen)) {
+		lock.lock();
+		this->remoteRequests.erase(requestId);
+		return -1;
+	}
+	return requestId;
+}
+
+bool SerialOverEthernet::SOELinkHandler::processRequest(const char* package, unsigned int packageLen, unsigned char channel) {
+	// the request id is echoed by the confirm send while processing the package, requests can not be nested
+	if (packageLen < SOE_TCP_REQUEST_PREFIX_LEN + 1 || this->rxRequestId != 0)
+		return sendError("malformed request package");
+
+	unsigned short requestId = (package[1] & 0xFF) << 0 | (package[2] & 0xFF) << 8;
+	if (requestId == 0)
+		return sendError("malformed request package");
+	this->rxRequestId = requestId;
+	bool processed = processPackage(package + SOE_TCP_REQUEST_PREFIX_LEN, packageLen - SOE_TCP_REQUEST_PREFIX_LEN, channel);
+	this->rxRequestId = 0;
+	return processed;
+}
+
+// Returns the pending request send first, which is answered next by remotes without request ids
+static std::map<unsigned short, SerialOverEthernet::SOERequest>::iterator oldestRequest(std::map<unsigned short, SerialOverEthernet::SOERequest>& requests) {
+	auto oldest = requests.end();
+	for (auto request = requests.begin(); request != requests.end(); request++)
+		if (!request->second.completed && (oldest == requests.end() || request->second.sequence < oldest->second.sequence))
+			oldest = request;
+	return oldest;
+}
+
+// Completes the request with the result, requests nobody waits for anymore are removed
+static void completeRequest(std::map<unsigned short, SerialOverEthernet::SOERequest>& requests, std::map<unsigned short, SerialOverEthernet::SOERequest>::iterator request, bool success) {
+	if (request->second.abandoned) {
+		requests.erase(request);
+		return;
+	}
+	request->second.completed = true;
+	request->second.success = success;
+}
+
 bool SerialOverEthernet::SOELinkHandler::sendError(const std::string& message) {
-	char package[message.length() + 1] {0};
+	std::vector<char> buffer(SOE_TCP_PACKAGE_HEADROOM + message.length() + 1);
+	char* package = buffer.data() + SOE_TCP_PACKAGE_HEADROOM;
 	package[0] = SOE_TCP_OPC_ERROR;
 	memcpy(package + 1, message.c_str(), (size_t) message.length());
 
@@ -48,36 +170,394 @@ bool SerialOverEthernet::SOELinkHandler::processError(const char* package, unsig
 	std::string message(package + 1, packageLen - 1);
 
 	printf("[!] remote error frame: %s\n", message.c_str());
+
+	// fail the pending request, an remote not supporting protocol negotiation answers the hello with an error
+	// the remote does not know the session anymore
+	if (this->resumePending) {
+		printf("[!] remote rejected resuming the session: %s/%s\n", this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+		return false;
+	}
+
+	std::unique_lock<std::mutex> lock(this->m_remoteReturn);
+	if (this->helloPending) {
+		dbgprintf("[DBG] remote does not support protocol negotiation, fallback to v1\n");
+		this->helloPending = false;
+	} else {
+		auto request = oldestRequest(this->remoteRequests);
+		if (request != this->remoteRequests.end())
+			completeRequest(this->remoteRequests, request, false);
+	}
+	lock.unlock();
+	this->cv_remoteReturn.notify_all();
+	return true;
+}
+
+bool SerialOverEthernet::SOELinkHandler::sendHello(unsigned char version, unsigned int frameLimit, unsigned long long session) {
+	char buffer[SOE_TCP_PACKAGE_HEADROOM + 14] = { 0 };
+	char* package = buffer + SOE_TCP_PACKAGE_HEADROOM;
+	package[0] = SOE_TCP_OPC_HELLO;
+	package[1] = (char) version;
+	package[2] = (frameLimit >> 0) & 0xFF;
+	package[3] = (frameLimit >> 8) & 0xFF;
+	package[4] = (frameLimit >> 16) & 0xFF;
+	package[5] = SOE_TCP_FEATURES | (sessionTimeout > 0 ? SOE_TCP_FEATURE_SESSION : 0);
+
+	// the session id is appended if an session is offered, remotes without session support ignore it
+	if (session == 0)
+		return transmitPackage(package, 6);
+	for (unsigned int i = 0; i < 8; i++)
+		package[6 + i] = (session >> (i * 8)) & 0xFF;
+	return transmitPackage(package, 14);
+}
+
+bool SerialOverEthernet::SOELinkHandler::processHello(const char* package, unsigned int packageLen) {
+	if (packageLen < 2)
+		return sendError("malformed hello package");
+	unsigned char version = (unsigned char) package[1] < SOE_TCP_PROTOCOL_VERSION ? (unsigned char) package[1] : SOE_TCP_PROTOCOL_VERSION;
+
+	// the frame length limit is optional, without it the remote only accepts the v1 length
+	unsigned int remoteLimit = SOE_TCP_FRAME_MAX_LEN;
+	if (packageLen >= 5)
+		remoteLimit = (package[2] & 0xFF) << 0 | (package[3] & 0xFF) << 8 | (package[4] & 0xFF) << 16;
+	unsigned int frameMaxLen = remoteLimit < frameLimit ? remoteLimit : frameLimit;
+	if (frameMaxLen < SOE_TCP_FRAME_MAX_LEN) frameMaxLen = SOE_TCP_FRAME_MAX_LEN;
+	unsigned char features = packageLen >= 6 ? (unsigned char) package[5] : 0;
+
+	std::unique_lock<std::mutex> lock(this->m_remoteReturn);
+	if (this->helloPending) {
+		// response to our negotiation, the remote switched after sending it
+		this->rxProtocolVersion = version;
+		this->rxFrameMaxLen = frameMaxLen;
+		this->remoteFeatures = features;
+		std::unique_lock<std::mutex> txLock(this->m_socketTX);
+		this->txProtocolVersion = version;
+		this->txFrameMaxLen = frameMaxLen;
+		txLock.unlock();
+		this->helloPending = false;
+		lock.unlock();
+		this->cv_remoteReturn.notify_all();
+		return true;
+	}
+	lock.unlock();
+
+	// request from the remote, respond with the old framing and switch after it
+	dbgprintf("[DBG] remote requested protocol v%u, using v%u with max frame length %u\n", (unsigned int) (unsigned char) package[1], version, frameMaxLen);
+	char buffer[SOE_TCP_PACKAGE_HEADROOM + 6] = { 0 };
+	char* response = buffer + SOE_TCP_PACKAGE_HEADROOM;
+	response[0] = SOE_TCP_OPC_HELLO;
+	response[1] = (char) version;
+	response[2] = (frameLimit >> 0) & 0xFF;
+	response[3] = (frameLimit >> 8) & 0xFF;
+	response[4] = (frameLimit >> 16) & 0xFF;
+	response[5] = SOE_TCP_FEATURES | (sessionTimeout > 0 ? SOE_TCP_FEATURE_SESSION : 0);
+	std::unique_lock<std::mutex> txLock(this->m_socketTX);
+	if (this->txProtocolVersion != 1 || !transmitPackageV1(response, 6)) {
+		dbgprintf("[DBG] unable to send hello response\n");
+		return false;
+	}
+	this->txProtocolVersion = version;
+	this->txFrameMaxLen = frameMaxLen;
+	txLock.unlock();
+	this->rxProtocolVersion = version;
+	this->rxFrameMaxLen = frameMaxLen;
+	this->remoteFeatures = features;
+	updateSerialBuffer();
+
+	// accept the session offered by the remote, it can resume it with an new connection
+	if ((features & SOE_TCP_FEATURE_SESSION) && packageLen >= 14 && sessionTimeout > 0 && version >= 2) {
+		unsigned long long session = 0;
+		for (unsigned int i = 0; i < 8; i++)
+			session |= (unsigned long long) (package[6 + i] & 0xFF) << (i * 8);
+		std::lock_guard<std::mutex> sessionLock(m_sessions);
+		if (session != 0 && !sessions.count(session)) {
+			dbgprintf("[DBG] session established: %016llx\n", session);
+			sessions[session] = this;
+			this->sessionId = session;
+		}
+	}
 	return true;
 }
 
 bool SerialOverEthernet::SOELinkHandler::sendConfirm(bool status) {
-	char package[] = { SOE_TCP_OPC_CONFIRM, status ? (char) 0x1 : (char) 0x0 };
+	char buffer[SOE_TCP_PACKAGE_HEADROOM + 4] = { 0 };
+	char* package = buffer + SOE_TCP_PACKAGE_HEADROOM;
+	package[0] = SOE_TCP_OPC_CONFIRM;
+	package[1] = status ? 0x1 : 0x0;
 
-	return transmitPackage(package, 2);
+	// the id of the request is appended if it had one, remotes without request ids only read the status
+	if (this->rxRequestId == 0)
+		return transmitPackage(package, 2);
+	package[2] = (this->rxRequestId >> 0) & 0xFF;
+	package[3] = (this->rxRequestId >> 8) & 0xFF;
+	return transmitPackage(package, 4);
 }
 
 bool SerialOverEthernet::SOELinkHandler::processConfirm(const char* package, unsigned int packageLen) {
+	if (packageLen < 2)
+		return sendError("malformed confirm package");
+
 	std::unique_lock<std::mutex> lock(this->m_remoteReturn);
-	this->remoteReturn = package[1] == 0x1;
+	auto request = packageLen >= 4 ?
+			this->remoteRequests.find((unsigned short) ((package[2] & 0xFF) << 0 | (package[3] & 0xFF) << 8)) :
+			oldestRequest(this->remoteRequests);
+	if (request == this->remoteRequests.end()) {
+		dbgprintf("[DBG] received confirm without pending request\n");
+		return true;
+	}
+	completeRequest(this->remoteRequests, request, package[1] == 0x1);
 	lock.unlock();
 	this->cv_remoteReturn.notify_all();
 	return true;
 }
 
-bool SerialOverEthernet::SOELinkHandler::sendRemoteOpen(const std::string& remoteSerial) {
-	char package[remoteSerial.length() + 1] {0};
+bool SerialOverEthernet::SOELinkHandler::sendPing(unsigned long long timestamp) {
+	char buffer[SOE_TCP_PACKAGE_HEADROOM + 9] = { 0 };
+	char* package = buffer + SOE_TCP_PACKAGE_HEADROOM;
+	package[0] = SOE_TCP_OPC_PING;
+	for (unsigned int i = 0; i < 8; i++)
+		package[1 + i] = (timestamp >> (i * 8)) & 0xFF;
+
+	return transmitPackage(package, 9);
+}
+
+bool SerialOverEthernet::SOELinkHandler::processPing(const char* package, unsigned int packageLen) {
+	if (packageLen < 9)
+		return sendError("malformed ping package");
+
+	// the timestamp is only interpreted by the sender, it is echoed unchanged
+	char buffer[SOE_TCP_PACKAGE_HEADROOM + 9] = { 0 };
+	char* response = buffer + SOE_TCP_PACKAGE_HEADROOM;
+	memcpy(response, package, 9);
+	response[0] = SOE_TCP_OPC_PONG;
+
+	return transmitPackage(response, 9);
+}
+
+bool SerialOverEthernet::SOELinkHandler::processPong(const char* package, unsigned int packageLen) {
+	if (packageLen < 9)
+		return sendError("malformed pong package");
+
+	unsigned long long timestamp = 0;
+	for (unsigned int i = 0; i < 8; i++)
+		timestamp |= (unsigned long long) (package[1 + i] & 0xFF) << (i * 8);
+	unsigned long long now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	if (timestamp > now) return true;
+	unsigned long rtt = (unsigned long) (now - timestamp);
+
+	// the jitter is smoothed like the interarrival jitter of RTP (RFC 3550)
+	std::lock_guard<std::mutex> lock(this->m_latency);
+	if (this->rttResponses > 0) {
+		long difference = (long) rtt - (long) this->rttLast;
+		long deviation = difference < 0 ? -difference : difference;
+		this->rttJitter = (unsigned long) ((long) this->rttJitter + (deviation - (long) this->rttJitter) / 16);
+	}
+	this->rttLast = rtt;
+	this->rttResponses++;
+	if (this->rttSamples.size() < SOE_TCP_RTT_SAMPLES) {
+		this->rttSamples.push_back(rtt);
+	} else {
+		this->rttSamples[this->rttSampleIndex] = rtt;
+		this->rttSampleIndex = (this->rttSampleIndex + 1) % SOE_TCP_RTT_SAMPLES;
+	}
+	dbgprintf("[DBG] round trip time: %lu us\n", rtt);
+	return true;
+}
+
+bool SerialOverEthernet::SOELinkHandler::sendResume() {
+	char buffer[SOE_TCP_PACKAGE_HEADROOM + 9] = { 0 };
+	char* package = buffer + SOE_TCP_PACKAGE_HEADROOM;
+	package[0] = SOE_TCP_OPC_RESUME;
+	for (unsigned int i = 0; i < 8; i++)
+		package[1 + i] = (this->sessionId >> (i * 8)) & 0xFF;
+
+	// the handler accepting the new connection did not negotiate the protocol, the request and its response use the v1 framing
+	return transmitPackageV1(package, 9);
+}
+
+bool SerialOverEthernet::SOELinkHandler::processResume(const char* package, unsigned int packageLen) {
+	if (packageLen < 9)
+		return sendError("malformed resume package");
+	unsigned long long session = 0;
+	for (unsigned int i = 0; i < 8; i++)
+		session |= (unsigned long long) (package[1 + i] & 0xFF) << (i * 8);
+
+	if (this->resumePending) {
+		if (session != this->sessionId)
+			return sendError("malformed resume package");
+
+		// response of the remote, which continues with the negotiated protocol, transmit the resync before anything else
+		std::unique_lock<std::shared_mutex> sessionLock(this->m_session);
+		std::unique_lock<std::mutex> txLock(this->m_socketTX);
+		this->rxProtocolVersion = this->txProtocolVersion;
+		this->resumePending = false;
+		if (!sendResync()) return false;
+		this->suspended = false;
+		txLock.unlock();
+		this->cv_socketTX.notify_all();
+		this->resumes++;
+		printf("[i] session resumed: %s/%s\n", this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+		return true;
+	}
+
+	// request on an new connection, pass it to the handler of the session
+	if (this->sessionId != 0 || this->rxProtocolVersion != 1)
+		return sendError("unexpected resume package");
+	std::unique_lock<std::mutex> sessionLock(m_sessions);
+	auto handler = sessions.find(session);
+	if (handler == sessions.end()) {
+		sessionLock.unlock();
+		printf("[!] unable to resume unknown session: %s/%s\n", this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+		sendError("unknown session");
+		return false;
+	}
+	printf("[i] connection resumes session of: %s\n", handler->second->getRemoteAddress().c_str());
+	unwatchTransport(); // the event loop of the session receives the connection from now on
+	std::unique_lock<std::mutex> transportLock(this->m_transport);
+	handler->second->handOverTransport(this->transport.release());
+	transportLock.unlock();
+	sessionLock.unlock();
+
+	// this handler is not needed anymore
+	shutdown();
+	return true;
+}
+
+bool SerialOverEthernet::SOELinkHandler::sendCloseSession() {
+	char buffer[SOE_TCP_PACKAGE_HEADROOM + 1] = { 0 };
+	char* package = buffer + SOE_TCP_PACKAGE_HEADROOM;
+	package[0] = SOE_TCP_OPC_CLOSE_SESSION;
+
+	// send with m_socketTX locked and no frame in transmission, the queued records are discarded with the connection anyway
+	if (this->txProtocolVersion >= 2)
+		return transmitPackageDirect(package, 1);
+	return transmitPackageV1(package, 1);
+}
+
+bool SerialOverEthernet::SOELinkHandler::processCloseSession(const char* package, unsigned int packageLen) {
+	printf("[i] session closed by remote: %s/%s\n", this->remoteHostName.c_str(), this->remoteHostPort.c_str());
+	this->sessionClosed = true;
+	return true;
+}
+
+bool SerialOverEthernet::SOELinkHandler::sendResync() {
+	std::shared_lock<std::shared_mutex> channelLock(this->m_channels);
+	std::vector<SOEChannel*> channels;
+	for (auto& channel : this->channels)
+		channels.push_back(channel.second.get());
+	channelLock.unlock();
+
+	// the reception position of each channel tells the remote where to continue, the granted credits replace the ones lost in flight
+	for (SOEChannel* channel : channels) {
+		std::unique_lock<std::mutex> lock(channel->m_serialTX);
+		unsigned long long granted = channel->rxCreditsGranted;
+		lock.unlock();
+		channel->rxAcknowledged = channel->rxSequence;
+
+		char buffer[SOE_TCP_CHANNEL_HEADROOM + 17] = { 0 };
+		char* package = buffer + SOE_TCP_CHANNEL_HEADROOM;
+		package[0] = SOE_TCP_OPC_STREAM_RESYNC;
+		for (unsigned int i = 0; i < 8; i++) {
+			package[1 + i] = (channel->rxSequence >> (i * 8)) & 0xFF;
+			package[9 + i] = (granted >> (i * 8)) & 0xFF;
+		}
+		unsigned int packageLen = 17;
+		if (channel->number != 0) {
+			package -= SOE_TCP_CHANNEL_PREFIX_LEN;
+			packageLen += SOE_TCP_CHANNEL_PREFIX_LEN;
+			package[0] = SOE_TCP_OPC_CHANNEL;
+			package[1] = (char) channel->number;
+		}
+		dbgprintf("[DBG] resync reception position: %llu bytes (channel %u)\n", channel->rxSequence, (unsigned int) channel->number);
+		if (!transmitPackageDirect(package, packageLen))
+			return false;
+	}
+
+	char buffer[SOE_TCP_PACKAGE_HEADROOM + 1] = { 0 };
+	char* package = buffer + SOE_TCP_PACKAGE_HEADROOM;
+	package[0] = SOE_TCP_OPC_RESYNCED;
+	return transmitPackageDirect(package, 1);
+}
+
+bool SerialOverEthernet::SOELinkHandler::processResync(const char* package, unsigned int packageLen, unsigned char channel) {
+	if (packageLen < 17)
+		return sendError("malformed resync package");
+	unsigned long long received = 0;
+	unsigned long long granted = 0;
+	for (unsigned int i = 0; i < 8; i++) {
+		received |= (unsigned long long) (package[1 + i] & 0xFF) << (i * 8);
+		granted |= (unsigned long long) (package[9 + i] & 0xFF) << (i * 8);
+	}
+
+	// the data up to the reception position arrived, the data after it is retransmitted
+	SOEChannel& localChannel = getChannel(channel);
+	std::unique_lock<std::mutex> lock(localChannel.m_txCredits);
+	if (received < localChannel.txAcknowledged || received > localChannel.txSequence) {
+		printf("[!] frame error, received resync outside of the transmitted data\n");
+		return false;
+	}
+	localChannel.retransmitBuffer.erase(localChannel.retransmitBuffer.begin(), localChannel.retransmitBuffer.begin() + (received - localChannel.txAcknowledged));
+	localChannel.txAcknowledged = received;
+	if (this->remoteFeatures & SOE_TCP_FEATURE_CREDITS)
+		localChannel.txCredits = granted > localChannel.txSequence ? (unsigned long) (granted - localChannel.txSequence) : 0;
+	localChannel.resyncPending = false;
+	localChannel.retransmitPending = true;
+	dbgprintf("[DBG] resync transmission position: %llu bytes, %zu bytes to retransmit (channel %u)\n", received, localChannel.retransmitBuffer.size(), (unsigned int) channel);
+	lock.unlock();
+	localChannel.cv_txCredits.notify_all();
+	updateSerialEvents(localChannel);
+	return true;
+}
+
+bool SerialOverEthernet::SOELinkHandler::processResynced(const char* package, unsigned int packageLen) {
+	std::shared_lock<std::shared_mutex> channelLock(this->m_channels);
+	std::vector<SOEChannel*> channels;
+	for (auto& channel : this->channels)
+		channels.push_back(channel.second.get());
+	channelLock.unlock();
+
+	// channels the remote did not know did not receive anything, all their data is retransmitted
+	for (SOEChannel* channel : channels) {
+		std::unique_lock<std::mutex> lock(channel->m_txCredits);
+		if (!channel->resyncPending) continue;
+		channel->resyncPending = false;
+		channel->retransmitPending = true;
+		lock.unlock();
+		channel->cv_txCredits.notify_all();
+		updateSerialEvents(*channel);
+	}
+	return true;
+}
+
+int SerialOverEthernet::SOELinkHandler::sendRemoteOpen(unsigned char channel, const std::string& remoteSerial, unsigned char options) {
+	// the options are separated by an null character, they are omitted if none are requested for compatibility
+	unsigned int packageLen = (unsigned int) remoteSerial.length() + (options ? 3 : 1);
+	std::vector<char> buffer(SOE_TCP_REQUEST_HEADROOM + packageLen);
+	char* package = buffer.data() + SOE_TCP_REQUEST_HEADROOM;
 	package[0] = SOE_TCP_OPC_OPEN_PORT;
 	memcpy(package + 1, remoteSerial.c_str(), (size_t) remoteSerial.length());
+	if (options)
+		package[packageLen - 1] = (char) options;
 
-	return transmitPackage(package, (unsigned int) remoteSerial.length() + 1);
+	return transmitRequestPackage(channel, package, packageLen, "open port", remoteSerial);
 }
 
-bool SerialOverEthernet::SOELinkHandler::processRemoteOpen(const char* package, unsigned int packageLen) {
-	std::string portName(package + 1, packageLen - 1);
+bool SerialOverEthernet::SOELinkHandler::processRemoteOpen(const char* package, unsigned int packageLen, unsigned char channel) {
+	const char* nameEnd = (const char*) memchr(package + 1, 0, packageLen - 1);
+	std::string portName(package + 1, nameEnd ? nameEnd : package + packageLen);
+	unsigned char options = nameEnd && nameEnd + 1 < package + packageLen ? (unsigned char) nameEnd[1] : 0;
+
+	// enable compression before the port is opened, the remote accepts compressed data at any time
+	SOEChannel& localChannel = getChannel(channel);
+	if ((options & SOE_TCP_FEATURE_COMPRESSION) && !localChannel.txCompressor) {
+		printf("[i] compression enabled from remote: %s\n", portName.c_str());
+		localChannel.txCompressor.reset(new SerialOverEthernet::SOECompressor());
+	}
 
-	printf("[i] open port from remote: %s\n", portName.c_str());
-	bool opened = openLocalPort(portName);
+	if (channel != 0)
+		printf("[i] open port from remote: %s (channel %u)\n", portName.c_str(), (unsigned int) channel);
+	else
+		printf("[i] open port from remote: %s\n", portName.c_str());
+	bool opened = openLocalPort(channel, portName);
 	if (!opened)
 		printf("[!] unable to open port from remote: %s\n", portName.c_str());
 	if (!sendConfirm(opened)) {
@@ -87,17 +567,20 @@ bool SerialOverEthernet::SOELinkHandler::processRemoteOpen(const char* package,
 	return true;
 }
 
-bool SerialOverEthernet::SOELinkHandler::sendRemoteClose() {
-	char package = SOE_TCP_OPC_CLOSE_PORT;
+int SerialOverEthernet::SOELinkHandler::sendRemoteClose(unsigned char channel) {
+	char buffer[SOE_TCP_REQUEST_HEADROOM + 1] = { 0 };
+	char* package = buffer + SOE_TCP_REQUEST_HEADROOM;
+	package[0] = SOE_TCP_OPC_CLOSE_PORT;
 
-	return transmitPackage(&package, 1);
+	return transmitRequestPackage(channel, package, 1, "close port", getChannel(channel).remotePortName);
 }
 
-bool SerialOverEthernet::SOELinkHandler::processRemoteClose(const char* package, unsigned int packageLen) {
-	printf("[i] close port from remote: %s\n", this->localPortName.c_str());
-	bool closed = closeLocalPort();
+bool SerialOverEthernet::SOELinkHandler::processRemoteClose(const char* package, unsigned int packageLen, unsigned char channel) {
+	SOEChannel& localChannel = getChannel(channel);
+	printf("[i] close port from remote: %s\n", localChannel.localPortName.c_str());
+	bool closed = closeLocalPort(channel);
 	if (!closed)
-		printf("[!] unable to close port from remote: %s\n", this->localPortName.c_str());
+		printf("[!] unable to close port from remote: %s\n", localChannel.localPortName.c_str());
 	if (!sendConfirm(closed)) {
 		dbgprintf("[DBG] unable to send confirm response\n");
 		return false;
@@ -105,8 +588,9 @@ bool SerialOverEthernet::SOELinkHandler::processRemoteClose(const char* package,
 	return true;
 }
 
-bool SerialOverEthernet::SOELinkHandler::sendRemoteConfig(const SerialAccess::SerialPortConfiguration& remoteSerial) {
-	char package[18] {0};
+int SerialOverEthernet::SOELinkHandler::sendRemoteConfig(unsigned char channel, const SerialAccess::SerialPortConfiguration& remoteSerial) {
+	char buffer[SOE_TCP_REQUEST_HEADROOM + 18] = { 0 };
+	char* package = buffer + SOE_TCP_REQUEST_HEADROOM;
 	package[0] = SOE_TCP_OPC_CONFIGURE_PORT;
 	package[1] = (remoteSerial.baudRate >> 24) & 0xFF;
 	package[2] = (remoteSerial.baudRate >> 16) & 0xFF;
@@ -126,10 +610,13 @@ bool SerialOverEthernet::SOELinkHandler::sendRemoteConfig(const SerialAccess::Se
 	package[16] = (remoteSerial.flowControl >> 8) & 0xFF;
 	package[17] = (remoteSerial.flowControl >> 0) & 0xFF;
 
-	return transmitPackage(package, 18);
+	return transmitRequestPackage(channel, package, 18, "change configuration", getChannel(channel).remotePortName);
 }
 
-bool SerialOverEthernet::SOELinkHandler::processRemoteConfig(const char* package, unsigned int packageLen) {
+bool SerialOverEthernet::SOELinkHandler::processRemoteConfig(const char* package, unsigned int packageLen, unsigned char channel) {
+	if (packageLen < 18)
+		return sendError("malformed configure package");
+
 	SerialAccess::SerialPortConfiguration config = {
 		(unsigned long) ( // baud rate
 				(package[1] & 0xFF) << 24 |
@@ -155,10 +642,11 @@ bool SerialOverEthernet::SOELinkHandler::processRemoteConfig(const char* package
 				(package[17] & 0xFF) << 0)
 	};
 
-	printf("[i] change port configuration from remote: %s (baud %lu)\n", this->localPortName.c_str(), config.baudRate);
-	bool changed = setLocalConfig(config);
+	SOEChannel& localChannel = getChannel(channel);
+	printf("[i] change port configuration from remote: %s (baud %lu)\n", localChannel.localPortName.c_str(), config.baudRate);
+	bool changed = setLocalConfig(channel, config);
 	if (!changed)
-		printf("[!] unable to change configuration from remote: %s\n", this->localPortName.c_str());
+		printf("[!] unable to change configuration from remote: %s\n", localChannel.localPortName.c_str());
 	if (!sendConfirm(changed)) {
 		dbgprintf("[DBG] unable to send config confirm\n");
 		return false;
@@ -166,17 +654,117 @@ bool SerialOverEthernet::SOELinkHandler::processRemoteConfig(const char* package
 	return true;
 }
 
-bool SerialOverEthernet::SOELinkHandler::sendSerialData(const char* data, unsigned int len) {
-	char package[len + 1] {0};
+bool SerialOverEthernet::SOELinkHandler::sendSerialData(SOEChannel& channel, char* data, unsigned int len) {
+	if (channel.txCompressor && channel.txCompressor->shouldAttempt(len)) {
+		if (channel.txCompressed.size() < SOE_SERIAL_DATA_HEADROOM + len)
+			channel.txCompressed.resize(SOE_SERIAL_DATA_HEADROOM + len);
+
+		// send compressed only if it is smaller, otherwise fall back to the raw package
+		unsigned int compressedLen = channel.txCompressor->compress(data, len, channel.txCompressed.data() + SOE_SERIAL_DATA_HEADROOM, len - 1);
+		if (compressedLen) {
+			char* package = channel.txCompressed.data() + SOE_SERIAL_DATA_HEADROOM - 1;
+			package[0] = SOE_TCP_OPC_STREAM_COMPRESSED;
+			return transmitChannelPackage(channel.number, package, compressedLen + 1);
+		}
+	}
+
+	// the opcode and frame header are written in front of the data, no copy required
+	char* package = data - 1;
 	package[0] = SOE_TCP_OPC_STREAM_SERIAL;
-	memcpy(package + 1, data, len);
 
-	return transmitPackage(package, len + 1);
+	return transmitChannelPackage(channel.number, package, len + 1);
 }
 
-bool SerialOverEthernet::SOELinkHandler::processSerialData(const char* package, unsigned int packageLen) {
-	if (packageLen)
-		transmitSerialData(package + 1, packageLen - 1);
+bool SerialOverEthernet::SOELinkHandler::processSerialData(const char* package, unsigned int packageLen, unsigned char channel) {
+	SOEChannel& localChannel = getChannel(channel);
+	queueSerialData(localChannel, package + 1, packageLen - 1);
+
+	return acknowledgeSerialData(localChannel, packageLen - 1);
+}
+
+bool SerialOverEthernet::SOELinkHandler::processCompressedData(const char* package, unsigned int packageLen, unsigned char channel) {
+	// the history of the remote compressor starts with its first compressed package
+	SOEChannel& localChannel = getChannel(channel);
+	if (!localChannel.rxDecompressor)
+		localChannel.rxDecompressor.reset(new SerialOverEthernet::SOEDecompressor());
+
+	const char* data;
+	int dataLen = localChannel.rxDecompressor->decompress(package + 1, packageLen - 1, &data);
+	if (dataLen < 0) {
+		printf("[!] frame error, received malformed compressed serial data\n");
+		return false;
+	}
+	dbgprintf("[DBG] decompressed serial data: %u -> %d bytes\n", packageLen - 1, dataLen);
+	if (dataLen)
+		queueSerialData(localChannel, data, (unsigned int) dataLen);
+
+	return acknowledgeSerialData(localChannel, (unsigned int) dataLen);
+}
 
+bool SerialOverEthernet::SOELinkHandler::sendCredits(unsigned char channel, unsigned long credits) {
+	char buffer[SOE_TCP_CHANNEL_HEADROOM + 5] = { 0 };
+	char* package = buffer + SOE_TCP_CHANNEL_HEADROOM;
+	package[0] = SOE_TCP_OPC_STREAM_CREDITS;
+	package[1] = (credits >> 0) & 0xFF;
+	package[2] = (credits >> 8) & 0xFF;
+	package[3] = (credits >> 16) & 0xFF;
+	package[4] = (credits >> 24) & 0xFF;
+
+	dbgprintf("[DBG] grant credits: %lu bytes (channel %u)\n", credits, (unsigned int) channel);
+	return transmitChannelPackage(channel, package, 5);
+}
+
+bool SerialOverEthernet::SOELinkHandler::processCredits(const char* package, unsigned int packageLen, unsigned char channel) {
+	if (packageLen < 5)
+		return sendError("malformed credits package");
+
+	// the credits add up, the remote only grants what it has space for
+	SOEChannel& localChannel = getChannel(channel);
+	unsigned long credits = (unsigned long) (package[1] & 0xFF) << 0 | (unsigned long) (package[2] & 0xFF) << 8 | (unsigned long) (package[3] & 0xFF) << 16 | (unsigned long) (package[4] & 0xFF) << 24;
+	std::unique_lock<std::mutex> lock(localChannel.m_txCredits);
+	localChannel.txCredits += credits;
+	lock.unlock();
+	localChannel.cv_txCredits.notify_all();
+	updateSerialEvents(localChannel);
+	return true;
+}
+
+bool SerialOverEthernet::SOELinkHandler::sendAck(unsigned char channel, unsigned long long received) {
+	char buffer[SOE_TCP_CHANNEL_HEADROOM + 9] = { 0 };
+	char* package = buffer + SOE_TCP_CHANNEL_HEADROOM;
+	package[0] = SOE_TCP_OPC_STREAM_ACK;
+	for (unsigned int i = 0; i < 8; i++)
+		package[1 + i] = (received >> (i * 8)) & 0xFF;
+
+	dbgprintf("[DBG] acknowledge serial data: %llu bytes (channel %u)\n", received, (unsigned int) channel);
+	return transmitChannelPackage(channel, package, 9);
+}
+
+bool SerialOverEthernet::SOELinkHandler::processAck(const char* package, unsigned int packageLen, unsigned char channel) {
+	if (packageLen < 9)
+		return sendError("malformed ack package");
+	unsigned long long received = 0;
+	for (unsigned int i = 0; i < 8; i++)
+		received |= (unsigned long long) (package[1 + i] & 0xFF) << (i * 8);
+
+	// the acknowledged data does not have to be retransmitted anymore
+	SOEChannel& localChannel = getChannel(channel);
+	std::unique_lock<std::mutex> lock(localChannel.m_txCredits);
+	if (received <= localChannel.txAcknowledged || received > localChannel.txSequence) return true;
+	localChannel.retransmitBuffer.erase(localChannel.retransmitBuffer.begin(), localChannel.retransmitBuffer.begin() + (received - localChannel.txAcknowledged));
+	localChannel.txAcknowledged = received;
+	lock.unlock();
+	localChannel.cv_txCredits.notify_all();
+	updateSerialEvents(localChannel);
 	return true;
 }
+
+bool SerialOverEthernet::SOELinkHandler::acknowledgeSerialData(SOEChannel& channel, unsigned int len) {
+	if (this->sessionId == 0) return true;
+
+	// the acknowledgments only free the retransmission buffer of the remote, so they are not send for every package
+	channel.rxSequence += len;
+	if (channel.rxSequence - channel.rxAcknowledged < SOE_SERIAL_ACK_LEN) return true;
+	channel.rxAcknowledged = channel.rxSequence;
+	return sendAck(channel.number, channel.rxSequence);
+}
@@ -0,0 +1,949 @@
+/*
+ * soetransport.cpp
+ *
+ * Implements the TCP and UDP transports of the links.
+ * The UDP transport and the TCP listener for event loops are currently only supported on linux.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "soetransport.hpp"
+#include "dbgprintf.h"
+
+namespace SerialOverEthernet {
+
+class SOETcpTransport : public SOETransport {
+
+public:
+	SOETcpTransport(NetSocket::Socket* socket) {
+		this->socket.reset(socket);
+		this->socket->setTimeouts(0, 0);
+		this->socket->setNagle(false);
+	}
+
+	bool send(const char* buffer, unsigned int length) override {
+		return this->socket->send(buffer, length);
+	}
+
+	bool receive(char* buffer, unsigned int length, unsigned int* received) override {
+		return this->socket->receive(buffer, length, received);
+	}
+
+	void close() override {
+		this->socket->close();
+	}
+
+	bool isOpen() override {
+		return this->socket->isOpen();
+	}
+
+	int lastError() override {
+		return this->socket->lastError();
+	}
+
+	const char* getName() override {
+		return "TCP";
+	}
+
+	int getHandle() override {
+		return -1; // the socket library does not expose its descriptor
+	}
+
+private:
+	std::unique_ptr<NetSocket::Socket> socket;
+
+};
+
+}
+
+SerialOverEthernet::SOETransport* SerialOverEthernet::newTcpTransport(NetSocket::Socket* socket) {
+	return new SOETcpTransport(socket);
+}
+
+#ifdef PLATFORM_LIN
+
+#include <sys/socket.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <vector>
+#include <iterator>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define SOE_UDP_TYPE_SYN 0x1				// connection request
+#define SOE_UDP_TYPE_SYNACK 0x2				// connection confirmation
+#define SOE_UDP_TYPE_DATA 0x3				// stream segment
+#define SOE_UDP_TYPE_ACK 0x4				// acknowledgment without segment
+#define SOE_UDP_TYPE_FIN 0x5				// connection closed
+#define SOE_UDP_HEADER_LEN 17				// type, connection id, sequence number, cumulative acknowledgment and selective acknowledgment bits
+#define SOE_UDP_DATAGRAM_LEN (SOE_UDP_HEADER_LEN + SOE_UDP_SEGMENT_LEN)
+#define SOE_UDP_CONNECT_TIMEOUT 4000		// timeout in ms for the connection request
+#define SOE_UDP_CONNECT_RETRY 200			// interval in ms of repeated connection requests
+#define SOE_UDP_POLL_INTERVAL 100			// interval in ms in which the datagram reader checks if it should terminate
+
+typedef std::chrono::steady_clock UdpClock;
+
+static std::atomic<unsigned long> udpPacingRate(SOE_UDP_DEFAULT_RATE);
+
+static inline void writeUint32(char* buffer, uint32_t value) {
+	for (unsigned int i = 0; i < 4; i++)
+		buffer[i] = (value >> i * 8) & 0xFF;
+}
+
+static inline uint32_t readUint32(const char* buffer) {
+	uint32_t value = 0;
+	for (unsigned int i = 0; i < 4; i++)
+		value |= ((uint32_t) (unsigned char) buffer[i]) << i * 8;
+	return value;
+}
+
+// Compares sequence numbers, taking the wrap around into account
+static inline bool sequenceBefore(uint32_t a, uint32_t b) {
+	return (int32_t) (a - b) < 0;
+}
+
+static inline double elapsedMs(UdpClock::time_point from, UdpClock::time_point to) {
+	return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+namespace SerialOverEthernet {
+
+// The datagram socket, shared between the listener and the connections accepted by it
+struct UdpSocket {
+	int fd;
+	UdpSocket(int fd) : fd(fd) {}
+	~UdpSocket() { ::close(this->fd); }
+};
+
+struct UdpSegment {
+	uint32_t sequence;
+	std::vector<char> data;
+	UdpClock::time_point sentAt;
+	unsigned int sendCount;					// number of transmissions, zero if not yet send
+	bool acknowledged;						// if selectively acknowledged, the segment is kept until all before it are acknowledged
+	bool lost;								// if considered lost and waiting for retransmission
+};
+
+/**
+ * The state of one UDP connection, shared between the transport and the datagram reader.
+ */
+class UdpSession {
+
+public:
+	UdpSession(std::shared_ptr<UdpSocket> socket, const sockaddr_storage& remote, socklen_t remoteLen, uint32_t connectionId, bool established) {
+		this->socket = socket;
+		this->remote = remote;
+		this->remoteLen = remoteLen;
+		this->connectionId = connectionId;
+		this->established = established;
+		this->open = true;
+		this->error = 0;
+		this->txNextSequence = 0;
+		this->srtt = 0;
+		this->rttvar = 0;
+		this->rto = SOE_UDP_MAX_RTO;
+		this->pacingRate = udpPacingRate;
+		this->tokens = SOE_UDP_PACING_BURST * SOE_UDP_SEGMENT_LEN;
+		this->tokenTime = this->lastTransmit = this->lastReceive = UdpClock::now();
+		this->rxNext = 0;
+		this->rxStreamStart = 0;
+		this->worker = std::thread([this]() { runWorker(); });
+	}
+
+	~UdpSession() {
+		close(0);
+		this->worker.join();
+	}
+
+	bool matches(const sockaddr_storage& address, socklen_t addressLen) {
+		return addressLen == this->remoteLen && memcmp(&address, &this->remote, addressLen) == 0;
+	}
+
+	uint32_t getConnectionId() {
+		return this->connectionId;
+	}
+
+	bool waitEstablished(unsigned int timeout) {
+		std::unique_lock<std::mutex> lock(this->m_session);
+		this->cv_receive.wait_for(lock, std::chrono::milliseconds(timeout), [this]() { return this->established || !this->open; });
+		return this->established && this->open;
+	}
+
+	void sendControl(uint8_t type) {
+		std::lock_guard<std::mutex> lock(this->m_session);
+		transmitDatagram(type, 0, nullptr, 0);
+	}
+
+	void close(int errorCode) {
+		std::unique_lock<std::mutex> lock(this->m_session);
+		closeLocked(errorCode);
+	}
+
+	bool isOpen() {
+		std::lock_guard<std::mutex> lock(this->m_session);
+		return this->open;
+	}
+
+	int lastError() {
+		std::lock_guard<std::mutex> lock(this->m_session);
+		return this->error;
+	}
+
+	bool send(const char* buffer, unsigned int length) {
+		std::unique_lock<std::mutex> lock(this->m_session);
+		while (length > 0) {
+			if (this->txSegments.size() >= SOE_UDP_WINDOW) {
+				transmitPending(UdpClock::now());
+				this->cv_worker.notify_one();
+			}
+			this->cv_send.wait(lock, [this]() { return this->txSegments.size() < SOE_UDP_WINDOW || !this->open; });
+			if (!this->open) return false;
+
+			// append to the last segment if it was not yet send, otherwise start an new one
+			if (this->txSegments.empty() || this->txSegments.back().sendCount > 0 || this->txSegments.back().data.size() == SOE_UDP_SEGMENT_LEN) {
+				UdpSegment segment;
+				segment.sequence = this->txNextSequence++;
+				segment.sendCount = 0;
+				segment.acknowledged = false;
+				segment.lost = false;
+				segment.data.reserve(SOE_UDP_SEGMENT_LEN);
+				this->txSegments.push_back(std::move(segment));
+			}
+			std::vector<char>& data = this->txSegments.back().data;
+			unsigned int chunk = SOE_UDP_SEGMENT_LEN - data.size() < length ? SOE_UDP_SEGMENT_LEN - data.size() : length;
+			data.insert(data.end(), buffer, buffer + chunk);
+			buffer += chunk;
+			length -= chunk;
+		}
+
+		// transmit immediately if the pacing allows it, the worker sends the rest
+		transmitPending(UdpClock::now());
+		this->cv_worker.notify_one();
+		return true;
+	}
+
+	bool receive(char* buffer, unsigned int length, unsigned int* received) {
+		std::unique_lock<std::mutex> lock(this->m_session);
+		this->cv_receive.wait(lock, [this]() { return this->rxStream.size() > this->rxStreamStart || !this->open; });
+		unsigned int available = this->rxStream.size() - this->rxStreamStart;
+		*received = available < length ? available : length;
+		if (*received == 0) return false;
+		memcpy(buffer, this->rxStream.data() + this->rxStreamStart, *received);
+		this->rxStreamStart += *received;
+		if (this->rxStreamStart == this->rxStream.size()) {
+			this->rxStream.clear();
+			this->rxStreamStart = 0;
+		}
+		return true;
+	}
+
+	void handleDatagram(const char* datagram, unsigned int length) {
+		if (length < SOE_UDP_HEADER_LEN) return;
+		uint8_t type = (uint8_t) datagram[0];
+		uint32_t sequence = readUint32(datagram + 5);
+		uint32_t ack = readUint32(datagram + 9);
+		uint32_t sack = readUint32(datagram + 13);
+
+		std::unique_lock<std::mutex> lock(this->m_session);
+		if (!this->open) return;
+		UdpClock::time_point now = UdpClock::now();
+		this->lastReceive = now;
+
+		switch (type) {
+		case SOE_UDP_TYPE_SYN:
+			// the confirmation got lost, the remote repeats its request
+			transmitDatagram(SOE_UDP_TYPE_SYNACK, 0, nullptr, 0);
+			return;
+		case SOE_UDP_TYPE_SYNACK:
+			this->established = true;
+			this->cv_receive.notify_all();
+			return;
+		case SOE_UDP_TYPE_FIN:
+			dbgprintf("[DBG] UDP connection closed by remote\n");
+			closeLocked(0);
+			return;
+		case SOE_UDP_TYPE_ACK:
+			processAck(ack, sack, now);
+			break;
+		case SOE_UDP_TYPE_DATA:
+			processAck(ack, sack, now);
+			processSegment(sequence, datagram + SOE_UDP_HEADER_LEN, length - SOE_UDP_HEADER_LEN);
+			// acknowledge every segment immediately, gaps are reported by the selective acknowledgment bits
+			transmitDatagram(SOE_UDP_TYPE_ACK, 0, nullptr, 0);
+			break;
+		default:
+			return;
+		}
+
+		transmitPending(now);
+		this->cv_worker.notify_one();
+	}
+
+private:
+	void closeLocked(int errorCode) {
+		if (!this->open) return;
+		if (errorCode == 0) {
+			transmitDatagram(SOE_UDP_TYPE_FIN, 0, nullptr, 0);
+			transmitDatagram(SOE_UDP_TYPE_FIN, 0, nullptr, 0);
+		}
+		this->open = false;
+		this->error = errorCode;
+		this->cv_send.notify_all();
+		this->cv_receive.notify_all();
+		this->cv_worker.notify_all();
+	}
+
+	void transmitDatagram(uint8_t type, uint32_t sequence, const char* payload, unsigned int length) {
+		char datagram[SOE_UDP_DATAGRAM_LEN];
+		datagram[0] = (char) type;
+		writeUint32(datagram + 1, this->connectionId);
+		writeUint32(datagram + 5, sequence);
+		writeUint32(datagram + 9, this->rxNext);
+
+		// report the segments received after the gap
+		uint32_t sack = 0;
+		for (auto& segment : this->rxOutOfOrder) {
+			uint32_t bit = segment.first - this->rxNext - 1;
+			if (bit >= SOE_UDP_SACK_BITS) break;
+			sack |= 1U << bit;
+		}
+		writeUint32(datagram + 13, sack);
+		if (length) memcpy(datagram + SOE_UDP_HEADER_LEN, payload, length);
+
+		if (::sendto(this->socket->fd, datagram, SOE_UDP_HEADER_LEN + length, MSG_NOSIGNAL, (sockaddr*) &this->remote, this->remoteLen) < 0)
+			dbgprintf("[DBG] UDP transmission failed: %d\n", errno);
+		this->lastTransmit = UdpClock::now();
+	}
+
+	void updateRtt(double sample) {
+		if (this->srtt == 0) {
+			this->srtt = sample;
+			this->rttvar = sample / 2;
+		} else {
+			this->rttvar = 0.75 * this->rttvar + 0.25 * (sample > this->srtt ? sample - this->srtt : this->srtt - sample);
+			this->srtt = 0.875 * this->srtt + 0.125 * sample;
+		}
+		double timeout = this->srtt + 4 * this->rttvar;
+		this->rto = timeout < SOE_UDP_MIN_RTO ? SOE_UDP_MIN_RTO : timeout > SOE_UDP_MAX_RTO ? SOE_UDP_MAX_RTO : (unsigned int) timeout;
+	}
+
+	void acknowledge(UdpSegment& segment, UdpClock::time_point now) {
+		if (segment.acknowledged) return;
+		segment.acknowledged = true;
+		// only segments transmitted once give an unambiguous round trip time
+		if (segment.sendCount == 1)
+			updateRtt(elapsedMs(segment.sentAt, now));
+	}
+
+	void processAck(uint32_t ack, uint32_t sack, UdpClock::time_point now) {
+		if (this->txSegments.empty()) return;
+		uint32_t first = this->txSegments.front().sequence;
+
+		// the cumulative acknowledgment covers all segments before it, the bits the segments after the first missing one
+		for (UdpSegment& segment : this->txSegments) {
+			if (!sequenceBefore(segment.sequence, ack)) break;
+			if (segment.sendCount > 0) acknowledge(segment, now);
+		}
+		uint32_t highestAcknowledged = ack;
+		for (unsigned int bit = 0; bit < SOE_UDP_SACK_BITS; bit++) {
+			if (!(sack & (1U << bit))) continue;
+			uint32_t index = ack + 1 + bit - first;
+			if (index >= this->txSegments.size() || this->txSegments[index].sendCount == 0) continue;
+			acknowledge(this->txSegments[index], now);
+			highestAcknowledged = ack + 1 + bit;
+		}
+
+		// fast retransmit segments with enough later segments acknowledged, at most once per round trip
+		unsigned int acknowledgedAfter = 0;
+		for (auto segment = this->txSegments.rbegin(); segment != this->txSegments.rend(); segment++) {
+			if (!sequenceBefore(segment->sequence, highestAcknowledged) && segment->sequence != highestAcknowledged) continue;
+			if (segment->acknowledged) {
+				acknowledgedAfter++;
+			} else if (acknowledgedAfter >= SOE_UDP_DUP_THRESHOLD && segment->sendCount > 0 && !segment->lost && elapsedMs(segment->sentAt, now) > this->srtt) {
+				dbgprintf("[DBG] UDP fast retransmit of segment %u\n", segment->sequence);
+				segment->lost = true;
+			}
+		}
+
+		while (!this->txSegments.empty() && this->txSegments.front().acknowledged)
+			this->txSegments.pop_front();
+		this->cv_send.notify_all();
+	}
+
+	void processSegment(uint32_t sequence, const char* data, unsigned int length) {
+		if (sequenceBefore(sequence, this->rxNext) || sequence - this->rxNext >= SOE_UDP_WINDOW)
+			return; // duplicate or outside of the window
+		if (sequence != this->rxNext) {
+			this->rxOutOfOrder.emplace(sequence, std::vector<char>(data, data + length));
+			return;
+		}
+
+		// deliver in order, including the segments which were waiting for this one
+		this->rxStream.insert(this->rxStream.end(), data, data + length);
+		this->rxNext++;
+		for (auto segment = this->rxOutOfOrder.begin(); segment != this->rxOutOfOrder.end() && segment->first == this->rxNext; segment = this->rxOutOfOrder.erase(segment)) {
+			this->rxStream.insert(this->rxStream.end(), segment->second.begin(), segment->second.end());
+			this->rxNext++;
+		}
+		this->cv_receive.notify_all();
+	}
+
+	// Transmits lost and new segments as far as the pacing allows, returns true if segments are waiting for the pacing
+	bool transmitPending(UdpClock::time_point now) {
+		this->tokens += elapsedMs(this->tokenTime, now) * this->pacingRate / 1000;
+		if (this->tokens > SOE_UDP_PACING_BURST * SOE_UDP_SEGMENT_LEN)
+			this->tokens = SOE_UDP_PACING_BURST * SOE_UDP_SEGMENT_LEN;
+		this->tokenTime = now;
+
+		// retransmissions first, they block the delivery of everything after them
+		for (UdpSegment& segment : this->txSegments) {
+			if (segment.sendCount == 0) break;
+			if (!segment.lost) continue;
+			if (this->tokens <= 0) return true;
+			transmitSegment(segment, now);
+		}
+		for (UdpSegment& segment : this->txSegments) {
+			if (segment.sendCount > 0) continue;
+			if (this->tokens <= 0) return true;
+			transmitSegment(segment, now);
+		}
+		return false;
+	}
+
+	void transmitSegment(UdpSegment& segment, UdpClock::time_point now) {
+		transmitDatagram(SOE_UDP_TYPE_DATA, segment.sequence, segment.data.data(), segment.data.size());
+		segment.sentAt = now;
+		segment.sendCount++;
+		segment.lost = false;
+		this->tokens -= segment.data.size() + SOE_UDP_HEADER_LEN;
+	}
+
+	void runWorker() {
+		std::unique_lock<std::mutex> lock(this->m_session);
+		while (this->open) {
+			UdpClock::time_point now = UdpClock::now();
+			UdpClock::time_point wakeup = now + std::chrono::milliseconds(SOE_UDP_KEEPALIVE);
+
+			if (elapsedMs(this->lastReceive, now) > SOE_UDP_IDLE_TIMEOUT) {
+				printf("[!] UDP connection timed out\n");
+				closeLocked(ETIMEDOUT);
+				break;
+			}
+
+			// retransmission timeouts, doubled with each retransmission of the segment
+			for (UdpSegment& segment : this->txSegments) {
+				if (segment.sendCount == 0) break;
+				if (segment.acknowledged || segment.lost) continue;
+				unsigned int timeout = this->rto << (segment.sendCount < 6 ? segment.sendCount - 1 : 5);
+				if (timeout > SOE_UDP_MAX_RTO) timeout = SOE_UDP_MAX_RTO;
+				UdpClock::time_point deadline = segment.sentAt + std::chrono::milliseconds(timeout);
+				if (deadline > now) {
+					if (deadline < wakeup) wakeup = deadline;
+					continue;
+				}
+				if (segment.sendCount > SOE_UDP_MAX_RETRIES) {
+					printf("[!] UDP connection lost, segment not acknowledged\n");
+					closeLocked(ETIMEDOUT);
+					return;
+				}
+				segment.lost = true;
+			}
+
+			// wait for the pacing to allow the next segment
+			if (transmitPending(now)) {
+				UdpClock::time_point refill = now + std::chrono::microseconds((long long) ((1 - this->tokens) * 1000000 / this->pacingRate) + 1);
+				if (refill < wakeup) wakeup = refill;
+			}
+
+			// keep the connection alive and the acknowledgments up to date while idle
+			if (elapsedMs(this->lastTransmit, now) >= SOE_UDP_KEEPALIVE)
+				transmitDatagram(SOE_UDP_TYPE_ACK, 0, nullptr, 0);
+
+			this->cv_worker.wait_until(lock, wakeup);
+		}
+	}
+
+	std::shared_ptr<UdpSocket> socket;
+	sockaddr_storage remote;
+	socklen_t remoteLen;
+	uint32_t connectionId;
+	bool established;
+
+	std::mutex m_session;									// protects all connection state
+	std::condition_variable cv_worker;						// wakes the worker for retransmissions and pacing
+	std::condition_variable cv_send;						// waiting point for space in the transmission window
+	std::condition_variable cv_receive;						// waiting point for received data and the connection confirmation
+	std::thread worker;										// handles timeouts, pacing and keep alive
+	bool open;
+	int error;
+
+	std::deque<UdpSegment> txSegments;						// unacknowledged and not yet send segments, ordered by sequence number
+	uint32_t txNextSequence;								// sequence number of the next new segment
+	double srtt;											// smoothed round trip time in ms
+	double rttvar;											// round trip time variation in ms
+	unsigned int rto;										// retransmission timeout in ms
+	double pacingRate;										// pacing rate in bytes per second
+	double tokens;											// bytes which can be send without exceeding the pacing rate
+	UdpClock::time_point tokenTime;							// last update of the pacing tokens
+	UdpClock::time_point lastTransmit;						// last datagram send to the remote
+	UdpClock::time_point lastReceive;						// last datagram received from the remote
+
+	uint32_t rxNext;										// sequence number of the next segment to deliver
+	std::map<uint32_t, std::vector<char>> rxOutOfOrder;		// segments received after an missing one
+	std::vector<char> rxStream;								// delivered stream data not yet received by the link
+	unsigned int rxStreamStart;								// read position in the stream data
+
+};
+
+class SOEUdpTransport : public SOETransport {
+
+public:
+	// connection accepted by an listener, the datagrams are dispatched by the listener
+	SOEUdpTransport(std::shared_ptr<UdpSession> session) {
+		this->session = session;
+		this->readerRunning = false;
+	}
+
+	// outgoing connection, reads its own datagrams
+	SOEUdpTransport(std::shared_ptr<UdpSocket> socket, std::shared_ptr<UdpSession> session) {
+		this->socket = socket;
+		this->session = session;
+		this->readerRunning = true;
+		this->reader = std::thread([this]() {
+			char datagram[SOE_UDP_DATAGRAM_LEN];
+			while (this->readerRunning) {
+				pollfd pollDesc = { this->socket->fd, POLLIN, 0 };
+				if (::poll(&pollDesc, 1, SOE_UDP_POLL_INTERVAL) <= 0) continue;
+				sockaddr_storage address;
+				socklen_t addressLen = sizeof(address);
+				ssize_t length = ::recvfrom(this->socket->fd, datagram, sizeof(datagram), 0, (sockaddr*) &address, &addressLen);
+				if (length < SOE_UDP_HEADER_LEN || !this->session->matches(address, addressLen) || readUint32(datagram + 1) != this->session->getConnectionId())
+					continue;
+				this->session->handleDatagram(datagram, length);
+			}
+		});
+	}
+
+	~SOEUdpTransport() {
+		this->session->close(0);
+		if (this->reader.joinable()) {
+			this->readerRunning = false;
+			this->reader.join();
+		}
+	}
+
+	bool send(const char* buffer, unsigned int length) override {
+		return this->session->send(buffer, length);
+	}
+
+	bool receive(char* buffer, unsigned int length, unsigned int* received) override {
+		return this->session->receive(buffer, length, received);
+	}
+
+	void close() override {
+		this->session->close(0);
+	}
+
+	bool isOpen() override {
+		return this->session->isOpen();
+	}
+
+	int lastError() override {
+		return this->session->lastError();
+	}
+
+	const char* getName() override {
+		return "UDP";
+	}
+
+	int getHandle() override {
+		return -1; // the datagrams are received by the reader threads
+	}
+
+private:
+	std::shared_ptr<UdpSocket> socket;
+	std::shared_ptr<UdpSession> session;
+	std::atomic<bool> readerRunning;
+	std::thread reader;
+
+};
+
+// An accepted TCP connection, using the socket directly so that an event loop can wait on it
+// the socket does not block, so that the event loop can transmit without blocking, send and receive wait for the socket instead
+class SOETcpTransportLin : public SOETransport {
+
+public:
+	SOETcpTransportLin(int fd) {
+		this->fd = fd;
+		this->open = true;
+		this->error = 0;
+		int noDelay = 1;
+		::setsockopt(this->fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+	}
+
+	~SOETcpTransportLin() {
+		::close(this->fd);
+	}
+
+	bool send(const char* buffer, unsigned int length) override {
+		while (length > 0) {
+			unsigned int sent = 0;
+			if (!trySend(buffer, length, &sent))
+				return false;
+			buffer += sent;
+			length -= sent;
+			if (length > 0 && !waitFor(POLLOUT))
+				return false;
+		}
+		return true;
+	}
+
+	bool trySend(const char* buffer, unsigned int length, unsigned int* sent) override {
+		*sent = 0;
+		while (*sent < length) {
+			ssize_t count = ::send(this->fd, buffer + *sent, length - *sent, MSG_NOSIGNAL);
+			if (count < 0 && errno == EINTR) continue;
+			if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+			if (count <= 0) {
+				this->error = errno;
+				close();
+				return false;
+			}
+			*sent += (unsigned int) count;
+		}
+		return true;
+	}
+
+	bool receive(char* buffer, unsigned int length, unsigned int* received) override {
+		ssize_t count;
+		do {
+			count = ::recv(this->fd, buffer, length, 0);
+		} while ((count < 0 && errno == EINTR) || (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && waitFor(POLLIN)));
+		if (count <= 0) {
+			this->error = count == 0 ? 0 : errno;
+			*received = 0;
+			close();
+			return false;
+		}
+		*received = (unsigned int) count;
+		return true;
+	}
+
+	void close() override {
+		// the descriptor stays valid until the transport is deleted, so that it is not reused while an other thread still uses it
+		if (this->open.exchange(false))
+			::shutdown(this->fd, SHUT_RDWR);
+	}
+
+	bool isOpen() override {
+		return this->open;
+	}
+
+	int lastError() override {
+		return this->error;
+	}
+
+	const char* getName() override {
+		return "TCP";
+	}
+
+	int getHandle() override {
+		return this->fd;
+	}
+
+private:
+	// waits until the socket is ready, returns false if the connection was closed meanwhile
+	bool waitFor(short events) {
+		pollfd pollfd = { this->fd, events, 0 };
+		while (::poll(&pollfd, 1, -1) < 0) {
+			if (errno == EINTR) continue;
+			this->error = errno;
+			close();
+			return false;
+		}
+		return this->open;
+	}
+
+	int fd;
+	std::atomic<bool> open;
+	std::atomic<int> error;
+
+};
+
+class SOETcpListenerLin : public SOETcpListener {
+
+public:
+	SOETcpListenerLin(int fd) {
+		this->fd = fd;
+		this->open = true;
+	}
+
+	~SOETcpListenerLin() {
+		::close(this->fd);
+	}
+
+	SOETransport* accept(std::string& hostName, std::string& hostPort) override {
+		sockaddr_storage address;
+		socklen_t addressLen = sizeof(address);
+		int client = ::accept4(this->fd, (sockaddr*) &address, &addressLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (client < 0) {
+			// connections reset before they were accepted and running out of descriptors do not affect other connections
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED && errno != EMFILE && errno != ENFILE) {
+				printf("[!] failed to accept TCP connection: %d\n", errno);
+				close();
+			}
+			return nullptr;
+		}
+
+		char host[NI_MAXHOST];
+		char port[NI_MAXSERV];
+		if (::getnameinfo((const sockaddr*) &address, addressLen, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+			hostName = host;
+			hostPort = port;
+		} else {
+			hostName = hostPort = "N/A";
+		}
+		return new SOETcpTransportLin(client);
+	}
+
+	int getHandle() override {
+		return this->fd;
+	}
+
+	bool isOpen() override {
+		return this->open;
+	}
+
+	void close() override {
+		this->open = false;
+	}
+
+private:
+	int fd;
+	std::atomic<bool> open;
+
+};
+
+class SOEUdpListenerLin : public SOEUdpListener {
+
+public:
+	SOEUdpListenerLin(std::shared_ptr<UdpSocket> socket) {
+		this->socket = socket;
+		this->running = true;
+		this->reader = std::thread([this]() { runReader(); });
+	}
+
+	~SOEUdpListenerLin() {
+		close();
+		this->reader.join();
+	}
+
+	SOETransport* accept(std::string& hostName, std::string& hostPort) override {
+		std::unique_lock<std::mutex> lock(this->m_accept);
+		this->cv_accept.wait(lock, [this]() { return !this->acceptQueue.empty() || !this->running; });
+		if (!this->running) return nullptr;
+		std::shared_ptr<UdpSession> session = this->acceptQueue.front().session;
+		hostName = this->acceptQueue.front().hostName;
+		hostPort = this->acceptQueue.front().hostPort;
+		this->acceptQueue.pop_front();
+		return new SOEUdpTransport(session);
+	}
+
+	void close() override {
+		std::lock_guard<std::mutex> lock(this->m_accept);
+		this->running = false;
+		this->cv_accept.notify_all();
+	}
+
+private:
+	struct PendingConnection {
+		std::shared_ptr<UdpSession> session;
+		std::string hostName;
+		std::string hostPort;
+	};
+
+	void runReader() {
+		char datagram[SOE_UDP_DATAGRAM_LEN];
+		while (this->running) {
+			pollfd pollDesc = { this->socket->fd, POLLIN, 0 };
+			if (::poll(&pollDesc, 1, SOE_UDP_POLL_INTERVAL) <= 0) continue;
+			sockaddr_storage address;
+			socklen_t addressLen = sizeof(address);
+			ssize_t length = ::recvfrom(this->socket->fd, datagram, sizeof(datagram), 0, (sockaddr*) &address, &addressLen);
+			if (length < SOE_UDP_HEADER_LEN) continue;
+
+			// connections are identified by the remote address and the connection id chosen by the remote
+			std::string key((const char*) &address, addressLen);
+			key.append(datagram + 1, 4);
+			auto entry = this->sessions.find(key);
+			std::shared_ptr<UdpSession> session = entry != this->sessions.end() ? entry->second.lock() : nullptr;
+			if (!session) {
+				if (entry != this->sessions.end()) this->sessions.erase(entry);
+				if (datagram[0] != SOE_UDP_TYPE_SYN) continue;
+				session = acceptSession(address, addressLen, readUint32(datagram + 1));
+				this->sessions[key] = session;
+			}
+			session->handleDatagram(datagram, length);
+
+			// drop the entries of connections which were closed meanwhile
+			for (auto expired = this->sessions.begin(); expired != this->sessions.end(); )
+				expired = expired->second.expired() ? this->sessions.erase(expired) : std::next(expired);
+		}
+	}
+
+	std::shared_ptr<UdpSession> acceptSession(const sockaddr_storage& address, socklen_t addressLen, uint32_t connectionId) {
+		PendingConnection connection;
+		connection.session = std::make_shared<UdpSession>(this->socket, address, addressLen, connectionId, true);
+		char host[NI_MAXHOST];
+		char port[NI_MAXSERV];
+		if (::getnameinfo((const sockaddr*) &address, addressLen, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+			connection.hostName = host;
+			connection.hostPort = port;
+		} else {
+			connection.hostName = connection.hostPort = "N/A";
+		}
+		std::lock_guard<std::mutex> lock(this->m_accept);
+		this->acceptQueue.push_back(connection);
+		this->cv_accept.notify_one();
+		return connection.session;
+	}
+
+	std::shared_ptr<UdpSocket> socket;
+	std::atomic<bool> running;
+	std::thread reader;
+	std::map<std::string, std::weak_ptr<UdpSession>> sessions;		// connections by remote address and id, only accessed by the reader
+	std::mutex m_accept;
+	std::condition_variable cv_accept;
+	std::deque<PendingConnection> acceptQueue;
+
+};
+
+}
+
+SerialOverEthernet::SOETcpListener* SerialOverEthernet::newTcpListener(const std::string& hostName, const std::string& hostPort, bool shared) {
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo* addresses;
+	if (::getaddrinfo(hostName.c_str(), hostPort.c_str(), &hints, &addresses) != 0)
+		return nullptr;
+
+	// the listen socket does not block, so that an event loop reporting an connection reset meanwhile does not stall
+	for (addrinfo* address = addresses; address != nullptr; address = address->ai_next) {
+		int fd = ::socket(address->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0) continue;
+		int reuse = 1;
+		::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		if (shared && ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) != 0) {
+			::close(fd);
+			continue;
+		}
+		if (::bind(fd, address->ai_addr, address->ai_addrlen) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+			::close(fd);
+			continue;
+		}
+		freeaddrinfo(addresses);
+		return new SOETcpListenerLin(fd);
+	}
+
+	freeaddrinfo(addresses);
+	return nullptr;
+}
+
+SerialOverEthernet::SOETransport* SerialOverEthernet::newUdpTransport(const std::string& hostName, const std::string& hostPort) {
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	addrinfo* addresses;
+	if (::getaddrinfo(hostName.c_str(), hostPort.c_str(), &hints, &addresses) != 0) {
+		printf("[!] unable to resolve UDP address: %s/%s\n", hostName.c_str(), hostPort.c_str());
+		return nullptr;
+	}
+
+	std::random_device random;
+	for (addrinfo* address = addresses; address != nullptr; address = address->ai_next) {
+		int fd = ::socket(address->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if (fd < 0) continue;
+		std::shared_ptr<UdpSocket> socket = std::make_shared<UdpSocket>(fd);
+		sockaddr_storage remote;
+		memcpy(&remote, address->ai_addr, address->ai_addrlen);
+		std::shared_ptr<UdpSession> session = std::make_shared<UdpSession>(socket, remote, address->ai_addrlen, (uint32_t) random(), false);
+		SOEUdpTransport* transport = new SOEUdpTransport(socket, session);
+
+		// repeat the request until confirmed
+		for (unsigned int elapsed = 0; elapsed < SOE_UDP_CONNECT_TIMEOUT; elapsed += SOE_UDP_CONNECT_RETRY) {
+			session->sendControl(SOE_UDP_TYPE_SYN);
+			if (session->waitEstablished(SOE_UDP_CONNECT_RETRY)) {
+				freeaddrinfo(addresses);
+				return transport;
+			}
+		}
+		delete transport;
+	}
+
+	freeaddrinfo(addresses);
+	return nullptr;
+}
+
+SerialOverEthernet::SOEUdpListener* SerialOverEthernet::newUdpListener(const std::string& hostName, const std::string& hostPort) {
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo* addresses;
+	if (::getaddrinfo(hostName.c_str(), hostPort.c_str(), &hints, &addresses) != 0)
+		return nullptr;
+
+	for (addrinfo* address = addresses; address != nullptr; address = address->ai_next) {
+		int fd = ::socket(address->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if (fd < 0) continue;
+		if (::bind(fd, address->ai_addr, address->ai_addrlen) != 0) {
+			::close(fd);
+			continue;
+		}
+		freeaddrinfo(addresses);
+		return new SOEUdpListenerLin(std::make_shared<UdpSocket>(fd));
+	}
+
+	freeaddrinfo(addresses);
+	return nullptr;
+}
+
+void SerialOverEthernet::setUdpPacingRate(unsigned long bytesPerSecond) {
+	udpPacingRate = bytesPerSecond > 0 ? bytesPerSecond : 1;
+}
+
+#else
+
+SerialOverEthernet::SOETcpListener* SerialOverEthernet::newTcpListener(const std::string& hostName, const std::string& hostPort, bool shared) {
+	return nullptr;
+}
+
+SerialOverEthernet::SOETransport* SerialOverEthernet::newUdpTransport(const std::string& hostName, const std::string& hostPort) {
+	printf("[!] UDP transport not supported on this platform\n");
+	return nullptr;
+}
+
+SerialOverEthernet::SOEUdpListener* SerialOverEthernet::newUdpListener(const std::string& hostName, const std::string& hostPort) {
+	return nullptr;
+}
+
+void SerialOverEthernet::setUdpPacingRate(unsigned long bytesPerSecond) {}
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * readexactly_bench.cpp
+ *
+ * Compares the wakeups of the reader when receiving fixed size frames with readBytes() and readExactly().
+ * The data is written to an pseudo terminal one byte at a time, like it arrives from an slow serial line.
+ * The read calls are the returns to user space, the context switches also include the wakeups inside the kernel,
+ * which the pseudo terminal driver issues for each byte even if VMIN is not reached yet.
+ * Not part of the library build, linux only:
+ *
+ *   g++ -O2 -std=c++17 -DPLATFORM_LIN -I../src/cpp/public -I../src/cpp/source readexactly_bench.cpp ../src/cpp/source/serial_*.cpp -o readexactly_bench -lutil -lpthread
+ *   ./readexactly_bench [frame length] [frames] [byte interval us]
+ */
+
+#include <serial_port.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pty.h>
+#include <termios.h>
+#include <sys/resource.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+struct BenchResult {
+	unsigned long frames;		// complete frames received
+	unsigned long calls;		// read calls made
+	long wakeups;				// voluntary context switches of the reader thread
+	double cpuSeconds;			// CPU time of the reader thread
+	double seconds;
+};
+
+// Writes the frames to the master side of the pseudo terminal, one byte per interval
+static void dribble(int master, unsigned long length, unsigned long frames, unsigned int interval) {
+	char byte = 0;
+	for (unsigned long i = 0; i < length * frames; i++, byte++) {
+		if (::write(master, &byte, 1) != 1) return;
+		std::this_thread::sleep_for(std::chrono::microseconds(interval));
+	}
+}
+
+static rusage threadUsage() {
+	rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	return usage;
+}
+
+static double cpuTime(const rusage& usage) {
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+}
+
+static BenchResult run(bool exactly, unsigned long length, unsigned long frames, unsigned int interval) {
+	int master, slave;
+	char name[64];
+	if (::openpty(&master, &slave, name, nullptr, nullptr) != 0) {
+		printf("[!] failed to open pseudo terminal\n");
+		exit(1);
+	}
+	termios raw;
+	::tcgetattr(master, &raw);
+	::cfmakeraw(&raw);
+	::tcsetattr(master, TCSANOW, &raw);
+
+	SerialAccess::SerialPort* port = SerialAccess::newSerialPort(name);
+	if (!port->openPort() || !port->setTimeouts(-1, 0, -1)) {
+		printf("[!] failed to open port: %s\n", name);
+		exit(1);
+	}
+
+	BenchResult result = { 0, 0, 0, 0, 0 };
+	std::vector<char> frame(length);
+	std::thread writer(dribble, master, length, frames, interval);
+	auto start = std::chrono::steady_clock::now();
+	rusage usage = threadUsage();
+	while (result.frames < frames) {
+		unsigned long received = 0;
+		while (received < length) {
+			result.calls++;
+			unsigned long read = exactly ?
+					port->readExactly(frame.data() + received, length - received, 1000) :
+					port->readBytes(frame.data() + received, length - received);
+			if (read == 0 && exactly) break;
+			received += read;
+		}
+		if (received < length) break;
+		result.frames++;
+	}
+	rusage used = threadUsage();
+	result.wakeups = used.ru_nvcsw - usage.ru_nvcsw;
+	result.cpuSeconds = cpuTime(used) - cpuTime(usage);
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	writer.join();
+	port->closePort();
+	delete port;
+	::close(slave);
+	::close(master);
+	return result;
+}
+
+int main(int argc, const char** argv) {
+	unsigned long length = argc > 1 ? strtoul(argv[1], nullptr, 10) : 64;
+	unsigned long frames = argc > 2 ? strtoul(argv[2], nullptr, 10) : 200;
+	unsigned int interval = argc > 3 ? strtoul(argv[3], nullptr, 10) : 100;
+	printf("%lu frames of %lu bytes, one byte every %u us\n", frames, length, interval);
+
+	const char* names[] = { "readBytes", "readExactly" };
+	for (int exactly = 0; exactly < 2; exactly++) {
+		BenchResult result = run(exactly != 0, length, frames, interval);
+		printf("%-12s %lu frames in %.2f s, %.1f read calls/frame, %.1f us CPU/frame, %.1f context switches/frame\n", names[exactly],
+				result.frames, result.seconds, (double) result.calls / result.frames, result.cpuSeconds * 1000000.0 / result.frames, (double) result.wakeups / result.frames);
+	}
+	return 0;
+}
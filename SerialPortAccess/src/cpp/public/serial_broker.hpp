@@ -0,0 +1,133 @@
+#pragma once
+
+#include "serial_port.hpp"
+
+namespace SerialAccess {
+
+enum SerialBrokerArbitration {
+	SPC_BROKER_TX_SHARED = 1,		// all clients may transmit, each write is passed to the port as an whole
+	SPC_BROKER_TX_EXCLUSIVE = 2,	// the first client that transmits owns the port until it releases it or disconnects
+	SPC_BROKER_TX_PRIMARY = 3		// only the longest connected client may transmit
+};
+
+static const unsigned long SERIAL_BROKER_DEFAULT_RING = 65536;	// default capacity of the reception ring
+static const unsigned long SERIAL_BROKER_MAX_WRITE = 4096;		// max length of an single client write
+static const long SERIAL_BROKER_REJECTED = -1;					// the write was rejected by the arbitration
+static const long SERIAL_BROKER_ERROR = -2;						// the broker connection failed
+
+/**
+ * Shares one serial port between multiple local processes.
+ * The broker owns the reading side of the port: everything received is read from the port exactly once and published to all
+ * clients through an shared memory ring (memfd), which the clients read without any system calls as long as data is available.
+ * Transmissions from the clients are received over an unix domain socket and written to the port according to the arbitration mode.
+ * This is currently only supported on linux.
+ */
+class SerialBroker {
+
+public:
+	virtual ~SerialBroker() {};
+
+	/**
+	 * Creates the shared memory ring and the client socket and starts the broker threads.
+	 * The port has to be open already and remains owned by the caller, it has to stay open until the broker was stopped.
+	 * @return true if the broker was started, false if an error occurred
+	 */
+	virtual bool start() = 0;
+
+	/**
+	 * Stops the broker threads, disconnects all clients and removes the client socket.
+	 * If the broker is not running, this has no effect.
+	 */
+	virtual void stop() = 0;
+
+	/**
+	 * Returns true if the broker is running.
+	 * @return true if the broker is running, false otherwise
+	 */
+	virtual bool isRunning() = 0;
+
+	/**
+	 * Returns the number of currently connected clients.
+	 * @return The number of clients
+	 */
+	virtual unsigned int getClientCount() = 0;
+
+};
+
+/**
+ * An client of an serial broker, provides access to the shared port.
+ */
+class SerialBrokerClient {
+
+public:
+	virtual ~SerialBrokerClient() {};
+
+	/**
+	 * Connects to the broker and maps the reception ring.
+	 * Only data received after connecting is returned by readBytes().
+	 * @return true if the connection was established, false otherwise
+	 */
+	virtual bool connect() = 0;
+
+	/**
+	 * Disconnects from the broker, releasing the port if this client owned it.
+	 * If the client is not connected, this has no effect.
+	 */
+	virtual void disconnect() = 0;
+
+	/**
+	 * Returns true if the client is connected and the broker still running.
+	 * @return true if connected, false otherwise
+	 */
+	virtual bool isConnected() = 0;
+
+	/**
+	 * Reads the data received by the port from the shared ring.
+	 * If the client falls behind by more than the ring capacity, the oldest data is skipped and counted as lost.
+	 * @param buffer The buffer to write the data to
+	 * @param bufferCapacity The capacity of the buffer, aka the max number of bytes to read
+	 * @param timeout The time in ms to wait for data, zero means instant return, less than zero means wait indefinitely
+	 * @return The number of bytes read, zero if the timeout expired or the broker was stopped
+	 */
+	virtual unsigned long readBytes(char* buffer, unsigned long bufferCapacity, int timeout) = 0;
+
+	/**
+	 * Transmits the data over the shared port.
+	 * @param buffer The buffer to read the data from
+	 * @param bufferLength The number of bytes to write, at most SERIAL_BROKER_MAX_WRITE
+	 * @return The number of bytes written to the port, SERIAL_BROKER_REJECTED if the arbitration denied the write, SERIAL_BROKER_ERROR if the connection failed
+	 */
+	virtual long writeBytes(const char* buffer, unsigned long bufferLength) = 0;
+
+	/**
+	 * Releases the port after an write, only has an effect with SPC_BROKER_TX_EXCLUSIVE arbitration.
+	 * @return true if the release was sent, false if the connection failed
+	 */
+	virtual bool releasePort() = 0;
+
+	/**
+	 * Returns the number of bytes skipped because this client did not read fast enough.
+	 * @return The number of lost bytes since connecting
+	 */
+	virtual unsigned long long getLostBytes() = 0;
+
+};
+
+/**
+ * Creates an new broker for the port.
+ * @param port The open serial port to share
+ * @param socketPath The file name of the unix domain socket the clients connect to
+ * @param arbitration The arbitration mode for transmissions of the clients
+ * @param ringCapacity The capacity of the reception ring in bytes, rounded up to an power of two
+ * @return The broker, or nullptr if not supported on this platform
+ */
+SerialBroker* newSerialBroker(SerialPort* port, const char* socketPath, SerialBrokerArbitration arbitration, unsigned long ringCapacity);
+
+/**
+ * Creates an new client for the broker listening on the socket.
+ * @param socketPath The file name of the unix domain socket of the broker
+ * @return The client, or nullptr if not supported on this platform
+ */
+SerialBrokerClient* newSerialBrokerClient(const char* socketPath);
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+namespace SerialAccess {
+
+enum SerialChecksumType {
+	SPC_CRC16_MODBUS = 1,		// polynomial 0x8005 reflected, initial value 0xFFFF (Modbus RTU)
+	SPC_CRC16_CCITT = 2,		// polynomial 0x1021, initial value 0xFFFF (CRC-16/CCITT-FALSE)
+	SPC_CRC16_XMODEM = 3,		// polynomial 0x1021, initial value 0x0000 (XMODEM, ZMODEM)
+	SPC_CRC32 = 4				// polynomial 0x04C11DB7 reflected, initial value and final xor 0xFFFFFFFF (Ethernet, ZIP)
+};
+
+/**
+ * Calculates CRC checksums over data that can be supplied in multiple parts.
+ * The table driven slicing-by-8 implementation is used on all platforms.
+ * For CRC32 an hardware accelerated implementation is selected on the first use if supported by the CPU:
+ * carry-less multiplication (PCLMUL) on AMD 64, the CRC32 instructions on ARM 64.
+ */
+class SerialChecksum {
+
+public:
+	/**
+	 * Creates an new checksum calculation, initialized to the start value of the checksum type.
+	 * @param type The checksum algorithm to use
+	 */
+	SerialChecksum(SerialChecksumType type);
+
+	/**
+	 * Resets the checksum to its start value.
+	 */
+	void reset();
+
+	/**
+	 * Continues the checksum calculation with the supplied data.
+	 * @param data The next part of the data
+	 * @param length The number of bytes
+	 */
+	void update(const char* data, unsigned long length);
+
+	/**
+	 * Returns the checksum of all data supplied since the creation or the last reset.
+	 * This does not modify the calculation state, more data can be supplied afterwards.
+	 * @return The checksum value
+	 */
+	unsigned long get() const;
+
+	/**
+	 * Calculates the checksum of the data in one call.
+	 * @param type The checksum algorithm to use
+	 * @param data The data to calculate the checksum of
+	 * @param length The number of bytes
+	 * @return The checksum value
+	 */
+	static unsigned long calculate(SerialChecksumType type, const char* data, unsigned long length);
+
+	/**
+	 * Returns an short name of the implementation selected for the checksum type on this CPU.
+	 * @param type The checksum algorithm
+	 * @return The implementation name, such as "slicing-by-8" or "pclmul"
+	 */
+	static const char* getImplementation(SerialChecksumType type);
+
+private:
+	SerialChecksumType type;
+	unsigned long state;
+
+};
+
+}
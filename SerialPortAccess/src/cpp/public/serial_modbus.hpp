@@ -0,0 +1,96 @@
+#pragma once
+
+#include "serial_port.hpp"
+#include <chrono>
+
+namespace SerialAccess {
+
+static const unsigned long MODBUS_RTU_MAX_FRAME_LEN = 256;			// address + PDU + CRC
+static const unsigned long MODBUS_RTU_MIN_FRAME_LEN = 4;			// address + function code + CRC
+static const unsigned long MODBUS_RTU_FIXED_T15_MICROS = 750;		// fixed t1.5 for baud rates above 19200
+static const unsigned long MODBUS_RTU_FIXED_T35_MICROS = 1750;		// fixed t3.5 for baud rates above 19200
+
+enum ModbusFrameStatus {
+	MODBUS_FRAME_OK = 0,
+	MODBUS_FRAME_TIMEOUT = 1,			// no frame started within the timeout
+	MODBUS_FRAME_CRC_ERROR = 2,			// the frame checksum did not match
+	MODBUS_FRAME_GAP_ERROR = 3,			// silence of more than t1.5 within the frame
+	MODBUS_FRAME_OVERRUN = 4,			// more data received than fits in the frame buffer
+	MODBUS_FRAME_INCOMPLETE = 5,		// frame shorter than the minimal length
+	MODBUS_FRAME_PORT_ERROR = 6			// the port is closed or could not be configured
+};
+
+/**
+ * Calculates the Modbus CRC16 (polynomial 0xA001 reflected, initial value 0xFFFF) of the data.
+ * @param data The data to calculate the checksum of
+ * @param length The number of bytes
+ * @return The checksum, transmitted low byte first
+ */
+unsigned short modbusCRC16(const char* data, unsigned long length);
+
+/**
+ * Implements the Modbus RTU framing on top of an serial port.
+ * The frames are delimited by silence on the line of 3.5 character times (t3.5).
+ * An frame is discarded if a silence of more than 1.5 character times (t1.5) occurs within it.
+ * Both times are calculated from the configuration of the port.
+ */
+class ModbusRTUPort {
+
+public:
+	/**
+	 * Creates an new Modbus RTU frame layer for the port.
+	 * The port remains owned by the caller and has to stay valid as long as this object is used.
+	 * @param port The serial port to use
+	 */
+	ModbusRTUPort(SerialPort* port);
+
+	/**
+	 * Reads the configuration of the port and calculates the frame timings.
+	 * This also changes the read timeouts of the port to instant return, the write timeout stays unchanged.
+	 * Has to be called after the port was opened and every time the configuration changes.
+	 * @return true if the port is open and the timings where updated, false otherwise
+	 */
+	bool updateTiming();
+
+	/**
+	 * Returns the inter character timeout t1.5 currently used.
+	 * @return The inter character timeout in microseconds
+	 */
+	unsigned long getCharTimeout();
+
+	/**
+	 * Returns the inter frame delay t3.5 currently used.
+	 * @return The inter frame delay in microseconds
+	 */
+	unsigned long getFrameDelay();
+
+	/**
+	 * Waits for the next complete frame and validates its checksum.
+	 * Invalid frames are discarded, in this case zero is returned and the status indicates the reason.
+	 * @param frame The buffer to write the frame to, the CRC is written behind the frame but not included in the returned length
+	 * @param frameCapacity The capacity of the buffer, MODBUS_RTU_MAX_FRAME_LEN is enough for every valid frame
+	 * @param timeout The time in milliseconds to wait for the start of a frame, less than zero means wait indefinitely
+	 * @param status Optional pointer to write the result status to
+	 * @return The length of the frame (address + PDU), or zero if no valid frame was received
+	 */
+	unsigned long receiveFrame(char* frame, unsigned long frameCapacity, int timeout, ModbusFrameStatus* status = 0);
+
+	/**
+	 * Appends the CRC to the frame and transmits it.
+	 * Waits until the line was silent for t3.5 since the last reception or transmission before sending.
+	 * @param frame The frame to send (address + PDU), without CRC
+	 * @param frameLength The length of the frame, at most MODBUS_RTU_MAX_FRAME_LEN - 2
+	 * @return true if the complete frame was written to the port, false otherwise
+	 */
+	bool sendFrame(const char* frame, unsigned long frameLength);
+
+private:
+	SerialPort* port;
+	std::chrono::microseconds charTime;						// transmission time of one character
+	std::chrono::microseconds charTimeout;					// t1.5
+	std::chrono::microseconds frameDelay;					// t3.5
+	std::chrono::steady_clock::time_point lastActivity;		// end of the last reception or transmission
+
+};
+
+}
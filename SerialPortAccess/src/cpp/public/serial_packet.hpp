@@ -0,0 +1,135 @@
+#pragma once
+
+#include "serial_port.hpp"
+
+namespace SerialAccess {
+
+enum SerialPacketEncoding {
+	SPC_PACKET_COBS = 1,		// consistent overhead byte stuffing, packets delimited by zero bytes
+	SPC_PACKET_SLIP = 2			// RFC 1055 serial line IP framing
+};
+
+static const unsigned long SERIAL_PACKET_BUFFER_LEN = 1024;		// size of the internal transmission and reception buffers
+static const long SERIAL_PACKET_NONE = -1;						// no complete packet received before the read timeout or the port was closed
+static const long SERIAL_PACKET_ERROR = -2;						// malformed or oversized packet, was discarded
+
+/**
+ * Returns the maximum length of the COBS encoding of an packet, including the delimiter.
+ * @param length The length of the packet
+ * @return The maximal length of the encoded data
+ */
+inline unsigned long cobsMaxEncodedLength(unsigned long length) {
+	return length + length / 254 + 2;
+}
+
+/**
+ * Returns the maximum length of the SLIP encoding of an packet, including the delimiters.
+ * @param length The length of the packet
+ * @return The maximal length of the encoded data
+ */
+inline unsigned long slipMaxEncodedLength(unsigned long length) {
+	return length * 2 + 2;
+}
+
+/**
+ * Encodes the packet using COBS, including the trailing zero delimiter.
+ * @param packet The packet to encode
+ * @param length The length of the packet
+ * @param encoded The buffer to write the encoded data to
+ * @param capacity The capacity of the buffer, cobsMaxEncodedLength() is always enough
+ * @return The length of the encoded data, or zero if the buffer was too small
+ */
+unsigned long cobsEncode(const char* packet, unsigned long length, char* encoded, unsigned long capacity);
+
+/**
+ * Decodes an COBS encoded packet, the delimiter can be omitted.
+ * @param encoded The encoded data of exactly one packet
+ * @param length The length of the encoded data
+ * @param packet The buffer to write the packet to
+ * @param capacity The capacity of the buffer, the encoded length is always enough
+ * @return The length of the packet, or SERIAL_PACKET_ERROR if the data was malformed or the buffer too small
+ */
+long cobsDecode(const char* encoded, unsigned long length, char* packet, unsigned long capacity);
+
+/**
+ * Encodes the packet using SLIP, including an leading and an trailing END delimiter.
+ * @param packet The packet to encode
+ * @param length The length of the packet
+ * @param encoded The buffer to write the encoded data to
+ * @param capacity The capacity of the buffer, slipMaxEncodedLength() is always enough
+ * @return The length of the encoded data, or zero if the buffer was too small
+ */
+unsigned long slipEncode(const char* packet, unsigned long length, char* encoded, unsigned long capacity);
+
+/**
+ * Decodes an SLIP encoded packet, the delimiters can be omitted.
+ * @param encoded The encoded data of exactly one packet
+ * @param length The length of the encoded data
+ * @param packet The buffer to write the packet to
+ * @param capacity The capacity of the buffer, the encoded length is always enough
+ * @return The length of the packet, or SERIAL_PACKET_ERROR if the data was malformed or the buffer too small
+ */
+long slipDecode(const char* encoded, unsigned long length, char* packet, unsigned long capacity);
+
+/**
+ * Implements an packet transport on top of an serial port using COBS or SLIP framing.
+ * Packets are encoded and decoded in place between the caller buffers and two fixed internal buffers, no memory is allocated per packet.
+ * The blocking behavior of the functions is defined by the timeouts configured on the port.
+ */
+class SerialPacketPort {
+
+public:
+	/**
+	 * Creates an new packet transport for the port.
+	 * The port remains owned by the caller and has to stay valid as long as this object is used.
+	 * @param port The serial port to use
+	 * @param encoding The framing to use for the packets
+	 */
+	SerialPacketPort(SerialPort* port, SerialPacketEncoding encoding);
+
+	/**
+	 * Encodes and transmits the packet.
+	 * @param packet The packet to send
+	 * @param length The length of the packet
+	 * @return true if the complete packet was written to the port, false otherwise
+	 */
+	bool sendPacket(const char* packet, unsigned long length);
+
+	/**
+	 * Reads from the port until an complete packet was received.
+	 * Incomplete packets are kept if the read times out, and continued on the next call.
+	 * The packet is decoded directly into the buffer, so the same buffer has to be supplied again in this case.
+	 * @param packet The buffer to write the packet to
+	 * @param capacity The capacity of the buffer, packets that do not fit are discarded
+	 * @return The length of the packet, SERIAL_PACKET_NONE if the read timed out or the port was closed, SERIAL_PACKET_ERROR if an packet was discarded
+	 */
+	long receivePacket(char* packet, unsigned long capacity);
+
+	/**
+	 * Discards all partially received data.
+	 */
+	void resetReception();
+
+private:
+	bool flushTransmission();
+	bool reserveTransmission(unsigned long length);
+	bool decodeReception(char* packet, unsigned long capacity, long* result);
+
+	SerialPort* port;
+	SerialPacketEncoding encoding;
+
+	char txBuffer[SERIAL_PACKET_BUFFER_LEN];
+	unsigned long txLength;
+
+	char rxBuffer[SERIAL_PACKET_BUFFER_LEN];
+	unsigned long rxBegin;
+	unsigned long rxEnd;
+	unsigned long rxPacketLength;		// bytes of the current packet already decoded
+	unsigned int rxBlockRemaining;		// COBS: bytes remaining in the current block
+	bool rxPendingZero;					// COBS: an zero has to be inserted before the next block
+	bool rxEscaped;						// SLIP: the last byte was an escape
+	bool rxDiscard;						// current packet is discarded until the next delimiter
+
+};
+
+}
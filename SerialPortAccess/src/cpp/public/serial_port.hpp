@@ -44,6 +44,15 @@ static const SerialPortConfig DEFAULT_PORT_CONFIGURATION = {
 	.flowControl = SPC_FLOW_NONE
 };
 
+#ifdef PLATFORM_WIN
+typedef void* SerialPortHandle;		// the HANDLE of the port, opened for overlapped IO
+#else
+typedef int SerialPortHandle;		// the file descriptor of the port
+#endif
+
+static const long SERIAL_IO_WOULD_BLOCK = -1;	// the operation could not be performed without blocking
+static const long SERIAL_IO_ERROR = -2;			// the port is closed or an error occurred
+
 static const int DEFAULT_PORT_RX_TIMEOUT = -1;
 static const int DEFAULT_PORT_RX_TIMEOUT_MULTIPLIER = 0;
 static const int DEFAULT_PORT_TX_TIMEOUT = 100;
@@ -116,6 +125,15 @@ public:
 	 */
 	virtual bool openPort() = 0;
 
+	/**
+	 * Attempt to claim/open the port in non blocking mode.
+	 * In this mode the native handle of the port can be registered in an external event loop (epoll, select, libuv, ...),
+	 * the data is then transfered using tryReadBytes() and tryWriteBytes().
+	 * The normal read and write functions remain available, but writeBytes() might return before all data was written, even without timeout.
+	 * @return true if the port was successfully opened, false otherwise
+	 */
+	virtual bool openPortNonBlocking() = 0;
+
 	/**
 	 * Closes the port.
 	 * If the port is already closed, this has no affect.
@@ -128,6 +146,22 @@ public:
 	 */
 	virtual bool isOpen() = 0;
 
+	/**
+	 * Returns the operating system handle of the port, for use in external event loops.
+	 * The handle remains owned by the port and must not be closed or reconfigured directly.
+	 * @return The file descriptor (linux) or HANDLE (windows) of the port, invalid if the port is not open
+	 */
+	virtual SerialPortHandle getNativeHandle() = 0;
+
+	/**
+	 * Waits until at least one byte is available to be read from the port.
+	 * Unlike the read timeouts, this timeout is specified in microseconds, which allows detecting short gaps in the reception.
+	 * The precision achievable depends on the platform (full microseconds on linux, milliseconds on windows).
+	 * @param timeoutMicros The time to wait for data, zero means instant return, less than zero means wait indefinitely
+	 * @return true if data is available for reading, false if the timeout expired or the port was closed
+	 */
+	virtual bool waitForData(long long timeoutMicros) = 0;
+
 	/**
 	 * Attempts to fill the buffer by reading bytes from the port.
 	 * If not enough bytes could be read after the read timeout expires, the function returns with what was received.
@@ -155,6 +189,32 @@ public:
 	 */
 	virtual unsigned long readBytesConsecutive(char* buffer, unsigned long bufferCapacity, unsigned int consecutiveDelay, unsigned int receptionWaitTimeout) = 0;
 
+	/**
+	 * Reads exactly the requested number of bytes, or less if the deadline expires first.
+	 * Unlike readBytes(), the driver is configured to only complete the operation when the requested amount is available,
+	 * instead of waking up the caller for each received byte, which is useful for fixed size binary protocols.
+	 *
+	 * NOTE
+	 * This function temporary changes the timeout configuration of the port, it is restored before returning.
+	 *
+	 * @param buffer The buffer to write the data to
+	 * @param length The number of bytes to read
+	 * @param deadline The time in ms to wait for all bytes, zero means only read what is already available, less than zero means wait indefinitely
+	 * @return The number of bytes read, equal to length if the read completed before the deadline
+	 */
+	virtual unsigned long readExactly(char* buffer, unsigned long length, int deadline) = 0;
+
+	/**
+	 * Enables adaptive read sizing for readBytes().
+	 * The arrival rate of the data is measured, and after the first byte arrived, readBytes() waits for as many bytes as
+	 * are expected to arrive within the latency budget at the current rate and baud, before returning.
+	 * On slow links this returns each byte immediately, on saturated links the number of wakeups and read calls is reduced.
+	 * This is currently only supported on linux.
+	 * @param latencyBudget The maximum additional time in microseconds a received byte is held back, zero disables adaptive reads
+	 * @return true if the budget was set, false if not supported or the port is not open
+	 */
+	virtual bool setReadLatencyBudget(long long latencyBudget) = 0;
+
 	/**
 	 * Attempts to write the content of the buffer to the serial port.
 	 * If not all data could be written until the write timeout expires, the function returns.
@@ -163,6 +223,34 @@ public:
 	 * @return The number of bytes written
 	 */
 	virtual unsigned long writeBytes(const char* buffer, unsigned long bufferLength) = 0;
+
+	/**
+	 * Enables metering of writeBytes() to an fraction of the line rate, calculated from the configured baud and frame format.
+	 * The data is handed to the driver in chunks, which prevents overruns of receivers with shallow FIFOs when no flow control is available.
+	 * This extends the time writeBytes() blocks accordingly, tryWriteBytes() is not affected.
+	 * @param linePercent The percentage of the line rate to transmit with, zero disables pacing
+	 * @param chunkSize The max number of bytes written at once, zero for the default (16 bytes)
+	 * @param chunkGap An additional idle time in microseconds on the line after each chunk
+	 * @return true if the pacing was configured, false if the port is not open
+	 */
+	virtual bool setTransmitPacing(unsigned int linePercent, unsigned long chunkSize, unsigned int chunkGap) = 0;
+
+	/**
+	 * Reads the bytes already available from the port, without ever blocking and independent of the configured timeouts.
+	 * @param buffer The buffer to write the data to
+	 * @param bufferCapacity The capacity of the buffer, aka the max number of bytes to read
+	 * @return The number of bytes read, SERIAL_IO_WOULD_BLOCK if no data is available, SERIAL_IO_ERROR if the port is closed or failed
+	 */
+	virtual long tryReadBytes(char* buffer, unsigned long bufferCapacity) = 0;
+
+	/**
+	 * Writes as many bytes as possible to the port, without ever blocking and independent of the configured timeouts.
+	 * This is only exact for ports opened using openPortNonBlocking(), otherwise the write only happens if the driver reports space in its buffer.
+	 * @param buffer The buffer to read the data from
+	 * @param bufferLength The length of the buffer, aka the max number of bytes to write
+	 * @return The number of bytes written, SERIAL_IO_WOULD_BLOCK if no space is available, SERIAL_IO_ERROR if the port is closed or failed
+	 */
+	virtual long tryWriteBytes(const char* buffer, unsigned long bufferLength) = 0;
 	
 };
 
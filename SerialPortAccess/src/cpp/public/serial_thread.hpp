@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <thread>
+
+namespace SerialAccess {
+
+enum SerialThreadScheduling {
+	SPC_SCHED_NORMAL = 1,		// default time sharing scheduling of the operating system
+	SPC_SCHED_FIFO = 2,			// real time, runs until it blocks or an higher priority thread becomes ready
+	SPC_SCHED_RR = 3			// real time, like FIFO but with time slices between threads of equal priority
+};
+
+typedef struct SerialThreadConfiguration {
+	SerialThreadScheduling scheduling;
+	int priority;					// real time priority (1-99 on linux), ignored for normal scheduling
+	unsigned long long cpuMask;		// bit mask of the CPUs the thread may run on, zero for no restriction
+} SerialThreadConfig;
+
+static const SerialThreadConfig DEFAULT_THREAD_CONFIGURATION = {
+	.scheduling = SPC_SCHED_NORMAL,
+	.priority = 0,
+	.cpuMask = 0
+};
+
+/**
+ * Applies the scheduling policy, priority and CPU affinity to the calling thread.
+ * Real time scheduling usually requires elevated privileges (CAP_SYS_NICE or an rtprio limit on linux).
+ * On windows, real time scheduling is mapped to the time critical thread priority.
+ * @param config The configuration to apply
+ * @return true if all settings where applied, false if at least one failed
+ */
+bool applyThreadConfig(const SerialThreadConfig& config);
+
+/**
+ * Reads the effective scheduling policy, priority and CPU affinity of the calling thread.
+ * @param config The configuration struct to write the settings to
+ * @return true if the settings where read, false if an error occurred
+ */
+bool getThreadConfig(SerialThreadConfig& config);
+
+/**
+ * Reads the CPU time an thread consumed so far, for monitoring.
+ * This is only supported on linux.
+ * @param thread The thread, it has to be joinable
+ * @param cpuTime Where to store the CPU time in microseconds
+ * @return true if the time was read, false otherwise
+ */
+bool getThreadCpuTime(std::thread& thread, unsigned long long* cpuTime);
+
+/**
+ * Locks all current and future memory pages of the process in RAM, to avoid page faults in time critical threads.
+ * This is only supported on linux.
+ * @return true if the memory was locked, false otherwise
+ */
+bool lockProcessMemory();
+
+/**
+ * Parses an CPU list in the format "0,2,4-7" to an CPU mask.
+ * @param cpuList The CPU list string
+ * @param cpuMask Where to store the CPU mask
+ * @return true if the list was valid, false otherwise
+ */
+bool parseCpuList(const std::string& cpuList, unsigned long long* cpuMask);
+
+/**
+ * Formats the configuration as human readable string for log output, such as "fifo priority 50 cpus 2,3".
+ * @param config The configuration to format
+ * @return The formatted configuration
+ */
+std::string formatThreadConfig(const SerialThreadConfig& config);
+
+}
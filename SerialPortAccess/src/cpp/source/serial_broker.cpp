@@ -0,0 +1,541 @@
+
+#include "serial_broker.hpp"
+
+#ifdef PLATFORM_LIN
+
+#include <new>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define BROKER_MAGIC 0x5342524BU		// 'SBRK'
+#define BROKER_MIN_RING 4096
+#define BROKER_OP_WRITE 'W'
+#define BROKER_OP_RELEASE 'R'
+
+/*
+ * The reception ring is an single producer, multiple consumer ring in the shared memory.
+ * Only the broker writes to it, the clients map it read only and keep their read position locally.
+ * The broker never waits for the clients, an client that falls behind detects that its data was overwritten
+ * by comparing its read position with the write position after copying, similar to an sequence lock.
+ * Waiting clients sleep on an futex on the sequence counter, which the broker increments on each publish.
+ */
+struct BrokerRing {
+	uint32_t magic;
+	uint32_t capacity;							// size of the data area, power of two
+	uint32_t maxChunk;							// max bytes written before the write position is advanced
+	std::atomic<uint32_t> closed;				// set when the broker stopped
+	std::atomic<uint32_t> sequence;				// futex word, incremented on each publish
+	std::atomic<uint64_t> writePosition;		// total number of bytes published
+	char data[];
+};
+
+static long futexWait(std::atomic<uint32_t>* word, uint32_t expected, const struct timespec* timeout) {
+	return syscall(SYS_futex, (uint32_t*) word, FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+static void futexWake(std::atomic<uint32_t>* word) {
+	syscall(SYS_futex, (uint32_t*) word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void printBrokerError(const char* format) {
+	int errorCode = errno;
+	if (errorCode == 0) return;
+	printf(format, errorCode, strerror(errorCode));
+}
+
+class SerialBrokerLin : public SerialAccess::SerialBroker {
+
+private:
+	SerialAccess::SerialPort* port;
+	std::string socketPath;
+	SerialAccess::SerialBrokerArbitration arbitration;
+	unsigned long ringCapacity;
+
+	int ringFd = -1;
+	size_t ringSize = 0;
+	BrokerRing* ring = nullptr;
+	int listenFd = -1;
+	int stopFd = -1;
+	std::atomic<bool> running;
+	std::atomic<unsigned int> clientCount;
+	std::vector<int> clients;	// in order of connection, only accessed by the control thread
+	int exclusiveOwner = -1;	// client owning the port with exclusive arbitration
+	std::thread thread_rx;
+	std::thread thread_control;
+
+public:
+
+	SerialBrokerLin(SerialAccess::SerialPort* port, const char* socketPath, SerialAccess::SerialBrokerArbitration arbitration, unsigned long ringCapacity)
+	{
+		this->port = port;
+		this->socketPath = socketPath;
+		this->arbitration = arbitration;
+		this->ringCapacity = BROKER_MIN_RING;
+		while (this->ringCapacity < ringCapacity && this->ringCapacity < 0x80000000UL)
+			this->ringCapacity <<= 1;
+		this->running = false;
+		this->clientCount = 0;
+	}
+
+	~SerialBrokerLin()
+	{
+		stop();
+	}
+
+	bool start()
+	{
+		if (this->running) return false;
+
+		// Create the shared memory ring, sealed against resizing by the clients
+		this->ringSize = sizeof(BrokerRing) + this->ringCapacity;
+		this->ringFd = memfd_create("serial-broker-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		if (this->ringFd < 0) {
+			printBrokerError("error %i in SerialBroker:start:memfd_create: %s\n");
+			return false;
+		}
+		if (::ftruncate(this->ringFd, this->ringSize) != 0 || ::fcntl(this->ringFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+			printBrokerError("error %i in SerialBroker:start:ftruncate: %s\n");
+			cleanup();
+			return false;
+		}
+		void* memory = ::mmap(NULL, this->ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, this->ringFd, 0);
+		if (memory == MAP_FAILED) {
+			printBrokerError("error %i in SerialBroker:start:mmap: %s\n");
+			cleanup();
+			return false;
+		}
+		this->ring = new (memory) BrokerRing();
+		this->ring->magic = BROKER_MAGIC;
+		this->ring->capacity = this->ringCapacity;
+		this->ring->maxChunk = this->ringCapacity / 4;
+		this->ring->closed = 0;
+		this->ring->sequence = 0;
+		this->ring->writePosition = 0;
+
+		// Create the client socket
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (this->socketPath.length() >= sizeof(address.sun_path)) {
+			printf("error in SerialBroker:start: socket path too long: %s\n", this->socketPath.c_str());
+			cleanup();
+			return false;
+		}
+		strcpy(address.sun_path, this->socketPath.c_str());
+		::unlink(this->socketPath.c_str());
+		this->listenFd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		if (this->listenFd < 0 || ::bind(this->listenFd, (struct sockaddr*) &address, sizeof(address)) != 0 || ::listen(this->listenFd, 16) != 0) {
+			printBrokerError("error %i in SerialBroker:start:bind: %s\n");
+			cleanup();
+			return false;
+		}
+
+		this->stopFd = eventfd(0, EFD_CLOEXEC);
+		this->running = true;
+		this->thread_rx = std::thread([this]() -> void {
+			this->handleReception();
+		});
+		this->thread_control = std::thread([this]() -> void {
+			this->handleClients();
+		});
+		return true;
+	}
+
+	void stop()
+	{
+		if (!this->running) return;
+		this->running = false;
+		uint64_t value = 1;
+		if (::write(this->stopFd, &value, sizeof(value)) < 0)
+			printBrokerError("error %i in SerialBroker:stop:write: %s\n");
+		this->thread_rx.join();
+		this->thread_control.join();
+
+		// Wake up all waiting clients
+		this->ring->closed = 1;
+		this->ring->sequence.fetch_add(1, std::memory_order_release);
+		futexWake(&this->ring->sequence);
+
+		for (int client : this->clients)
+			::close(client);
+		this->clients.clear();
+		this->clientCount = 0;
+		this->exclusiveOwner = -1;
+		cleanup();
+	}
+
+	bool isRunning()
+	{
+		return this->running;
+	}
+
+	unsigned int getClientCount()
+	{
+		return this->clientCount;
+	}
+
+private:
+
+	void cleanup()
+	{
+		if (this->listenFd >= 0) {
+			::close(this->listenFd);
+			::unlink(this->socketPath.c_str());
+		}
+		if (this->stopFd >= 0) ::close(this->stopFd);
+		if (this->ring != nullptr) ::munmap(this->ring, this->ringSize);
+		if (this->ringFd >= 0) ::close(this->ringFd);
+		this->listenFd = this->stopFd = this->ringFd = -1;
+		this->ring = nullptr;
+	}
+
+	// Reads the port directly into the ring and publishes the data to the clients
+	void handleReception()
+	{
+		uint32_t mask = this->ring->capacity - 1;
+		while (this->running && this->port->isOpen()) {
+			if (!this->port->waitForData(100000)) continue;
+
+			uint64_t position = this->ring->writePosition.load(std::memory_order_relaxed);
+			uint32_t offset = position & mask;
+			uint32_t length = this->ring->capacity - offset < this->ring->maxChunk ? this->ring->capacity - offset : this->ring->maxChunk;
+
+			long received = this->port->tryReadBytes(this->ring->data + offset, length);
+			if (received == SerialAccess::SERIAL_IO_ERROR) break;
+			if (received <= 0) continue;
+
+			this->ring->writePosition.store(position + received, std::memory_order_release);
+			this->ring->sequence.fetch_add(1, std::memory_order_release);
+			futexWake(&this->ring->sequence);
+		}
+	}
+
+	// Accepts new clients and handles their transmissions
+	void handleClients()
+	{
+		std::vector<struct pollfd> pollfds;
+		while (this->running) {
+			pollfds.clear();
+			pollfds.push_back({ this->stopFd, POLLIN, 0 });
+			pollfds.push_back({ this->listenFd, POLLIN, 0 });
+			for (int client : this->clients)
+				pollfds.push_back({ client, POLLIN, 0 });
+
+			if (::poll(pollfds.data(), pollfds.size(), -1) < 0) {
+				if (errno == EINTR) continue;
+				printBrokerError("error %i in SerialBroker:handleClients:poll: %s\n");
+				break;
+			}
+			if (pollfds[0].revents) break;
+
+			if (pollfds[1].revents & POLLIN)
+				acceptClient();
+
+			for (size_t i = 2; i < pollfds.size(); i++) {
+				if (pollfds[i].revents == 0) continue;
+				if (!handleClientMessage(pollfds[i].fd))
+					removeClient(pollfds[i].fd);
+			}
+		}
+	}
+
+	void acceptClient()
+	{
+		int client = ::accept4(this->listenFd, NULL, NULL, SOCK_CLOEXEC);
+		if (client < 0) {
+			printBrokerError("error %i in SerialBroker:acceptClient:accept: %s\n");
+			return;
+		}
+
+		// Send the ring file descriptor with the hello message
+		uint32_t magic = BROKER_MAGIC;
+		struct iovec iov = { &magic, sizeof(magic) };
+		char control[CMSG_SPACE(sizeof(int))];
+		memset(control, 0, sizeof(control));
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &this->ringFd, sizeof(int));
+
+		if (::sendmsg(client, &message, MSG_NOSIGNAL) != sizeof(magic)) {
+			printBrokerError("error %i in SerialBroker:acceptClient:sendmsg: %s\n");
+			::close(client);
+			return;
+		}
+
+		this->clients.push_back(client);
+		this->clientCount = this->clients.size();
+	}
+
+	void removeClient(int client)
+	{
+		for (auto entry = this->clients.begin(); entry != this->clients.end(); entry++) {
+			if (*entry != client) continue;
+			this->clients.erase(entry);
+			break;
+		}
+		if (this->exclusiveOwner == client) this->exclusiveOwner = -1;
+		::close(client);
+		this->clientCount = this->clients.size();
+	}
+
+	bool mayTransmit(int client)
+	{
+		switch (this->arbitration) {
+		case SerialAccess::SPC_BROKER_TX_EXCLUSIVE:
+			if (this->exclusiveOwner < 0) this->exclusiveOwner = client;
+			return this->exclusiveOwner == client;
+		case SerialAccess::SPC_BROKER_TX_PRIMARY:
+			return !this->clients.empty() && this->clients.front() == client;
+		default:
+		case SerialAccess::SPC_BROKER_TX_SHARED:
+			return true;
+		}
+	}
+
+	// Handles an request of the client, returns false if the client disconnected
+	bool handleClientMessage(int client)
+	{
+		char message[SerialAccess::SERIAL_BROKER_MAX_WRITE + 1];
+		ssize_t length = ::recv(client, message, sizeof(message), 0);
+		if (length <= 0) return false;
+
+		int32_t result = 0;
+		if (message[0] == BROKER_OP_RELEASE) {
+			if (this->exclusiveOwner == client) this->exclusiveOwner = -1;
+		} else if (message[0] == BROKER_OP_WRITE) {
+			if (mayTransmit(client)) {
+				unsigned long written = 0;
+				while (written < (unsigned long) length - 1) {
+					unsigned long transmitted = this->port->writeBytes(message + 1 + written, length - 1 - written);
+					if (transmitted == 0) break;
+					written += transmitted;
+				}
+				result = written;
+			} else {
+				result = SerialAccess::SERIAL_BROKER_REJECTED;
+			}
+		}
+
+		return ::send(client, &result, sizeof(result), MSG_NOSIGNAL) == sizeof(result);
+	}
+
+};
+
+class SerialBrokerClientLin : public SerialAccess::SerialBrokerClient {
+
+private:
+	std::string socketPath;
+	int socketFd = -1;
+	const BrokerRing* ring = nullptr;
+	size_t ringSize = 0;
+	uint64_t readPosition = 0;
+	unsigned long long lostBytes = 0;
+
+public:
+
+	SerialBrokerClientLin(const char* socketPath)
+	{
+		this->socketPath = socketPath;
+	}
+
+	~SerialBrokerClientLin()
+	{
+		disconnect();
+	}
+
+	bool connect()
+	{
+		if (this->socketFd >= 0) return false;
+
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (this->socketPath.length() >= sizeof(address.sun_path)) return false;
+		strcpy(address.sun_path, this->socketPath.c_str());
+
+		this->socketFd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+		if (this->socketFd < 0 || ::connect(this->socketFd, (struct sockaddr*) &address, sizeof(address)) != 0) {
+			printBrokerError("error %i in SerialBrokerClient:connect:connect: %s\n");
+			disconnect();
+			return false;
+		}
+
+		// Receive the ring file descriptor
+		uint32_t magic = 0;
+		struct iovec iov = { &magic, sizeof(magic) };
+		char control[CMSG_SPACE(sizeof(int))];
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		if (::recvmsg(this->socketFd, &message, MSG_CMSG_CLOEXEC) != sizeof(magic) || magic != BROKER_MAGIC) {
+			printf("error in SerialBrokerClient:connect: invalid broker hello\n");
+			disconnect();
+			return false;
+		}
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+		if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+			printf("error in SerialBrokerClient:connect: no ring received\n");
+			disconnect();
+			return false;
+		}
+		int ringFd;
+		memcpy(&ringFd, CMSG_DATA(cmsg), sizeof(int));
+
+		// Map the ring read only, the mapping stays valid after closing the descriptor
+		struct stat ringStat;
+		void* memory = MAP_FAILED;
+		if (::fstat(ringFd, &ringStat) == 0 && (size_t) ringStat.st_size > sizeof(BrokerRing))
+			memory = ::mmap(NULL, ringStat.st_size, PROT_READ, MAP_SHARED, ringFd, 0);
+		::close(ringFd);
+		if (memory == MAP_FAILED) {
+			printBrokerError("error %i in SerialBrokerClient:connect:mmap: %s\n");
+			disconnect();
+			return false;
+		}
+		this->ring = (const BrokerRing*) memory;
+		this->ringSize = ringStat.st_size;
+		this->readPosition = this->ring->writePosition.load(std::memory_order_acquire);
+		this->lostBytes = 0;
+		return true;
+	}
+
+	void disconnect()
+	{
+		if (this->ring != nullptr) ::munmap((void*) this->ring, this->ringSize);
+		if (this->socketFd >= 0) ::close(this->socketFd);
+		this->ring = nullptr;
+		this->socketFd = -1;
+	}
+
+	bool isConnected()
+	{
+		return this->ring != nullptr && this->ring->closed == 0;
+	}
+
+	unsigned long readBytes(char* buffer, unsigned long bufferCapacity, int timeout)
+	{
+		if (this->ring == nullptr) return 0;
+
+		uint32_t capacity = this->ring->capacity;
+		uint32_t mask = capacity - 1;
+		uint32_t window = capacity - this->ring->maxChunk; // data older than this might be overwritten at any time
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+		while (true) {
+			uint32_t sequence = this->ring->sequence.load(std::memory_order_acquire);
+			uint64_t writePosition = this->ring->writePosition.load(std::memory_order_acquire);
+
+			if (writePosition != this->readPosition) {
+				if (writePosition - this->readPosition > window) {
+					this->lostBytes += writePosition - window - this->readPosition;
+					this->readPosition = writePosition - window;
+				}
+
+				unsigned long length = writePosition - this->readPosition < bufferCapacity ? writePosition - this->readPosition : bufferCapacity;
+				uint32_t offset = this->readPosition & mask;
+				unsigned long firstPart = capacity - offset < length ? capacity - offset : length;
+				memcpy(buffer, this->ring->data + offset, firstPart);
+				memcpy(buffer + firstPart, this->ring->data, length - firstPart);
+
+				// Verify the copied data was not overwritten by the broker in the meantime
+				std::atomic_thread_fence(std::memory_order_acquire);
+				uint64_t currentPosition = this->ring->writePosition.load(std::memory_order_relaxed);
+				if (currentPosition - this->readPosition > window) continue;
+
+				this->readPosition += length;
+				return length;
+			}
+
+			if (this->ring->closed || timeout == 0) return 0;
+
+			struct timespec waitTime;
+			if (timeout > 0) {
+				auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+				if (remaining <= 0) return 0;
+				waitTime.tv_sec = remaining / 1000000000;
+				waitTime.tv_nsec = remaining % 1000000000;
+			}
+			futexWait((std::atomic<uint32_t>*) &this->ring->sequence, sequence, timeout > 0 ? &waitTime : NULL);
+		}
+	}
+
+	long writeBytes(const char* buffer, unsigned long bufferLength)
+	{
+		if (this->socketFd < 0 || bufferLength > SerialAccess::SERIAL_BROKER_MAX_WRITE) return SerialAccess::SERIAL_BROKER_ERROR;
+
+		char message[SerialAccess::SERIAL_BROKER_MAX_WRITE + 1];
+		message[0] = BROKER_OP_WRITE;
+		memcpy(message + 1, buffer, bufferLength);
+		int32_t result;
+		if (::send(this->socketFd, message, bufferLength + 1, MSG_NOSIGNAL) != (ssize_t) bufferLength + 1 ||
+			::recv(this->socketFd, &result, sizeof(result), 0) != sizeof(result)) {
+			printBrokerError("error %i in SerialBrokerClient:writeBytes:send: %s\n");
+			return SerialAccess::SERIAL_BROKER_ERROR;
+		}
+		return result;
+	}
+
+	bool releasePort()
+	{
+		if (this->socketFd < 0) return false;
+
+		char message = BROKER_OP_RELEASE;
+		int32_t result;
+		return ::send(this->socketFd, &message, 1, MSG_NOSIGNAL) == 1 && ::recv(this->socketFd, &result, sizeof(result), 0) == sizeof(result);
+	}
+
+	unsigned long long getLostBytes()
+	{
+		return this->lostBytes;
+	}
+
+};
+
+SerialAccess::SerialBroker* SerialAccess::newSerialBroker(SerialPort* port, const char* socketPath, SerialBrokerArbitration arbitration, unsigned long ringCapacity) {
+	return new SerialBrokerLin(port, socketPath, arbitration, ringCapacity);
+}
+
+SerialAccess::SerialBrokerClient* SerialAccess::newSerialBrokerClient(const char* socketPath) {
+	return new SerialBrokerClientLin(socketPath);
+}
+
+#else
+
+SerialAccess::SerialBroker* SerialAccess::newSerialBroker(SerialPort* port, const char* socketPath, SerialBrokerArbitration arbitration, unsigned long ringCapacity) {
+	return nullptr;
+}
+
+SerialAccess::SerialBrokerClient* SerialAccess::newSerialBrokerClient(const char* socketPath) {
+	return nullptr;
+}
+
+#endif
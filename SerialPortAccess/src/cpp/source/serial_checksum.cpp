@@ -0,0 +1,284 @@
+
+#include "serial_checksum.hpp"
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CHECKSUM_X86_CLMUL
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(PLATFORM_LIN)
+#define CHECKSUM_ARM64_CRC
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+typedef uint32_t (*crc32_function)(uint32_t crc, const unsigned char* data, size_t length);
+
+/*
+ * Slicing-by-8 lookup tables.
+ * Table 0 is the classic byte wise table, table k advances an byte by k additional zero bytes.
+ */
+
+static uint32_t crc16ModbusTable[8][256];
+static uint32_t crc32Table[8][256];
+static uint16_t crc16CcittTable[8][256];
+
+static void initReflectedTable(uint32_t table[8][256], uint32_t polynomial) {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 1) ? (crc >> 1) ^ polynomial : (crc >> 1);
+		table[0][i] = crc;
+	}
+	for (uint32_t i = 0; i < 256; i++)
+		for (int k = 1; k < 8; k++)
+			table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+}
+
+static void initCcittTable(uint16_t table[8][256]) {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint16_t crc = (uint16_t) (i << 8);
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+		table[0][i] = crc;
+	}
+	for (uint32_t i = 0; i < 256; i++)
+		for (int k = 1; k < 8; k++)
+			table[k][i] = (uint16_t) ((table[k - 1][i] << 8) ^ table[0][table[k - 1][i] >> 8]);
+}
+
+static bool initTables() {
+	initReflectedTable(crc16ModbusTable, 0xA001);
+	initReflectedTable(crc32Table, 0xEDB88320);
+	initCcittTable(crc16CcittTable);
+	return true;
+}
+
+// the tables are built on the first use, so that checksums calculated by static initializers of other files do not depend on the initialization order
+static void prepareTables() {
+	static const bool tablesReady = initTables();
+	(void) tablesReady;
+}
+
+static inline uint32_t load32(const unsigned char* data) {
+	return (uint32_t) data[0] | (uint32_t) data[1] << 8 | (uint32_t) data[2] << 16 | (uint32_t) data[3] << 24;
+}
+
+// Slicing-by-8 for reflected checksums of up to 32 bits, held in the low bits of crc
+static uint32_t updateReflected(const uint32_t table[8][256], uint32_t crc, const unsigned char* data, size_t length) {
+	while (length >= 8) {
+		uint32_t low = load32(data) ^ crc;
+		uint32_t high = load32(data + 4);
+		crc =	table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+				table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+		data += 8;
+		length -= 8;
+	}
+	while (length--)
+		crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xFF];
+	return crc;
+}
+
+// Slicing-by-8 for the not reflected 16 bit CCITT polynomial
+static uint16_t updateCcitt(uint16_t crc, const unsigned char* data, size_t length) {
+	const uint16_t (*table)[256] = crc16CcittTable;
+	while (length >= 8) {
+		crc =	table[7][data[0] ^ (crc >> 8)] ^ table[6][data[1] ^ (crc & 0xFF)] ^ table[5][data[2]] ^ table[4][data[3]] ^
+				table[3][data[4]] ^ table[2][data[5]] ^ table[1][data[6]] ^ table[0][data[7]];
+		data += 8;
+		length -= 8;
+	}
+	while (length--)
+		crc = (uint16_t) ((crc << 8) ^ table[0][((crc >> 8) ^ *data++) & 0xFF]);
+	return crc;
+}
+
+static uint32_t updateCRC32Table(uint32_t crc, const unsigned char* data, size_t length) {
+	return updateReflected(crc32Table, crc, data, length);
+}
+
+#ifdef CHECKSUM_X86_CLMUL
+
+/*
+ * CRC32 folding using carry-less multiplication, as described in
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009).
+ * Folds four 128 bit lanes in parallel over 64 byte blocks, then reduces to 32 bits using Barrett reduction.
+ * Requires at least 64 bytes and processes multiples of 16 bytes, the rest is left to the table implementation.
+ */
+__attribute__((target("pclmul,sse2")))
+static uint32_t updateCRC32Clmul(uint32_t crc, const unsigned char* data, size_t length) {
+	if (length < 64) return updateCRC32Table(crc, data, length);
+
+	static const uint64_t k1k2[] __attribute__((aligned(16))) = { 0x0154442bd4, 0x01c6e41596 };
+	static const uint64_t k3k4[] __attribute__((aligned(16))) = { 0x01751997d0, 0x00ccaa009e };
+	static const uint64_t k5k0[] __attribute__((aligned(16))) = { 0x0163cd6124, 0x0000000000 };
+	static const uint64_t poly[] __attribute__((aligned(16))) = { 0x01db710641, 0x01f7011641 };
+
+	size_t remaining = length & 15;
+	length -= remaining;
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i*) (data + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*) (data + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*) (data + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*) (data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+	x0 = _mm_load_si128((const __m128i*) k1k2);
+	data += 64;
+	length -= 64;
+
+	// Fold 64 byte blocks into the four lanes
+	while (length >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		y5 = _mm_loadu_si128((const __m128i*) (data + 0x00));
+		y6 = _mm_loadu_si128((const __m128i*) (data + 0x10));
+		y7 = _mm_loadu_si128((const __m128i*) (data + 0x20));
+		y8 = _mm_loadu_si128((const __m128i*) (data + 0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		data += 64;
+		length -= 64;
+	}
+
+	// Fold the four lanes into one
+	x0 = _mm_load_si128((const __m128i*) k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// Fold remaining 16 byte blocks
+	while (length >= 16) {
+		x2 = _mm_loadu_si128((const __m128i*) data);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		data += 16;
+		length -= 16;
+	}
+
+	// Fold 128 to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64((const __m128i*) k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x0 = _mm_load_si128((const __m128i*) poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	crc = (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+
+	return updateCRC32Table(crc, data, remaining);
+}
+
+#endif
+
+#ifdef CHECKSUM_ARM64_CRC
+
+// The ARMv8 CRC32 instructions implement exactly the reflected CRC32 polynomial
+__attribute__((target("+crc")))
+static uint32_t updateCRC32Arm(uint32_t crc, const unsigned char* data, size_t length) {
+	while (length >= 8) {
+		uint64_t word;
+		__builtin_memcpy(&word, data, 8);
+		crc = __crc32d(crc, word);
+		data += 8;
+		length -= 8;
+	}
+	while (length--)
+		crc = __crc32b(crc, *data++);
+	return crc;
+}
+
+#endif
+
+static const char* crc32Implementation = "slicing-by-8";
+
+static crc32_function selectCRC32() {
+#if defined(CHECKSUM_X86_CLMUL)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse2")) {
+		crc32Implementation = "pclmul";
+		return updateCRC32Clmul;
+	}
+#elif defined(CHECKSUM_ARM64_CRC)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+		crc32Implementation = "armv8-crc32";
+		return updateCRC32Arm;
+	}
+#endif
+	return updateCRC32Table;
+}
+
+// selected on the first use, like the tables
+static crc32_function getCRC32() {
+	static const crc32_function updateCRC32 = selectCRC32();
+	return updateCRC32;
+}
+
+SerialAccess::SerialChecksum::SerialChecksum(SerialChecksumType type) {
+	prepareTables();
+	this->type = type;
+	reset();
+}
+
+void SerialAccess::SerialChecksum::reset() {
+	switch (this->type) {
+	case SPC_CRC16_MODBUS: this->state = 0xFFFF; break;
+	case SPC_CRC16_CCITT: this->state = 0xFFFF; break;
+	case SPC_CRC16_XMODEM: this->state = 0x0000; break;
+	case SPC_CRC32: this->state = 0xFFFFFFFF; break;
+	}
+}
+
+void SerialAccess::SerialChecksum::update(const char* data, unsigned long length) {
+	const unsigned char* bytes = (const unsigned char*) data;
+	switch (this->type) {
+	case SPC_CRC16_MODBUS: this->state = updateReflected(crc16ModbusTable, (uint32_t) this->state, bytes, length); break;
+	case SPC_CRC16_CCITT:
+	case SPC_CRC16_XMODEM: this->state = updateCcitt((uint16_t) this->state, bytes, length); break;
+	case SPC_CRC32: this->state = getCRC32()((uint32_t) this->state, bytes, length); break;
+	}
+}
+
+unsigned long SerialAccess::SerialChecksum::get() const {
+	if (this->type == SPC_CRC32) return ~this->state & 0xFFFFFFFF;
+	return this->state;
+}
+
+unsigned long SerialAccess::SerialChecksum::calculate(SerialChecksumType type, const char* data, unsigned long length) {
+	SerialChecksum checksum(type);
+	checksum.update(data, length);
+	return checksum.get();
+}
+
+const char* SerialAccess::SerialChecksum::getImplementation(SerialChecksumType type) {
+	if (type != SPC_CRC32) return "slicing-by-8";
+	getCRC32();
+	return crc32Implementation;
+}
@@ -0,0 +1,133 @@
+
+#include "serial_modbus.hpp"
+#include "serial_checksum.hpp"
+#include <thread>
+#include <string.h>
+
+using namespace std::chrono;
+
+unsigned short SerialAccess::modbusCRC16(const char* data, unsigned long length) {
+	return (unsigned short) SerialChecksum::calculate(SPC_CRC16_MODBUS, data, length);
+}
+
+SerialAccess::ModbusRTUPort::ModbusRTUPort(SerialPort* port) {
+	this->port = port;
+	this->charTime = microseconds(0);
+	this->charTimeout = microseconds(MODBUS_RTU_FIXED_T15_MICROS);
+	this->frameDelay = microseconds(MODBUS_RTU_FIXED_T35_MICROS);
+	this->lastActivity = steady_clock::now();
+}
+
+bool SerialAccess::ModbusRTUPort::updateTiming() {
+	SerialPortConfig config;
+	if (!this->port->getConfig(config) || config.baudRate == 0) return false;
+
+	// start bit + data bits + parity bit + stop bits (one and a half rounded up)
+	unsigned long bitsPerChar = 1 + config.dataBits + (config.parity == SPC_PARITY_NONE ? 0 : 1) + (config.stopBits == SPC_STOPB_ONE ? 1 : 2);
+	this->charTime = microseconds((bitsPerChar * 1000000 + config.baudRate - 1) / config.baudRate);
+
+	// The specification recommends fixed values above 19200 baud, since the timer load would be too high otherwise
+	if (config.baudRate > 19200) {
+		this->charTimeout = microseconds(MODBUS_RTU_FIXED_T15_MICROS);
+		this->frameDelay = microseconds(MODBUS_RTU_FIXED_T35_MICROS);
+	} else {
+		this->charTimeout = this->charTime * 3 / 2;
+		this->frameDelay = this->charTime * 7 / 2;
+	}
+
+	// Reads should only return what already arrived, the waiting is done using waitForData()
+	int readTimeout, readTimeoutInterval, writeTimeout;
+	if (!this->port->getTimeouts(&readTimeout, &readTimeoutInterval, &writeTimeout)) return false;
+	return this->port->setTimeouts(0, 0, writeTimeout);
+}
+
+unsigned long SerialAccess::ModbusRTUPort::getCharTimeout() {
+	return this->charTimeout.count();
+}
+
+unsigned long SerialAccess::ModbusRTUPort::getFrameDelay() {
+	return this->frameDelay.count();
+}
+
+unsigned long SerialAccess::ModbusRTUPort::receiveFrame(char* frame, unsigned long frameCapacity, int timeout, ModbusFrameStatus* status) {
+	ModbusFrameStatus result = MODBUS_FRAME_OK;
+	if (status == 0) status = &result;
+
+	if (!this->port->isOpen()) {
+		*status = MODBUS_FRAME_PORT_ERROR;
+		return 0;
+	}
+
+	// Wait for the first character of the frame
+	if (!this->port->waitForData(timeout < 0 ? -1 : (long long) timeout * 1000)) {
+		*status = this->port->isOpen() ? MODBUS_FRAME_TIMEOUT : MODBUS_FRAME_PORT_ERROR;
+		return 0;
+	}
+
+	char discard[MODBUS_RTU_MAX_FRAME_LEN];
+	unsigned long frameLength = 0;
+	SerialChecksum checksum(SPC_CRC16_MODBUS);
+	*status = MODBUS_FRAME_OK;
+
+	while (true) {
+
+		// Read everything that arrived so far, data beyond the buffer capacity is discarded
+		unsigned long bufferSpace = frameLength < frameCapacity ? frameCapacity - frameLength : 0;
+		if (bufferSpace > 0) {
+			unsigned long received = this->port->readBytes(frame + frameLength, bufferSpace);
+			checksum.update(frame + frameLength, received);
+			frameLength += received;
+		} else if (this->port->readBytes(discard, MODBUS_RTU_MAX_FRAME_LEN) > 0) {
+			*status = MODBUS_FRAME_OVERRUN;
+		}
+		this->lastActivity = steady_clock::now();
+
+		// The frame ends when the line stays silent for t3.5
+		if (!this->port->waitForData(this->frameDelay.count())) break;
+
+		// A silence longer than t1.5 within the frame marks it as corrupt
+		if (steady_clock::now() - this->lastActivity > this->charTimeout && *status == MODBUS_FRAME_OK)
+			*status = MODBUS_FRAME_GAP_ERROR;
+
+	}
+
+	if (*status != MODBUS_FRAME_OK) return 0;
+
+	if (frameLength < MODBUS_RTU_MIN_FRAME_LEN) {
+		*status = MODBUS_FRAME_INCOMPLETE;
+		return 0;
+	}
+
+	// The checksum over the frame including its CRC is zero if the CRC matches
+	if (checksum.get() != 0) {
+		*status = MODBUS_FRAME_CRC_ERROR;
+		return 0;
+	}
+
+	return frameLength - 2;
+}
+
+bool SerialAccess::ModbusRTUPort::sendFrame(const char* frame, unsigned long frameLength) {
+	if (frameLength > MODBUS_RTU_MAX_FRAME_LEN - 2) return false;
+
+	char buffer[MODBUS_RTU_MAX_FRAME_LEN];
+	memcpy(buffer, frame, frameLength);
+	unsigned short crc = modbusCRC16(frame, frameLength);
+	buffer[frameLength] = crc & 0xFF;
+	buffer[frameLength + 1] = crc >> 8;
+	frameLength += 2;
+
+	// Ensure the inter frame delay since the last activity on the line
+	std::this_thread::sleep_until(this->lastActivity + this->frameDelay);
+
+	unsigned long written = 0;
+	while (written < frameLength) {
+		unsigned long transmitted = this->port->writeBytes(buffer + written, frameLength - written);
+		if (transmitted == 0) return false;
+		written += transmitted;
+	}
+
+	// The write returns when the data is queued, the line is busy until the last character was shifted out
+	this->lastActivity = steady_clock::now() + this->charTime * frameLength;
+	return true;
+}
@@ -0,0 +1,68 @@
+
+#include "serial_pacing.hpp"
+#include <thread>
+#include <algorithm>
+
+SerialAccess::SerialTxPacer::SerialTxPacer() {
+	this->linePercent = 0;
+	this->chunkSize = SERIAL_PACING_DEFAULT_CHUNK;
+	this->chunkGap = std::chrono::microseconds(0);
+	this->charTime = 0;
+	this->rate = 0;
+	this->tokens = 0;
+}
+
+void SerialAccess::SerialTxPacer::configure(unsigned int linePercent, unsigned long chunkSize, unsigned int chunkGap) {
+	this->linePercent = linePercent > 100 ? 100 : linePercent;
+	this->chunkSize = chunkSize == 0 ? SERIAL_PACING_DEFAULT_CHUNK : chunkSize;
+	this->chunkGap = std::chrono::microseconds(chunkGap);
+	this->rate = this->charTime > 0 ? this->linePercent / (100.0 * this->charTime) : 0;
+	this->tokens = this->chunkSize;
+	this->lastRefill = this->nextChunk = std::chrono::steady_clock::now();
+}
+
+void SerialAccess::SerialTxPacer::setLineConfig(const SerialPortConfig& config) {
+	if (config.baudRate == 0) {
+		this->charTime = this->rate = 0;
+		return;
+	}
+	double stopBits = config.stopBits == SPC_STOPB_TWO ? 2 : config.stopBits == SPC_STOPB_ONE_HALF ? 1.5 : 1;
+	double parityBits = config.parity == SPC_PARITY_NONE ? 0 : 1;
+	this->charTime = (1 + config.dataBits + parityBits + stopBits) / config.baudRate;
+	this->rate = this->linePercent / (100.0 * this->charTime);
+}
+
+bool SerialAccess::SerialTxPacer::isEnabled() const {
+	return this->rate > 0;
+}
+
+unsigned long SerialAccess::SerialTxPacer::acquire(unsigned long length) {
+	unsigned long chunk = length < this->chunkSize ? length : this->chunkSize;
+
+	// Wait for the gap after the last chunk and until enough tokens are available for the next one
+	auto now = std::chrono::steady_clock::now();
+	this->tokens += std::chrono::duration<double>(now - this->lastRefill).count() * this->rate;
+	if (this->tokens > this->chunkSize) this->tokens = this->chunkSize;
+	this->lastRefill = now;
+
+	auto readyTime = this->nextChunk;
+	if (this->tokens < chunk)
+		readyTime = std::max(readyTime, now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>((chunk - this->tokens) / this->rate)));
+	if (readyTime > now) {
+		std::this_thread::sleep_until(readyTime);
+		this->tokens += std::chrono::duration<double>(readyTime - now).count() * this->rate;
+		if (this->tokens > this->chunkSize) this->tokens = this->chunkSize;
+		this->lastRefill = readyTime;
+	}
+
+	return chunk;
+}
+
+void SerialAccess::SerialTxPacer::consume(unsigned long length) {
+	this->tokens -= length;
+
+	// The gap starts after the chunk has left the line, not when it was handed to the driver
+	if (this->chunkGap.count() == 0) return;
+	auto transmitTime = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(length * this->charTime));
+	this->nextChunk = std::chrono::steady_clock::now() + transmitTime + this->chunkGap;
+}
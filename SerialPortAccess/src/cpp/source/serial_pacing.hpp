@@ -0,0 +1,63 @@
+#pragma once
+
+#include "serial_port.hpp"
+#include <chrono>
+
+namespace SerialAccess {
+
+static const unsigned long SERIAL_PACING_DEFAULT_CHUNK = 16;	// default burst length, the typical FIFO depth of an UART
+
+/**
+ * Token bucket limiting the transmission rate to an fraction of the line rate.
+ * Shared by the platform implementations, which call acquire() before and consume() after each write to the driver.
+ */
+class SerialTxPacer {
+
+public:
+	SerialTxPacer();
+
+	/**
+	 * Configures the pacing, the line rate has to be supplied separately using setLineConfig().
+	 * @param linePercent The percentage of the line rate to transmit with, zero disables pacing
+	 * @param chunkSize The max number of bytes written at once, zero for the default
+	 * @param chunkGap An additional idle time in microseconds after each chunk was transmitted
+	 */
+	void configure(unsigned int linePercent, unsigned long chunkSize, unsigned int chunkGap);
+
+	/**
+	 * Updates the line rate from the port configuration.
+	 * @param config The current configuration of the port
+	 */
+	void setLineConfig(const SerialPortConfig& config);
+
+	/**
+	 * Returns true if pacing is enabled and the line rate known.
+	 */
+	bool isEnabled() const;
+
+	/**
+	 * Waits until the next chunk may be written.
+	 * @param length The number of bytes remaining to be written
+	 * @return The number of bytes that may be written now
+	 */
+	unsigned long acquire(unsigned long length);
+
+	/**
+	 * Accounts the bytes actually written to the driver.
+	 * @param length The number of bytes written
+	 */
+	void consume(unsigned long length);
+
+private:
+	unsigned int linePercent;
+	unsigned long chunkSize;
+	std::chrono::microseconds chunkGap;
+	double charTime;		// s per character on the line
+	double rate;			// bytes per s allowed
+	double tokens;
+	std::chrono::steady_clock::time_point lastRefill;
+	std::chrono::steady_clock::time_point nextChunk;
+
+};
+
+}
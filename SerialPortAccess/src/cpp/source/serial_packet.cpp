@@ -0,0 +1,300 @@
+
+#include "serial_packet.hpp"
+#include <stdint.h>
+#include <string.h>
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+#define COBS_MAX_BLOCK 254
+
+/*
+ * The delimiter and escape scans are the hot loops of both codecs.
+ * COBS only has to find zero bytes, which memchr already does vectorized on all platforms.
+ * SLIP needs to find two different bytes, this is done with an portable word at a time test.
+ */
+
+typedef uintptr_t scan_word;
+static const scan_word SCAN_ONES = ~(scan_word) 0 / 0xFF;
+static const scan_word SCAN_HIGHS = SCAN_ONES * 0x80;
+
+static inline bool wordHasByte(scan_word word, scan_word pattern) {
+	scan_word x = word ^ pattern;
+	return ((x - SCAN_ONES) & ~x & SCAN_HIGHS) != 0;
+}
+
+static const char* findSlipSpecial(const char* data, const char* end) {
+	const scan_word endPattern = SCAN_ONES * SLIP_END;
+	const scan_word escPattern = SCAN_ONES * SLIP_ESC;
+	while (data + sizeof(scan_word) <= end) {
+		scan_word word;
+		memcpy(&word, data, sizeof(scan_word));
+		if (wordHasByte(word, endPattern) || wordHasByte(word, escPattern)) break;
+		data += sizeof(scan_word);
+	}
+	while (data < end && (unsigned char) *data != SLIP_END && (unsigned char) *data != SLIP_ESC) data++;
+	return data;
+}
+
+// Encodes the next COBS block, writes at most COBS_MAX_BLOCK + 1 bytes
+static unsigned long cobsEncodeBlock(const char* data, unsigned long remaining, char* encoded, unsigned long* consumed, bool* last) {
+	unsigned long block = remaining < COBS_MAX_BLOCK ? remaining : COBS_MAX_BLOCK;
+	const char* zero = (const char*) memchr(data, 0, block);
+	unsigned long runLength = zero ? zero - data : block;
+	encoded[0] = (char) (runLength + 1);
+	memcpy(encoded + 1, data, runLength);
+	*consumed = runLength + (zero ? 1 : 0);
+	*last = !zero && (block < COBS_MAX_BLOCK || remaining == COBS_MAX_BLOCK);
+	return runLength + 1;
+}
+
+// Encodes as much of the data as fits in the buffer using SLIP escaping
+static unsigned long slipEncodeRun(const char* data, unsigned long remaining, char* encoded, unsigned long capacity, unsigned long* consumed) {
+	const char* begin = data;
+	const char* end = data + remaining;
+	unsigned long written = 0;
+	while (data < end && written < capacity) {
+		const char* special = findSlipSpecial(data, end);
+		unsigned long runLength = special - data;
+		if (runLength > capacity - written) runLength = capacity - written;
+		memcpy(encoded + written, data, runLength);
+		written += runLength;
+		data += runLength;
+		if (data == special && data < end) {
+			if (capacity - written < 2) break;
+			encoded[written++] = (char) SLIP_ESC;
+			encoded[written++] = (char) ((unsigned char) *data == SLIP_END ? SLIP_ESC_END : SLIP_ESC_ESC);
+			data++;
+		}
+	}
+	*consumed = data - begin;
+	return written;
+}
+
+unsigned long SerialAccess::cobsEncode(const char* packet, unsigned long length, char* encoded, unsigned long capacity) {
+	unsigned long written = 0;
+	bool last = false;
+	while (!last) {
+		unsigned long block = length < COBS_MAX_BLOCK ? length : COBS_MAX_BLOCK;
+		if (written + block + 2 > capacity) return 0;
+		unsigned long consumed;
+		written += cobsEncodeBlock(packet, length, encoded + written, &consumed, &last);
+		packet += consumed;
+		length -= consumed;
+	}
+	encoded[written++] = 0;
+	return written;
+}
+
+long SerialAccess::cobsDecode(const char* encoded, unsigned long length, char* packet, unsigned long capacity) {
+	const char* end = encoded + length;
+	unsigned long written = 0;
+	while (encoded < end && *encoded != 0) {
+		unsigned char code = (unsigned char) *encoded++;
+		if (code - 1 > end - encoded || (unsigned long) (code - 1) > capacity - written) return SERIAL_PACKET_ERROR;
+		if (memchr(encoded, 0, code - 1) != 0) return SERIAL_PACKET_ERROR;
+		memcpy(packet + written, encoded, code - 1);
+		written += code - 1;
+		encoded += code - 1;
+		if (code < 0xFF && encoded < end && *encoded != 0) {
+			if (written == capacity) return SERIAL_PACKET_ERROR;
+			packet[written++] = 0;
+		}
+	}
+	return written;
+}
+
+unsigned long SerialAccess::slipEncode(const char* packet, unsigned long length, char* encoded, unsigned long capacity) {
+	if (capacity < 2) return 0;
+	encoded[0] = (char) SLIP_END;
+	unsigned long consumed;
+	unsigned long written = 1 + slipEncodeRun(packet, length, encoded + 1, capacity - 2, &consumed);
+	if (consumed < length) return 0;
+	encoded[written++] = (char) SLIP_END;
+	return written;
+}
+
+long SerialAccess::slipDecode(const char* encoded, unsigned long length, char* packet, unsigned long capacity) {
+	const char* end = encoded + length;
+	unsigned long written = 0;
+	while (encoded < end) {
+		const char* special = findSlipSpecial(encoded, end);
+		unsigned long runLength = special - encoded;
+		if (runLength > capacity - written) return SERIAL_PACKET_ERROR;
+		memcpy(packet + written, encoded, runLength);
+		written += runLength;
+		encoded = special;
+		if (encoded == end) break;
+		if ((unsigned char) *encoded++ == SLIP_END) continue;
+		if (encoded == end || written == capacity) return SERIAL_PACKET_ERROR;
+		switch ((unsigned char) *encoded++) {
+		case SLIP_ESC_END: packet[written++] = (char) SLIP_END; break;
+		case SLIP_ESC_ESC: packet[written++] = (char) SLIP_ESC; break;
+		default: return SERIAL_PACKET_ERROR;
+		}
+	}
+	return written;
+}
+
+SerialAccess::SerialPacketPort::SerialPacketPort(SerialPort* port, SerialPacketEncoding encoding) {
+	this->port = port;
+	this->encoding = encoding;
+	this->txLength = 0;
+	resetReception();
+}
+
+void SerialAccess::SerialPacketPort::resetReception() {
+	this->rxBegin = this->rxEnd = 0;
+	this->rxPacketLength = 0;
+	this->rxBlockRemaining = 0;
+	this->rxPendingZero = false;
+	this->rxEscaped = false;
+	this->rxDiscard = false;
+}
+
+bool SerialAccess::SerialPacketPort::flushTransmission() {
+	unsigned long written = 0;
+	while (written < this->txLength) {
+		unsigned long transmitted = this->port->writeBytes(this->txBuffer + written, this->txLength - written);
+		if (transmitted == 0) {
+			this->txLength = 0;
+			return false;
+		}
+		written += transmitted;
+	}
+	this->txLength = 0;
+	return true;
+}
+
+bool SerialAccess::SerialPacketPort::reserveTransmission(unsigned long length) {
+	if (SERIAL_PACKET_BUFFER_LEN - this->txLength >= length) return true;
+	return flushTransmission();
+}
+
+bool SerialAccess::SerialPacketPort::sendPacket(const char* packet, unsigned long length) {
+	if (this->encoding == SPC_PACKET_COBS) {
+		bool last = false;
+		while (!last) {
+			if (!reserveTransmission(COBS_MAX_BLOCK + 1)) return false;
+			unsigned long consumed;
+			this->txLength += cobsEncodeBlock(packet, length, this->txBuffer + this->txLength, &consumed, &last);
+			packet += consumed;
+			length -= consumed;
+		}
+		if (!reserveTransmission(1)) return false;
+		this->txBuffer[this->txLength++] = 0;
+	} else {
+		if (!reserveTransmission(1)) return false;
+		this->txBuffer[this->txLength++] = (char) SLIP_END;
+		while (length > 0) {
+			if (!reserveTransmission(2)) return false;
+			unsigned long consumed;
+			this->txLength += slipEncodeRun(packet, length, this->txBuffer + this->txLength, SERIAL_PACKET_BUFFER_LEN - this->txLength, &consumed);
+			packet += consumed;
+			length -= consumed;
+		}
+		if (!reserveTransmission(1)) return false;
+		this->txBuffer[this->txLength++] = (char) SLIP_END;
+	}
+	return flushTransmission();
+}
+
+bool SerialAccess::SerialPacketPort::decodeReception(char* packet, unsigned long capacity, long* result) {
+
+	// Appends decoded bytes to the packet, or marks it as discarded if it does not fit
+	auto append = [&](const char* data, unsigned long length) {
+		if (this->rxDiscard) return;
+		if (capacity - this->rxPacketLength < length) {
+			this->rxDiscard = true;
+			return;
+		}
+		memcpy(packet + this->rxPacketLength, data, length);
+		this->rxPacketLength += length;
+	};
+
+	// Completes the current packet and resets the decoder state
+	auto complete = [&](bool malformed) {
+		*result = (malformed || this->rxDiscard) ? SERIAL_PACKET_ERROR : (long) this->rxPacketLength;
+		this->rxPacketLength = 0;
+		this->rxBlockRemaining = 0;
+		this->rxPendingZero = false;
+		this->rxEscaped = false;
+		this->rxDiscard = false;
+	};
+
+	const char zero = 0;
+	while (this->rxBegin < this->rxEnd) {
+		const char* data = this->rxBuffer + this->rxBegin;
+		const char* end = this->rxBuffer + this->rxEnd;
+
+		if (this->encoding == SPC_PACKET_COBS) {
+			if (this->rxBlockRemaining == 0) {
+				unsigned char code = (unsigned char) *data;
+				this->rxBegin++;
+				if (code == 0) {
+					// Skip delimiters not preceded by an packet, used to resynchronize
+					if (this->rxPacketLength == 0 && !this->rxPendingZero && !this->rxDiscard) continue;
+					complete(false);
+					return true;
+				}
+				if (this->rxPendingZero) append(&zero, 1);
+				this->rxBlockRemaining = code - 1;
+				this->rxPendingZero = code < 0xFF;
+				continue;
+			}
+			unsigned long available = end - data < this->rxBlockRemaining ? end - data : this->rxBlockRemaining;
+			const char* delimiter = (const char*) memchr(data, 0, available);
+			unsigned long runLength = delimiter ? delimiter - data : available;
+			append(data, runLength);
+			this->rxBegin += runLength;
+			this->rxBlockRemaining -= runLength;
+			if (delimiter) {
+				// Delimiter within an block, the packet was truncated
+				this->rxBegin++;
+				complete(true);
+				return true;
+			}
+		} else {
+			if (this->rxEscaped) {
+				this->rxEscaped = false;
+				this->rxBegin++;
+				char escaped = (char) SLIP_END;
+				switch ((unsigned char) *data) {
+				case SLIP_ESC_END: break;
+				case SLIP_ESC_ESC: escaped = (char) SLIP_ESC; break;
+				default: this->rxDiscard = true; continue;
+				}
+				append(&escaped, 1);
+				continue;
+			}
+			const char* special = findSlipSpecial(data, end);
+			append(data, special - data);
+			this->rxBegin += special - data;
+			if (special < end) {
+				this->rxBegin++;
+				if ((unsigned char) *special == SLIP_ESC) {
+					this->rxEscaped = true;
+					continue;
+				}
+				// Skip empty packets caused by the leading delimiters
+				if (this->rxPacketLength == 0 && !this->rxDiscard) continue;
+				complete(false);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+long SerialAccess::SerialPacketPort::receivePacket(char* packet, unsigned long capacity) {
+	long result;
+	while (!decodeReception(packet, capacity, &result)) {
+		unsigned long received = this->port->readBytes(this->rxBuffer, SERIAL_PACKET_BUFFER_LEN);
+		if (received == 0) return SERIAL_PACKET_NONE;
+		this->rxBegin = 0;
+		this->rxEnd = received;
+	}
+	return result;
+}
@@ -150,6 +150,12 @@ JNIEXPORT jboolean JNICALL Java_de_m_1marvin_serialportaccess_SerialPort_n_1getT
 	return false;
 }
 
+JNIEXPORT jboolean JNICALL Java_de_m_1marvin_serialportaccess_SerialPort_n_1setReadLatencyBudget(JNIEnv* env, jclass clazz, jlong handle, jlong latencyBudget)
+{
+	SerialPort* port = (SerialPort*)handle;
+	return port->setReadLatencyBudget((long long) latencyBudget);
+}
+
 JNIEXPORT jboolean JNICALL Java_de_m_1marvin_serialportaccess_SerialPort_n_1openPort(JNIEnv* env, jclass clazz, jlong handle)
 {
 	SerialPort* port = (SerialPort*)handle;
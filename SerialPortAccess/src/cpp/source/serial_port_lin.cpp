@@ -1,6 +1,7 @@
 #ifdef PLATFORM_LIN
 
 #include "serial_port.hpp"
+#include "serial_pacing.hpp"
 #include <thread>
 #include <chrono>
 #include <stdio.h>
@@ -11,6 +12,7 @@
 #include <unistd.h>
 #include <termios.h>
 #include <sys/eventfd.h>
+#include <sys/ioctl.h>
 
 void printError(const char* format) {
 	setbuf(stdout, NULL); // Work around for errors printed during JNI
@@ -102,18 +104,80 @@ private:
 	int rxTimeout = 0;
 	int rxTimeoutInterval = 0;
 	int txTimeout = 0;
+	bool nonBlocking = false;
+	SerialAccess::SerialTxPacer txPacer;
+	long long rxLatencyBudget = 0;	// us, zero if adaptive reads are disabled
+	double rxArrivalRate = 0;		// bytes/s, moving average
+	std::chrono::steady_clock::time_point rxLastRead;
 	struct pollfd pollfdRx[2]; // rx, evt
 	struct pollfd pollfdTx[2]; // tx, evt
 
+	// Returns the time in seconds required to transmit one character with the current configuration, zero if unknown
+	double getCharacterTime()
+	{
+		int baudRate = getBaudValue(cfgetispeed(&this->comPortState));
+		if (baudRate <= 0) return 0;
+		int dataBits = 8;
+		switch (this->comPortState.c_cflag & CSIZE) {
+		case CS5: dataBits = 5; break;
+		case CS6: dataBits = 6; break;
+		case CS7: dataBits = 7; break;
+		}
+		int frameBits = 1 + dataBits + ((this->comPortState.c_cflag & PARENB) ? 1 : 0) + ((this->comPortState.c_cflag & CSTOPB) ? 2 : 1);
+		return (double) frameBits / baudRate;
+	}
+
+	// After the first byte arrived, waits for the number of bytes expected within the latency budget
+	void waitForReadChunk(unsigned long bufferCapacity)
+	{
+		int availableBytes = 0;
+		if (::ioctl(this->comPortHandle, FIONREAD, &availableBytes) != 0 || availableBytes <= 0) return;
+
+		double charTime = getCharacterTime();
+		if (charTime <= 0) return;
+
+		// The chunk that can be expected within the budget, limited by the rate the line can deliver at most
+		double budget = this->rxLatencyBudget / 1000000.0;
+		double chunk = this->rxArrivalRate * budget;
+		if (chunk > budget / charTime) chunk = budget / charTime;
+		unsigned long targetBytes = chunk > bufferCapacity ? bufferCapacity : (unsigned long) chunk;
+		if (targetBytes <= (unsigned long) availableBytes) return;
+
+		double interval = this->rxArrivalRate * charTime < 1 ? 1 / this->rxArrivalRate : charTime;
+		long long waitMicros = (long long) ((targetBytes - availableBytes) * interval * 1000000.0);
+		if (waitMicros > this->rxLatencyBudget) waitMicros = this->rxLatencyBudget;
+
+		// Only the close event can end the wait early, the data is collected once after it
+		struct timespec timeout;
+		timeout.tv_sec = waitMicros / 1000000;
+		timeout.tv_nsec = (waitMicros % 1000000) * 1000;
+		this->pollfdRx[1].revents = 0;
+		::ppoll(&this->pollfdRx[1], 1, &timeout, NULL);
+	}
+
+	// Updates the moving average of the arrival rate after an read
+	void updateArrivalRate(unsigned long receivedBytes)
+	{
+		auto now = std::chrono::steady_clock::now();
+		double elapsed = std::chrono::duration<double>(now - this->rxLastRead).count();
+		this->rxLastRead = now;
+		if (elapsed <= 0) return;
+
+		double rate = receivedBytes / elapsed;
+		double charTime = getCharacterTime();
+		if (charTime > 0 && rate > 1 / charTime) rate = 1 / charTime;
+		this->rxArrivalRate += (rate - this->rxArrivalRate) * 0.25;
+	}
+
 public:
 
 	SerialPortLin(const char* portFile)
 	{
 		this->portFileName = portFile;
 		this->comPortHandle = -1;
-		this->pollfdTx[1].fd = eventfd(0, 0);
+		this->pollfdTx[1].fd = eventfd(0, EFD_NONBLOCK);
 		this->pollfdTx[1].events = POLLIN;
-		this->pollfdRx[1].fd = eventfd(0, 0);
+		this->pollfdRx[1].fd = eventfd(0, EFD_NONBLOCK);
 		this->pollfdRx[1].events = POLLIN;
 	}
 
@@ -161,18 +225,18 @@ public:
 		switch (config.flowControl) {
 		case SerialAccess::SPC_PARITY_NONE:
 			this->comPortState.c_cflag &= ~CRTSCTS; // Disable RTS/CTS
-			this->comPortState.c_cflag &= ~IXON; // Disable XON
-			this->comPortState.c_cflag &= ~IXOFF; // Disable XON
+			this->comPortState.c_iflag &= ~IXON; // Disable XON
+			this->comPortState.c_iflag &= ~IXOFF; // Disable XON
 			break;
 		case SerialAccess::SPC_FLOW_XON_XOFF:
 			this->comPortState.c_cflag &= ~CRTSCTS; // Disable RTS/CTS
-			this->comPortState.c_cflag |= IXON; // Enable XON
-			this->comPortState.c_cflag |= IXOFF; // Enable XON
+			this->comPortState.c_iflag |= IXON; // Enable XON
+			this->comPortState.c_iflag |= IXOFF; // Enable XON
 			break;
 		case SerialAccess::SPC_FLOW_RTS_CTS:
 			this->comPortState.c_cflag |= CRTSCTS; // Enable RTS/CTS
-			this->comPortState.c_cflag &= ~IXON; // Disable XON
-			this->comPortState.c_cflag &= ~IXOFF; // Disable XON
+			this->comPortState.c_iflag &= ~IXON; // Disable XON
+			this->comPortState.c_iflag &= ~IXOFF; // Disable XON
 			break;
 		default:
 			return false; // RTS/DTS flow control not supported
@@ -205,10 +269,11 @@ public:
 
 		// Save this->comPortHandle settings, also checking for error
 		if (tcsetattr(this->comPortHandle, TCSANOW, &this->comPortState) != 0) {
-		  printf("error %i from tcsetattr: %s\n", errno, strerror(errno));
-		  return 1;
+			printError("error %i in SerialPort:setConfig:tcsetattr: %s\n");
+			return false;
 		}
 
+		updateTransmitPacing();
 		return true;
 	}
 
@@ -228,14 +293,14 @@ public:
 		} else
 			config.parity = SerialAccess::SPC_PARITY_NONE;
 
-		if ((this->comPortState.c_cflag & IXON) || (this->comPortState.c_cflag & IXOFF))
+		if ((this->comPortState.c_iflag & IXON) || (this->comPortState.c_iflag & IXOFF))
 			config.flowControl = SerialAccess::SPC_FLOW_XON_XOFF;
 		else if (this->comPortState.c_cflag & CRTSCTS)
 			config.flowControl = SerialAccess::SPC_FLOW_RTS_CTS;
 		else
 			config.flowControl = SerialAccess::SPC_FLOW_NONE;
 
-		switch (config.dataBits & CSIZE) {
+		switch (this->comPortState.c_cflag & CSIZE) {
 		case CS5: config.dataBits = 5; break;
 		case CS6: config.dataBits = 6; break;
 		case CS7: config.dataBits = 7; break;
@@ -249,16 +314,32 @@ public:
 	}
 
 	bool openPort()
+	{
+		return openPort(false);
+	}
+
+	bool openPortNonBlocking()
+	{
+		return openPort(true);
+	}
+
+	bool openPort(bool nonBlocking)
 	{
 		if (this->comPortHandle >= 0) return false;
-		this->comPortHandle = ::open(this->portFileName, O_RDWR);
+		this->comPortHandle = ::open(this->portFileName, O_RDWR | (nonBlocking ? O_NONBLOCK : 0));
 
 		if (isOpen()) {
+			this->nonBlocking = nonBlocking;
 			this->pollfdRx[0].fd = this->comPortHandle;
 			this->pollfdRx[0].events = POLLIN;
 			this->pollfdTx[0].fd = this->comPortHandle;
 			this->pollfdTx[0].events = POLLOUT;
 
+			// clear close events of a previous closePort()
+			unsigned long val;
+			while (::read(this->pollfdRx[1].fd, (char*) &val, 8) > 0);
+			while (::read(this->pollfdTx[1].fd, (char*) &val, 8) > 0);
+
 			setConfig(SerialAccess::DEFAULT_PORT_CONFIGURATION);
 			setTimeouts(SerialAccess::DEFAULT_PORT_RX_TIMEOUT, SerialAccess::DEFAULT_PORT_RX_TIMEOUT_MULTIPLIER, SerialAccess::DEFAULT_PORT_TX_TIMEOUT);
 			return true;
@@ -286,6 +367,11 @@ public:
 		return this->comPortHandle >= 0;
 	}
 
+	SerialAccess::SerialPortHandle getNativeHandle()
+	{
+		return this->comPortHandle;
+	}
+
 	bool setBaud(unsigned long baud)
 	{
 		if (this->comPortHandle < 0) return false;
@@ -306,6 +392,7 @@ public:
 			return false;
 		}
 
+		updateTransmitPacing();
 		return true;
 	}
 
@@ -341,7 +428,7 @@ public:
 		} else {
 			// Wait for readTimeout ms, then return no matter what has or has not been received
 			// When receiving a byte, wait additonal readTimeoutInterval ms for another one before returning
-			this->rxTimeout = (unsigned char) (readTimeout / 100);
+			this->rxTimeout = readTimeout;
 			this->rxTimeoutInterval = readTimeoutInterval;
 			this->comPortState.c_cc[VTIME] = readTimeoutInterval < 0 ? 0 : (unsigned char) (readTimeoutInterval / 100);
 			this->comPortState.c_cc[VMIN] = 0;
@@ -366,6 +453,32 @@ public:
 		return true;
 	}
 
+	bool waitForData(long long timeoutMicros)
+	{
+		if (this->comPortHandle < 0) return false;
+
+		struct timespec timeout;
+		timeout.tv_sec = timeoutMicros / 1000000;
+		timeout.tv_nsec = (timeoutMicros % 1000000) * 1000;
+
+		this->pollfdRx[0].revents = this->pollfdRx[1].revents = 0;
+		if (::ppoll(this->pollfdRx, 2, timeoutMicros < 0 ? NULL : &timeout, NULL) < 0) {
+			if (errno != EINTR)
+				printError("error %i in SerialPort:waitForData:ppoll: %s\n");
+			return false;
+		}
+		return (this->pollfdRx[0].revents & POLLIN) != 0;
+	}
+
+	bool setReadLatencyBudget(long long latencyBudget)
+	{
+		if (this->comPortHandle < 0) return false;
+		this->rxLatencyBudget = latencyBudget < 0 ? 0 : latencyBudget;
+		this->rxArrivalRate = 0;
+		this->rxLastRead = std::chrono::steady_clock::now();
+		return true;
+	}
+
 	unsigned long readBytes(char* buffer, unsigned long bufferCapacity)
 	{
 		if (this->comPortHandle < 0) return 0;
@@ -376,8 +489,15 @@ public:
 			if (this->pollfdRx[0].revents == 0) return 0;
 		}
 
+		if (this->rxLatencyBudget > 0)
+			waitForReadChunk(bufferCapacity);
+
 		ssize_t receivedBytes = ::read(this->comPortHandle, buffer, bufferCapacity);
 		if (receivedBytes < 0) return 0;
+
+		if (this->rxLatencyBudget > 0)
+			updateArrivalRate(receivedBytes);
+
 		return receivedBytes;
 	}
 
@@ -406,7 +526,112 @@ public:
 		return receivedBytes;
 	}
 
+	unsigned long readExactly(char* buffer, unsigned long length, int deadline)
+	{
+		if (this->comPortHandle < 0) return 0;
+
+		struct termios originalState;
+		if (::tcgetattr(this->comPortHandle, &originalState) != 0) {
+			printError("error %i in SerialPort:readExactly:tcgetattr: %s\n");
+			return 0;
+		}
+
+		// With VTIME = 0 the tty driver only reports the port as readable once VMIN bytes are buffered,
+		// so the poll below only wakes up when the complete remainder (or the next 255 bytes) has arrived
+		struct termios readState = originalState;
+		readState.c_cc[VTIME] = 0;
+		readState.c_cc[VMIN] = 0;
+
+		auto deadlineTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(deadline);
+		unsigned long receivedBytes = 0;
+		while (receivedBytes < length) {
+			unsigned long remainingBytes = length - receivedBytes;
+			unsigned char minBytes = remainingBytes > 255 ? 255 : (unsigned char) remainingBytes;
+			if (readState.c_cc[VMIN] != minBytes) {
+				readState.c_cc[VMIN] = minBytes;
+				if (::tcsetattr(this->comPortHandle, TCSANOW, &readState) != 0) {
+					printError("error %i in SerialPort:readExactly:tcsetattr: %s\n");
+					break;
+				}
+			}
+
+			int waitTime = -1;
+			if (deadline >= 0) {
+				auto remainingTime = std::chrono::ceil<std::chrono::milliseconds>(deadlineTime - std::chrono::steady_clock::now()).count();
+				waitTime = remainingTime < 0 ? 0 : (int) remainingTime;
+			}
+
+			this->pollfdRx[0].revents = this->pollfdRx[1].revents = 0;
+			if (::poll(this->pollfdRx, 2, waitTime) < 0 && errno != EINTR) {
+				printError("error %i in SerialPort:readExactly:poll: %s\n");
+				break;
+			}
+			if (this->pollfdRx[1].revents != 0) break; // port closed
+
+			// After an hangup the port stays readable without any data arriving anymore, so this is handled like an expired deadline
+			bool hangup = (this->pollfdRx[0].revents & (POLLHUP | POLLERR)) != 0;
+			if (this->pollfdRx[0].revents == 0 || hangup) {
+				if (waitTime != 0 && !hangup) continue; // interrupted
+
+				// Deadline expired, take what already arrived without blocking for VMIN
+				int availableBytes = 0;
+				if (::ioctl(this->comPortHandle, FIONREAD, &availableBytes) == 0 && availableBytes > 0) {
+					readState.c_cc[VMIN] = 0;
+					::tcsetattr(this->comPortHandle, TCSANOW, &readState);
+					ssize_t result = ::read(this->comPortHandle, buffer + receivedBytes, (unsigned long) availableBytes < remainingBytes ? availableBytes : remainingBytes);
+					if (result > 0) receivedBytes += result;
+				}
+				break;
+			}
+
+			ssize_t result = ::read(this->comPortHandle, buffer + receivedBytes, remainingBytes);
+			if (result < 0) {
+				if (errno == EAGAIN || errno == EINTR) continue;
+				printError("error %i in SerialPort:readExactly:read: %s\n");
+				break;
+			}
+			if (result == 0) break; // end of file, the peer hung up
+			receivedBytes += result;
+		}
+
+		if (::tcsetattr(this->comPortHandle, TCSANOW, &originalState) != 0)
+			printError("error %i in SerialPort:readExactly:tcsetattr: %s\n");
+
+		return receivedBytes;
+	}
+
+	bool setTransmitPacing(unsigned int linePercent, unsigned long chunkSize, unsigned int chunkGap)
+	{
+		if (this->comPortHandle < 0) return false;
+		this->txPacer.configure(linePercent, chunkSize, chunkGap);
+		updateTransmitPacing();
+		return true;
+	}
+
+	void updateTransmitPacing()
+	{
+		SerialAccess::SerialPortConfig config;
+		if (getConfig(config))
+			this->txPacer.setLineConfig(config);
+	}
+
 	unsigned long writeBytes(const char* buffer, unsigned long bufferLength)
+	{
+		if (!this->txPacer.isEnabled())
+			return writeBytesDirect(buffer, bufferLength);
+
+		unsigned long writtenBytes = 0;
+		while (writtenBytes < bufferLength && isOpen()) {
+			unsigned long chunkLength = this->txPacer.acquire(bufferLength - writtenBytes);
+			unsigned long chunkWritten = writeBytesDirect(buffer + writtenBytes, chunkLength);
+			this->txPacer.consume(chunkWritten);
+			writtenBytes += chunkWritten;
+			if (chunkWritten < chunkLength) break; // timeout or error
+		}
+		return writtenBytes;
+	}
+
+	unsigned long writeBytesDirect(const char* buffer, unsigned long bufferLength)
 	{
 		if (this->comPortHandle < 0) return 0;
 
@@ -421,6 +646,50 @@ public:
 		return writtenBytes;
 	}
 
+	long tryReadBytes(char* buffer, unsigned long bufferCapacity)
+	{
+		if (this->comPortHandle < 0) return SerialAccess::SERIAL_IO_ERROR;
+
+		// In blocking mode, only read if data is available, which guarantees read() to return immediately
+		if (!this->nonBlocking) {
+			struct pollfd pollfdRead = { this->comPortHandle, POLLIN, 0 };
+			int result = ::poll(&pollfdRead, 1, 0);
+			if (result < 0) return SerialAccess::SERIAL_IO_ERROR;
+			if (result == 0) return SerialAccess::SERIAL_IO_WOULD_BLOCK;
+		}
+
+		ssize_t receivedBytes = ::read(this->comPortHandle, buffer, bufferCapacity);
+		if (receivedBytes < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return SerialAccess::SERIAL_IO_WOULD_BLOCK;
+			printError("error %i in SerialPort:tryReadBytes:read: %s\n");
+			return SerialAccess::SERIAL_IO_ERROR;
+		}
+		// no data is reported as EAGAIN or by the poll above, an empty read means the device hung up, e.g. an unplugged USB adapter
+		if (receivedBytes == 0 && bufferCapacity > 0) return SerialAccess::SERIAL_IO_ERROR;
+		return receivedBytes;
+	}
+
+	long tryWriteBytes(const char* buffer, unsigned long bufferLength)
+	{
+		if (this->comPortHandle < 0) return SerialAccess::SERIAL_IO_ERROR;
+
+		// In blocking mode, only write if there is space in the output buffer
+		if (!this->nonBlocking) {
+			struct pollfd pollfdWrite = { this->comPortHandle, POLLOUT, 0 };
+			int result = ::poll(&pollfdWrite, 1, 0);
+			if (result < 0) return SerialAccess::SERIAL_IO_ERROR;
+			if (result == 0) return SerialAccess::SERIAL_IO_WOULD_BLOCK;
+		}
+
+		ssize_t writtenBytes = ::write(this->comPortHandle, buffer, bufferLength);
+		if (writtenBytes < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return SerialAccess::SERIAL_IO_WOULD_BLOCK;
+			printError("error %i in SerialPort:tryWriteBytes:write: %s\n");
+			return SerialAccess::SERIAL_IO_ERROR;
+		}
+		return writtenBytes;
+	}
+
 };
 
 SerialAccess::SerialPort* SerialAccess::newSerialPort(const char* portFile) {
@@ -2,6 +2,7 @@
 #ifdef PLATFORM_WIN
 
 #include "serial_port.hpp"
+#include "serial_pacing.hpp"
 #include <windows.h>
 #include <thread>
 #include <chrono>
@@ -25,9 +26,12 @@ private:
 	COMMTIMEOUTS comPortTimeouts;
 	OVERLAPPED writeOverlapped;
 	OVERLAPPED readOverlapped;
+	OVERLAPPED waitOverlapped;
 	HANDLE writeEventHandle;
 	HANDLE readEventHandle;
+	HANDLE waitEventHandle;
 	HANDLE comPortHandle;
+	SerialAccess::SerialTxPacer txPacer;
 	const char* portFileName;
 
 public:
@@ -40,6 +44,7 @@ public:
 		this->comPortTimeouts = {0};
 		this->writeEventHandle = INVALID_HANDLE_VALUE;
 		this->readEventHandle = INVALID_HANDLE_VALUE;
+		this->waitEventHandle = INVALID_HANDLE_VALUE;
 	}
 
 	~SerialPortWin() {
@@ -96,6 +101,7 @@ public:
 			return false;
 		}
 
+		updateTransmitPacing();
 		return true;
 	}
 
@@ -167,9 +173,22 @@ public:
 			return false;
 		}
 
+		this->waitEventHandle = CreateEventA(NULL, TRUE, FALSE, NULL);
+		if (this->waitEventHandle == NULL) {
+			printError("error %lu in SerialPort:openPort:CreateEventA: %s\n");
+			closePort();
+			return false;
+		}
+
 		return true;
 	}
 
+	bool openPortNonBlocking()
+	{
+		// The port is always opened for overlapped IO, which does not block on its own
+		return openPort();
+	}
+
 	void closePort()
 	{
 		if (this->comPortHandle == INVALID_HANDLE_VALUE) return;
@@ -178,9 +197,12 @@ public:
 			CloseHandle(this->writeEventHandle);
 		if (this->readEventHandle != NULL)
 			CloseHandle(this->readEventHandle);
+		if (this->waitEventHandle != NULL)
+			CloseHandle(this->waitEventHandle);
 		this->comPortHandle = INVALID_HANDLE_VALUE;
 		this->writeEventHandle = NULL;
 		this->readEventHandle = NULL;
+		this->waitEventHandle = NULL;
 	}
 
 	bool isOpen()
@@ -188,6 +210,11 @@ public:
 		return this->comPortHandle != INVALID_HANDLE_VALUE;
 	}
 
+	SerialAccess::SerialPortHandle getNativeHandle()
+	{
+		return this->comPortHandle;
+	}
+
 	bool setBaud(unsigned long baud)
 	{
 		if (this->comPortHandle == INVALID_HANDLE_VALUE) return false;
@@ -200,6 +227,7 @@ public:
 			printError("error %lu in SerialPort:setBaud:SetCommState: %s\n");
 			return false;
 		}
+		updateTransmitPacing();
 		return true;
 	}
 
@@ -228,6 +256,12 @@ public:
 			//																	^- interval = 0 causes read to block indefinetly because ... windows ...
 			this->comPortTimeouts.ReadTotalTimeoutConstant = MAXULONG32;
 			this->comPortTimeouts.ReadTotalTimeoutMultiplier = 0;
+		} else if (readTimeout == 0 && readTimeoutInterval <= 0) {
+			// Return immediately with whatever is already in the buffer
+			// All timeouts zero would cause read to block until the buffer is filled instead
+			this->comPortTimeouts.ReadIntervalTimeout = MAXULONG32;
+			this->comPortTimeouts.ReadTotalTimeoutConstant = 0;
+			this->comPortTimeouts.ReadTotalTimeoutMultiplier = 0;
 		} else {
 			// Wait for readTimeout ms, then return no matter what has or has not been received
 			// When receiving a byte, wait additional readTimeoutInterval ms for another one before returning
@@ -254,11 +288,57 @@ public:
 		}
 
 		*readTimeout = (int) this->comPortTimeouts.ReadTotalTimeoutConstant == MAXULONG32 ? -1 : this->comPortTimeouts.ReadTotalTimeoutConstant;
-		*readTimeoutInterval = (int) this->comPortTimeouts.ReadIntervalTimeout;
+		*readTimeoutInterval = this->comPortTimeouts.ReadIntervalTimeout == MAXULONG32 ? 0 : (int) this->comPortTimeouts.ReadIntervalTimeout;
 		*writeTimeout = (int) this->comPortTimeouts.WriteTotalTimeoutConstant;
 		return true;
 	}
 
+	bool waitForData(long long timeoutMicros)
+	{
+		if (this->comPortHandle == INVALID_HANDLE_VALUE) return false;
+
+		// Check if data is already waiting in the buffer
+		COMSTAT comStatus;
+		DWORD comErrors;
+		if (!ClearCommError(this->comPortHandle, &comErrors, &comStatus)) {
+			printError("error %lu in SerialPort:waitForData:ClearCommError: %s\n");
+			return false;
+		}
+		if (comStatus.cbInQue > 0) return true;
+		if (timeoutMicros == 0) return false;
+
+		// Create overlapped event
+		ZeroMemory(&this->waitOverlapped, sizeof(OVERLAPPED));
+		this->waitOverlapped.hEvent = this->waitEventHandle;
+		if (!ResetEvent(this->waitEventHandle)) {
+			printError("error %lu in SerialPort:waitForData:ResetEvent: %s\n");
+			return false;
+		}
+
+		// Wait for the EV_RXCHAR event, windows only supports millisecond timeouts here
+		DWORD eventMask = 0;
+		if (!WaitCommEvent(this->comPortHandle, &eventMask, &this->waitOverlapped)) {
+			if (GetLastError() != ERROR_IO_PENDING) {
+				printError("error %lu in SerialPort:waitForData:WaitCommEvent: %s\n");
+				return false;
+			}
+
+			DWORD timeoutMillis = timeoutMicros < 0 ? INFINITE : (DWORD) ((timeoutMicros + 999) / 1000);
+			if (WaitForSingleObject(this->waitEventHandle, timeoutMillis) != WAIT_OBJECT_0) {
+				// Abort the pending wait operation by resetting the event mask
+				SetCommMask(this->comPortHandle, EV_RXCHAR);
+				DWORD unused;
+				GetOverlappedResult(this->comPortHandle, &this->waitOverlapped, &unused, TRUE);
+			}
+		}
+
+		if (!ClearCommError(this->comPortHandle, &comErrors, &comStatus)) {
+			printError("error %lu in SerialPort:waitForData:ClearCommError: %s\n");
+			return false;
+		}
+		return comStatus.cbInQue > 0;
+	}
+
 	unsigned long readBytes(char* buffer, unsigned long bufferCapacity)
 	{
 		if (this->comPortHandle == INVALID_HANDLE_VALUE) return 0;
@@ -319,7 +399,83 @@ public:
 		return receivedBytes;
 	}
 
+	unsigned long readExactly(char* buffer, unsigned long length, int deadline)
+	{
+		if (this->comPortHandle == INVALID_HANDLE_VALUE) return 0;
+
+		COMMTIMEOUTS originalTimeouts;
+		if (!GetCommTimeouts(this->comPortHandle, &originalTimeouts)) {
+			printError("error %lu in SerialPort:readExactly:GetCommTimeouts: %s\n");
+			return 0;
+		}
+
+		// Without interval timeout the driver completes the read only when the buffer is filled or the total timeout expired
+		COMMTIMEOUTS readTimeouts = originalTimeouts;
+		readTimeouts.ReadTotalTimeoutMultiplier = 0;
+		if (deadline < 0) {
+			// All zero means wait until the buffer is filled
+			readTimeouts.ReadIntervalTimeout = 0;
+			readTimeouts.ReadTotalTimeoutConstant = 0;
+		} else if (deadline == 0) {
+			// Return immediately with whatever is already in the buffer
+			readTimeouts.ReadIntervalTimeout = MAXULONG32;
+			readTimeouts.ReadTotalTimeoutConstant = 0;
+		} else {
+			readTimeouts.ReadIntervalTimeout = 0;
+			readTimeouts.ReadTotalTimeoutConstant = deadline;
+		}
+
+		if (!SetCommTimeouts(this->comPortHandle, &readTimeouts)) {
+			printError("error %lu in SerialPort:readExactly:SetCommTimeouts: %s\n");
+			return 0;
+		}
+
+		unsigned long receivedBytes = readBytes(buffer, length);
+
+		if (!SetCommTimeouts(this->comPortHandle, &originalTimeouts))
+			printError("error %lu in SerialPort:readExactly:SetCommTimeouts: %s\n");
+
+		return receivedBytes;
+	}
+
+	bool setReadLatencyBudget(long long latencyBudget)
+	{
+		// Not supported, the driver already completes reads in chunks controlled by the interval timeout
+		return false;
+	}
+
+	bool setTransmitPacing(unsigned int linePercent, unsigned long chunkSize, unsigned int chunkGap)
+	{
+		if (this->comPortHandle == INVALID_HANDLE_VALUE) return false;
+		this->txPacer.configure(linePercent, chunkSize, chunkGap);
+		updateTransmitPacing();
+		return true;
+	}
+
+	void updateTransmitPacing()
+	{
+		SerialAccess::SerialPortConfig config;
+		if (getConfig(config))
+			this->txPacer.setLineConfig(config);
+	}
+
 	unsigned long writeBytes(const char* buffer, unsigned long bufferLength)
+	{
+		if (!this->txPacer.isEnabled())
+			return writeBytesDirect(buffer, bufferLength);
+
+		unsigned long writtenBytes = 0;
+		while (writtenBytes < bufferLength && isOpen()) {
+			unsigned long chunkLength = this->txPacer.acquire(bufferLength - writtenBytes);
+			unsigned long chunkWritten = writeBytesDirect(buffer + writtenBytes, chunkLength);
+			this->txPacer.consume(chunkWritten);
+			writtenBytes += chunkWritten;
+			if (chunkWritten < chunkLength) break; // timeout or error
+		}
+		return writtenBytes;
+	}
+
+	unsigned long writeBytesDirect(const char* buffer, unsigned long bufferLength)
 	{
 		if (this->comPortHandle == INVALID_HANDLE_VALUE) return 0;
 
@@ -354,6 +510,79 @@ public:
 		return writtenBytes;
 	}
 
+	long tryReadBytes(char* buffer, unsigned long bufferCapacity)
+	{
+		if (this->comPortHandle == INVALID_HANDLE_VALUE) return SerialAccess::SERIAL_IO_ERROR;
+
+		// Only request the bytes already in the driver buffer, the read then completes immediately
+		COMSTAT comStat;
+		if (!ClearCommError(this->comPortHandle, NULL, &comStat)) {
+			printError("error %lu in SerialPort:tryReadBytes:ClearCommError: %s\n");
+			return SerialAccess::SERIAL_IO_ERROR;
+		}
+		if (comStat.cbInQue == 0) return SerialAccess::SERIAL_IO_WOULD_BLOCK;
+		if (bufferCapacity > comStat.cbInQue) bufferCapacity = comStat.cbInQue;
+
+		// Create overlapped event
+		ZeroMemory(&this->readOverlapped, sizeof(OVERLAPPED));
+		this->readOverlapped.hEvent = this->readEventHandle;
+		if (!ResetEvent(this->readEventHandle)) {
+			printError("error %lu in SerialPort:tryReadBytes:ResetEvent: %s\n");
+			return SerialAccess::SERIAL_IO_ERROR;
+		}
+
+		unsigned long receivedBytes;
+		if (!ReadFile(this->comPortHandle, buffer, bufferCapacity, &receivedBytes, &this->readOverlapped)) {
+			if (GetLastError() != ERROR_IO_PENDING) {
+				printError("error %lu in SerialPort:tryReadBytes:ReadFile: %s\n");
+				return SerialAccess::SERIAL_IO_ERROR;
+			}
+			if (!GetOverlappedResult(this->comPortHandle, &this->readOverlapped, &receivedBytes, TRUE)) {
+				if (GetLastError() == ERROR_OPERATION_ABORTED)
+					return SerialAccess::SERIAL_IO_ERROR; // port closed
+				printError("error %lu in SerialPort:tryReadBytes:GetOverlappedResult: %s\n");
+				return SerialAccess::SERIAL_IO_ERROR;
+			}
+		}
+
+		return receivedBytes == 0 ? SerialAccess::SERIAL_IO_WOULD_BLOCK : (long) receivedBytes;
+	}
+
+	long tryWriteBytes(const char* buffer, unsigned long bufferLength)
+	{
+		if (this->comPortHandle == INVALID_HANDLE_VALUE) return SerialAccess::SERIAL_IO_ERROR;
+
+		// Create overlapped event
+		ZeroMemory(&this->writeOverlapped, sizeof(OVERLAPPED));
+		this->writeOverlapped.hEvent = this->writeEventHandle;
+		if (!ResetEvent(this->writeEventHandle)) {
+			printError("error %lu in SerialPort:tryWriteBytes:ResetEvent: %s\n");
+			return SerialAccess::SERIAL_IO_ERROR;
+		}
+
+		unsigned long writtenBytes;
+		if (!WriteFile(this->comPortHandle, buffer, bufferLength, &writtenBytes, &this->writeOverlapped)) {
+			if (GetLastError() != ERROR_IO_PENDING) {
+				printError("error %lu in SerialPort:tryWriteBytes:WriteFile: %s\n");
+				return SerialAccess::SERIAL_IO_ERROR;
+			}
+
+			// If the driver could not take everything immediately, cancel the rest and report what was written
+			if (!GetOverlappedResult(this->comPortHandle, &this->writeOverlapped, &writtenBytes, FALSE)) {
+				if (GetLastError() != ERROR_IO_INCOMPLETE) {
+					printError("error %lu in SerialPort:tryWriteBytes:GetOverlappedResult: %s\n");
+					return SerialAccess::SERIAL_IO_ERROR;
+				}
+				CancelIoEx(this->comPortHandle, &this->writeOverlapped);
+				if (!GetOverlappedResult(this->comPortHandle, &this->writeOverlapped, &writtenBytes, TRUE) && GetLastError() != ERROR_OPERATION_ABORTED) {
+					printError("error %lu in SerialPort:tryWriteBytes:GetOverlappedResult: %s\n");
+					return SerialAccess::SERIAL_IO_ERROR;
+				}
+			}
+		}
+
+		return writtenBytes == 0 ? SerialAccess::SERIAL_IO_WOULD_BLOCK : (long) writtenBytes;
+	}
 
 };
 
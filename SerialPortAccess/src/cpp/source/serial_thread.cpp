@@ -0,0 +1,180 @@
+
+#include "serial_thread.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef PLATFORM_WIN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <time.h>
+#endif
+
+#define THREAD_MAX_CPUS 64
+
+#ifdef PLATFORM_WIN
+
+bool SerialAccess::applyThreadConfig(const SerialThreadConfig& config) {
+	bool success = true;
+	int priority = config.scheduling == SPC_SCHED_NORMAL ? THREAD_PRIORITY_NORMAL : THREAD_PRIORITY_TIME_CRITICAL;
+	if (!SetThreadPriority(GetCurrentThread(), priority)) {
+		printf("error %lu in applyThreadConfig:SetThreadPriority\n", GetLastError());
+		success = false;
+	}
+	if (config.cpuMask != 0 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) config.cpuMask) == 0) {
+		printf("error %lu in applyThreadConfig:SetThreadAffinityMask\n", GetLastError());
+		success = false;
+	}
+	return success;
+}
+
+bool SerialAccess::getThreadConfig(SerialThreadConfig& config) {
+	int priority = GetThreadPriority(GetCurrentThread());
+	if (priority == THREAD_PRIORITY_ERROR_RETURN) return false;
+	config.scheduling = priority == THREAD_PRIORITY_TIME_CRITICAL ? SPC_SCHED_FIFO : SPC_SCHED_NORMAL;
+	config.priority = 0;
+
+	// The affinity can only be read by setting it, so set it to the process mask and back
+	DWORD_PTR processMask, systemMask;
+	config.cpuMask = 0;
+	if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+		DWORD_PTR threadMask = SetThreadAffinityMask(GetCurrentThread(), processMask);
+		if (threadMask != 0) {
+			SetThreadAffinityMask(GetCurrentThread(), threadMask);
+			if (threadMask != systemMask) config.cpuMask = threadMask;
+		}
+	}
+	return true;
+}
+
+bool SerialAccess::getThreadCpuTime(std::thread& thread, unsigned long long* cpuTime) {
+	return false;
+}
+
+bool SerialAccess::lockProcessMemory() {
+	return false;
+}
+
+#else
+
+bool SerialAccess::applyThreadConfig(const SerialThreadConfig& config) {
+	bool success = true;
+
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	int policy = SCHED_OTHER;
+	if (config.scheduling != SPC_SCHED_NORMAL) {
+		policy = config.scheduling == SPC_SCHED_RR ? SCHED_RR : SCHED_FIFO;
+		param.sched_priority = config.priority;
+		if (param.sched_priority < sched_get_priority_min(policy)) param.sched_priority = sched_get_priority_min(policy);
+		if (param.sched_priority > sched_get_priority_max(policy)) param.sched_priority = sched_get_priority_max(policy);
+	}
+	int result = pthread_setschedparam(pthread_self(), policy, &param);
+	if (result != 0) {
+		printf("error %i in applyThreadConfig:pthread_setschedparam: %s\n", result, strerror(result));
+		success = false;
+	}
+
+	if (config.cpuMask != 0) {
+		cpu_set_t cpuSet;
+		CPU_ZERO(&cpuSet);
+		for (int cpu = 0; cpu < THREAD_MAX_CPUS; cpu++)
+			if (config.cpuMask & (1ULL << cpu)) CPU_SET(cpu, &cpuSet);
+		result = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet);
+		if (result != 0) {
+			printf("error %i in applyThreadConfig:pthread_setaffinity_np: %s\n", result, strerror(result));
+			success = false;
+		}
+	}
+
+	return success;
+}
+
+bool SerialAccess::getThreadConfig(SerialThreadConfig& config) {
+	int policy;
+	struct sched_param param;
+	if (pthread_getschedparam(pthread_self(), &policy, &param) != 0) return false;
+	config.scheduling = policy == SCHED_FIFO ? SPC_SCHED_FIFO : policy == SCHED_RR ? SPC_SCHED_RR : SPC_SCHED_NORMAL;
+	config.priority = param.sched_priority;
+
+	cpu_set_t cpuSet;
+	config.cpuMask = 0;
+	if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet) != 0) return false;
+	int cpuCount = 0;
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &cpuSet)) continue;
+		cpuCount++;
+		if (cpu < THREAD_MAX_CPUS) config.cpuMask |= 1ULL << cpu;
+	}
+	// Report no restriction if the thread may run on all online CPUs
+	if (cpuCount >= sysconf(_SC_NPROCESSORS_ONLN)) config.cpuMask = 0;
+	return true;
+}
+
+bool SerialAccess::getThreadCpuTime(std::thread& thread, unsigned long long* cpuTime) {
+	if (!thread.joinable()) return false;
+	clockid_t clock;
+	if (pthread_getcpuclockid(thread.native_handle(), &clock) != 0) return false;
+	struct timespec time;
+	if (clock_gettime(clock, &time) != 0) return false;
+	*cpuTime = (unsigned long long) time.tv_sec * 1000000 + time.tv_nsec / 1000;
+	return true;
+}
+
+bool SerialAccess::lockProcessMemory() {
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		printf("error %i in lockProcessMemory:mlockall: %s\n", errno, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+#endif
+
+bool SerialAccess::parseCpuList(const std::string& cpuList, unsigned long long* cpuMask) {
+	unsigned long long mask = 0;
+	const char* list = cpuList.c_str();
+	while (*list) {
+		char* end;
+		unsigned long first = strtoul(list, &end, 10);
+		if (end == list) return false;
+		unsigned long last = first;
+		list = end;
+		if (*list == '-') {
+			last = strtoul(++list, &end, 10);
+			if (end == list) return false;
+			list = end;
+		}
+		if (first > last || last >= THREAD_MAX_CPUS) return false;
+		for (unsigned long cpu = first; cpu <= last; cpu++) mask |= 1ULL << cpu;
+		if (*list == ',') list++;
+		else if (*list) return false;
+	}
+	*cpuMask = mask;
+	return mask != 0;
+}
+
+std::string SerialAccess::formatThreadConfig(const SerialThreadConfig& config) {
+	std::string text;
+	switch (config.scheduling) {
+	case SPC_SCHED_FIFO: text = "fifo priority " + std::to_string(config.priority); break;
+	case SPC_SCHED_RR: text = "rr priority " + std::to_string(config.priority); break;
+	default: text = "normal"; break;
+	}
+	if (config.cpuMask == 0) return text + " cpus all";
+
+	text += " cpus ";
+	bool first = true;
+	for (int cpu = 0; cpu < THREAD_MAX_CPUS; cpu++) {
+		if (!(config.cpuMask & (1ULL << cpu))) continue;
+		if (!first) text += ",";
+		text += std::to_string(cpu);
+		first = false;
+	}
+	return text;
+}
@@ -18,6 +18,7 @@
 #endif
 #include "serialportterminal.h"
 #include <serial_port.hpp>
+#include <serial_thread.hpp>
 
 #ifndef BUILD_VERSION
 #define BUILD_VERSION N/A
@@ -31,6 +32,8 @@ static bool lineEditing = false;			// if line editing mode is enabled
 static char sendLineEnd = 0;				// if a ln or cr should be send after each line entered
 static unsigned long pipeCloseDelay = 0;	// the delay for closing the receptor thread after closing stdin
 static SerialAccess::SerialPortConfiguration portConfiguration(SerialAccess::DEFAULT_PORT_CONFIGURATION);
+static SerialAccess::SerialThreadConfig threadConfiguration(SerialAccess::DEFAULT_THREAD_CONFIGURATION);
+static bool lockMemory = false;				// if the process memory should be locked in RAM
 static SerialAccess::SerialPort* port;
 
 int main(int argc, const char** argv) {
@@ -51,6 +54,10 @@ int main(int argc, const char** argv) {
 		printf(" -flowctrl [flow control] : none|xonxoff|rtscts|dsrdtr\n");
 		printf(" -lineedit (send new line) : sendlf|sendcr\n");
 		printf(" -dclose [pipe close delay] : [ms]\n");
+		printf(" -sched [reception thread scheduling] : normal|fifo|rr\n");
+		printf(" -prio [real time thread priority]\n");
+		printf(" -cpus [cpu list for reception thread] : e.g. 0,2-3\n");
+		printf(" -mlock (lock process memory)\n");
 		printf("serial terminal version: " ASSTRING(BUILD_VERSION) "\n");
 		return 1;
 	}
@@ -90,6 +97,15 @@ int main(int argc, const char** argv) {
 				if (arg == "sendcr") sendLineEnd = '\r';
 			} else if (flag == "-dclose") {
 				pipeCloseDelay = std::strtoul(argv[i], NULL, 10);
+			} else if (flag == "-sched") {
+				if (arg == "normal") threadConfiguration.scheduling = SerialAccess::SPC_SCHED_NORMAL;
+				if (arg == "fifo") threadConfiguration.scheduling = SerialAccess::SPC_SCHED_FIFO;
+				if (arg == "rr") threadConfiguration.scheduling = SerialAccess::SPC_SCHED_RR;
+			} else if (flag == "-prio") {
+				threadConfiguration.priority = std::strtol(argv[i], NULL, 10);
+			} else if (flag == "-cpus") {
+				if (!SerialAccess::parseCpuList(arg, &threadConfiguration.cpuMask))
+					printf("[!] invalid cpu list: %s\n", argv[i]);
 			} else {
 				i--; // no match with argument
 			}
@@ -98,8 +114,15 @@ int main(int argc, const char** argv) {
 		if (flag == "-lineedit") {
 			lineEditing = true;
 		}
+		if (flag == "-mlock") {
+			lockMemory = true;
+		}
 	}
 
+	// lock memory before the reception thread allocates its stack
+	if (lockMemory && !(lockMemory = SerialAccess::lockProcessMemory()))
+		printf("[!] failed to lock process memory\n");
+
 	// attempt enable raw input mode
 	if (!lineEditing) {
 		if (!setupConsole(false)) {
@@ -177,6 +200,15 @@ void receptionLoop() {
 	char receptionBuffer[1];
 	unsigned long receptionLen = 0;
 
+	// apply real time configuration and report the effective settings
+	if (threadConfiguration.scheduling != SerialAccess::SPC_SCHED_NORMAL || threadConfiguration.cpuMask != 0 || lockMemory) {
+		if (!SerialAccess::applyThreadConfig(threadConfiguration))
+			printf("[!] failed to apply reception thread configuration\n");
+		SerialAccess::SerialThreadConfig effectiveConfig;
+		if (SerialAccess::getThreadConfig(effectiveConfig))
+			printf("[i] reception thread running with: %s%s\n", SerialAccess::formatThreadConfig(effectiveConfig).c_str(), lockMemory ? ", memory locked" : "");
+	}
+
 	while (!shouldTerminate) {
 		receptionLen = port->readBytes(receptionBuffer, 1);
 		if (receptionLen > 0)